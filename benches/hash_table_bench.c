@@ -0,0 +1,489 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "hash_table.h"
+#include "hash_table_typed.h"
+
+/**
+ * @file hash_table_bench.c
+ * @author Marcus Enderskog
+ * @date 2021-04-15
+ * @brief Benchmarks of the hash table backends for growing sizes, key types and key distributions.
+ *
+ * Usage: hash_table_bench [max_size]. Sizes run from 1e3 up to max_size (1e6 by default) in steps of ten.
+ * Every measurement is printed as one CSV line with the columns of the header below, so that two runs can be
+ * compared line by line. Peak RSS is the high-water mark of the whole process at the time of the measurement.
+ * Integer lookups are also measured on a typed hash table of hash_table_typed.h, reported as backend "typed".
+ **/
+
+/// Largest size benchmarked when none is given on the command line.
+#define DEFAULT_MAX_SIZE 1000000
+
+/// Smallest size benchmarked.
+#define MIN_SIZE 1000
+
+/// Lookups and walks are repeated until at least this many operations are timed, so that small sizes are measurable.
+#define MIN_OPERATIONS 1000000
+
+/// Distance between the string keys in their backing storage, enough for the longest key formatted below.
+#define STRING_STRIDE 24
+
+/// @brief Kinds of keys benchmarked.
+typedef enum key_kind
+{
+  INT_KEYS = 0,     ///< Distinct integers, scattered over the full range of unsigned int.
+  STRING_KEYS = 1,  ///< Short decimal strings, hashed with hash_table_hash_string.
+} key_kind_t;
+
+/// @brief Distributions keys are looked up with.
+typedef enum distribution
+{
+  UNIFORM = 0,  ///< Every key is equally likely.
+  ZIPFIAN = 1,  ///< The key of rank r is about as likely as 1 / (r + 1), so that a few keys are hot.
+} distribution_t;
+
+/// @brief Backend to benchmark, with the options its hash tables are created with.
+typedef struct backend
+{
+  const char *name;
+  hash_table_backend_t backend;
+  bool prefilter;           // Whether lookups go through a Bloom filter first.
+} backend_t;
+
+/// @brief Keys of a benchmark and the order in which they are looked up.
+typedef struct workload
+{
+  key_kind_t kind;
+  size_t size;              // Number of keys stored.
+  elem_t *keys;             // Keys stored in the hash table.
+  elem_t *misses;           // Keys of the same kind that are never stored.
+  char *strings;            // Backing storage of string keys, NULL for integer keys.
+  size_t no_operations;     // Number of lookups timed per measurement.
+  unsigned int *order;      // Indices of the keys to look up, drawn from the distribution.
+} workload_t;
+
+static const backend_t backends[] = {
+  { "chained", HASH_TABLE_CHAINED, false },
+  { "chained+filter", HASH_TABLE_CHAINED, true },
+  { "open", HASH_TABLE_OPEN_ADDRESSING, false },
+};
+
+/// Typed counterpart of the open addressing backend for integer keys, reported under its own name.
+static const backend_t typed_backend = { "typed", HASH_TABLE_OPEN_ADDRESSING, false };
+
+HASH_TABLE_DEFINE(typed_map, unsigned int, unsigned int, HASH_TABLE_HASH_SCALAR, HASH_TABLE_EQ_SCALAR)
+
+static const char *key_kind_names[] = { "int", "string" };
+static const char *distribution_names[] = { "uniform", "zipfian" };
+
+/// State of the pseudo-random number generator, fixed so that every run benchmarks the same keys.
+static uint64_t rng_state = UINT64_C(0x9e3779b97f4a7c15);
+
+/**
+ * @brief Draw the next pseudo-random number (xorshift64*).
+ * @return A 64-bit pseudo-random number.
+ **/
+static uint64_t rng_next(void)
+{
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return rng_state * UINT64_C(0x2545f4914f6cdd1d);
+}
+
+/**
+ * @brief Draw a pseudo-random number uniformly from [0, 1).
+ * @return The number.
+ **/
+static double rng_unit(void)
+{
+  return (double) (rng_next() >> 11) / (double) (UINT64_C(1) << 53);
+}
+
+/**
+ * @brief Read the monotonic clock.
+ * @return Nanoseconds since an arbitrary point in time.
+ **/
+static uint64_t now_nanoseconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+/**
+ * @brief Read the peak resident set size of the process.
+ * @return Peak resident set size in kilobytes.
+ **/
+static long peak_rss_kilobytes(void)
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+/**
+ * @brief Allocate memory or exit, as a benchmark cannot go on without it.
+ * @param size Number of bytes to allocate.
+ * @return The allocation.
+ **/
+static void *checked_malloc(const size_t size)
+{
+  void *ptr = malloc(size);
+  if (ptr == NULL)
+    {
+      fprintf(stderr, "hash_table_bench: out of memory allocating %zu bytes\n", size);
+      exit(EXIT_FAILURE);
+    }
+  return ptr;
+}
+
+/**
+ * @brief Create an empty hash table for a backend and kind of keys, or exit on failure.
+ * @param backend Backend to create the hash table with.
+ * @param kind Kind of keys the hash table will store.
+ * @return The hash table.
+ **/
+static hash_table_t *create_table(const backend_t *backend, const key_kind_t kind)
+{
+  hash_table_options_t options = {
+    .backend = backend->backend,
+    .prefilter = backend->prefilter,
+    .hash_function = kind == STRING_KEYS ? hash_table_hash_string : NULL,
+  };
+  hash_table_t *ht = hash_table_create_with_options(&options);
+  if (ht == NULL)
+    {
+      fprintf(stderr, "hash_table_bench: could not create a %s hash table\n", backend->name);
+      exit(EXIT_FAILURE);
+    }
+  return ht;
+}
+
+/**
+ * @brief Generate the stored and missing keys of a workload.
+ * @param kind Kind of keys to generate.
+ * @param size Number of keys to store.
+ * @return The workload, without a lookup order.
+ **/
+static workload_t workload_create(const key_kind_t kind, const size_t size)
+{
+  workload_t workload = {
+    .kind = kind,
+    .size = size,
+    .keys = checked_malloc(size * sizeof(elem_t)),
+    .misses = checked_malloc(size * sizeof(elem_t)),
+    .strings = kind == STRING_KEYS ? checked_malloc(2 * size * STRING_STRIDE) : NULL,
+    .no_operations = size < MIN_OPERATIONS ? MIN_OPERATIONS : size,
+  };
+  workload.order = checked_malloc(workload.no_operations * sizeof(unsigned int));
+
+  for (size_t i = 0; i < size; i++)
+    {
+      // Multiplying by an odd constant permutes unsigned int, so stored keys and misses never coincide
+      const unsigned int hit = (unsigned int) i * 2654435761u;
+      const unsigned int miss = (unsigned int) (i + size) * 2654435761u;
+      if (kind == INT_KEYS)
+        {
+          workload.keys[i] = unsigned_int_elem(hit);
+          workload.misses[i] = unsigned_int_elem(miss);
+        }
+      else
+        {
+          char *hit_string = workload.strings + 2 * i * STRING_STRIDE;
+          char *miss_string = hit_string + STRING_STRIDE;
+          snprintf(hit_string, STRING_STRIDE, "key:%u", hit);
+          snprintf(miss_string, STRING_STRIDE, "key:%u", miss);
+          workload.keys[i] = ptr_elem(hit_string);
+          workload.misses[i] = ptr_elem(miss_string);
+        }
+    }
+  return workload;
+}
+
+/**
+ * @brief Draw the order in which the keys of a workload are looked up.
+ * @param workload Workload operated upon.
+ * @param distribution Distribution to draw the key indices from.
+ *
+ * Zipfian ranks are drawn by inverting the continuous 1 / x density over [1, size + 1], which needs no
+ * table of size entries and keeps sizes of 1e8 within reach.
+ **/
+static void workload_draw_order(workload_t *workload, const distribution_t distribution)
+{
+  const double log_range = log((double) workload->size + 1);
+  for (size_t i = 0; i < workload->no_operations; i++)
+    {
+      size_t index;
+      if (distribution == UNIFORM)
+        {
+          index = rng_next() % workload->size;
+        }
+      else
+        {
+          index = (size_t) exp(rng_unit() * log_range) - 1;
+          index = index < workload->size ? index : workload->size - 1;
+        }
+      workload->order[i] = (unsigned int) index;
+    }
+}
+
+/**
+ * @brief Free the keys of a workload.
+ * @param workload Workload operated upon.
+ **/
+static void workload_destroy(workload_t *workload)
+{
+  free(workload->keys);
+  free(workload->misses);
+  free(workload->strings);
+  free(workload->order);
+}
+
+/**
+ * @brief Print one measurement as a CSV line.
+ * @param backend Backend measured.
+ * @param workload Workload measured.
+ * @param distribution Name of the distribution keys were drawn from, "none" if every key was used once.
+ * @param operation Name of the operation measured.
+ * @param no_operations Number of operations timed.
+ * @param nanoseconds Time taken by all operations.
+ **/
+static void report(const backend_t *backend, const workload_t *workload, const char *distribution, const char *operation,
+                   const size_t no_operations, const uint64_t nanoseconds)
+{
+  const double ns_per_op = (double) nanoseconds / (double) no_operations;
+  printf("%s,%s,%s,%zu,%s,%zu,%.2f,%.0f,%ld\n", backend->name, key_kind_names[workload->kind], distribution,
+         workload->size, operation, no_operations, ns_per_op, 1e9 / ns_per_op, peak_rss_kilobytes());
+  fflush(stdout);
+}
+
+/**
+ * @brief Exit if a benchmark computed a wrong result, as its timings would be meaningless.
+ * @param condition Whether the result was right.
+ * @param operation Name of the operation checked.
+ **/
+static void check(const bool condition, const char *operation)
+{
+  if (!condition)
+    {
+      fprintf(stderr, "hash_table_bench: %s returned a wrong result\n", operation);
+      exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Insert every key of a workload into a hash table.
+ * @param ht Hash table operated upon.
+ * @param workload Workload with the keys to insert.
+ **/
+static void insert_all(hash_table_t *ht, const workload_t *workload)
+{
+  for (size_t i = 0; i < workload->size; i++)
+    {
+      hash_table_insert(ht, workload->keys[i], unsigned_int_elem((unsigned int) i));
+    }
+}
+
+/**
+ * @brief Benchmark the operations that use every key once: insertion with growth, parallel loading, walks,
+ * resizing and removal.
+ * @param backend Backend to benchmark.
+ * @param workload Workload with the keys to use.
+ **/
+static void bench_bulk(const backend_t *backend, const workload_t *workload)
+{
+  hash_table_t *ht = create_table(backend, workload->kind);
+  uint64_t start = now_nanoseconds();
+  insert_all(ht, workload);
+  report(backend, workload, "none", "insert", workload->size, now_nanoseconds() - start);
+  check(hash_table_size(ht) == workload->size, "insert");
+
+  // Loading the same pairs into an empty hash table with one thread per processor
+  elem_t *values = checked_malloc(workload->size * sizeof(elem_t));
+  for (size_t i = 0; i < workload->size; i++)
+    {
+      values[i] = unsigned_int_elem((unsigned int) i);
+    }
+  hash_table_t *built = create_table(backend, workload->kind);
+  start = now_nanoseconds();
+  hash_table_build_parallel(built, workload->keys, values, workload->size, 0);
+  report(backend, workload, "none", "build_parallel", workload->size, now_nanoseconds() - start);
+  check(hash_table_size(built) == workload->size, "build_parallel");
+  hash_table_destroy(built);
+  free(values);
+
+  size_t visited = 0;
+  start = now_nanoseconds();
+  while (visited < workload->no_operations)
+    {
+      hash_table_iter_t iter;
+      elem_t key;
+      elem_t *value;
+      hash_table_iter_begin(ht, &iter);
+      while (hash_table_iter_next(&iter, &key, &value))
+        {
+          visited++;
+        }
+    }
+  report(backend, workload, "none", "iterate", visited, now_nanoseconds() - start);
+
+  // Reserving four times the size rehashes every entry once into a bigger bucket array
+  start = now_nanoseconds();
+  check(hash_table_reserve(ht, 4 * workload->size), "reserve");
+  report(backend, workload, "none", "resize", workload->size, now_nanoseconds() - start);
+
+  size_t removed = 0;
+  start = now_nanoseconds();
+  for (size_t i = 0; i < workload->size; i++)
+    {
+      elem_t value;
+      removed += hash_table_remove(ht, workload->keys[i], &value);
+    }
+  report(backend, workload, "none", "remove", workload->size, now_nanoseconds() - start);
+  check(removed == workload->size, "remove");
+  hash_table_destroy(ht);
+}
+
+/**
+ * @brief Benchmark lookups of stored and missing keys, and a mix of lookups, inserts and removes.
+ * @param backend Backend to benchmark.
+ * @param workload Workload with the keys to use, and the order to use them in.
+ * @param distribution Distribution the order was drawn from.
+ *
+ * The mixed workload is 80% lookups, 10% inserts and 10% removes of keys drawn from the distribution, so
+ * that the size of the hash table stays about the same.
+ **/
+static void bench_lookups(const backend_t *backend, const workload_t *workload, const distribution_t distribution)
+{
+  const char *name = distribution_names[distribution];
+  hash_table_t *ht = create_table(backend, workload->kind);
+  insert_all(ht, workload);
+
+  size_t found = 0;
+  uint64_t start = now_nanoseconds();
+  for (size_t i = 0; i < workload->no_operations; i++)
+    {
+      elem_t value;
+      found += hash_table_lookup(ht, workload->keys[workload->order[i]], &value);
+    }
+  report(backend, workload, name, "lookup_hit", workload->no_operations, now_nanoseconds() - start);
+  check(found == workload->no_operations, "lookup_hit");
+
+  found = 0;
+  start = now_nanoseconds();
+  for (size_t i = 0; i < workload->no_operations; i++)
+    {
+      elem_t value;
+      found += hash_table_lookup(ht, workload->misses[workload->order[i]], &value);
+    }
+  report(backend, workload, name, "lookup_miss", workload->no_operations, now_nanoseconds() - start);
+  check(found == 0, "lookup_miss");
+
+  start = now_nanoseconds();
+  for (size_t i = 0; i < workload->no_operations; i++)
+    {
+      const unsigned int index = workload->order[i];
+      elem_t value;
+      switch (i % 10)
+        {
+        case 0:
+          hash_table_remove(ht, workload->keys[index], &value);
+          break;
+        case 5:
+          hash_table_insert(ht, workload->keys[index], unsigned_int_elem(index));
+          break;
+        default:
+          hash_table_lookup(ht, workload->keys[index], &value);
+          break;
+        }
+    }
+  report(backend, workload, name, "mixed", workload->no_operations, now_nanoseconds() - start);
+  hash_table_destroy(ht);
+}
+
+/**
+ * @brief Benchmark lookups of stored and missing integer keys on a typed hash table.
+ * @param workload Workload with integer keys, and the order to use them in.
+ * @param distribution Distribution the order was drawn from.
+ **/
+static void bench_typed_lookups(const workload_t *workload, const distribution_t distribution)
+{
+  const char *name = distribution_names[distribution];
+  typed_map_t *ht = typed_map_create();
+  check(ht != NULL, "typed_map_create");
+  uint64_t start = now_nanoseconds();
+  for (size_t i = 0; i < workload->size; i++)
+    {
+      typed_map_insert(ht, workload->keys[i].u, (unsigned int) i);
+    }
+  if (distribution == UNIFORM)
+    report(&typed_backend, workload, "none", "insert", workload->size, now_nanoseconds() - start);
+  check(typed_map_size(ht) == workload->size, "insert");
+
+  size_t found = 0;
+  start = now_nanoseconds();
+  for (size_t i = 0; i < workload->no_operations; i++)
+    {
+      unsigned int value;
+      found += typed_map_lookup(ht, workload->keys[workload->order[i]].u, &value);
+    }
+  report(&typed_backend, workload, name, "lookup_hit", workload->no_operations, now_nanoseconds() - start);
+  check(found == workload->no_operations, "lookup_hit");
+
+  found = 0;
+  start = now_nanoseconds();
+  for (size_t i = 0; i < workload->no_operations; i++)
+    {
+      unsigned int value;
+      found += typed_map_lookup(ht, workload->misses[workload->order[i]].u, &value);
+    }
+  report(&typed_backend, workload, name, "lookup_miss", workload->no_operations, now_nanoseconds() - start);
+  check(found == 0, "lookup_miss");
+  typed_map_destroy(ht);
+}
+
+int main(int argc, char *argv[])
+{
+  size_t max_size = DEFAULT_MAX_SIZE;
+  if (argc > 1)
+    {
+      // Parsed as a floating point number, so that sizes such as 1e8 are accepted
+      const double requested = strtod(argv[1], NULL);
+      if (requested < MIN_SIZE)
+        {
+          fprintf(stderr, "usage: %s [max_size], with max_size at least %d\n", argv[0], MIN_SIZE);
+          return EXIT_FAILURE;
+        }
+      max_size = (size_t) requested;
+    }
+
+  printf("backend,keys,distribution,size,operation,operations,ns_per_op,ops_per_second,peak_rss_kb\n");
+  for (size_t size = MIN_SIZE; size <= max_size; size *= 10)
+    {
+      for (key_kind_t kind = INT_KEYS; kind <= STRING_KEYS; kind++)
+        {
+          workload_t workload = workload_create(kind, size);
+          for (size_t b = 0; b < sizeof(backends) / sizeof(backends[0]); b++)
+            {
+              bench_bulk(&backends[b], &workload);
+            }
+          for (distribution_t distribution = UNIFORM; distribution <= ZIPFIAN; distribution++)
+            {
+              workload_draw_order(&workload, distribution);
+              for (size_t b = 0; b < sizeof(backends) / sizeof(backends[0]); b++)
+                {
+                  bench_lookups(&backends[b], &workload, distribution);
+                }
+              if (kind == INT_KEYS)
+                bench_typed_lookups(&workload, distribution);
+            }
+          workload_destroy(&workload);
+        }
+    }
+  return EXIT_SUCCESS;
+}
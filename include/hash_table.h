@@ -1,6 +1,8 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include "linked_list.h"
 
 /**
@@ -40,6 +42,130 @@ typedef void(*apply_function_ht)(const elem_t key, elem_t *value, const void *ex
  **/
 typedef unsigned long(*hash_function)(const elem_t key);
 
+/// @brief Storage strategies a hash table can be created with.
+typedef enum hash_table_backend
+{
+  HASH_TABLE_CHAINED = 0,          ///< Buckets of linked entries, one heap node per key (default).
+  HASH_TABLE_OPEN_ADDRESSING = 1,  ///< Swiss-table style open addressing with inline entries and SIMD-probed control bytes.
+  HASH_TABLE_MAPPED = 2,           ///< Snapshot mapped into memory by hash_table_open_mapped, with a fixed set of keys.
+  HASH_TABLE_SHARDED = 3,          ///< Independent hash tables of another backend selected by hash, created by setting no_shards.
+} hash_table_backend_t;
+
+/// @brief Outcome of inserting a key-value pair.
+typedef enum hash_table_status
+{
+  HASH_TABLE_INSERTED = 0,   ///< The key was not stored yet and has been inserted.
+  HASH_TABLE_UPDATED = 1,    ///< The key was already stored and its value has been replaced.
+  HASH_TABLE_NO_MEMORY = 2,  ///< Memory allocation failed; the hash table is unchanged.
+  HASH_TABLE_READ_ONLY = 3,  ///< The key was not stored and the hash table takes no new keys (mapped); it is unchanged.
+  HASH_TABLE_UNSUPPORTED = 4, ///< The backend does not support the kind of insertion, such as expiry; the hash table is unchanged.
+} hash_table_status_t;
+
+/// @brief Kinds of events reported to the log function.
+typedef enum hash_table_event
+{
+  HASH_TABLE_EVENT_RESIZE = 0,            ///< The hash table starts rehashing into a different number of buckets or slots.
+  HASH_TABLE_EVENT_NO_MEMORY = 1,         ///< Memory allocation failed, so the operation was not carried out.
+  HASH_TABLE_EVENT_OVERFLOW = 2,          ///< The hash table can not grow since its new size would not fit in a size_t.
+  HASH_TABLE_EVENT_INVALID_ARGUMENT = 3,  ///< A hash table could not be created from the given arguments.
+  HASH_TABLE_EVENT_IO_ERROR = 4,          ///< Writing or mapping a snapshot failed, or the snapshot is not valid.
+} hash_table_event_t;
+
+/**
+ * @brief Receive an event of a hash table.
+ * @param ht Hash table the event is about, or NULL if it happened while creating one.
+ * @param event Kind of event.
+ * @param message Human readable description of the event, only valid during the call.
+ * @param extra Data the log function was registered with.
+ **/
+typedef void(*hash_table_log_function)(const hash_table_t *ht, const hash_table_event_t event, const char *message, void *extra);
+
+/**
+ * @brief Receive an entry evicted from a hash table in cache mode or expired, e.g. to release a payload its value points to.
+ * @param key Key of the evicted entry; an owned key is only valid during the call.
+ * @param value Value of the evicted entry.
+ * @param extra Data the hash table was created with (evict_extra).
+ * 
+ * The function is called while the hash table evicts, so it must not operate on the hash table.
+ **/
+typedef void(*hash_table_evict_function)(const elem_t key, const elem_t value, void *extra);
+
+/**
+ * @brief Get the cost of an entry counted against the byte budget of a hash table in cache mode.
+ * @param key Key of the entry, as stored.
+ * @param value Value the entry is inserted with.
+ * @return Cost of the entry in bytes, such as the size of a payload its value points to.
+ **/
+typedef size_t(*hash_table_cost_function)(const elem_t key, const elem_t value);
+
+/**
+ * @brief Read the clock that times to live of a hash table are measured with.
+ * @param extra Data the hash table was created with (clock_extra).
+ * @return The current time in ticks, which must never decrease.
+ **/
+typedef uint64_t(*hash_table_clock_function)(void *extra);
+
+/// @brief Kinds of changes recorded in the change log of a hash table.
+typedef enum hash_table_change_kind
+{
+  HASH_TABLE_CHANGE_INSERT = 0,  ///< A key was inserted or its value replaced; value holds the new value.
+  HASH_TABLE_CHANGE_REMOVE = 1,  ///< A key was removed, evicted or expired; value holds its last value.
+  HASH_TABLE_CHANGE_CLEAR = 2,   ///< Every entry was removed; key and value are 0.
+} hash_table_change_kind_t;
+
+/// @brief Record of a single change to a hash table, as read from its change log by hash_table_changes.
+typedef struct hash_table_change hash_table_change_t;
+
+/// @brief Record of a single change to a hash table, as read from its change log by hash_table_changes.
+struct hash_table_change
+{
+  uint64_t seq;                   // Sequence number of the change, one more than that of the change before it.
+  hash_table_change_kind_t kind;  // What changed.
+  elem_t key;                     // Key that changed.
+  elem_t value;                   // Value of the key after an insertion, before a removal.
+};
+
+/// @brief Memory arena that entry slabs of a chained hash table are allocated from.
+typedef struct hash_table_allocator hash_table_allocator_t;
+
+/// @brief Memory arena that entry slabs of a chained hash table are allocated from.
+struct hash_table_allocator
+{
+  void *(*alloc)(size_t size, void *arena);            // Allocate size bytes, returning NULL on failure.
+  void (*free)(void *ptr, size_t size, void *arena);   // Release an allocation, or NULL if the arena is released as a whole.
+  void *arena;                                         // User data passed to alloc and free.
+};
+
+/// @brief Optional parameters for hash_table_create_with_options. Zero-initialized fields select defaults.
+typedef struct hash_table_options hash_table_options_t;
+
+/// @brief Optional parameters for hash_table_create_with_options. Zero-initialized fields select defaults.
+struct hash_table_options
+{
+  hash_table_backend_t backend;  // Storage backend to use.
+  size_t no_buckets;             // Capacity hint, 0 for the default of 17.
+  float load_factor;             // Maximum load factor, 0 for the default of 0.75 (capped at 0.875 for open addressing).
+  hash_function hash_function;   // Hash function to hash keys with, NULL for integer keys (hash_table_hash_int).
+  predicate_ht key_equiv;        // Confirms keys with equal hashes are equal, called with a stored key and value and a pointer to the sought key; NULL to match a built-in hash function, or for integer keys.
+  predicate_ht value_equiv;      // Function that determines how values will get compared, NULL for integer values.
+  hash_table_allocator_t allocator; // Arena for entry slabs (chained only), all NULL for malloc and free.
+  size_t rehash_step;            // Old buckets migrated per insert, lookup or remove while growing (chained only), 0 to rehash at once.
+  bool lock_free_reads;          // Lookups take no locks at all (concurrent tables only).
+  float min_load_factor;         // Load below which hash_table_remove shrinks the table, at most a quarter of load_factor; 0 never shrinks.
+  bool owned_keys;               // Copy string keys (key.p) into storage of the hash table on insertion, hashing them with hash_table_hash_string unless told otherwise (not concurrent tables).
+  size_t max_entries;            // Cache mode: evict entries on insertion to hold at most this many (chained only, not concurrent tables); 0 for no limit.
+  size_t max_bytes;              // Cache mode: evict entries on insertion to keep their total cost within this many bytes (chained only, not concurrent tables); 0 for no limit.
+  hash_table_cost_function cost_function; // Cost of an entry against max_bytes, computed once on insertion; NULL for the entry itself plus any owned key.
+  hash_table_evict_function evict_function; // Called with every entry evicted to stay within budget or expired, NULL for none.
+  void *evict_extra;             // Data passed to evict_function.
+  hash_table_clock_function clock_function; // Clock for hash_table_insert_ttl, NULL for milliseconds of the monotonic clock.
+  void *clock_extra;             // Data passed to clock_function.
+  size_t no_shards;              // Split into this many independent hash tables of backend, rounded up to a power of two; 0 or 1 for a single one.
+  const int *shard_nodes;        // NUMA node to allocate the entry slabs of every shard on, one per rounded number of shards or NULL; only honoured when built with HASH_TABLE_NUMA.
+  size_t change_log_size;        // Most recent changes kept for hash_table_changes, rounded up to a power of two; 0 for no change log (not concurrent tables, nor owned keys).
+  bool prefilter;                // Reject most lookups and removals of missing keys with a Bloom filter of the stored hashes (chained only, not concurrent tables).
+};
+
 /** 
  * @brief Create a new hash table with a starting bucket size of 17 and load factor of 0.75.
  * @param func Hash function to hash keys with.
@@ -51,7 +177,7 @@ hash_table_t *hash_table_create(hash_function func, predicate_ht key_comp_fun, p
 
 /**
  * @brief Create a new hash table with a given bucket size and load factor.
- * @param no_buckets Number of buckets to store entries in. Valid numbers include 17, 31, 67, 127, 257, 509, 1021, 2053, 4099, 8191 and 16381.
+ * @param no_buckets Capacity hint for the number of buckets to store entries in. Any positive number is accepted and rounded up to the nearest prime number.
  * @param load_factor Maximum load factor before hash table gets resized.
  * @param func Hash function to hash keys with.
  * @param key_comp_fun Function that determines how keys will get compared.
@@ -60,6 +186,74 @@ hash_table_t *hash_table_create(hash_function func, predicate_ht key_comp_fun, p
  **/
 hash_table_t *hash_table_create_dynamic(const size_t no_buckets, const float load_factor, hash_function func, predicate_ht key_comp_fun, predicate_ht value_comp_fun);
 
+/**
+ * @brief Create a new hash table from a set of options.
+ * @param options Options to create the hash table with. Fields left as 0 or NULL select their defaults.
+ * @return A new empty hash table, or NULL if creation failed.
+ * 
+ * With owned_keys set, keys must be null-terminated strings, which are copied on insertion so that callers
+ * need not keep them alive. Copies are packed into chunks owned by the hash table along with their lengths,
+ * so comparing them touches no memory of the caller. Keys handed out by the hash table (by walks, key
+ * comparison functions and hash_table_keys) point to these copies, which remain valid until their key is
+ * removed or the hash table is cleared or destroyed.
+ * 
+ * With max_entries or max_bytes set, a chained hash table acts as a cache: inserting a new key evicts
+ * entries until the table is within both budgets again, never evicting the entry just inserted. Entries are
+ * evicted in CLOCK order, approximating least recently used: lookups, upserts and updates of a key mark its
+ * entry as used, and eviction sweeps the buckets for an entry that has not been used since the sweep last
+ * passed it. Evicted entries are passed to evict_function before being destroyed; entries removed, cleared
+ * or left when the hash table is destroyed are not.
+ * 
+ * With no_shards set above 1, the hash table is split into that many shards, rounded up to a power of two,
+ * which are independent hash tables created from the same options. Keys are spread over the shards by the
+ * high bits of their mixed hash, and the capacity hint and budgets of cache mode are split evenly between
+ * them. Operations on a key only touch its shard, so shards grow and rehash independently; sizes, capacities,
+ * statistics and walks cover all shards. Budgets of cache mode are enforced per shard.
+ * 
+ * With change_log_size set, changes to the hash table are recorded in a ring buffer of that many records,
+ * to be read by hash_table_changes. A sharded hash table keeps a single change log for all shards.
+ * 
+ * With prefilter set, a chained hash table keeps a blocked Bloom filter of the hashes of its entries, about
+ * 10 bits per entry at the maximum load, which hash_table_lookup, hash_table_has_key, hash_table_update,
+ * hash_table_remove and the batched lookups test before walking a chain. Reading a single cache line of the
+ * filter rejects about 99% of the keys that are missing, which suits hash tables that are mostly asked for
+ * keys they do not hold. Insertions set bits as well, and the filter is rebuilt by every rehash and once as
+ * many entries have been removed as it was sized for. Its size and false positive rate are reported by
+ * hash_table_stats.
+ **/
+hash_table_t *hash_table_create_with_options(const hash_table_options_t *options);
+
+/**
+ * @brief Create a new hash table that may be shared between threads.
+ * @param options Options to create the hash table with, as for hash_table_create_with_options. Only the chained backend is supported, without owned keys or cache mode.
+ * @return A new empty thread-safe hash table, or NULL if creation failed.
+ * 
+ * Buckets are guarded by striped locks. Resizing the table never rehashes it at once: old buckets are migrated
+ * by subsequent operations, rehash_step at a time (2 if left as 0).
+ * 
+ * The following functions may be called on the hash table from any number of threads at once:
+ * hash_table_insert, hash_table_lookup, hash_table_has_key, hash_table_remove, hash_table_update,
+ * hash_table_insert_batch, hash_table_lookup_batch, hash_table_reserve, hash_table_shrink_to_fit,
+ * hash_table_capacity, hash_table_stats, hash_table_size, hash_table_is_empty, hash_table_clear and the
+ * functions walking all entries (hash_table_keys, hash_table_values, hash_table_has_value, hash_table_any,
+ * hash_table_all and hash_table_apply_to_all). Clearing, measuring and walking block all other operations
+ * while they run, so the functions passed to a walk must not call back into the hash table.
+ * Neither may the function passed to hash_table_update, which runs while its bucket is locked.
+ * hash_table_upsert and iterators are not safe while other threads modify the hash table. hash_table_destroy
+ * must only be called once no other thread uses the hash table. The hash function, comparison functions and
+ * allocator must be safe to call from several threads.
+ * 
+ * With lock_free_reads set, hash_table_lookup, hash_table_lookup_batch and hash_table_has_key take no locks
+ * and never wait for writers, which suits tables that are mostly read. Removed entries and old bucket arrays
+ * are then reclaimed in batches once no lookup can still be reading them, which makes removals and resizes
+ * occasionally wait for lookups in progress. Since lookups do not wait for walks either,
+ * hash_table_apply_to_all must then not run concurrently with lookups.
+ * 
+ * With no_shards set above 1, every shard is a concurrent hash table of its own, so that writers to
+ * different shards never share a lock, and resizes only block the keys of one shard.
+ **/
+hash_table_t *hash_table_concurrent_create(const hash_table_options_t *options);
+
 /** 
  * @brief Delete a hash table and frees its memory
  * @param ht Hash table to be deleted
@@ -71,8 +265,9 @@ void hash_table_destroy(hash_table_t *ht);
  * @param ht Hash table to insert into
  * @param key Key to insert
  * @param value Value to insert
+ * @return Whether the key was inserted, its value replaced, or nothing changed since memory ran out
  **/
-void hash_table_insert(hash_table_t *ht, const elem_t key, const elem_t value);
+hash_table_status_t hash_table_insert(hash_table_t *ht, const elem_t key, const elem_t value);
 
 /** 
  * @brief Lookup value for key in a hash table.
@@ -83,6 +278,62 @@ void hash_table_insert(hash_table_t *ht, const elem_t key, const elem_t value);
  **/
 bool hash_table_lookup(hash_table_t *ht, const elem_t key, elem_t *result);
 
+/**
+ * @brief Insert a batch of key-value pairs in a hash table.
+ * @param ht Hash table to insert into
+ * @param keys Keys to insert
+ * @param values Values to insert, one per key
+ * @param no_keys Number of keys
+ * 
+ * Has the same effect as inserting every pair in order, but hashes several keys ahead and prefetches their
+ * buckets so that the memory accesses of different keys overlap.
+ **/
+void hash_table_insert_batch(hash_table_t *ht, const elem_t *keys, const elem_t *values, const size_t no_keys);
+
+/**
+ * @brief Insert a key-value pair entry in a hash table that expires once a time to live has passed.
+ * @param ht Hash table to insert into (chained backend only, not concurrent)
+ * @param key Key to insert
+ * @param value Value to insert
+ * @param ttl Ticks of the clock of the hash table (clock_function) until the entry expires
+ * @return Whether the key was inserted, its value replaced, or nothing changed since memory ran out or the
+ * hash table does not support expiry (HASH_TABLE_UNSUPPORTED)
+ * 
+ * Inserting a stored key replaces both its value and its time to live, whereas hash_table_insert leaves
+ * the time to live of a stored key as it is. Expired entries are never found by lookups, upserts, updates
+ * or removals, which reclaim any expired entry they come across. All other entries are reclaimed by a
+ * timer wheel, a bounded number at a time, by every call to hash_table_insert_ttl and hash_table_expire;
+ * until then they are still counted by hash_table_size and visited by walks. Expired entries are passed to
+ * evict_function before being destroyed. Snapshots do not record times to live.
+ **/
+hash_table_status_t hash_table_insert_ttl(hash_table_t *ht, const elem_t key, const elem_t value, const uint64_t ttl);
+
+/**
+ * @brief Reclaim the expired entries of a hash table.
+ * @param ht Hash table operated upon
+ * @param budget Most timers to process, SIZE_MAX to reclaim every expired entry
+ * @return The number of entries reclaimed
+ * 
+ * Timers of entries that were removed or inserted again count against the budget as well, so the cost of a
+ * call is bounded by the budget, and otherwise proportional to the number of entries that expired rather than
+ * to the size of the hash table or the time elapsed since the last call.
+ **/
+size_t hash_table_expire(hash_table_t *ht, size_t budget);
+
+/**
+ * @brief Lookup values for a batch of keys in a hash table.
+ * @param ht Hash table operated upon
+ * @param keys Keys to lookup
+ * @param no_keys Number of keys
+ * @param results Array of no_keys elements where found values will be stored; elements for missing keys are left untouched
+ * @param found Array of no_keys flags telling which keys were found, or NULL
+ * @return The number of keys found
+ * 
+ * Has the same effect as looking up every key in order, but hashes several keys ahead and prefetches their
+ * buckets so that the memory accesses of different keys overlap.
+ **/
+size_t hash_table_lookup_batch(hash_table_t *ht, const elem_t *keys, const size_t no_keys, elem_t *results, bool *found);
+
 /** 
  * @brief Remove any mapping from key to a value
  * @param ht Hash table to remove entry from
@@ -92,6 +343,30 @@ bool hash_table_lookup(hash_table_t *ht, const elem_t key, elem_t *result);
  **/
 bool hash_table_remove(hash_table_t *ht, const elem_t key, elem_t *result);
 
+/**
+ * @brief Get the value for a key in a hash table, inserting the key with a given value if it is missing
+ * @param ht Hash table operated upon
+ * @param key Key to lookup or insert
+ * @param value Value to insert the key with if it is missing
+ * @param inserted Pointer where whether the key was inserted will be stored, or NULL
+ * @return A pointer to the value stored for the key, which may be updated in place, or NULL if the key was
+ * missing and could not be inserted
+ * 
+ * The key is looked for once, so a read-modify-write of its value costs a single probe. The pointer is only
+ * valid until the hash table is modified again.
+ **/
+elem_t *hash_table_upsert(hash_table_t *ht, const elem_t key, const elem_t value, bool *inserted);
+
+/**
+ * @brief Apply a function to the value for a key in a hash table
+ * @param ht Hash table operated upon
+ * @param key Key whose value to update
+ * @param f Function to pass the key and a pointer to its value to
+ * @param x Optional additional data
+ * @return True if the key was found and its value updated, false otherwise
+ **/
+bool hash_table_update(hash_table_t *ht, const elem_t key, apply_function_ht f, const void *x);
+
 /** 
  * @brief Returns the number of key-value entries in a hash table.
  * @param ht Hash table operated upon.
@@ -106,12 +381,142 @@ size_t hash_table_size(hash_table_t *ht);
  **/
 bool hash_table_is_empty(hash_table_t *ht);
 
+/**
+ * @brief Make room for a number of entries, so that inserting up to that many does not resize a hash table.
+ * @param ht Hash table operated upon.
+ * @param no_entries Number of entries the hash table should hold without growing.
+ * @return True if the hash table has room for no_entries entries afterwards, false otherwise.
+ * 
+ * The hash table is rehashed at most once, straight to the required size. It never shrinks.
+ **/
+bool hash_table_reserve(hash_table_t *ht, const size_t no_entries);
+
+/**
+ * @brief Shrink a hash table to the smallest size that holds its entries.
+ * @param ht Hash table operated upon.
+ * @return True if the hash table was shrunk or already had that size, false otherwise.
+ **/
+bool hash_table_shrink_to_fit(hash_table_t *ht);
+
+/**
+ * @brief Returns the number of buckets (chained) or slots (open addressing) of a hash table.
+ * @param ht Hash table operated upon.
+ * @return The number of buckets or slots.
+ **/
+size_t hash_table_capacity(hash_table_t *ht);
+
+/// Number of chain lengths the histogram of hash_table_stats tells apart; longer chains share the last bin.
+#define HASH_TABLE_STATS_HISTOGRAM_SIZE 16
+
+/// @brief Snapshot of the shape and activity of a hash table, as reported by hash_table_stats.
+typedef struct hash_table_stats hash_table_stats_t;
+
+/// @brief Snapshot of the shape and activity of a hash table, as reported by hash_table_stats.
+struct hash_table_stats
+{
+  size_t no_buckets;          // Number of buckets (chained) or slots (open addressing), including old buckets during a rehash.
+  size_t size;                // Number of entries.
+  float load_factor;          // Current load, size divided by the number of current buckets or slots.
+  size_t max_chain_length;    // Longest chain (chained) or probe sequence in groups to reach an entry (open addressing).
+  float mean_chain_length;    // Mean length of the non-empty chains (chained) or of the probe sequences of all entries (open addressing).
+  size_t chain_length_histogram[HASH_TABLE_STATS_HISTOGRAM_SIZE]; // Buckets per chain length (chained) or entries per probe sequence length (open addressing).
+  size_t no_resizes;          // Rehashes started since creation, growing, shrinking or in place.
+  size_t filter_bytes;        // Memory taken by the prefilter, 0 without one.
+  float filter_false_positive_rate; // Estimated chance that the prefilter lets a missing key through to its chain, 0 without one.
+  bool has_counters;          // Whether the library was built with HASH_TABLE_STATS; the fields below are 0 otherwise.
+  size_t no_finds;            // Searches for a key by any operation.
+  size_t no_probes;           // Entries (chained) or groups (open addressing) examined by those searches.
+  size_t no_filter_rejections; // Searches the prefilter answered alone, as their key was missing.
+  double rehash_seconds;      // Time spent moving entries into new buckets or slots.
+};
+
+/**
+ * @brief Measure the shape of a hash table and collect its counters.
+ * @param ht Hash table operated upon.
+ * @param stats Pointer where the statistics will be stored.
+ * 
+ * Chains or probe sequences are measured by walking the whole hash table, so this takes time linear in its
+ * capacity. Counters of searches and rehash time are only maintained when the library is built with
+ * HASH_TABLE_STATS defined, which keeps them out of the hot paths otherwise.
+ **/
+void hash_table_stats(hash_table_t *ht, hash_table_stats_t *stats);
+
 /** 
  * @brief Clear all entries in a hash table.
  * @param ht Hash table operated upon.
  **/
 void hash_table_clear(hash_table_t *ht);
 
+/**
+ * @brief Move every entry of a hash table into another one.
+ * @param dst Hash table to move entries into
+ * @param src Hash table to move entries out of, which is left empty
+ * @return True if every entry was moved, false if memory ran out or the hash tables can not exchange entries
+ * 
+ * Entries of src replace those of equal keys in dst, keeping their times to live if dst supports expiry;
+ * entries that have already expired are dropped. Between chained hash tables with the same allocator, the
+ * same setting of owned_keys and entries that either both or neither carry room for cache bookkeeping and
+ * times to live, the entries are relinked rather than copied, without allocating or calling the hash function
+ * unless the two hash functions differ. Hash tables with the same number of shards and hash function are
+ * merged shard by shard; other hash tables fall back to inserting and removing their entries one at a time.
+ * Neither hash table may be concurrent or mapped, and dst must own its keys if src does.
+ **/
+bool hash_table_merge(hash_table_t *dst, hash_table_t *src);
+
+/**
+ * @brief Move the entries of a hash table that satisfy some property into another one.
+ * @param src Hash table to move entries out of
+ * @param P Function to pass keys and values to, selecting the entries to move
+ * @param x Optional additional data
+ * @param dst Hash table to move entries into
+ * @return The number of entries moved, which stops short if memory ran out or the hash tables can not
+ * exchange entries
+ * 
+ * Entries of src replace those of equal keys in dst, keeping their times to live if dst supports expiry;
+ * selected entries that have already expired are dropped rather than moved. Between chained hash tables,
+ * selected entries are unlinked from src in a single walk over its chains and linked into dst under their
+ * stored hashes, with entries allocated from the slabs of dst. Hash tables with the same number of shards and
+ * hash function are split shard by shard; other hash tables fall back to inserting and removing their entries
+ * one at a time. The same restrictions as for hash_table_merge apply.
+ **/
+size_t hash_table_split(hash_table_t *src, predicate_ht P, const void *x, hash_table_t *dst);
+
+/**
+ * @brief Exchange the contents of two hash tables in constant time, e.g. to replace a table built in the background.
+ * @param a First hash table
+ * @param b Second hash table
+ * @return True if the contents were exchanged, false if either hash table is concurrent
+ * 
+ * Iterators of either hash table are invalidated.
+ **/
+bool hash_table_swap(hash_table_t *a, hash_table_t *b);
+
+/**
+ * @brief Get the number of shards of a hash table.
+ * @param ht Hash table operated upon
+ * @return The number of shards, 1 unless the hash table was created with no_shards above 1
+ **/
+size_t hash_table_no_shards(hash_table_t *ht);
+
+/**
+ * @brief Get the shard a key belongs to, e.g. to route work on the key to a thread that owns the shard.
+ * @param ht Hash table operated upon
+ * @param key Key to examine
+ * @return Index of the shard that holds the key if it is stored, below hash_table_no_shards
+ * 
+ * Threads that only operate on keys of their own shards never contend for the same locks or cache lines, and
+ * with shards placed on NUMA nodes their entries stay local to the node the thread runs on.
+ **/
+size_t hash_table_shard_of(hash_table_t *ht, const elem_t key);
+
+/**
+ * @brief Get the NUMA node the entries of a shard are allocated on, e.g. to pin the thread that owns the shard.
+ * @param ht Hash table operated upon
+ * @param shard Index of the shard, below hash_table_no_shards
+ * @return The NUMA node of the shard, or -1 if it was not placed on one
+ **/
+int hash_table_shard_node(hash_table_t *ht, const size_t shard);
+
 /** 
  * @brief Return the keys for all entries in a hash table (in no particular order, but same as hash_table_values).
  * @param ht Hash table operated upon.
@@ -130,6 +535,7 @@ list_t *hash_table_values(hash_table_t *ht);
  * @brief Check if a hash table has an entry with a given key.
  * @param ht Hash table operated upon.
  * @param key The key sought.
+ * @return True if the key was found, false otherwise. Costs the same as hash_table_lookup.
  **/
 bool hash_table_has_key(hash_table_t *ht, const elem_t key);
 
@@ -162,4 +568,253 @@ bool hash_table_any(hash_table_t *ht, predicate_ht P, const void *x);
  * @param P Function to pass keys and values to
  * @param x Optional additional data
  **/
-void hash_table_apply_to_all(hash_table_t *ht, apply_function_ht f, const void *x);
\ No newline at end of file
+void hash_table_apply_to_all(hash_table_t *ht, apply_function_ht f, const void *x);
+
+/**
+ * @brief Load a batch of key-value pairs into an empty hash table using several threads.
+ * @param ht Hash table to load, which should be empty
+ * @param keys Keys to insert
+ * @param values Values to insert, one per key
+ * @param no_keys Number of keys
+ * @param no_threads Number of threads to use, 0 for one per online processor
+ * 
+ * Has the same effect as hash_table_insert_batch, including later pairs replacing the values of earlier
+ * pairs with equal keys. A chained hash table is presized to hold every pair, after which the pairs are
+ * hashed, partitioned by bucket range and linked into their chains by one thread per range, without locks.
+ * Hash tables of any other backend, with owned keys, in cache mode, with a change log or that already hold
+ * entries are loaded with hash_table_insert_batch instead, as are batches too small to be worth the threads.
+ * The hash and key comparison functions are called from several threads at once.
+ **/
+void hash_table_build_parallel(hash_table_t *ht, const elem_t *keys, const elem_t *values, const size_t no_keys, const size_t no_threads);
+
+/**
+ * @brief Apply some property to all entries in a hash table using several threads.
+ * @param ht Hash table operated on
+ * @param f Function to pass keys and values to, called from several threads at once
+ * @param x Optional additional data
+ * @param no_threads Number of threads to use, 0 for one per online processor
+ * 
+ * Has the same effect as hash_table_apply_to_all, and every entry is still passed to f exactly once, but
+ * the buckets or slots are split into one range per thread. Concurrent and mapped hash tables are walked by
+ * the calling thread alone.
+ **/
+void hash_table_apply_to_all_parallel(hash_table_t *ht, apply_function_ht f, const void *x, const size_t no_threads);
+
+/**
+ * @brief Check if all keys in a hash table satisfy some property using several threads.
+ * @param ht Hash table operated upon
+ * @param P Function to pass keys and values to, called from several threads at once
+ * @param x Optional additional data
+ * @param no_threads Number of threads to use, 0 for one per online processor
+ * 
+ * Every thread stops as soon as any of them finds an entry that does not satisfy the property.
+ **/
+bool hash_table_all_parallel(hash_table_t *ht, predicate_ht P, const void *x, const size_t no_threads);
+
+/**
+ * @brief Check if at least one key in a hash table satisfy some property using several threads.
+ * @param ht Hash table operated upon
+ * @param P Function to pass keys and values to, called from several threads at once
+ * @param x Optional additional data
+ * @param no_threads Number of threads to use, 0 for one per online processor
+ * 
+ * Every thread stops as soon as any of them finds an entry that satisfies the property.
+ **/
+bool hash_table_any_parallel(hash_table_t *ht, predicate_ht P, const void *x, const size_t no_threads);
+
+/// @brief Position of a walk over the entries of a hash table, meant to be allocated on the stack.
+typedef struct hash_table_iter hash_table_iter_t;
+
+/// @brief Position of a walk over the entries of a hash table. Its fields are private to the implementation.
+struct hash_table_iter
+{
+  hash_table_t *ht;   // Hash table being walked.
+  size_t array;       // Bucket array being walked (chained): 0 for buckets still being migrated, 1 for the current ones.
+  size_t bucket;      // Bucket of the current entry (chained), or slot to continue the walk at (open addressing).
+  entry_t **link;     // Link to the current entry, NULL before the first entry of a bucket (chained).
+  bool has_current;   // Whether there is a current entry that has not been removed.
+  size_t shard;       // Shard being walked (sharded); the fields above then track the walk within it.
+  elem_t key;         // Key of the current entry, recorded in the change log when it is removed.
+  elem_t *value;      // Value of the current entry, recorded along with its key.
+};
+
+/**
+ * @brief Start a walk over the entries of a hash table.
+ * @param ht Hash table to walk.
+ * @param iter Iterator to initialize.
+ * 
+ * The walk visits every entry once, in no particular order, without allocating. Removing entries through
+ * hash_table_iter_remove_current keeps the walk valid; any other operation on the hash table invalidates it
+ * (including lookups while an incremental rehash is ongoing, since those migrate buckets). On a concurrent
+ * hash table, no other thread may modify the hash table during the walk.
+ **/
+void hash_table_iter_begin(hash_table_t *ht, hash_table_iter_t *iter);
+
+/**
+ * @brief Advance a walk to the next entry.
+ * @param iter Iterator operated upon.
+ * @param key Pointer where the key of the entry will be stored.
+ * @param value Pointer where a pointer to the value of the entry, which may be updated in place, will be stored.
+ * @return True if there was a next entry, false if the walk is over.
+ **/
+bool hash_table_iter_next(hash_table_iter_t *iter, elem_t *key, elem_t **value);
+
+/**
+ * @brief Remove the entry a walk is currently at.
+ * @param iter Iterator operated upon.
+ * @return True if the entry was removed, false if there was no current entry or the hash table takes no
+ * removals (mapped).
+ * 
+ * The walk continues with the entry following the removed one on the next call to hash_table_iter_next.
+ **/
+bool hash_table_iter_remove_current(hash_table_iter_t *iter);
+
+/**
+ * @brief Write a snapshot of a hash table to a file, to be mapped back into memory by hash_table_open_mapped.
+ * @param ht Hash table to save, which is left unchanged.
+ * @param fd File descriptor to write the snapshot to, from its current position on.
+ * @return True if the whole snapshot was written, false otherwise.
+ * 
+ * The snapshot is a flat, pointer-free layout: a header, an array with the offset of the first entry of
+ * every bucket, and the entries packed bucket by bucket along with the hashes of their keys. Keys and values
+ * are written as they are stored, so pointers among them are meaningless to any other process; only
+ * hash tables of integers, floats and booleans should be saved. Failures are reported to the log function.
+ **/
+bool hash_table_save(hash_table_t *ht, const int fd);
+
+/**
+ * @brief Map a snapshot written by hash_table_save into memory as a hash table.
+ * @param path Path of the snapshot.
+ * @param options Hash and comparison functions to use, which must be those of the saved hash table, or NULL
+ * for integer keys and values. Other fields are ignored.
+ * @return A hash table of backend HASH_TABLE_MAPPED, or NULL if the file could not be mapped or is not a
+ * valid snapshot for this process.
+ * 
+ * Nothing is read or allocated per entry: pages of the snapshot are loaded on first use, so the hash table is
+ * ready at once regardless of its size. Its set of keys is fixed. Lookups, walks and updates of values work
+ * as usual, with updated values private to the process and never written back to the file, whereas inserting
+ * new keys fails with HASH_TABLE_READ_ONLY and removals and clearing are refused. Since hashes are stored in
+ * the snapshot, the hash seed (see hash_table_set_hash_seed) must be the one it was saved with. A mapped hash
+ * table is not thread-safe for updates, and is released with hash_table_destroy.
+ **/
+hash_table_t *hash_table_open_mapped(const char *path, const hash_table_options_t *options);
+
+/**
+ * @brief Get the sequence number the next change to a hash table will be recorded with.
+ * @param ht Hash table operated upon.
+ * @return The sequence number of the next change, which is the number of changes recorded so far, or 0 if
+ * the hash table has no change log.
+ * 
+ * A replica is set up by copying every entry along with this sequence number, then kept up to date by
+ * applying the changes from that sequence number on.
+ **/
+uint64_t hash_table_change_seq(hash_table_t *ht);
+
+/**
+ * @brief Read the changes to a hash table from a sequence number on, e.g. to bring a replica up to date.
+ * @param ht Hash table operated upon.
+ * @param since Sequence number of the first change to read.
+ * @param changes Array where the changes will be stored, in the order they were made.
+ * @param max_changes Most changes to read.
+ * @return The number of changes read, 0 if there were none since or the hash table has no change log.
+ * 
+ * The change log keeps the change_log_size most recent changes, overwriting older ones. Should the change
+ * with sequence number since have been overwritten, reading starts at the oldest change kept, so that the
+ * sequence number of the first change read is greater than since; a replica must then be copied anew.
+ * Insertions and removals through hash_table_insert, hash_table_insert_batch, hash_table_insert_ttl,
+ * hash_table_upsert, hash_table_update, hash_table_remove and hash_table_iter_remove_current are recorded,
+ * along with clearing and the entries evicted in cache mode or expired. Entries moved by hash_table_merge and
+ * hash_table_split are recorded as removals from the source and insertions into the destination, whatever the
+ * backends. Values written through the slot returned by hash_table_upsert or by walks are not recorded, and
+ * hash_table_swap exchanges change logs along with the entries. Records hold keys and values as they are
+ * stored, so pointers among them must remain valid for as long as the changes are read.
+ **/
+size_t hash_table_changes(hash_table_t *ht, const uint64_t since, hash_table_change_t *changes, const size_t max_changes);
+
+/**
+ * @brief Apply changes read from the change log of another hash table, e.g. to a replica.
+ * @param ht Hash table to apply the changes to.
+ * @param changes Changes to apply, in the order they were made.
+ * @param no_changes Number of changes.
+ * @return The number of changes applied, which stops short if memory ran out.
+ * 
+ * Insertions are applied with hash_table_insert, removals with hash_table_remove and clearing with
+ * hash_table_clear, so the changes are recorded by the change log of ht in turn, if it has one.
+ **/
+size_t hash_table_apply_changes(hash_table_t *ht, const hash_table_change_t *changes, const size_t no_changes);
+
+/**
+ * @brief Set the seed of the built-in hash functions.
+ * @param seed New seed, preferably a secret random value so that keys hashing to the same buckets cannot be
+ * crafted (hash flooding)
+ * 
+ * The seed is shared by every hash table using a built-in hash function, so it must be set before any of them
+ * is created and not changed while any of them exists.
+ **/
+void hash_table_set_hash_seed(const unsigned long seed);
+
+/**
+ * @brief Get the seed of the built-in hash functions.
+ * @return The seed set by hash_table_set_hash_seed, 0 if it was never set.
+ **/
+unsigned long hash_table_get_hash_seed(void);
+
+/**
+ * @brief Register a function to report events of every hash table to, such as resizes and failures.
+ * @param log Function to call with each event, or NULL to report nothing, which is the default.
+ * @param extra Data passed to every call of the log function.
+ * 
+ * Hash tables never write to stdout or stderr themselves, and messages are only formatted while a log
+ * function is registered. The log function is shared by every hash table, so it must be registered before
+ * any of them is created. It may be called from any thread using a concurrent hash table, possibly while
+ * locks are held, so it must not call back into hash tables.
+ **/
+void hash_table_set_log_function(hash_table_log_function log, void *extra);
+
+/**
+ * @brief Hash a sequence of bytes, for use by hash functions of keys that are not integers, pointers or strings.
+ * @param data Bytes to hash
+ * @param length Number of bytes
+ * @param seed Seed to hash with
+ * @return Hash value in the form of an unsigned long integer
+ **/
+unsigned long hash_table_hash_bytes(const void *data, const size_t length, const unsigned long seed);
+
+/**
+ * @brief Hash an integer key, which is the default hash function.
+ * @param key Key to hash, of which the i or u field is used
+ * @return Hash value in the form of an unsigned long integer; distinct keys always have distinct hashes
+ **/
+unsigned long hash_table_hash_int(const elem_t key);
+
+/**
+ * @brief Hash a pointer key by its address.
+ * @param key Key to hash, of which the p field is used
+ * @return Hash value in the form of an unsigned long integer; distinct keys always have distinct hashes
+ **/
+unsigned long hash_table_hash_pointer(const elem_t key);
+
+/**
+ * @brief Hash a string key by its contents.
+ * @param key Key to hash, of which the p field points to a NUL-terminated string
+ * @return Hash value in the form of an unsigned long integer
+ **/
+unsigned long hash_table_hash_string(const elem_t key);
+
+/**
+ * @brief Compare a stored string key with a sought one, the default key comparison with hash_table_hash_string.
+ * @param key Stored key, of which the p field points to a NUL-terminated string
+ * @param value_ignored Stored value (ignored)
+ * @param x Pointer to the sought key, of which the p field points to a NUL-terminated string
+ * @return True if both strings have the same contents, false otherwise
+ **/
+bool hash_table_equiv_string(const elem_t key, const elem_t value_ignored, const void *x);
+
+/**
+ * @brief Compare a stored pointer key with a sought one, the default key comparison with hash_table_hash_pointer.
+ * @param key Stored key, of which the p field is used
+ * @param value_ignored Stored value (ignored)
+ * @param x Pointer to the sought key, of which the p field is used
+ * @return True if both pointers are equal, false otherwise
+ **/
+bool hash_table_equiv_pointer(const elem_t key, const elem_t value_ignored, const void *x);
\ No newline at end of file
@@ -0,0 +1,443 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hash_table.h"
+
+/**
+ * @file hash_table_typed.h
+ * @author Marcus Enderskog
+ * @date 2021-04-15
+ * @brief Statically typed hash tables generated by a macro, so that hashing and key comparison can be inlined.
+ *
+ * HASH_TABLE_DEFINE(name, KeyT, ValT, HASH, EQ) defines the type name_t and static inline functions named
+ * name_create, name_insert, name_lookup and so on, which mirror the functions of hash_table.h for keys of type
+ * KeyT and values of type ValT. Unlike hash_table_t, which calls its hash and comparison functions through
+ * pointers and stores elem_t unions, a typed hash table is generated for its types, so the compiler sees HASH
+ * and EQ at every call site and can inline them.
+ *
+ * Typed hash tables use the same layout as the open addressing backend: inline slots beside one control byte
+ * each, probed a group at a time in triangular order, with tombstones for removed entries and a maximum load
+ * factor of 0.875. Groups are 8 control bytes matched with portable 64-bit arithmetic rather than SIMD, so the
+ * header needs nothing but a C compiler. Allocation failures are returned as for hash_table.h, but are not
+ * reported to the log function. Typed hash tables are not thread-safe.
+ **/
+
+/// Number of control bytes of a typed hash table probed at once.
+#define HASH_TABLE_TYPED_GROUP_WIDTH 8
+
+/// Control byte of a slot that has never been used.
+#define HASH_TABLE_TYPED_EMPTY ((int8_t) -128)
+
+/// Control byte of a slot whose entry has been removed (tombstone).
+#define HASH_TABLE_TYPED_DELETED ((int8_t) -2)
+
+/// Smallest number of slots of a typed hash table, two groups.
+#define HASH_TABLE_TYPED_MIN_SLOTS 16
+
+/// Lowest bit of every byte of a group.
+#define HASH_TABLE_TYPED_LSBS UINT64_C(0x0101010101010101)
+
+/// Highest bit of every byte of a group.
+#define HASH_TABLE_TYPED_MSBS UINT64_C(0x8080808080808080)
+
+/// Hash function for integer and pointer keys of typed hash tables; hashes are mixed anyway, so the key will do.
+#define HASH_TABLE_HASH_SCALAR(key) ((uint64_t) (key))
+
+/// Key comparison for integer and pointer keys of typed hash tables.
+#define HASH_TABLE_EQ_SCALAR(a, b) ((a) == (b))
+
+/**
+ * @brief Mix the bits of a hash so that both the group index and the tag depend on all of them.
+ * @param hash Hash as returned by the hash function of a typed hash table.
+ * @return Mixed hash, whose low bits select the group and whose 7 highest bits are the tag.
+ **/
+static inline uint64_t hash_table_typed_mix(uint64_t hash)
+{
+  hash *= UINT64_C(0x9e3779b97f4a7c15);
+  return hash ^ (hash >> 32);
+}
+
+/**
+ * @brief Get the control byte tag of a mixed hash.
+ * @param mixed Mixed hash.
+ * @return The 7 highest bits of the hash, which is never an empty or deleted control byte.
+ **/
+static inline int8_t hash_table_typed_tag(const uint64_t mixed)
+{
+  return (int8_t) (mixed >> 57);
+}
+
+/**
+ * @brief Load a group of control bytes into an integer whose lowest byte is the first control byte.
+ * @param ctrl First control byte of the group.
+ * @return The group.
+ **/
+static inline uint64_t hash_table_typed_load_group(const int8_t *ctrl)
+{
+  uint64_t group;
+  memcpy(&group, ctrl, sizeof(group));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  group = __builtin_bswap64(group);
+#endif
+  return group;
+}
+
+/**
+ * @brief Find the control bytes of a group equal to a tag.
+ * @param group Group of control bytes.
+ * @param tag Tag to look for.
+ * @return Mask with the highest bit of every matching byte set.
+ *
+ * This is the classic test for zero bytes applied to the group XOR the tag. It may also flag a byte right
+ * above a genuine match, so callers confirm each candidate against its control byte.
+ **/
+static inline uint64_t hash_table_typed_match(const uint64_t group, const int8_t tag)
+{
+  const uint64_t x = group ^ (HASH_TABLE_TYPED_LSBS * (uint8_t) tag);
+  return (x - HASH_TABLE_TYPED_LSBS) & ~x & HASH_TABLE_TYPED_MSBS;
+}
+
+/**
+ * @brief Find the empty control bytes of a group.
+ * @param group Group of control bytes.
+ * @return Mask with the highest bit of every empty byte set.
+ *
+ * Only empty (10000000) and deleted (11111110) bytes have their highest bit set, and of those only empty
+ * bytes have their second lowest bit clear.
+ **/
+static inline uint64_t hash_table_typed_match_empty(const uint64_t group)
+{
+  return group & ~group << 6 & HASH_TABLE_TYPED_MSBS;
+}
+
+/**
+ * @brief Find the empty or deleted control bytes of a group.
+ * @param group Group of control bytes.
+ * @return Mask with the highest bit of every empty or deleted byte set.
+ **/
+static inline uint64_t hash_table_typed_match_free(const uint64_t group)
+{
+  return group & ~group << 7 & HASH_TABLE_TYPED_MSBS;
+}
+
+/**
+ * @brief Get the position within its group of the first byte flagged in a mask.
+ * @param mask Mask as returned by one of the match functions, not 0.
+ * @return Index of the byte.
+ **/
+static inline size_t hash_table_typed_lowest(const uint64_t mask)
+{
+  return (size_t) __builtin_ctzll(mask) / 8;
+}
+
+/**
+ * @brief Get the number of entries a typed hash table may hold before it has to grow.
+ * @param no_slots Number of slots.
+ * @return Seven eighths of the number of slots.
+ **/
+static inline size_t hash_table_typed_max_load(const size_t no_slots)
+{
+  return no_slots - no_slots / 8;
+}
+
+/**
+ * @brief Find the first empty or deleted slot along the probe sequence of a mixed hash.
+ * @param ctrl Control bytes to probe.
+ * @param no_slots Number of slots, a power of two of at least two groups.
+ * @param mixed Mixed hash.
+ * @return Index of the slot; there always is one as the load is kept below the number of slots.
+ **/
+static inline size_t hash_table_typed_probe_free(const int8_t *ctrl, const size_t no_slots, const uint64_t mixed)
+{
+  const size_t group_mask = no_slots / HASH_TABLE_TYPED_GROUP_WIDTH - 1;
+  size_t group = (size_t) mixed & group_mask;
+  for (size_t stride = 1; ; stride++)
+  {
+    const uint64_t match = hash_table_typed_match_free(hash_table_typed_load_group(&ctrl[group * HASH_TABLE_TYPED_GROUP_WIDTH]));
+    if (match != 0)
+      return group * HASH_TABLE_TYPED_GROUP_WIDTH + hash_table_typed_lowest(match);
+    group = (group + stride) & group_mask;
+  }
+}
+
+/**
+ * @brief Define a statically typed hash table and its functions.
+ * @param name Prefix of the generated type name_t and of every function.
+ * @param KeyT Type of the keys, which are copied by assignment.
+ * @param ValT Type of the values, which are copied by assignment.
+ * @param HASH Function or macro mapping a key to a uint64_t hash; HASH_TABLE_HASH_SCALAR for integers.
+ * @param EQ Function or macro telling whether two keys are equal; HASH_TABLE_EQ_SCALAR for integers.
+ *
+ * The generated functions, where name_t *ht is the hash table operated upon:
+ * - name_t *name_create(void): a new empty hash table, or NULL if memory allocation failed.
+ * - void name_destroy(ht): delete the hash table and free its memory.
+ * - hash_table_status_t name_insert(ht, key, value): insert or update a key-value pair.
+ * - bool name_lookup(ht, key, ValT *result): lookup the value for a key.
+ * - ValT *name_upsert(ht, key, value, bool *inserted): get the value slot for a key, inserting it if missing.
+ * - bool name_remove(ht, key, ValT *result): remove the mapping for a key, storing its value in result.
+ * - bool name_has_key(ht, key), size_t name_size(ht), bool name_is_empty(ht), size_t name_capacity(ht).
+ * - bool name_reserve(ht, no_entries): make room so that inserting up to no_entries entries does not resize.
+ * - void name_clear(ht): remove all entries.
+ * - void name_iter_begin(ht, name_iter_t *iter), bool name_iter_next(iter, KeyT *key, ValT **value) and
+ *   bool name_iter_remove_current(iter): walk the entries, just like hash_table_iter_begin and friends.
+ **/
+#define HASH_TABLE_DEFINE(name, KeyT, ValT, HASH, EQ)                                                          \
+  typedef struct name name##_t;                                                                                 \
+  typedef struct name##_slot name##_slot_t;                                                                     \
+  typedef struct name##_iter name##_iter_t;                                                                     \
+                                                                                                                \
+  struct name##_slot                                                                                            \
+  {                                                                                                             \
+    KeyT key;                                                                                                   \
+    ValT value;                                                                                                 \
+  };                                                                                                            \
+                                                                                                                \
+  struct name                                                                                                   \
+  {                                                                                                             \
+    int8_t *ctrl;             /* Control byte per slot: empty, deleted or the tag of its key. */               \
+    name##_slot_t *slots;     /* Inline key-value slots, parallel to ctrl. */                                   \
+    size_t no_slots;          /* Number of slots, a power of two of at least two groups. */                     \
+    size_t size;              /* Number of entries. */                                                         \
+    size_t growth_left;       /* Empty slots that may be filled before a resize is needed. */                   \
+  };                                                                                                            \
+                                                                                                                \
+  struct name##_iter                                                                                            \
+  {                                                                                                             \
+    name##_t *ht;             /* Hash table being walked. */                                                    \
+    size_t slot;              /* Slot to continue the walk at, one past the current entry. */                  \
+    bool has_current;         /* Whether there is a current entry that has not been removed. */                \
+  };                                                                                                            \
+                                                                                                                \
+  static inline bool name##_alloc_slots(name##_t *ht, const size_t no_slots)                                    \
+  {                                                                                                             \
+    int8_t *ctrl = malloc(no_slots);                                                                            \
+    name##_slot_t *slots = malloc(no_slots * sizeof(name##_slot_t));                                          \
+    if (ctrl == NULL || slots == NULL)                                                                          \
+    {                                                                                                           \
+      free(ctrl);                                                                                               \
+      free(slots);                                                                                              \
+      return false;                                                                                             \
+    }                                                                                                           \
+    memset(ctrl, HASH_TABLE_TYPED_EMPTY, no_slots);                                                             \
+    ht->ctrl = ctrl;                                                                                            \
+    ht->slots = slots;                                                                                          \
+    ht->no_slots = no_slots;                                                                                    \
+    ht->growth_left = hash_table_typed_max_load(no_slots);                                                      \
+    return true;                                                                                                \
+  }                                                                                                             \
+                                                                                                                \
+  static inline name##_t *name##_create(void)                                                                   \
+  {                                                                                                             \
+    name##_t *ht = calloc(1, sizeof(name##_t));                                                                 \
+    if (ht != NULL && !name##_alloc_slots(ht, HASH_TABLE_TYPED_MIN_SLOTS))                                      \
+    {                                                                                                           \
+      free(ht);                                                                                                 \
+      return NULL;                                                                                              \
+    }                                                                                                           \
+    return ht;                                                                                                  \
+  }                                                                                                             \
+                                                                                                                \
+  static inline void name##_destroy(name##_t *ht)                                                               \
+  {                                                                                                             \
+    free(ht->ctrl);                                                                                             \
+    free(ht->slots);                                                                                            \
+    free(ht);                                                                                                   \
+  }                                                                                                             \
+                                                                                                                \
+  static inline size_t name##_find(const name##_t *ht, const KeyT key, const uint64_t mixed)                    \
+  {                                                                                                             \
+    const int8_t tag = hash_table_typed_tag(mixed);                                                             \
+    const size_t group_mask = ht->no_slots / HASH_TABLE_TYPED_GROUP_WIDTH - 1;                                  \
+    size_t group = (size_t) mixed & group_mask;                                                                 \
+    for (size_t stride = 1; stride <= group_mask + 1; stride++)                                                 \
+    {                                                                                                           \
+      const size_t first = group * HASH_TABLE_TYPED_GROUP_WIDTH;                                                \
+      const uint64_t ctrl = hash_table_typed_load_group(&ht->ctrl[first]);                                      \
+      for (uint64_t match = hash_table_typed_match(ctrl, tag); match != 0; match &= match - 1)                  \
+      {                                                                                                         \
+        const size_t index = first + hash_table_typed_lowest(match);                                            \
+        if (ht->ctrl[index] == tag && EQ(ht->slots[index].key, key))                                            \
+          return index;                                                                                         \
+      }                                                                                                         \
+      if (hash_table_typed_match_empty(ctrl) != 0)                                                              \
+        break;                                                                                                  \
+      group = (group + stride) & group_mask;                                                                    \
+    }                                                                                                           \
+    return SIZE_MAX;                                                                                            \
+  }                                                                                                             \
+                                                                                                                \
+  static inline bool name##_rehash(name##_t *ht, const size_t no_slots)                                         \
+  {                                                                                                             \
+    name##_t old = *ht;                                                                                         \
+    if (!name##_alloc_slots(ht, no_slots))                                                                      \
+      return false;                                                                                             \
+    for (size_t i = 0; i < old.no_slots; i++)                                                                   \
+    {                                                                                                           \
+      if (old.ctrl[i] < 0)                                                                                      \
+        continue;                                                                                               \
+      const uint64_t mixed = hash_table_typed_mix(HASH(old.slots[i].key));                                      \
+      const size_t index = hash_table_typed_probe_free(ht->ctrl, no_slots, mixed);                              \
+      ht->ctrl[index] = hash_table_typed_tag(mixed);                                                            \
+      ht->slots[index] = old.slots[i];                                                                          \
+    }                                                                                                           \
+    ht->growth_left -= ht->size;                                                                                \
+    free(old.ctrl);                                                                                             \
+    free(old.slots);                                                                                            \
+    return true;                                                                                                \
+  }                                                                                                             \
+                                                                                                                \
+  static inline bool name##_reserve(name##_t *ht, const size_t no_entries)                                      \
+  {                                                                                                             \
+    size_t no_slots = ht->no_slots;                                                                             \
+    while (hash_table_typed_max_load(no_slots) < no_entries)                                                    \
+    {                                                                                                           \
+      if (no_slots > SIZE_MAX / 2 / sizeof(name##_slot_t))                                                      \
+        return false;                                                                                           \
+      no_slots *= 2;                                                                                            \
+    }                                                                                                           \
+    if (no_slots == ht->no_slots && (no_entries <= ht->size || ht->growth_left >= no_entries - ht->size))       \
+      return true;                                                                                              \
+    return name##_rehash(ht, no_slots);                                                                         \
+  }                                                                                                             \
+                                                                                                                \
+  static inline ValT *name##_upsert(name##_t *ht, const KeyT key, const ValT value, bool *inserted)             \
+  {                                                                                                             \
+    const uint64_t mixed = hash_table_typed_mix(HASH(key));                                                     \
+    *inserted = false;                                                                                          \
+    size_t index = name##_find(ht, key, mixed);                                                                 \
+    if (index != SIZE_MAX)                                                                                      \
+      return &ht->slots[index].value;                                                                           \
+                                                                                                                \
+    index = hash_table_typed_probe_free(ht->ctrl, ht->no_slots, mixed);                                         \
+    if (ht->ctrl[index] == HASH_TABLE_TYPED_EMPTY && ht->growth_left == 0)                                      \
+    {                                                                                                           \
+      /* Grow if live entries make up at least half of the load, else rebuild to drop the tombstones */         \
+      const bool grow = ht->size >= hash_table_typed_max_load(ht->no_slots) / 2;                                \
+      if (grow && ht->no_slots > SIZE_MAX / 2 / sizeof(name##_slot_t))                                          \
+        return NULL;                                                                                            \
+      if (!name##_rehash(ht, grow ? 2 * ht->no_slots : ht->no_slots))                                           \
+        return NULL;                                                                                            \
+      index = hash_table_typed_probe_free(ht->ctrl, ht->no_slots, mixed);                                       \
+    }                                                                                                           \
+                                                                                                                \
+    if (ht->ctrl[index] == HASH_TABLE_TYPED_EMPTY)                                                              \
+      ht->growth_left -= 1;                                                                                     \
+    ht->ctrl[index] = hash_table_typed_tag(mixed);                                                              \
+    ht->slots[index].key = key;                                                                                 \
+    ht->slots[index].value = value;                                                                             \
+    ht->size += 1;                                                                                              \
+    *inserted = true;                                                                                           \
+    return &ht->slots[index].value;                                                                             \
+  }                                                                                                             \
+                                                                                                                \
+  static inline hash_table_status_t name##_insert(name##_t *ht, const KeyT key, const ValT value)               \
+  {                                                                                                             \
+    bool inserted;                                                                                              \
+    ValT *slot = name##_upsert(ht, key, value, &inserted);                                                      \
+    if (slot == NULL)                                                                                           \
+      return HASH_TABLE_NO_MEMORY;                                                                              \
+    if (inserted)                                                                                               \
+      return HASH_TABLE_INSERTED;                                                                               \
+    *slot = value;                                                                                              \
+    return HASH_TABLE_UPDATED;                                                                                  \
+  }                                                                                                             \
+                                                                                                                \
+  static inline bool name##_lookup(const name##_t *ht, const KeyT key, ValT *result)                            \
+  {                                                                                                             \
+    const size_t index = name##_find(ht, key, hash_table_typed_mix(HASH(key)));                                 \
+    if (index == SIZE_MAX)                                                                                      \
+      return false;                                                                                             \
+    *result = ht->slots[index].value;                                                                           \
+    return true;                                                                                                \
+  }                                                                                                             \
+                                                                                                                \
+  static inline bool name##_has_key(const name##_t *ht, const KeyT key)                                         \
+  {                                                                                                             \
+    return name##_find(ht, key, hash_table_typed_mix(HASH(key))) != SIZE_MAX;                                   \
+  }                                                                                                             \
+                                                                                                                \
+  static inline void name##_erase(name##_t *ht, const size_t index)                                             \
+  {                                                                                                             \
+    const size_t first = index - index % HASH_TABLE_TYPED_GROUP_WIDTH;                                          \
+    if (hash_table_typed_match_empty(hash_table_typed_load_group(&ht->ctrl[first])) != 0)                       \
+    {                                                                                                           \
+      ht->ctrl[index] = HASH_TABLE_TYPED_EMPTY;                                                                 \
+      ht->growth_left += 1;                                                                                     \
+    }                                                                                                           \
+    else                                                                                                        \
+    {                                                                                                           \
+      ht->ctrl[index] = HASH_TABLE_TYPED_DELETED;                                                               \
+    }                                                                                                           \
+    ht->size -= 1;                                                                                              \
+  }                                                                                                             \
+                                                                                                                \
+  static inline bool name##_remove(name##_t *ht, const KeyT key, ValT *result)                                  \
+  {                                                                                                             \
+    const size_t index = name##_find(ht, key, hash_table_typed_mix(HASH(key)));                                 \
+    if (index == SIZE_MAX)                                                                                      \
+      return false;                                                                                             \
+    *result = ht->slots[index].value;                                                                           \
+    name##_erase(ht, index);                                                                                    \
+    return true;                                                                                                \
+  }                                                                                                             \
+                                                                                                                \
+  static inline size_t name##_size(const name##_t *ht)                                                          \
+  {                                                                                                             \
+    return ht->size;                                                                                            \
+  }                                                                                                             \
+                                                                                                                \
+  static inline bool name##_is_empty(const name##_t *ht)                                                        \
+  {                                                                                                             \
+    return ht->size == 0;                                                                                       \
+  }                                                                                                             \
+                                                                                                                \
+  static inline size_t name##_capacity(const name##_t *ht)                                                      \
+  {                                                                                                             \
+    return ht->no_slots;                                                                                        \
+  }                                                                                                             \
+                                                                                                                \
+  static inline void name##_clear(name##_t *ht)                                                                 \
+  {                                                                                                             \
+    memset(ht->ctrl, HASH_TABLE_TYPED_EMPTY, ht->no_slots);                                                     \
+    ht->size = 0;                                                                                               \
+    ht->growth_left = hash_table_typed_max_load(ht->no_slots);                                                  \
+  }                                                                                                             \
+                                                                                                                \
+  static inline void name##_iter_begin(name##_t *ht, name##_iter_t *iter)                                       \
+  {                                                                                                             \
+    iter->ht = ht;                                                                                              \
+    iter->slot = 0;                                                                                             \
+    iter->has_current = false;                                                                                  \
+  }                                                                                                             \
+                                                                                                                \
+  static inline bool name##_iter_next(name##_iter_t *iter, KeyT *key, ValT **value)                             \
+  {                                                                                                             \
+    name##_t *ht = iter->ht;                                                                                    \
+    for (size_t i = iter->slot; i < ht->no_slots; i++)                                                          \
+    {                                                                                                           \
+      if (ht->ctrl[i] >= 0)                                                                                     \
+      {                                                                                                         \
+        iter->slot = i + 1;                                                                                     \
+        iter->has_current = true;                                                                               \
+        *key = ht->slots[i].key;                                                                                \
+        *value = &ht->slots[i].value;                                                                           \
+        return true;                                                                                            \
+      }                                                                                                         \
+    }                                                                                                           \
+    iter->slot = ht->no_slots;                                                                                  \
+    iter->has_current = false;                                                                                  \
+    return false;                                                                                               \
+  }                                                                                                             \
+                                                                                                                \
+  static inline bool name##_iter_remove_current(name##_iter_t *iter)                                            \
+  {                                                                                                             \
+    if (!iter->has_current)                                                                                     \
+      return false;                                                                                             \
+    name##_erase(iter->ht, iter->slot - 1);                                                                     \
+    iter->has_current = false;                                                                                  \
+    return true;                                                                                                \
+  }
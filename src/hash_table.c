@@ -1,9 +1,32 @@
+#include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include "hash_table.h"
+#include "hash_table_internal.h"
 
-#define PRIMES_SIZE 11
+/// Backend used by hash_table_create and hash_table_create_dynamic; may be overridden at build time.
+#ifndef HASH_TABLE_DEFAULT_BACKEND
+#define HASH_TABLE_DEFAULT_BACKEND HASH_TABLE_CHAINED
+#endif
+
+/// Number of buckets used when no capacity hint is given.
+#define DEFAULT_NO_BUCKETS 17
+
+/// Load factor used when none is given.
+#define DEFAULT_LOAD_FACTOR 0.75f
+
+/// Number of entries in the first slab of an entry pool.
+#define MIN_SLAB_ENTRIES 16
+
+/// Number of entries a slab grows to at most; slabs double in size until reaching it.
+#define MAX_SLAB_ENTRIES 1024
+
+/// Longest message passed to the log function, including the terminating null character.
+#define LOG_MESSAGE_SIZE 128
+
+/// Number of bytes in a chunk that short owned keys are carved from.
+#define KEY_CHUNK_SIZE 16384
 
 /**
  * @file hash_table.c
@@ -12,36 +35,47 @@
  * @brief Simple hash table that maps generic keys to values.
  **/
 
+/// Function events of every hash table are reported to, NULL to report nothing.
+static hash_table_log_function log_function = NULL;
+
+/// Data passed to every call of the log function.
+static void *log_extra = NULL;
+
 
-/// @brief Represents a storage key-value pair entry which contains a generic element type.
-struct entry
+/// @brief Chunk of entries allocated at once by an entry pool.
+struct entry_slab
 {
-  elem_t key;     // Key to map value to.
-  elem_t value;   // The actual value to be stored.
-  entry_t *next;  // Next entry, possibly NULL.
+  entry_slab_t *next;   // Previously allocated slab, possibly NULL.
+  size_t no_entries;    // Number of entries in the slab.
+  entry_t entries[];    // The entries themselves, entry_size bytes apart.
 };
 
-/// @brief Actual hash table that maps generic keys to values.
-struct hash_table
+/**
+ * @brief Get an entry of a slab of an entry pool.
+ * @param pool Entry pool the slab belongs to.
+ * @param slab Slab to index.
+ * @param index Index of the entry in the slab.
+ * @return A pointer to the entry.
+ **/
+static inline entry_t *slab_entry(const entry_pool_t *pool, entry_slab_t *slab, const size_t index)
 {
-  size_t no_buckets;            // Number of buckets to store entries in.
-  float load_factor;            // Maximum load factor before hash table gets resized.
-  hash_function hash_function;  // Hash function to hash keys with.
-  predicate_ht key_equiv;       // Function that determines how keys will get compared.
-  predicate_ht value_equiv;     // Function that detetmines how values will get compared.
-  size_t size;                  // Load/number of entries in the hash table.
-  entry_t *buckets;             // Linked structure in which entries are stored.
-};
+  return (entry_t *) ((char *) slab->entries + index * pool->entry_size);
+}
 
-/// Array of primes numbers to be used for setting the number of buckets in a hash table.
-size_t primes[PRIMES_SIZE] = {17, 31, 67, 127, 257, 509, 1021, 2053, 4099, 8191, 16381};
+/// @brief Copy of a string key owned by a hash table, stored along with its length.
+struct owned_key
+{
+  size_t length;   // Length of the key, excluding the terminating null character.
+  char bytes[];    // The key itself, null-terminated; holds the next free copy of its size class once freed.
+};
 
-/**
- * @brief Default hash function to assign.
- * @param key Key to hash.
- * @return Hash value in the form of an unsigned long integer.
- **/ 
-static unsigned long default_hash_function(elem_t key);
+/// @brief Chunk of memory that owned keys are carved from, or that holds a single long key.
+struct key_chunk
+{
+  key_chunk_t *prev;   // Next more recently allocated chunk, only maintained for long keys.
+  key_chunk_t *next;   // Previously allocated chunk, possibly NULL.
+  char bytes[];        // Copies of keys.
+};
 
 /**
  * @brief Compare two integer keys for equality.
@@ -52,49 +86,18 @@ static unsigned long default_hash_function(elem_t key);
 static bool default_key_equiv(const elem_t key, const elem_t value_ignored, const void *x);
 
 /**
- * @brief Find the previous entry for a certain key.
- * @param func Hash function.
- * @param first_entry First entry of the bucket.
- * @param key Hashed key.
- * @return A pointer to the previous entry.
- **/
-static entry_t *find_previous_entry_for_key(hash_function func, entry_t *first_entry, const unsigned long key);
-
-/**
- * @brief Create a new entry.
- * @param key Key to associate with entry.
- * @param value Value to associate with entry.
- * @param next An entry pointer to the next entry.
- * @return A pointer to the newly created entry.
- **/
-static entry_t *entry_create(const elem_t key, const elem_t value, entry_t *next);
-
-/** 
- * @brief Return the values for all entries in a hash table (in no particular order, but same as hash_table_keys).
+ * @brief Migrate buckets of an ongoing incremental rehash.
  * @param ht Hash table operated upon.
- * @return An array of values for hash table ht.
- **/
-static elem_t **hash_table_values_arr(hash_table_t *ht);
-
-/**
- * @brief Destroy an entry by freeing its allocated memory.
- * @param entry Entry to destroy.
+ * @param no_buckets Maximum number of old buckets to migrate.
  **/
-static void entry_destroy(entry_t *entry);
+static void hash_table_rehash_step(hash_table_t *ht, size_t no_buckets);
 
 /**
- * @brief Check whether the prime number library contains a given number.
+ * @brief Check whether a number is prime.
  * @param num Number to examine.
- * @return True if the number is contained within the library, false otherwise.
- **/
-static bool is_number_in_prime_library(const int num);
-
-/**
- * @brief Get the next prime number stored in the library.
- * @param current Current prime number.
- * @return The next prime number or -1 if no one was found.
+ * @return True if the number is prime, false otherwise.
  **/
-static int get_next_prime_number(const int current);
+static bool is_prime(const size_t num);
 
 /**
  * @brief Dummy function pointer to be used with linked lists.
@@ -105,14 +108,15 @@ static int get_next_prime_number(const int current);
 static bool dummy_func_ptr(const elem_t a, const elem_t b);
 
 /**
- * @brief Default hash function to assign.
- * @param key Key to hash.
- * @return Hash value in the form of an unsigned long integer.
- **/ 
-static unsigned long default_hash_function(elem_t key)
-{
-  return (unsigned long) key.i;
-}
+ * @brief Set up chained storage for a newly allocated hash table.
+ * @param ht Hash table whose common fields have already been set.
+ * @param no_buckets Capacity hint, rounded up to the nearest prime number.
+ * @return True if storage could be allocated, false otherwise.
+ **/
+static bool chained_init(hash_table_t *ht, const size_t no_buckets);
+
+/// @brief Operations of the chained backend.
+static const hash_table_ops_t chained_ops;
 
 /**
  * @brief Compare two integer keys for equality.
@@ -125,6 +129,28 @@ static bool default_key_equiv(const elem_t key, const elem_t value_ignored, cons
   return key.i == ((elem_t*)x)->i; 
 }
 
+/**
+ * @brief Allocate memory for an entry slab using malloc.
+ * @param size Number of bytes to allocate.
+ * @param arena_ignored Arena (ignored).
+ * @return The allocated memory, or NULL if allocation failed.
+ **/
+static void *default_slab_alloc(size_t size, void *arena_ignored)
+{
+  return malloc(size);
+}
+
+/**
+ * @brief Release memory of an entry slab using free.
+ * @param ptr Memory to release.
+ * @param size_ignored Number of bytes allocated (ignored).
+ * @param arena_ignored Arena (ignored).
+ **/
+static void default_slab_free(void *ptr, size_t size_ignored, void *arena_ignored)
+{
+  free(ptr);
+}
+
 /**
  * @brief Compare two integer values for equality.
  * @param key_ignoed Entry key (ignored).
@@ -137,43 +163,185 @@ static bool default_value_equiv(const elem_t key_ignored, const elem_t value, co
 }
 
 /**
- * @brief Check whether the prime number library contains a given number.
- * @param num Number to examine.
- * @return True if the number is contained within the library, false otherwise.
+ * @brief Register a function to report events of every hash table to, such as resizes and failures.
+ * @param log Function to call with each event, or NULL to report nothing, which is the default.
+ * @param extra Data passed to every call of the log function.
  **/
-static bool is_number_in_prime_library(const int num)
+void hash_table_set_log_function(hash_table_log_function log, void *extra)
 {
-  bool result = false;
-  for (int i = 0; i < PRIMES_SIZE; i++)
-  {
-    if (primes[i] == num)
+  log_function = log;
+  log_extra = extra;
+}
+
+/**
+ * @brief Report an event to the registered log function, if any.
+ * @param ht Hash table the event is about, or NULL if it happened while creating one.
+ * @param event Kind of event.
+ * @param format Format of the message, as for printf, which is only formatted if a log function is registered.
+ * 
+ * Messages are formatted into a buffer on the stack and truncated to fit it, so reporting an event never
+ * allocates memory; that would be of little use after an allocation failure.
+ **/
+void hash_table_log(const hash_table_t *ht, const hash_table_event_t event, const char *format, ...)
+{
+  if (log_function == NULL)
     {
-      result = true;
-      break;
+      return;
     }
+
+  char message[LOG_MESSAGE_SIZE];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(message, sizeof(message), format, args);
+  va_end(args);
+  log_function(ht, event, message, log_extra);
+}
+
+/**
+ * @brief Check whether a number is prime.
+ * @param num Number to examine.
+ * @return True if the number is prime, false otherwise.
+ * 
+ * Primality is determined by trial division with candidates on the form 6k +/- 1, which is cheap
+ * compared to the rehash that follows every call made during resizing.
+ **/
+static bool is_prime(const size_t num)
+{
+  if (num < 4)
+    return num >= 2;
+  if (num % 2 == 0 || num % 3 == 0)
+    return false;
+  for (size_t i = 5; i <= num / i; i += 6)
+  {
+    if (num % i == 0 || num % (i + 2) == 0)
+      return false;
   }
-  return result;
+  return true;
 }
 
 /**
- * @brief Get the next prime number stored in the library.
- * @param current Current prime number.
- * @return The next prime number or -1 if no one was found.
+ * @brief Get the smallest prime number greater than or equal to a given number.
+ * @param num Lower bound for the prime number.
+ * @return The next prime number, or 0 if no such number fits in a size_t.
  **/
-static int get_next_prime_number(const int current)
+size_t get_next_prime_number(const size_t num)
 {
-  int result = -1;
-  for (int i = 0; i < PRIMES_SIZE; i++)
+  for (size_t candidate = num; candidate >= num; candidate++)
   {
-    if (primes[i] == current)
+    if (is_prime(candidate))
+      return candidate;
+  }
+  return 0;
+}
+
+/**
+ * @brief Migrate buckets of an ongoing incremental rehash.
+ * @param ht Hash table operated upon.
+ * @param no_buckets Maximum number of old buckets to migrate.
+ * 
+ * Every entry in a migrated bucket is relinked into the current bucket array using its cached hash, so
+ * no entry is ever copied or reallocated. Its hash is added to the filter of the new bucket array, if any.
+ * Once the last old bucket has been migrated the old bucket array is deallocated and the rehash is finished.
+ * Calling this function while no rehash is ongoing does nothing.
+ **/
+static void hash_table_rehash_step(hash_table_t *ht, size_t no_buckets)
+{
+  if (ht->old_buckets == NULL)
     {
-      if (i < (PRIMES_SIZE - 1))
-        result = primes[i + 1];
-      break;
+      return;
+    }
+
+  const uint64_t start = stats_clock();
+  while (ht->old_buckets != NULL && no_buckets > 0)
+    {
+      entry_t *cursor = ht->old_buckets[ht->rehash_index];
+      ht->old_buckets[ht->rehash_index] = NULL;
+      while (cursor != NULL)
+        {
+          entry_t *next = cursor->next;
+          const size_t bucket = bucket_index(cursor->hash, ht->no_buckets, ht->bucket_reciprocal);
+
+          entry_t **link = find_link_for_key(&ht->buckets[bucket], cursor->hash);
+          cursor->next = *link;
+          *link = cursor;
+          if (ht->filter.blocks != NULL)
+            {
+              filter_add(&ht->filter, cursor->hash);
+            }
+          cursor = next;
+        }
+
+      ht->rehash_index += 1;
+      no_buckets -= 1;
+      if (ht->rehash_index == ht->no_old_buckets)
+        {
+          filter_release(&ht->old_filter);
+          free(ht->old_buckets);
+          ht->old_buckets = NULL;
+          ht->no_old_buckets = 0;
+          ht->rehash_index = 0;
+        }
     }
+  STATS_ADD(ht, rehash_nanoseconds, stats_clock() - start);
+}
+
+/**
+ * @brief Start rehashing a chained hash table into a new bucket array.
+ * @param ht Hash table operated upon.
+ * @param no_buckets_new Number of buckets of the new bucket array, which may be fewer than the current ones.
+ * @return True if the new bucket array could be allocated, false otherwise.
+ * 
+ * Any ongoing incremental rehash is finished first, so that there are never more than two bucket arrays.
+ * The current buckets then become the old buckets of a rehash. Unless the hash table was created with a
+ * rehash step, every old bucket is migrated right away; otherwise the rehash is spread over subsequent
+ * operations, with each of them migrating rehash_step buckets. A prefilter likewise starts over empty, sized
+ * for the new buckets, and is filled as entries are migrated; until then the filter of the old buckets is
+ * kept.
+ **/
+static bool chained_rehash(hash_table_t *ht, const size_t no_buckets_new)
+{
+  hash_table_rehash_step(ht, SIZE_MAX);
+  entry_t **buckets_new = calloc(no_buckets_new, sizeof(entry_t *));
+  if (buckets_new == NULL)
+  {
+    hash_table_log(ht, HASH_TABLE_EVENT_NO_MEMORY, "Failed to allocate %zu buckets!", no_buckets_new);
+    return false;
+  }
+  bloom_filter_t filter_new = { .blocks = NULL, .no_blocks = 0 };
+  if (ht->filter.blocks != NULL && !filter_init(ht, &filter_new, no_buckets_new))
+  {
+    free(buckets_new);
+    return false;
+  }
+  if (ht->filter.blocks != NULL)
+  {
+    ht->old_filter = ht->filter;
+    ht->filter = filter_new;
+    ht->filter_stale = 0;
+  }
+
+  ht->old_buckets = ht->buckets;
+  ht->no_old_buckets = ht->no_buckets;
+  ht->old_bucket_reciprocal = ht->bucket_reciprocal;
+  ht->rehash_index = 0;
+  ht->buckets = buckets_new;
+  ht->no_buckets = no_buckets_new;
+  ht->bucket_reciprocal = bucket_reciprocal(no_buckets_new);
+  ht->no_resizes += 1;
+  if (ht->rehash_step == 0)
+  {
+    hash_table_rehash_step(ht, SIZE_MAX);
   }
+  return true;
+}
 
-  return result;
+/**
+ * @brief Migrate every remaining old bucket of an ongoing incremental rehash of a chained hash table.
+ * @param ht Hash table operated upon.
+ **/
+void chained_rehash_finish(hash_table_t *ht)
+{
+  hash_table_rehash_step(ht, SIZE_MAX);
 }
 
 /**
@@ -182,78 +350,94 @@ static int get_next_prime_number(const int current)
  * @return A resized hash table if all operations were successful, otherwise the old hash table is returned.
  * 
  * Resizing is done by examining whether the maximum load (determined by the load factor) has been reached;
- * if this is the case, a new bucket size is calculated by attempting to get the next prime number from the 
- * internal prime number library. If the hash table is currently using the last (highest) available for its 
- * bucket size, resizing is not possible and the present hash table will be returned. If, however, resizing 
- * is possible, memory for the bucket entries will be reallocated and rehashed.
+ * if this is the case, a new bucket size is calculated as the smallest prime number that is at least twice
+ * the current bucket size. Growth is therefore unbounded and the load factor is kept regardless of how many
+ * entries are stored; only if the new bucket size would overflow (or memory allocation fails) is the present
+ * hash table returned unchanged. Otherwise the hash table is rehashed into the new buckets by chained_rehash.
+ * Should the maximum load be reached again before an incremental rehash has finished, the remaining old
+ * buckets are migrated at once before growing further.
  **/
 static hash_table_t *hash_table_resize(hash_table_t *ht)
 {  
   float current_load = (float) ht->size / (float) ht->no_buckets;
   if (current_load >= ht->load_factor)
   {
-    printf("Maximum load factor reached (%.2f), triggering resize..\n", current_load);
-    int no_buckets_new = get_next_prime_number(ht->no_buckets);
-    if (no_buckets_new != -1)
+    size_t no_buckets_new = 0;
+    if (ht->no_buckets <= (SIZE_MAX - 1) / 2)
     {
-      int no_buckets_old = ht->no_buckets;
-      printf("New size is: %d\n", no_buckets_new);
-      entry_t *buckets_new = calloc(no_buckets_new, sizeof(entry_t));
-      if (buckets_new == NULL)
-      {
-        puts("Failed to reallocate memory!");
-        return ht;
-      }
-
-      for (int i = 0; i < no_buckets_new; i++)
-      {
-        entry_t new_entry = {.key = int_elem(0), .value = int_elem(0), .next = NULL};
-        buckets_new[i] = new_entry;
-      }
-      
-      puts("Rehashing");
-      for (int i = 0; i < no_buckets_old; i++) 
-      {
-        entry_t *first_entry = &ht->buckets[i];
-        entry_t *cursor = first_entry->next;
-        while (cursor != NULL) {
-            entry_t *next = cursor->next;
-            const unsigned long hash_key = ht->hash_function(cursor->key);
-            const int bucket = hash_key % no_buckets_new;
-            
-            entry_t *entry = find_previous_entry_for_key(ht->hash_function, &buckets_new[bucket], hash_key);
-            cursor->next = entry->next;
-            entry->next = cursor;
-            cursor = next;
-        }
-      }
-  
-      free(ht->buckets);
-      ht->buckets = buckets_new;
-      ht->no_buckets = no_buckets_new;
-
+      no_buckets_new = get_next_prime_number(2 * ht->no_buckets + 1);
+    }
+    if (no_buckets_new != 0)
+    {
+      hash_table_log(ht, HASH_TABLE_EVENT_RESIZE, "Maximum load factor reached (%.2f), growing to %zu buckets", current_load, no_buckets_new);
+      chained_rehash(ht, no_buckets_new);
       return ht;
-
     }
     else
     {
-      puts("hash table resizing not possible - no more prime numbers in library!");
+      hash_table_log(ht, HASH_TABLE_EVENT_OVERFLOW, "Resizing not possible, the number of buckets would overflow!");
       return ht;
     }
   }
   return ht;
 }
 
+/**
+ * @brief Get the number of buckets a chained hash table needs to hold a number of entries without growing.
+ * @param ht Hash table whose load factor to use.
+ * @param no_entries Number of entries.
+ * @return The smallest prime number of buckets that keeps the load below the load factor until no_entries
+ * entries are stored, or 0 if no such number fits in a size_t.
+ * 
+ * A hash table grows when an entry is inserted while its load has reached the load factor, so holding
+ * no_entries entries takes more than no_entries / load_factor buckets.
+ **/
+size_t buckets_for_entries(const hash_table_t *ht, const size_t no_entries)
+{
+  const float no_buckets = (float) no_entries / ht->load_factor;
+  if (no_buckets >= (float) (SIZE_MAX / 2))
+  {
+    return 0;
+  }
+  return get_next_prime_number((size_t) no_buckets + 1);
+}
+
+/**
+ * @brief Rehash a chained hash table to the number of buckets that holds a number of entries.
+ * @param ht Hash table operated upon.
+ * @param no_entries Number of entries the hash table should hold without growing.
+ * @param shrink Whether the hash table may end up with fewer buckets than it has now.
+ * @return True if the hash table has the required number of buckets afterwards, false otherwise.
+ **/
+static bool chained_reserve(hash_table_t *ht, const size_t no_entries, const bool shrink)
+{
+  const size_t no_buckets_new = buckets_for_entries(ht, no_entries);
+  if (no_buckets_new == 0)
+  {
+    hash_table_log(ht, HASH_TABLE_EVENT_OVERFLOW, "Resizing not possible, the number of buckets would overflow!");
+    return false;
+  }
+  if (no_buckets_new == ht->no_buckets || (no_buckets_new < ht->no_buckets && !shrink))
+  {
+    return true;
+  }
+  hash_table_log(ht, HASH_TABLE_EVENT_RESIZE, "Resizing to %zu buckets to hold %zu entries", no_buckets_new, no_entries);
+  return chained_rehash(ht, no_buckets_new);
+}
+
 /** 
  * @brief Returns the number of key-value entries in a hash table.
  * @param ht Hash table operated upon.
  * @return The number of key-value entries in the hash table.
  * 
  * This operation is performed in O(1) time by returning the size field contained within the hash table itself.
+ * The field is read atomically, since a concurrent hash table may be updating it from other threads.
  **/
 size_t hash_table_size(hash_table_t *ht)
 {
-  return ht->size;
+  if (ht->shards != NULL)
+    return sharded_size(ht);
+  return __atomic_load_n(&ht->size, __ATOMIC_RELAXED);
 }
 
 /** 
@@ -268,301 +452,1641 @@ bool hash_table_is_empty(hash_table_t *ht)
   return hash_table_size(ht) == 0;
 }
 
+/**
+ * @brief Mark an entry as used, sparing it from the next eviction sweep of a hash table in cache mode.
+ * @param ht Hash table operated upon.
+ * @param entry Entry that was used.
+ * 
+ * Nothing is written unless in cache mode, so that lookups of other hash tables leave their entries clean.
+ **/
+static inline void entry_touch(const hash_table_t *ht, entry_t *entry)
+{
+  if (ht->cache)
+    {
+      entry_meta(entry)->referenced = true;
+    }
+}
+
 /** 
- * @brief Lookup value for key in a hash table.
+ * @brief Lookup value for an already hashed key that got through the prefilter of a chained hash table.
  * @param ht Hash table operated upon.
  * @param key Key to lookup.
+ * @param hash_key Hash of the key.
  * @param result Pointer where a found element will be stored.
  * @return True if a key was found, false otherwise.
+ * 
+ * If an incremental rehash is ongoing, a step of it is performed before the chain of the key is walked. An
+ * expired entry for the key is reclaimed rather than found.
  **/
-bool hash_table_lookup(hash_table_t *ht, const elem_t key, elem_t *result)
+static bool chained_probe(hash_table_t *ht, const elem_t key, const unsigned long hash_key, elem_t *result)
 {
-  const unsigned long hash_key = ht->hash_function(key); 
-  const int bucket = hash_key % ht->no_buckets;
-  entry_t *first_entry = &ht->buckets[bucket];
-  entry_t *cursor = first_entry->next;
+  hash_table_rehash_step(ht, ht->rehash_step);
+  entry_t **link = find_link_in_table(ht, key, hash_key);
+  entry_t *next = *link;
 
-  while (cursor != NULL)
+  if (next != NULL && next->hash == hash_key)
     {
-      const unsigned long current_hash_key = ht->hash_function(cursor->key);
-      if (current_hash_key == hash_key)
+      if (entry_expired(ht, next))
         {
-          *result = cursor->value;
-          return true;
+          chained_expire(ht, link);
+          return false;
         }
-      cursor = cursor->next;
+      entry_touch(ht, next);
+      *result = next->value;
+      return true;
     }
 
   return false;
 }
 
+/** 
+ * @brief Lookup value for an already hashed key in a chained hash table.
+ * @param ht Hash table operated upon.
+ * @param key Key to lookup.
+ * @param hash_key Hash of the key.
+ * @param result Pointer where a found element will be stored.
+ * @return True if a key was found, false otherwise.
+ * 
+ * Keys the prefilter rejects are missing without a rehash step or a walk of their chain; all others are
+ * looked up by chained_probe.
+ **/
+static bool chained_lookup_hashed(hash_table_t *ht, const elem_t key, const unsigned long hash_key, elem_t *result)
+{
+  return !filter_rejects(ht, hash_key) && chained_probe(ht, key, hash_key, result);
+}
+
 /**
- * @brief Create a new hash table with a given bucket size and load factor.
- * @param no_buckets Number of buckets to store entries in. Valid numbers include 17, 31, 67, 127, 257, 509, 1021, 2053, 4099, 8191 and 16381.
- * @param load_factor Maximum load factor before hash table gets resized.
- * @param func Hash function to hash keys with.
- * @param key_comp_fun Function that determines how keys will get compared.
- * @param value_comp_fun Function that detetmines how values will get compared.
- * @return A new empty hash table, or NULL if creation failed.
+ * @brief Prefetch where a window of hashed keys of a batch will be looked for in a chained hash table.
+ * @param ht Hash table operated upon.
+ * @param hashes Hashes of the keys of the window.
+ * @param no_keys Number of keys in the window, at most BATCH_WINDOW.
  * 
- * Creation of a new hash table is done by checking wheter the given number of buckets is a valid prime number,
- * i.e. is contained within the internal library. The given load factor is also sanity checked to ensure it is 
- * larger than 0. If any of these checks fail, NULL is returned; otherwise initial memory gets allocated and 
- * starting values are set. If no hash, key or value comparison function is provided, default functions are set
- * and the hash table is assumed to operate on integer keys and values. If any memory allocation fails, a message
- * is printed and NULL is returned.
+ * The bucket heads of all keys are prefetched first, and only then the first entry of each bucket, whose
+ * address is read from the bucket array and so is hopefully in the cache by then. Old buckets that remain to
+ * be migrated are not prefetched, since an ongoing rehash drains them within a few operations.
  **/
-hash_table_t *hash_table_create_dynamic(const size_t no_buckets, const float load_factor, hash_function func, predicate_ht key_comp_fun, predicate_ht value_comp_fun)
+static void chained_prefetch_window(hash_table_t *ht, const unsigned long *hashes, const size_t no_keys)
 {
-  if (!is_number_in_prime_library(no_buckets)) 
-  {
-    printf("Bucket size %ld not in prime number library!\n", no_buckets);
-    return NULL;
-  }
-  if (load_factor <= 0)
-  {
-    printf("Load factor must be greater than 0! Got %.2f\n", load_factor);
-    return NULL;
-  }
+  for (size_t i = 0; i < no_keys; i++)
+    {
+      __builtin_prefetch(&ht->buckets[bucket_index(hashes[i], ht->no_buckets, ht->bucket_reciprocal)]);
+    }
+  for (size_t i = 0; i < no_keys; i++)
+    {
+      __builtin_prefetch(ht->buckets[bucket_index(hashes[i], ht->no_buckets, ht->bucket_reciprocal)]);
+    }
+}
 
-  hash_table_t *ht = calloc(1, sizeof(hash_table_t));
-  if (ht == NULL)
+/**
+ * @brief Lookup values for a batch of keys in a chained hash table.
+ * @param ht Hash table operated upon.
+ * @param keys Keys to lookup.
+ * @param no_keys Number of keys.
+ * @param results Array where found values will be stored.
+ * @param found Array of flags telling which keys were found, or NULL.
+ * @return The number of keys found.
+ * 
+ * Keys are resolved one window at a time. Every key of a window is hashed and tested against the prefilter
+ * first, and only the keys that pass it have their buckets prefetched as a whole and are then probed, so
+ * that misses the filter rejects cost neither memory traffic nor a rehash step.
+ **/
+static size_t chained_lookup_batch(hash_table_t *ht, const elem_t *keys, const size_t no_keys, elem_t *results, bool *found)
+{
+  unsigned long hashes[BATCH_WINDOW];
+  size_t candidates[BATCH_WINDOW];
+  size_t no_found = 0;
+  for (size_t start = 0; start < no_keys; start += BATCH_WINDOW)
+    {
+      const size_t window = no_keys - start < BATCH_WINDOW ? no_keys - start : BATCH_WINDOW;
+      size_t no_candidates = 0;
+      for (size_t i = 0; i < window; i++)
+        {
+          const unsigned long hash_key = ht->hash_function(keys[start + i]);
+          if (found != NULL)
+            {
+              found[start + i] = false;
+            }
+          if (!filter_rejects(ht, hash_key))
+            {
+              hashes[no_candidates] = hash_key;
+              candidates[no_candidates] = start + i;
+              no_candidates += 1;
+            }
+        }
+      chained_prefetch_window(ht, hashes, no_candidates);
+      for (size_t i = 0; i < no_candidates; i++)
+        {
+          const size_t index = candidates[i];
+          const bool hit = chained_probe(ht, keys[index], hashes[i], &results[index]);
+          if (found != NULL)
+            {
+              found[index] = hit;
+            }
+          no_found += hit;
+        }
+    }
+  return no_found;
+}
+
+/**
+ * @brief Lookup value for key in a hash table.
+ * @param ht Hash table operated upon.
+ * @param key Key to lookup.
+ * @param result Pointer where a found element will be stored.
+ * @return True if a key was found, false otherwise.
+ **/
+bool hash_table_lookup(hash_table_t *ht, const elem_t key, elem_t *result)
+{
+  return ht->ops->lookup(ht, key, ht->hash_function(key), result);
+}
+
+/**
+ * @brief Set up chained storage for a newly allocated hash table.
+ * @param ht Hash table whose common fields have already been set.
+ * @param no_buckets Capacity hint, rounded up to the nearest prime number.
+ * @return True if storage could be allocated, false otherwise.
+ **/
+static bool chained_init(hash_table_t *ht, const size_t no_buckets)
+{
+  const size_t no_buckets_prime = get_next_prime_number(no_buckets);
+  if (no_buckets_prime == 0) 
   {
-    puts("Failed to allocate memory for hash table!");
-    return NULL;
+    hash_table_log(NULL, HASH_TABLE_EVENT_INVALID_ARGUMENT, "Bucket size %zu can not be rounded up to a prime number!", no_buckets);
+    return false;
   }
-  
-  ht->buckets = calloc(no_buckets, sizeof(entry_t));
+
+  ht->buckets = calloc(no_buckets_prime, sizeof(entry_t *));
   if (ht->buckets == NULL)
   {
-    puts("Failed to allocate memory for hash table entries!");
-    free(ht);
-    return NULL;
+    hash_table_log(NULL, HASH_TABLE_EVENT_NO_MEMORY, "Failed to allocate memory for hash table entries!");
+    return false;
   }
 
-  ht->no_buckets = no_buckets;
-  ht->load_factor = load_factor;
-  ht->size = 0;
-  if (func == NULL)
+  ht->no_buckets = no_buckets_prime;
+  ht->bucket_reciprocal = bucket_reciprocal(no_buckets_prime);
+  return true;
+}
+
+/**
+ * @brief Set the hash and comparison functions of a newly allocated hash table.
+ * @param ht Hash table operated upon.
+ * @param options Options holding the functions, where NULL selects the defaults for integer keys and values, or
+ * the comparison function matching a built-in hash function.
+ **/
+void functions_init(hash_table_t *ht, const hash_table_options_t *options)
+{
+  if (options->hash_function == NULL)
     {
-      ht->hash_function = default_hash_function;
+      ht->hash_function = options->owned_keys ? hash_table_hash_string : hash_table_hash_int;
     }
   else
     {
-      ht->hash_function = func;
+      ht->hash_function = options->hash_function;
     }
-  if (key_comp_fun == NULL)
+  if (options->key_equiv != NULL)
   {
-    ht->key_equiv = default_key_equiv;
+    ht->key_equiv = options->key_equiv;
+  }
+  else if (ht->hash_function == hash_table_hash_string)
+  {
+    ht->key_equiv = hash_table_equiv_string;
+  }
+  else if (ht->hash_function == hash_table_hash_pointer)
+  {
+    ht->key_equiv = hash_table_equiv_pointer;
   }
   else 
   {
-    ht->key_equiv = key_comp_fun;
+    ht->key_equiv = default_key_equiv;
   }
-  if (value_comp_fun == NULL)
+  if (options->value_equiv == NULL)
   {
     ht->value_equiv = default_value_equiv;
   }
   else {
-    ht->value_equiv = value_comp_fun;
+    ht->value_equiv = options->value_equiv;
   }
-  for (int i = 0; i < ht->no_buckets; ++i)
-    {
-      entry_t new_entry = {.key = int_elem(0), .value = int_elem(0), .next = NULL};
-      ht->buckets[i] = new_entry;
-    }
-  
-  return ht;
-}
-
-/** 
- * @brief Create a new hash table with a starting bucket size of 17 and load factor of 0.75.
- * @param func Hash function to hash keys with.
- * @param key_comp_fun Function that determines how keys will get compared.
- * @param value_comp_fun Function that detetmines how values will get compared.
- * @return A new empty hash table.
- * 
- * If no hash, key or value comparison function is provided, default functions are set
- * and the hash table is assumed to operate on integer keys and values.
- **/
-hash_table_t *hash_table_create(hash_function func, predicate_ht key_comp_fun, predicate_ht value_comp_fun)
-{
-  return hash_table_create_dynamic(17, 0.75, func, key_comp_fun, value_comp_fun);
 }
 
 /**
- * @brief Find the previous entry for a certain key.
- * @param func Hash function.
- * @param first_entry First entry of the bucket.
- * @param key Hashed key.
- * @return A pointer to the previous entry.
+ * @brief Create a new hash table from a set of options.
+ * @param options Options to create the hash table with. Fields left as 0 or NULL select their defaults.
+ * @return A new empty hash table, or NULL if creation failed.
+ * 
+ * The given load factor is sanity checked to ensure it is not negative, the minimum load factor to be at most a
+ * quarter of it, so that a hash table that just grew or shrunk is not resized again right away, and the
+ * backend to be a known one, which must be the chained one in cache mode.
+ * If any of these checks fail, NULL is returned; otherwise initial memory gets allocated and starting values
+ * are set. If no hash, key or value comparison function is provided, default functions are set and the hash
+ * table is assumed to operate on integer keys and values. If any memory allocation fails, the failure is
+ * reported to the log function and NULL is returned.
  **/
-static entry_t *find_previous_entry_for_key(hash_function func, entry_t *first_entry, const unsigned long key)
+hash_table_t *hash_table_create_with_options(const hash_table_options_t *options)
 {
-  entry_t *prev = first_entry;
-  entry_t *cursor = first_entry->next;
-  while (cursor != NULL)
+  if (options->load_factor < 0)
+  {
+    hash_table_log(NULL, HASH_TABLE_EVENT_INVALID_ARGUMENT, "Load factor must be greater than 0! Got %.2f", options->load_factor);
+    return NULL;
+  }
+  const float load_factor = options->load_factor == 0 ? DEFAULT_LOAD_FACTOR : options->load_factor;
+  if (options->min_load_factor < 0 || options->min_load_factor > load_factor / 4)
+  {
+    hash_table_log(NULL, HASH_TABLE_EVENT_INVALID_ARGUMENT, "Minimum load factor must be between 0 and a quarter of the load factor! Got %.2f", options->min_load_factor);
+    return NULL;
+  }
+  if (options->backend != HASH_TABLE_CHAINED && options->backend != HASH_TABLE_OPEN_ADDRESSING)
+  {
+    hash_table_log(NULL, HASH_TABLE_EVENT_INVALID_ARGUMENT, "Unknown hash table backend %d!", options->backend);
+    return NULL;
+  }
+  const bool cache = options->max_entries != 0 || options->max_bytes != 0;
+  if (cache && options->backend != HASH_TABLE_CHAINED)
+  {
+    hash_table_log(NULL, HASH_TABLE_EVENT_INVALID_ARGUMENT, "Cache mode is only supported by the chained backend!");
+    return NULL;
+  }
+  if (options->prefilter && options->backend != HASH_TABLE_CHAINED)
+  {
+    hash_table_log(NULL, HASH_TABLE_EVENT_INVALID_ARGUMENT, "Prefilters are only supported by the chained backend!");
+    return NULL;
+  }
+  if (options->change_log_size != 0 && options->owned_keys)
+  {
+    hash_table_log(NULL, HASH_TABLE_EVENT_INVALID_ARGUMENT, "Change logs are not supported with owned keys!");
+    return NULL;
+  }
+  if (options->no_shards > 1)
+  {
+    return sharded_create(options, false);
+  }
+
+  hash_table_t *ht = calloc(1, sizeof(hash_table_t));
+  if (ht == NULL)
+  {
+    hash_table_log(NULL, HASH_TABLE_EVENT_NO_MEMORY, "Failed to allocate memory for hash table!");
+    return NULL;
+  }
+  
+  ht->backend = options->backend;
+  ht->rehash_step = options->rehash_step;
+  ht->load_factor = load_factor;
+  ht->min_load_factor = options->min_load_factor;
+  ht->size = 0;
+  ht->owned_keys = options->owned_keys;
+  ht->cache = cache;
+  ht->max_entries = options->max_entries;
+  ht->max_bytes = options->max_bytes;
+  ht->cost_function = options->cost_function;
+  ht->evict_function = options->evict_function;
+  ht->evict_extra = options->evict_extra;
+  ht->clock_function = options->clock_function;
+  ht->clock_extra = options->clock_extra;
+  functions_init(ht, options);
+  // Only caches keep bookkeeping behind their entries, so that other hash tables get the smallest entries
+  ht->pool.entry_size = cache ? sizeof(entry_t) + sizeof(entry_meta_t) : sizeof(entry_t);
+  if (options->allocator.alloc == NULL)
+  {
+    ht->pool.allocator.alloc = default_slab_alloc;
+    ht->pool.allocator.free = default_slab_free;
+  }
+  else
+  {
+    ht->pool.allocator = options->allocator;
+  }
+
+  const size_t no_buckets = options->no_buckets == 0 ? DEFAULT_NO_BUCKETS : options->no_buckets;
+  bool initialized;
+  if (ht->backend == HASH_TABLE_OPEN_ADDRESSING)
+  {
+    ht->ops = &open_addressing_ops;
+    initialized = open_addressing_init(ht, no_buckets);
+  }
+  else
+  {
+    ht->ops = &chained_ops;
+    initialized = chained_init(ht, no_buckets);
+  }
+  if (!initialized)
+  {
+    free(ht);
+    return NULL;
+  }
+  if ((options->prefilter && !filter_init(ht, &ht->filter, ht->no_buckets))
+      || (options->change_log_size != 0 && !change_log_init(ht, options->change_log_size)))
+  {
+    hash_table_destroy(ht);
+    return NULL;
+  }
+  
+  return ht;
+}
+
+/**
+ * @brief Create a new hash table with a given bucket size and load factor.
+ * @param no_buckets Capacity hint for the number of buckets to store entries in. Rounded up to the nearest prime number.
+ * @param load_factor Maximum load factor before hash table gets resized.
+ * @param func Hash function to hash keys with.
+ * @param key_comp_fun Function that determines how keys will get compared.
+ * @param value_comp_fun Function that detetmines how values will get compared.
+ * @return A new empty hash table, or NULL if creation failed.
+ * 
+ * Creation of a new hash table is done by checking that the given number of buckets and load factor are both
+ * larger than 0. If any of these checks fail, NULL is returned; otherwise the hash table is created using the
+ * default backend (HASH_TABLE_DEFAULT_BACKEND, chained unless overridden at build time) just like
+ * hash_table_create_with_options would.
+ **/
+hash_table_t *hash_table_create_dynamic(const size_t no_buckets, const float load_factor, hash_function func, predicate_ht key_comp_fun, predicate_ht value_comp_fun)
+{
+  if (no_buckets == 0)
+  {
+    hash_table_log(NULL, HASH_TABLE_EVENT_INVALID_ARGUMENT, "Bucket size must be greater than 0!");
+    return NULL;
+  }
+  if (load_factor <= 0)
+  {
+    hash_table_log(NULL, HASH_TABLE_EVENT_INVALID_ARGUMENT, "Load factor must be greater than 0! Got %.2f", load_factor);
+    return NULL;
+  }
+
+  hash_table_options_t options = {
+    .backend = HASH_TABLE_DEFAULT_BACKEND,
+    .no_buckets = no_buckets,
+    .load_factor = load_factor,
+    .hash_function = func,
+    .key_equiv = key_comp_fun,
+    .value_equiv = value_comp_fun,
+  };
+  return hash_table_create_with_options(&options);
+}
+
+/** 
+ * @brief Create a new hash table with a starting bucket size of 17 and load factor of 0.75.
+ * @param func Hash function to hash keys with.
+ * @param key_comp_fun Function that determines how keys will get compared.
+ * @param value_comp_fun Function that detetmines how values will get compared.
+ * @return A new empty hash table.
+ * 
+ * If no hash, key or value comparison function is provided, default functions are set
+ * and the hash table is assumed to operate on integer keys and values.
+ **/
+hash_table_t *hash_table_create(hash_function func, predicate_ht key_comp_fun, predicate_ht value_comp_fun)
+{
+  return hash_table_create_dynamic(DEFAULT_NO_BUCKETS, DEFAULT_LOAD_FACTOR, func, key_comp_fun, value_comp_fun);
+}
+
+/**
+ * @brief Find the link to a certain hash, without comparing keys.
+ * @param head Head of the bucket.
+ * @param key Hashed key.
+ * @return A pointer to the link, either the head or the next field of an entry, to the first entry whose hash
+ * is not less than key.
+ * 
+ * Entries within a bucket are kept sorted on their cached hash, so the walk stops at the first entry
+ * whose hash is not less than the sought one without ever calling the hash function. The link rather than
+ * the preceding entry is returned since the head of a bucket is a bare pointer, not an entry.
+ **/
+entry_t **find_link_for_key(entry_t **head, const unsigned long key)
+{
+  entry_t **link = head;
+  while (*link != NULL)
     {
-      const unsigned long hash_key = func(cursor->key);
-      if (hash_key >= key)
+      if ((*link)->hash >= key)
         {
           break;
         }
-      prev = cursor;
-      cursor = cursor->next; /// Step forward to the next entry, and repeat loop
+      link = &(*link)->next; /// Step forward to the next entry, and repeat loop
     }
   
-  return prev;
+  return link;
+}
+
+/**
+ * @brief Find the link to a certain key, confirming equal hashes with the key comparison function.
+ * @param ht Hash table whose key comparison function to use.
+ * @param head Head of the bucket.
+ * @param key Key to find.
+ * @param hash Hash of the key.
+ * @return A pointer to the link to the entry for the key or, if the key is not stored, the link where it
+ * would be inserted. Either way the key is stored if and only if the linked entry has the same hash.
+ * 
+ * The cached hashes serve as a fast reject: the key comparison function is only called for entries whose hash
+ * equals the sought one. Since entries are sorted on their hash, all such entries follow one another, and the
+ * walk ends at the first entry with a greater hash.
+ **/
+entry_t **find_link_matching(hash_table_t *ht, entry_t **head, const elem_t key, const unsigned long hash)
+{
+  entry_t **link = head;
+  size_t no_probes = 0;
+  while (*link != NULL && (*link)->hash <= hash)
+    {
+      no_probes += 1;
+      if ((*link)->hash == hash && ht->key_equiv((*link)->key, (*link)->value, &key))
+        {
+          break;
+        }
+      link = &(*link)->next;
+    }
+
+  STATS_ADD(ht, no_finds, 1);
+  STATS_ADD(ht, no_probes, no_probes);
+  return link;
+}
+
+/**
+ * @brief Find the link to a certain key in whichever bucket array holds it.
+ * @param ht Hash table operated upon.
+ * @param key Key to find.
+ * @param hash Hash of the key.
+ * @return A pointer to the link to the key, in the current buckets if the key is not stored in the old ones.
+ * 
+ * While an incremental rehash is ongoing, a key may still reside in an old bucket that has not been migrated
+ * yet; that bucket is examined first. Otherwise, as well as when no rehash is ongoing, the link in the current
+ * bucket array is returned, which is also where a missing key should be inserted.
+ **/
+entry_t **find_link_in_table(hash_table_t *ht, const elem_t key, const unsigned long hash)
+{
+  if (ht->old_buckets != NULL)
+    {
+      const size_t old_bucket = bucket_index(hash, ht->no_old_buckets, ht->old_bucket_reciprocal);
+      if (old_bucket >= ht->rehash_index)
+        {
+          entry_t **link = find_link_matching(ht, &ht->old_buckets[old_bucket], key, hash);
+          if (*link != NULL && (*link)->hash == hash)
+            {
+              return link;
+            }
+        }
+    }
+  return find_link_matching(ht, &ht->buckets[bucket_index(hash, ht->no_buckets, ht->bucket_reciprocal)], key, hash);
 }
 
 /**
  * @brief Create a new entry.
+ * @param pool Entry pool to allocate the entry from.
  * @param key Key to associate with entry.
  * @param value Value to associate with entry.
+ * @param hash Hash of the key.
  * @param next An entry pointer to the next entry.
  * @return A pointer to the newly created entry; possibly NULL if memory allocation failed.
  * 
- * Creation is done by attempting to allocate memory for another entry and assigning the given parameters.
+ * Creation is done by reusing a previously destroyed entry from the free list of the pool if there is one,
+ * or else by handing out the next unused entry of the most recent slab. Only when that slab is exhausted is
+ * memory allocated, for a new slab twice the size of the previous one (up to MAX_SLAB_ENTRIES entries).
+ * Any bookkeeping behind the entry is cleared.
  **/
-static entry_t *entry_create(const elem_t key, const elem_t value, entry_t *next)
+entry_t *entry_create(entry_pool_t *pool, const elem_t key, const elem_t value, const unsigned long hash, entry_t *next)
 {
-  entry_t *new_entry = calloc(1, sizeof(entry_t));
-  if (new_entry == NULL)
+  entry_t *new_entry = pool->free_list;
+  if (new_entry != NULL)
   {
-    puts("Failed to allocate memory for entry!");
-    return NULL;
+    pool->free_list = new_entry->next;
+  }
+  else
+  {
+    if (pool->unused == 0)
+    {
+      size_t no_entries = pool->slabs == NULL ? MIN_SLAB_ENTRIES : 2 * pool->slabs->no_entries;
+      if (no_entries > MAX_SLAB_ENTRIES)
+        no_entries = MAX_SLAB_ENTRIES;
+      entry_slab_t *slab = pool->allocator.alloc(sizeof(entry_slab_t) + no_entries * pool->entry_size, pool->allocator.arena);
+      if (slab == NULL)
+      {
+        return NULL;
+      }
+      slab->next = pool->slabs;
+      slab->no_entries = no_entries;
+      pool->slabs = slab;
+      pool->unused = no_entries;
+    }
+    new_entry = slab_entry(pool, pool->slabs, pool->slabs->no_entries - pool->unused);
+    pool->unused -= 1;
   }
   new_entry->key = key;
   new_entry->value = value;
+  new_entry->hash = hash;
   new_entry->next = next;
+  if (entry_pool_has_meta(pool))
+  {
+    memset(entry_meta(new_entry), 0, pool->entry_size - sizeof(entry_t));
+  }
 
   return new_entry;
 }
 
 /**
- * @brief Insert a key-value pair entry in a hash table.
- * @param ht Hash table to insert into.
- * @param key Key to insert.
- * @param value Value to insert.
- * 
- * Before inserting a new entry, if necessary, the hash table gets resized and rehashed.
+ * @brief Unlink an entry from its chain and destroy it, along with any owned key.
+ * @param ht Hash table operated upon.
+ * @param link Link to the entry, either a bucket head or the next field of another entry.
+ * 
+ * Any expiry time of the entry is reset, which tells any timer still scheduled for it that it is gone. The
+ * bits of its hash in the prefilter stay set, and are counted as stale until the filter is rebuilt.
+ **/
+static void chained_unlink(hash_table_t *ht, entry_t **link)
+{
+  entry_t *entry = *link;
+  *link = entry->next;
+  if (ht->cache)
+    ht->cache_bytes -= entry_meta(entry)->cost;
+  if (ht->owned_keys)
+    key_arena_free(&ht->keys, entry->key);
+  if (entry_pool_has_meta(&ht->pool))
+    entry_meta(entry)->expires = 0;
+  entry_destroy(&ht->pool, entry);
+  ht->size -= 1;
+  if (ht->filter.blocks != NULL)
+    filter_forget(ht);
+}
+
+/**
+ * @brief Expire an entry of a chained hash table, passing it to the evict function before destroying it.
+ * @param ht Hash table operated upon.
+ * @param link Link to the entry, either a bucket head or the next field of another entry.
+ **/
+void chained_expire(hash_table_t *ht, entry_t **link)
+{
+  if (ht->evict_function != NULL)
+  {
+    ht->evict_function((*link)->key, (*link)->value, ht->evict_extra);
+  }
+  change_log_append(ht, HASH_TABLE_CHANGE_REMOVE, (*link)->key, (*link)->value);
+  chained_unlink(ht, link);
+}
+
+/**
+ * @brief Get the cost of a newly inserted entry of a hash table in cache mode.
+ * @param ht Hash table operated upon.
+ * @param key Key of the entry, as stored.
+ * @param value Value of the entry.
+ * @return The cost returned by the cost function or, without one, the size of the entry and of any owned
+ * key, capped at UINT32_MAX.
+ **/
+static uint32_t entry_cost(const hash_table_t *ht, const elem_t key, const elem_t value)
+{
+  size_t cost = ht->pool.entry_size;
+  if (ht->cost_function != NULL)
+  {
+    cost = ht->cost_function(key, value);
+  }
+  else if (ht->owned_keys)
+  {
+    cost += sizeof(owned_key_t) + strlen(key.p) + 1;
+  }
+  return cost < UINT32_MAX ? (uint32_t) cost : UINT32_MAX;
+}
+
+/**
+ * @brief Check whether a hash table in cache mode holds more entries, or costlier ones, than its budget allows.
+ * @param ht Hash table operated upon.
+ * @return True if entries should be evicted.
+ **/
+static inline bool over_budget(const hash_table_t *ht)
+{
+  return (ht->max_entries != 0 && ht->size > ht->max_entries) || (ht->max_bytes != 0 && ht->cache_bytes > ht->max_bytes);
+}
+
+/**
+ * @brief Evict entries of a hash table in cache mode until it is within its budget again.
+ * @param ht Hash table operated upon.
+ * @param keep Entry that must not be evicted, the one just inserted.
+ * 
+ * Entries are evicted in CLOCK order. The hand sweeps the bucket positions, numbered as for
+ * chained_for_each_range, and evicts the first entry of a bucket that has not been used since the hand last
+ * passed it, clearing the referenced flag of every entry it passes over. The hand passes every entry at most twice
+ * before finding one to evict, so evictions take amortized constant time as long as the load of the hash
+ * table stays near its load factor. Should the kept entry alone exceed the byte budget, it is left in place.
+ **/
+static void chained_evict(hash_table_t *ht, const entry_t *keep)
+{
+  while (over_budget(ht) && ht->size > 1)
+  {
+    if (ht->clock_hand >= ht->no_old_buckets + ht->no_buckets)
+    {
+      ht->clock_hand = 0;
+    }
+    const size_t hand = ht->clock_hand;
+    entry_t **link = hand < ht->no_old_buckets ? &ht->old_buckets[hand] : &ht->buckets[hand - ht->no_old_buckets];
+    while (*link != NULL && (entry_meta(*link)->referenced || *link == keep))
+    {
+      entry_meta(*link)->referenced = false;
+      link = &(*link)->next;
+    }
+    // The hand moves on even after evicting, as the entries it just passed over would be evicted next
+    ht->clock_hand += 1;
+    if (*link != NULL)
+    {
+      if (ht->evict_function != NULL)
+      {
+        ht->evict_function((*link)->key, (*link)->value, ht->evict_extra);
+      }
+      change_log_append(ht, HASH_TABLE_CHANGE_REMOVE, (*link)->key, (*link)->value);
+      chained_unlink(ht, link);
+    }
+  }
+}
+
+/**
+ * @brief Get the value slot for an already hashed key in a chained hash table, inserting the key if missing.
+ * @param ht Hash table operated upon.
+ * @param key Key to lookup or insert.
+ * @param value Value to insert the key with if it is missing.
+ * @param hash_key Hash of the key.
+ * @param inserted Pointer where whether the key was inserted will be stored.
+ * @return A pointer to the value stored for the key, or NULL if the key could not be inserted.
+ * 
+ * Before inserting a new entry, a step of any ongoing incremental rehash is performed and, if necessary,
+ * the hash table gets resized and rehashed. New entries always go into the current bucket array. The
+ * bucket is walked only once, as the link to the key is also where a missing key gets linked.
+ **/
+static elem_t *chained_upsert_hashed(hash_table_t *ht, const elem_t key, const elem_t value, const unsigned long hash_key, bool *inserted)
+{
+  hash_table_rehash_step(ht, ht->rehash_step);
+  ht = hash_table_resize(ht);
+  
+  entry_t **link = find_link_in_table(ht, key, hash_key);
+  entry_t *next = *link;
+
+  if (next != NULL && next->hash == hash_key && entry_expired(ht, next))
+    {
+      // An expired entry counts as missing, and the new one takes its place in the chain
+      chained_expire(ht, link);
+      link = find_link_in_table(ht, key, hash_key);
+      next = *link;
+    }
+  if (next != NULL && next->hash == hash_key)
+    {
+      entry_touch(ht, next);
+      *inserted = false;
+      return &next->value;
+    }
+
+  elem_t stored_key = key;
+  *inserted = false;
+  if (ht->owned_keys && !key_arena_copy(&ht->keys, &stored_key))
+  {
+    hash_table_log(ht, HASH_TABLE_EVENT_NO_MEMORY, "Failed to allocate memory for key!");
+    return NULL;
+  }
+  entry_t *new_entry = entry_create(&ht->pool, stored_key, value, hash_key, next);
+  if (new_entry == NULL)
+  {
+    hash_table_log(ht, HASH_TABLE_EVENT_NO_MEMORY, "Failed to allocate memory for entry!");
+    if (ht->owned_keys)
+      key_arena_free(&ht->keys, stored_key);
+    return NULL;
+  }
+  *link = new_entry;
+  ht->size += 1;
+  *inserted = true;
+  if (ht->filter.blocks != NULL)
+  {
+    filter_add(&ht->filter, hash_key);
+  }
+  if (ht->cache)
+  {
+    entry_meta_t *meta = entry_meta(new_entry);
+    meta->cost = entry_cost(ht, stored_key, value);
+    meta->referenced = true;
+    ht->cache_bytes += meta->cost;
+    chained_evict(ht, new_entry);
+  }
+  return &new_entry->value;
+}
+
+/**
+ * @brief Insert a key-value pair entry with an already hashed key in a chained hash table.
+ * @param ht Hash table to insert into.
+ * @param key Key to insert.
+ * @param value Value to insert.
+ * @param hash_key Hash of the key.
+ * @return Status of the insertion.
+ * 
+ * The value of an existing entry for the key is replaced.
+ **/
+static hash_table_status_t chained_insert_hashed(hash_table_t *ht, const elem_t key, const elem_t value, const unsigned long hash_key)
+{
+  bool inserted;
+  elem_t *slot = chained_upsert_hashed(ht, key, value, hash_key, &inserted);
+  return insert_status(slot, inserted, value);
+}
+
+/**
+ * @brief Insert a batch of key-value pairs in a chained hash table.
+ * @param ht Hash table to insert into.
+ * @param keys Keys to insert.
+ * @param values Values to insert, one per key.
+ * @param no_keys Number of keys.
+ * 
+ * Pairs are inserted one window at a time, each window being hashed and prefetched as a whole beforehand.
+ * Should an insertion resize the hash table, the prefetches for the rest of its window are wasted.
+ **/
+static void chained_insert_batch(hash_table_t *ht, const elem_t *keys, const elem_t *values, const size_t no_keys)
+{
+  unsigned long hashes[BATCH_WINDOW];
+  for (size_t start = 0; start < no_keys; start += BATCH_WINDOW)
+    {
+      const size_t window = no_keys - start < BATCH_WINDOW ? no_keys - start : BATCH_WINDOW;
+      for (size_t i = 0; i < window; i++)
+        {
+          hashes[i] = ht->hash_function(keys[start + i]);
+        }
+      chained_prefetch_window(ht, hashes, window);
+      for (size_t i = 0; i < window; i++)
+        {
+          chained_insert_hashed(ht, keys[start + i], values[start + i], hashes[i]);
+        }
+    }
+}
+
+/**
+ * @brief Insert a key-value pair entry in a hash table.
+ * @param ht Hash table to insert into.
+ * @param key Key to insert.
+ * @param value Value to insert.
+ * @return Whether the key was inserted, its value replaced, or nothing changed since memory ran out.
+ * 
+ * Before inserting a new entry, if necessary, the hash table gets resized and rehashed.
+ **/
+hash_table_status_t hash_table_insert(hash_table_t *ht, const elem_t key, const elem_t value)
+{
+  const hash_table_status_t status = ht->ops->insert(ht, key, value, ht->hash_function(key));
+  if (status == HASH_TABLE_INSERTED || status == HASH_TABLE_UPDATED)
+    change_log_append(ht, HASH_TABLE_CHANGE_INSERT, key, value);
+  return status;
+}
+
+/**
+ * @brief Insert a batch of key-value pairs in a hash table.
+ * @param ht Hash table to insert into.
+ * @param keys Keys to insert.
+ * @param values Values to insert, one per key.
+ * @param no_keys Number of keys.
+ * 
+ * With a change log, keys are inserted one at a time instead, so that every insertion is recorded in order
+ * with any evictions it causes.
+ **/
+void hash_table_insert_batch(hash_table_t *ht, const elem_t *keys, const elem_t *values, const size_t no_keys)
+{
+  if (ht->log != NULL)
+    {
+      for (size_t i = 0; i < no_keys; i++)
+        {
+          hash_table_insert(ht, keys[i], values[i]);
+        }
+      return;
+    }
+  ht->ops->insert_batch(ht, keys, values, no_keys);
+}
+
+/**
+ * @brief Lookup values for a batch of keys in a hash table.
+ * @param ht Hash table operated upon.
+ * @param keys Keys to lookup.
+ * @param no_keys Number of keys.
+ * @param results Array where found values will be stored.
+ * @param found Array of flags telling which keys were found, or NULL.
+ * @return The number of keys found.
+ **/
+size_t hash_table_lookup_batch(hash_table_t *ht, const elem_t *keys, const size_t no_keys, elem_t *results, bool *found)
+{
+  return ht->ops->lookup_batch(ht, keys, no_keys, results, found);
+}
+
+/**
+ * @brief Destroy an entry by returning it to its pool.
+ * @param pool Entry pool the entry was allocated from.
+ * @param entry Entry to destroy.
+ * 
+ * The memory of the entry is not released, but pushed on the free list of the pool for reuse.
+ **/
+void entry_destroy(entry_pool_t *pool, entry_t *entry)
+{
+  entry->next = pool->free_list;
+  pool->free_list = entry;
+}
+
+/**
+ * @brief Allocate a slab of entries for the caller to fill in, which the pool owns from then on.
+ * @param pool Entry pool operated upon.
+ * @param no_entries Number of entries of the slab.
+ * @return A pointer to the first entry of the slab, or NULL if memory allocation failed.
+ * 
+ * Since only the most recent slab of a pool hands out unused entries, the entries left in the previous one
+ * are moved to the free list. Entries of the slab that the caller does not fill in are returned with
+ * entry_destroy. The entries are entry_size bytes apart.
+ **/
+entry_t *entry_pool_alloc_slab(entry_pool_t *pool, const size_t no_entries)
+{
+  if (no_entries > (SIZE_MAX - sizeof(entry_slab_t)) / pool->entry_size)
+  {
+    return NULL;
+  }
+  entry_slab_t *slab = pool->allocator.alloc(sizeof(entry_slab_t) + no_entries * pool->entry_size, pool->allocator.arena);
+  if (slab == NULL)
+  {
+    return NULL;
+  }
+  for (; pool->unused > 0; pool->unused -= 1)
+  {
+    entry_destroy(pool, slab_entry(pool, pool->slabs, pool->slabs->no_entries - pool->unused));
+  }
+  slab->next = pool->slabs;
+  slab->no_entries = no_entries;
+  pool->slabs = slab;
+  return slab->entries;
+}
+
+/**
+ * @brief Release every slab of an entry pool, destroying all entries allocated from it at once.
+ * @param pool Entry pool operated upon.
+ * 
+ * This operation is performed in time proportional to the number of slabs rather than entries.
+ **/
+void entry_pool_release(entry_pool_t *pool)
+{
+  entry_slab_t *slab = pool->slabs;
+  while (slab != NULL)
+  {
+    entry_slab_t *next = slab->next;
+    if (pool->allocator.free != NULL)
+    {
+      pool->allocator.free(slab, sizeof(entry_slab_t) + slab->no_entries * pool->entry_size, pool->allocator.arena);
+    }
+    slab = next;
+  }
+  pool->slabs = NULL;
+  pool->free_list = NULL;
+  pool->unused = 0;
+}
+
+/**
+ * @brief Hand every slab of an entry pool over to another pool with the same allocator and entry size.
+ * @param dst Entry pool taking over the slabs.
+ * @param src Entry pool giving up its slabs, which is left empty.
+ * 
+ * Entries of src stay where they are and belong to dst from then on. Since only the most recent slab of a
+ * pool hands out unused entries, the slabs of src are linked in behind the most recent slab of dst, and the
+ * unused and free entries of src are moved to the free list of dst.
+ **/
+void entry_pool_merge(entry_pool_t *dst, entry_pool_t *src)
+{
+  for (; src->unused > 0; src->unused -= 1)
+  {
+    entry_destroy(dst, slab_entry(src, src->slabs, src->slabs->no_entries - src->unused));
+  }
+  while (src->free_list != NULL)
+  {
+    entry_t *entry = src->free_list;
+    src->free_list = entry->next;
+    entry_destroy(dst, entry);
+  }
+  if (src->slabs != NULL)
+  {
+    entry_slab_t *last = src->slabs;
+    while (last->next != NULL)
+      last = last->next;
+    if (dst->slabs == NULL)
+    {
+      dst->slabs = src->slabs;
+    }
+    else
+    {
+      last->next = dst->slabs->next;
+      dst->slabs->next = src->slabs;
+    }
+  }
+  src->slabs = NULL;
+}
+
+/**
+ * @brief Give every entry of a chained hash table room for bookkeeping, moving them into a new pool if needed.
+ * @param ht Hash table operated upon.
+ * @return True if the entries carry bookkeeping, false if memory allocation failed, in which case the hash
+ * table is left as it was.
+ * 
+ * Hash tables start out with bare entries unless in cache mode, and only the first entry given a time to
+ * live makes them pay for bookkeeping. The entries are copied into a single slab of a new pool, with their
+ * bookkeeping cleared, and relinked in place of the old ones, after which the old pool is released. This
+ * takes time proportional to the number of entries, once in the lifetime of the hash table.
+ **/
+bool chained_widen_entries(hash_table_t *ht)
+{
+  if (entry_pool_has_meta(&ht->pool))
+  {
+    return true;
+  }
+  entry_pool_t pool = {
+    .slabs = NULL, .free_list = NULL, .unused = 0,
+    .entry_size = sizeof(entry_t) + sizeof(entry_meta_t), .allocator = ht->pool.allocator,
+  };
+  entry_t *copies = NULL;
+  if (ht->size > 0 && (copies = entry_pool_alloc_slab(&pool, ht->size)) == NULL)
+  {
+    hash_table_log(ht, HASH_TABLE_EVENT_NO_MEMORY, "Failed to allocate memory for the bookkeeping of %zu entries!", ht->size);
+    return false;
+  }
+  entry_t **arrays[] = { ht->old_buckets, ht->buckets };
+  const size_t no_buckets[] = { ht->no_old_buckets, ht->no_buckets };
+  size_t no_copied = 0;
+  for (size_t a = 0; a < sizeof(arrays) / sizeof(arrays[0]); a++)
+  {
+    for (size_t bucket = 0; arrays[a] != NULL && bucket < no_buckets[a]; bucket++)
+    {
+      for (entry_t **link = &arrays[a][bucket]; *link != NULL; link = &(*link)->next)
+      {
+        entry_t *copy = slab_entry(&pool, pool.slabs, no_copied++);
+        *copy = **link;
+        memset(entry_meta(copy), 0, sizeof(entry_meta_t));
+        *link = copy;
+      }
+    }
+  }
+  entry_pool_release(&ht->pool);
+  ht->pool = pool;
+  return true;
+}
+
+/**
+ * @brief Get the size class of an owned key.
+ * @param length Length of the key.
+ * @return Index of the size class, KEY_SIZE_CLASSES or more for keys too long for any class.
+ **/
+static inline size_t key_size_class(const size_t length)
+{
+  return (sizeof(owned_key_t) + length + 1 + KEY_CLASS_SIZE - 1) / KEY_CLASS_SIZE - 1;
+}
+
+/**
+ * @brief Copy a string key into the storage of a hash table.
+ * @param arena Key arena to allocate the copy from.
+ * @param key Key to copy, whose pointer is replaced by one to the copy.
+ * @return True if the key was copied, false if memory allocation failed.
+ * 
+ * Keys are rounded up to size classes of KEY_CLASS_SIZE bytes. A short key reuses a freed copy of its size
+ * class if there is one, or else is carved from the most recent chunk, so that copies lie next to one another
+ * and are never allocated by themselves. The rest of a chunk too small for a key is left unused. A key too long
+ * for any size class gets a chunk of its own.
+ **/
+bool key_arena_copy(key_arena_t *arena, elem_t *key)
+{
+  const size_t length = strlen(key->p);
+  const size_t size_class = key_size_class(length);
+  owned_key_t *copy;
+  if (size_class >= KEY_SIZE_CLASSES)
+  {
+    key_chunk_t *chunk = malloc(sizeof(key_chunk_t) + sizeof(owned_key_t) + length + 1);
+    if (chunk == NULL)
+      return false;
+    chunk->prev = NULL;
+    chunk->next = arena->long_keys;
+    if (arena->long_keys != NULL)
+      arena->long_keys->prev = chunk;
+    arena->long_keys = chunk;
+    copy = (owned_key_t *) chunk->bytes;
+  }
+  else if (arena->free_lists[size_class] != NULL)
+  {
+    copy = arena->free_lists[size_class];
+    memcpy(&arena->free_lists[size_class], copy->bytes, sizeof(owned_key_t *));
+  }
+  else
+  {
+    const size_t size = (size_class + 1) * KEY_CLASS_SIZE;
+    if (arena->unused < size)
+    {
+      key_chunk_t *chunk = malloc(sizeof(key_chunk_t) + KEY_CHUNK_SIZE);
+      if (chunk == NULL)
+        return false;
+      chunk->next = arena->chunks;
+      arena->chunks = chunk;
+      arena->unused = KEY_CHUNK_SIZE;
+    }
+    copy = (owned_key_t *) &arena->chunks->bytes[KEY_CHUNK_SIZE - arena->unused];
+    arena->unused -= size;
+  }
+
+  copy->length = length;
+  memcpy(copy->bytes, key->p, length + 1);
+  key->p = copy->bytes;
+  return true;
+}
+
+/**
+ * @brief Free the copy of a key, for reuse by later copies.
+ * @param arena Key arena the copy was allocated from.
+ * @param key Key as returned by key_arena_copy.
+ * 
+ * A short key is pushed onto the free list of its size class, linked through its first bytes; the chunk of a
+ * long key is unlinked and deallocated right away.
+ **/
+void key_arena_free(key_arena_t *arena, const elem_t key)
+{
+  owned_key_t *copy = (owned_key_t *) ((char *) key.p - offsetof(owned_key_t, bytes));
+  const size_t size_class = key_size_class(copy->length);
+  if (size_class >= KEY_SIZE_CLASSES)
+  {
+    key_chunk_t *chunk = (key_chunk_t *) ((char *) copy - offsetof(key_chunk_t, bytes));
+    if (chunk->prev == NULL)
+      arena->long_keys = chunk->next;
+    else
+      chunk->prev->next = chunk->next;
+    if (chunk->next != NULL)
+      chunk->next->prev = chunk->prev;
+    free(chunk);
+    return;
+  }
+  memcpy(copy->bytes, &arena->free_lists[size_class], sizeof(owned_key_t *));
+  arena->free_lists[size_class] = copy;
+}
+
+/**
+ * @brief Release all memory of a key arena, freeing every copy allocated from it at once.
+ * @param arena Key arena operated upon.
+ **/
+void key_arena_release(key_arena_t *arena)
+{
+  key_chunk_t *lists[] = { arena->chunks, arena->long_keys };
+  for (size_t i = 0; i < sizeof(lists) / sizeof(lists[0]); i++)
+  {
+    for (key_chunk_t *chunk = lists[i]; chunk != NULL; )
+    {
+      key_chunk_t *next = chunk->next;
+      free(chunk);
+      chunk = next;
+    }
+  }
+  key_arena_t empty = { 0 };
+  *arena = empty;
+}
+
+/**
+ * @brief Hand every copy of a key arena over to another key arena.
+ * @param dst Key arena taking over the copies.
+ * @param src Key arena giving up its copies, which is left empty.
+ * 
+ * Chunks of src are linked in behind the most recent chunk of dst, which keeps handing out its unused bytes;
+ * the unused bytes of the most recent chunk of src are given up until the arena is released. Freed copies of
+ * src join the free lists of dst.
+ **/
+void key_arena_merge(key_arena_t *dst, key_arena_t *src)
+{
+  if (src->chunks != NULL)
+  {
+    if (dst->chunks == NULL)
+    {
+      dst->chunks = src->chunks;
+      dst->unused = src->unused;
+    }
+    else
+    {
+      key_chunk_t *last = src->chunks;
+      while (last->next != NULL)
+        last = last->next;
+      last->next = dst->chunks->next;
+      dst->chunks->next = src->chunks;
+    }
+  }
+  for (size_t size_class = 0; size_class < KEY_SIZE_CLASSES; size_class++)
+  {
+    owned_key_t *copy = src->free_lists[size_class];
+    if (copy == NULL)
+      continue;
+    owned_key_t *next;
+    memcpy(&next, copy->bytes, sizeof(owned_key_t *));
+    for (; next != NULL; memcpy(&next, copy->bytes, sizeof(owned_key_t *)))
+      copy = next;
+    memcpy(copy->bytes, &dst->free_lists[size_class], sizeof(owned_key_t *));
+    dst->free_lists[size_class] = src->free_lists[size_class];
+  }
+  if (src->long_keys != NULL)
+  {
+    key_chunk_t *last = src->long_keys;
+    while (last->next != NULL)
+      last = last->next;
+    last->next = dst->long_keys;
+    if (dst->long_keys != NULL)
+      dst->long_keys->prev = last;
+    dst->long_keys = src->long_keys;
+  }
+  key_arena_t empty = { 0 };
+  *src = empty;
+}
+
+/** 
+ * @brief Remove any mapping from key to a value in a chained hash table.
+ * @param ht Hash table to remove entry from.
+ * @param key Key to remove.
+ * @param hash_key Hash of the key.
+ * @param result Pointer where a removed element will be stored.
+ * @return True if a key was removed, false otherwise.
+ * 
+ * After a step of any ongoing incremental rehash, the bucket is walked once to find the link to the key. If
+ * an entry for the given key exists, it gets detatched from the linked structure then destroyed. Should the
+ * load drop below the minimum load factor, the hash table shrinks to half of its maximum load.
+ **/
+static bool chained_remove(hash_table_t *ht, const elem_t key, const unsigned long hash_key, elem_t *result)
+{
+  hash_table_rehash_step(ht, ht->rehash_step);
+  if (filter_rejects(ht, hash_key))
+    {
+      return false;
+    }
+  entry_t **link = find_link_in_table(ht, key, hash_key);
+  entry_t *entry_to_remove = *link;
+  
+  if (entry_to_remove == NULL || entry_to_remove->hash != hash_key)
+    {
+      return false;
+    }
+  else if (entry_expired(ht, entry_to_remove))
+    {
+      chained_expire(ht, link);
+      return false;
+    }
+  else
+    {
+      *result = entry_to_remove->value;
+      chained_unlink(ht, link);
+      if (below_min_load(ht, ht->size, ht->no_buckets))
+        {
+          chained_reserve(ht, 2 * ht->size, true);
+        }
+      return true;
+    }
+}
+
+/**
+ * @brief Apply a function to the value for a key in a chained hash table.
+ * @param ht Hash table operated upon.
+ * @param key Key whose value to update.
+ * @param hash_key Hash of the key.
+ * @param f Function to pass the key and a pointer to its value to.
+ * @param x Optional additional data.
+ * @param updated Pointer where the value stored by the update will be stored.
+ * @return True if the key was found and its value updated, false otherwise.
+ * 
+ * If an incremental rehash is ongoing, a step of it is performed before the key is looked up.
+ **/
+static bool chained_update(hash_table_t *ht, const elem_t key, const unsigned long hash_key, apply_function_ht f, const void *x, elem_t *updated)
+{
+  hash_table_rehash_step(ht, ht->rehash_step);
+  if (filter_rejects(ht, hash_key))
+    {
+      return false;
+    }
+  entry_t **link = find_link_in_table(ht, key, hash_key);
+  entry_t *next = *link;
+
+  if (next != NULL && next->hash == hash_key)
+    {
+      if (entry_expired(ht, next))
+        {
+          chained_expire(ht, link);
+          return false;
+        }
+      entry_touch(ht, next);
+      f(next->key, &next->value, x);
+      *updated = next->value;
+      return true;
+    }
+
+  return false;
+}
+
+/** 
+ * @brief Remove any mapping from key to a value.
+ * @param ht Hash table to remove entry from.
+ * @param key Key to remove.
+ * @param result Pointer where a removed element will be stored.
+ * @return True if a key was removed, false otherwise.
+ **/
+bool hash_table_remove(hash_table_t *ht, const elem_t key, elem_t *result)
+{
+  if (!ht->ops->remove(ht, key, ht->hash_function(key), result))
+    return false;
+  change_log_append(ht, HASH_TABLE_CHANGE_REMOVE, key, *result);
+  return true;
+}
+
+/**
+ * @brief Get the value for a key in a hash table, inserting the key with a given value if it is missing.
+ * @param ht Hash table operated upon.
+ * @param key Key to lookup or insert.
+ * @param value Value to insert the key with if it is missing.
+ * @param inserted Pointer where whether the key was inserted will be stored, or NULL.
+ * @return A pointer to the value stored for the key, or NULL if the key was missing and could not be inserted.
+ **/
+elem_t *hash_table_upsert(hash_table_t *ht, const elem_t key, const elem_t value, bool *inserted)
+{
+  bool inserted_ignored;
+  bool *key_inserted = inserted == NULL ? &inserted_ignored : inserted;
+  elem_t *slot = ht->ops->upsert(ht, key, value, ht->hash_function(key), key_inserted);
+  if (slot != NULL && *key_inserted)
+    change_log_append(ht, HASH_TABLE_CHANGE_INSERT, key, value);
+  return slot;
+}
+
+/**
+ * @brief Apply a function to the value for a key in a hash table.
+ * @param ht Hash table operated upon.
+ * @param key Key whose value to update.
+ * @param f Function to pass the key and a pointer to its value to.
+ * @param x Optional additional data.
+ * @return True if the key was found and its value updated, false otherwise.
+ **/
+bool hash_table_update(hash_table_t *ht, const elem_t key, apply_function_ht f, const void *x)
+{
+  elem_t updated;
+  if (!ht->ops->update(ht, key, ht->hash_function(key), f, x, &updated))
+    return false;
+  change_log_append(ht, HASH_TABLE_CHANGE_INSERT, key, updated);
+  return true;
+}
+
+/**
+ * @brief Clear all entries in a chained hash table.
+ * @param ht Hash table operated upon.
+ * 
+ * This operation is performed by detatching the chains from every bucket, then destroying all entries
+ * at once by releasing the slabs of the entry pool and any owned keys, without walking the entries
+ * themselves. Any ongoing incremental rehash is abandoned since there is nothing left to migrate, and the
+ * timer wheel is discarded along with the timers of the destroyed entries.
+ **/
+static void chained_clear(hash_table_t *ht)
+{
+  memset(ht->buckets, 0, ht->no_buckets * sizeof(entry_t *));
+  free(ht->old_buckets);
+  ht->old_buckets = NULL;
+  ht->no_old_buckets = 0;
+  ht->rehash_index = 0;
+  entry_pool_release(&ht->pool);
+  key_arena_release(&ht->keys);
+  ht->size = 0;
+  ht->cache_bytes = 0;
+  ht->clock_hand = 0;
+  timer_wheel_destroy(ht->wheel);
+  ht->wheel = NULL;
+  if (ht->filter.blocks != NULL)
+  {
+    filter_reset(ht);
+  }
+}
+
+/** 
+ * @brief Clear all entries in a hash table.
+ * @param ht Hash table operated upon.
+ **/
+void hash_table_clear(hash_table_t *ht)
+{
+  change_log_append(ht, HASH_TABLE_CHANGE_CLEAR, (elem_t) { 0 }, (elem_t) { 0 });
+  ht->ops->clear(ht);
+}
+
+/**
+ * @brief Make room for a number of entries, so that inserting up to that many does not resize a hash table.
+ * @param ht Hash table operated upon.
+ * @param no_entries Number of entries the hash table should hold without growing.
+ * @return True if the hash table has room for no_entries entries afterwards, false otherwise.
+ **/
+bool hash_table_reserve(hash_table_t *ht, const size_t no_entries)
+{
+  return ht->ops->reserve(ht, no_entries, false);
+}
+
+/**
+ * @brief Shrink a hash table to the smallest size that holds its entries.
+ * @param ht Hash table operated upon.
+ * @return True if the hash table was shrunk or already had that size, false otherwise.
+ **/
+bool hash_table_shrink_to_fit(hash_table_t *ht)
+{
+  return ht->ops->reserve(ht, hash_table_size(ht), true);
+}
+
+/**
+ * @brief Returns the number of buckets (chained) or slots (open addressing) of a hash table.
+ * @param ht Hash table operated upon.
+ * @return The number of buckets or slots.
+ * 
+ * The field is read atomically, since a concurrent hash table may be resized by other threads.
+ **/
+size_t hash_table_capacity(hash_table_t *ht)
+{
+  if (ht->shards != NULL)
+    return sharded_capacity(ht);
+  return __atomic_load_n(&ht->no_buckets, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Measure the shape of a hash table and collect its counters.
+ * @param ht Hash table operated upon.
+ * @param stats Pointer where the statistics will be stored.
+ * 
+ * The backend measures its chains or probe sequences, and with them the number of buckets or slots, since
+ * a rehash may be ongoing. The counters are read atomically as other threads may be updating them, and
+ * added to those the backend reported for the shards of a sharded hash table.
+ **/
+void hash_table_stats(hash_table_t *ht, hash_table_stats_t *stats)
+{
+  hash_table_stats_t empty = { 0 };
+  *stats = empty;
+  ht->ops->stats(ht, stats);
+  stats->load_factor = (float) stats->size / (float) hash_table_capacity(ht);
+  stats->no_resizes += __atomic_load_n(&ht->no_resizes, __ATOMIC_RELAXED);
+#ifdef HASH_TABLE_STATS
+  stats->has_counters = true;
+#endif
+  stats->no_finds += __atomic_load_n(&ht->counters.no_finds, __ATOMIC_RELAXED);
+  stats->no_probes += __atomic_load_n(&ht->counters.no_probes, __ATOMIC_RELAXED);
+  stats->no_filter_rejections += __atomic_load_n(&ht->counters.no_filter_rejections, __ATOMIC_RELAXED);
+  stats->rehash_seconds += (double) __atomic_load_n(&ht->counters.rehash_nanoseconds, __ATOMIC_RELAXED) / 1e9;
+}
+
+/**
+ * @brief Release the storage of a chained hash table.
+ * @param ht Hash table operated upon.
+ * 
+ * This operation is performed by releasing the slabs of the entry pool, then deallocting memory for the buckets.
+ **/
+static void chained_destroy(hash_table_t *ht)
+{
+  entry_pool_release(&ht->pool);
+  key_arena_release(&ht->keys);
+  timer_wheel_destroy(ht->wheel);
+  filter_release(&ht->filter);
+  filter_release(&ht->old_filter);
+  free(ht->old_buckets);
+  free(ht->buckets);
+}
+
+/**
+ * @brief Delete a hash table and frees its memory.
+ * @param ht Hash table to be deleted.
+ * 
+ * This operation is performed by releasing the storage held by the backend, then deallocting memory for
+ * the hash table itself.
+ **/ 
+void hash_table_destroy(hash_table_t *ht)
+{
+  ht->ops->destroy(ht);
+  change_log_destroy(ht->log);
+  free(ht);
+}
+
+/**
+ * @brief Visit the entries of a range of buckets of a chained hash table.
+ * @param ht Hash table operated upon.
+ * @param begin First bucket position to visit.
+ * @param end Position one past the last bucket to visit.
+ * @param visit Function to pass keys and values to; returning false stops the walk.
+ * @param extra Optional additional data.
+ * 
+ * Positions number the old buckets of an incremental rehash first, followed by the current buckets. Old
+ * buckets that have already been migrated are empty, so walking them visits nothing.
+ **/
+static void chained_for_each_range(hash_table_t *ht, const size_t begin, const size_t end, hash_table_visitor visit, void *extra)
+{
+  for (size_t i = begin; i < end; ++i)
+    {
+      entry_t *cursor = i < ht->no_old_buckets ? ht->old_buckets[i] : ht->buckets[i - ht->no_old_buckets];
+
+      while (cursor != NULL)
+        {
+          if (!visit(cursor->key, &cursor->value, extra))
+            {
+              return;
+            }
+          cursor = cursor->next;
+        }
+    }
+}
+
+/**
+ * @brief Visit the entries of a chained hash table.
+ * @param ht Hash table operated upon.
+ * @param visit Function to pass keys and values to; returning false stops the walk.
+ * @param extra Optional additional data.
+ * 
+ * During an incremental rehash the old buckets that are yet to be migrated are visited first, then the
+ * current buckets. The walk itself never migrates any buckets.
+ **/
+static void chained_for_each(hash_table_t *ht, hash_table_visitor visit, void *extra)
+{
+  chained_for_each_range(ht, ht->rehash_index, ht->no_old_buckets + ht->no_buckets, visit, extra);
+}
+
+/**
+ * @brief Add the chains of a bucket array to the chain length statistics of a hash table.
+ * @param buckets Heads of the chains.
+ * @param no_buckets Number of buckets.
+ * @param stats Statistics to add the chains to, whose maximum chain length and histogram are updated.
+ * @return The number of non-empty chains.
+ **/
+size_t chains_measure(entry_t *const *buckets, const size_t no_buckets, hash_table_stats_t *stats)
+{
+  size_t no_chains = 0;
+  for (size_t i = 0; i < no_buckets; ++i)
+    {
+      size_t length = 0;
+      for (const entry_t *cursor = buckets[i]; cursor != NULL; cursor = cursor->next)
+        {
+          length += 1;
+        }
+
+      no_chains += length > 0;
+      if (length > stats->max_chain_length)
+        {
+          stats->max_chain_length = length;
+        }
+      stats->chain_length_histogram[length < HASH_TABLE_STATS_HISTOGRAM_SIZE ? length : HASH_TABLE_STATS_HISTOGRAM_SIZE - 1] += 1;
+    }
+  return no_chains;
+}
+
+/**
+ * @brief Measure the chains of a chained hash table.
+ * @param ht Hash table operated upon.
+ * @param stats Statistics to store the chain lengths in.
+ * 
+ * During an incremental rehash the old buckets still to be migrated are measured along with the current ones.
+ **/
+static void chained_stats(hash_table_t *ht, hash_table_stats_t *stats)
+{
+  stats->size = ht->size;
+  stats->no_buckets = ht->no_buckets;
+  size_t no_chains = chains_measure(ht->buckets, ht->no_buckets, stats);
+  if (ht->old_buckets != NULL)
+    {
+      stats->no_buckets += ht->no_old_buckets - ht->rehash_index;
+      no_chains += chains_measure(&ht->old_buckets[ht->rehash_index], ht->no_old_buckets - ht->rehash_index, stats);
+    }
+  stats->mean_chain_length = no_chains == 0 ? 0 : (float) ht->size / (float) no_chains;
+  filter_stats(ht, stats);
+}
+
+/**
+ * @brief Advance a walk over a chained hash table to the next entry.
+ * @param iter Iterator operated upon.
+ * @param key Pointer where the key of the entry will be stored.
+ * @param value Pointer where a pointer to the value of the entry will be stored.
+ * @return True if there was a next entry, false if the walk is over.
+ * 
+ * During an incremental rehash the old buckets are walked before the current ones, just like for_each does.
+ * The walk keeps the link to the current entry, so that the current entry can be unlinked without walking
+ * the chain again; after a removal that same link leads to the next one.
+ **/
+static bool chained_iter_next(hash_table_iter_t *iter, elem_t *key, elem_t **value)
+{
+  hash_table_t *ht = iter->ht;
+  if (iter->has_current)
+    {
+      iter->link = &(*iter->link)->next;
+      iter->has_current = false;
+    }
+
+  for (; iter->array < 2; iter->array++, iter->bucket = 0)
+    {
+      entry_t **buckets = iter->array == 0 ? ht->old_buckets : ht->buckets;
+      const size_t no_buckets = iter->array == 0 ? (buckets == NULL ? 0 : ht->no_old_buckets) : ht->no_buckets;
+      for (; iter->bucket < no_buckets; iter->bucket++, iter->link = NULL)
+        {
+          if (iter->link == NULL)
+            {
+              iter->link = &buckets[iter->bucket];
+            }
+          entry_t *entry = *iter->link;
+          if (entry != NULL)
+            {
+              iter->has_current = true;
+              *key = entry->key;
+              *value = &entry->value;
+              return true;
+            }
+        }
+    }
+
+  return false;
+}
+
+/**
+ * @brief Remove the current entry of a walk over a chained hash table.
+ * @param iter Iterator operated upon, which has a current entry.
+ * @return True, as the entry is always removed.
+ **/
+static bool chained_iter_remove(hash_table_iter_t *iter)
+{
+  chained_unlink(iter->ht, iter->link);
+  iter->has_current = false;
+  return true;
+}
+
+/// @brief Operations of the chained backend.
+static const hash_table_ops_t chained_ops = {
+  .insert = chained_insert_hashed,
+  .lookup = chained_lookup_hashed,
+  .insert_batch = chained_insert_batch,
+  .lookup_batch = chained_lookup_batch,
+  .remove = chained_remove,
+  .upsert = chained_upsert_hashed,
+  .update = chained_update,
+  .reserve = chained_reserve,
+  .clear = chained_clear,
+  .destroy = chained_destroy,
+  .for_each = chained_for_each,
+  .for_each_range = chained_for_each_range,
+  .stored_hash = entry_stored_hash,
+  .stats = chained_stats,
+  .iter_next = chained_iter_next,
+  .iter_remove = chained_iter_remove,
+};
+
+/**
+ * @brief Start a walk over the entries of a hash table.
+ * @param ht Hash table to walk.
+ * @param iter Iterator to initialize.
+ **/
+void hash_table_iter_begin(hash_table_t *ht, hash_table_iter_t *iter)
+{
+  hash_table_iter_t start = { .ht = ht, .array = 0, .bucket = 0, .link = NULL, .has_current = false, .shard = 0 };
+  *iter = start;
+}
+
+/**
+ * @brief Advance a walk to the next entry.
+ * @param iter Iterator operated upon.
+ * @param key Pointer where the key of the entry will be stored.
+ * @param value Pointer where a pointer to the value of the entry will be stored.
+ * @return True if there was a next entry, false if the walk is over.
  **/
-void hash_table_insert(hash_table_t *ht, const elem_t key, const elem_t value)
+bool hash_table_iter_next(hash_table_iter_t *iter, elem_t *key, elem_t **value)
 {
-  ht = hash_table_resize(ht);
-  const unsigned long hash_key = ht->hash_function(key);
-  const int bucket = hash_key % ht->no_buckets;
-  
-  entry_t *entry = find_previous_entry_for_key(ht->hash_function, &ht->buckets[bucket], hash_key);
-  entry_t *next = entry->next;
-
-  if (next != NULL && ht->hash_function(next->key) == hash_key)
-    {
-      next->value = value;
-    }
-  else
+  if (!iter->ht->ops->iter_next(iter, key, value))
     {
-      entry_t *new_entry = entry_create(key, value, next);
-      if (new_entry == NULL)
-      {
-        puts("Insertion failed due to memory corruption!");
-        return;
-      }
-      entry->next = new_entry;
-      ht->size += 1;
+      return false;
     }
+  iter->key = *key;
+  iter->value = *value;
+  return true;
 }
 
 /**
- * @brief Destroy an entry by freeing its allocated memory.
- * @param entry Entry to destroy.
- **/
-static void entry_destroy(entry_t *entry)
-{
-  free(entry);
-}
-
-/** 
- * @brief Remove any mapping from key to a value.
- * @param ht Hash table to remove entry from.
- * @param key Key to remove.
- * @param result Pointer where a removed element will be stored.
- * @return True if a key was removed, false otherwise.
- * 
- * If an entry for the given key exists, the entry gets detatched from the linked structure then destroyed.
+ * @brief Remove the entry a walk is currently at.
+ * @param iter Iterator operated upon.
+ * @return True if the entry was removed, false if there was no current entry.
  **/
-bool hash_table_remove(hash_table_t *ht, const elem_t key, elem_t *result)
+bool hash_table_iter_remove_current(hash_table_iter_t *iter)
 {
-  const unsigned long hash_key = ht->hash_function(key); 
-  const int bucket = hash_key % ht->no_buckets;
-  bool entry_found = hash_table_lookup(ht, key, result);
-  
-  if (!entry_found)
+  if (!iter->has_current)
     {
       return false;
     }
-  else
+  const elem_t key = iter->key;
+  const elem_t value = *iter->value;
+  if (!iter->ht->ops->iter_remove(iter))
     {
-      entry_t *entry = find_previous_entry_for_key(ht->hash_function, &ht->buckets[bucket], hash_key);
-      entry_t *entry_to_remove = entry->next;
-      entry_t *next = entry_to_remove->next;
-      entry->next = next;
-      entry_destroy(entry_to_remove);
-      ht->size -= 1;
-      return true;
+      return false;
     }
+  change_log_append(iter->ht, HASH_TABLE_CHANGE_REMOVE, key, value);
+  return true;
 }
 
-/** 
- * @brief Clear all entries in a hash table.
- * @param ht Hash table operated upon.
- * 
- * This operation is performed by detatching entries from the linked structure and destroying them.
+/**
+ * @brief Dummy function pointer to be used with linked lists.
+ * @param a First element.
+ * @param b Second element.
+ * @return True
  **/
-void hash_table_clear(hash_table_t *ht)
+static bool dummy_func_ptr(const elem_t a, const elem_t b)
 {
-  for (int i = 0; i < ht->no_buckets; ++i)
-    {
-      entry_t *first_entry = &ht->buckets[i];
-      entry_t *cursor = first_entry->next;
-
-      while (cursor != NULL)
-        {
-          entry_t *entry_to_remove = cursor;
-          cursor = cursor->next;
-          first_entry->next = cursor;
-          entry_destroy(entry_to_remove);
-          ht->size -= 1;
-        }
-    }
+  return true;
 }
 
 /** 
- * @brief Delete a hash table and frees its memory.
- * @param ht Hash table to be deleted.
- * 
- * This operation is performed by clearing all entries, then deallocting memory for the entries
- * and hash table itself.
- **/ 
-void hash_table_destroy(hash_table_t *ht)
+ * @brief Append the key of a visited entry to a linked list.
+ * @param key Key of the visited entry.
+ * @param value_ignored Value of the visited entry (ignored).
+ * @param list Linked list to append to.
+ * @return True
+ **/
+static bool append_key(const elem_t key, elem_t *value_ignored, void *list)
 {
-  hash_table_clear(ht);
-  free(ht->buckets);
-  free(ht);
+  linked_list_append(list, key);
+  return true;
 }
 
 /**
- * @brief Dummy function pointer to be used with linked lists.
- * @param a First element.
- * @param b Second element.
+ * @brief Append the value of a visited entry to a linked list.
+ * @param key_ignored Key of the visited entry (ignored).
+ * @param value Value of the visited entry.
+ * @param list Linked list to append to.
  * @return True
  **/
-static bool dummy_func_ptr(const elem_t a, const elem_t b)
+static bool append_value(const elem_t key_ignored, elem_t *value, void *list)
 {
+  linked_list_append(list, *value);
   return true;
 }
 
-/** 
+/**
  * @brief Return the keys for all entries in a hash table (in no particular order, but same as hash_table_values).
  * @param ht Hash table operated upon.
  * @return A linked list of keys for hash table ht.
@@ -570,18 +2094,7 @@ static bool dummy_func_ptr(const elem_t a, const elem_t b)
 list_t *hash_table_keys(hash_table_t *ht)
 {
   list_t *keys = linked_list_create(dummy_func_ptr);
-  
-  for (int i = 0; i < ht->no_buckets; ++i)
-    {
-      entry_t *first_entry = &ht->buckets[i];
-      entry_t *cursor = first_entry->next;
-      
-      while (cursor != NULL)
-        {
-          linked_list_append(keys, cursor->key);
-          cursor = cursor->next;
-        }
-    }
+  ht->ops->for_each(ht, append_key, keys);
 
   return keys;
 }
@@ -594,18 +2107,7 @@ list_t *hash_table_keys(hash_table_t *ht)
 list_t *hash_table_values(hash_table_t *ht)
 {
   list_t *values = linked_list_create(dummy_func_ptr);
-  
-  for (int i = 0; i < ht->no_buckets; ++i)
-    {
-      entry_t *first_entry = &ht->buckets[i];
-      entry_t *cursor = first_entry->next;
-      
-      while (cursor != NULL)
-        {
-          linked_list_append(values, cursor->value);
-          cursor = cursor->next;
-        }
-    }
+  ht->ops->for_each(ht, append_value, values);
  
   return values;
 }
@@ -615,12 +2117,14 @@ list_t *hash_table_values(hash_table_t *ht)
  * @param ht Hash table operated upon.
  * @param key The key sought.
  * 
- * This operation is performed by examining whether any entry in the hash table satisfy the provided
- * key equivalence function.
+ * This operation is performed by probing the bucket of the key through the backend, exactly like
+ * hash_table_lookup, so it costs the same and allocates nothing. Entries are matched the same way
+ * lookups match them.
  **/
 bool hash_table_has_key(hash_table_t *ht, const elem_t key)
 {
-  return hash_table_any(ht, ht->key_equiv, &key);
+  elem_t value_ignored;
+  return ht->ops->lookup(ht, key, ht->hash_function(key), &value_ignored);
 }
 
 /**
@@ -636,27 +2140,56 @@ bool hash_table_has_value(hash_table_t *ht, const elem_t value)
   return hash_table_any(ht, ht->value_equiv, &value);
 }
 
+/// @brief Predicate applied during a walk by hash_table_all and hash_table_any, along with the outcome so far.
+struct predicate_walk
+{
+  predicate_ht P;  // Function to pass keys and values to.
+  const void *x;   // Optional additional data.
+  bool result;     // Outcome of the walk so far.
+};
+
+/**
+ * @brief Check that a visited entry satisfies the predicate of a walk, stopping at the first that does not.
+ * @param key Key of the visited entry.
+ * @param value Value of the visited entry.
+ * @param walk Predicate walk to update.
+ * @return True if the walk should continue, false otherwise.
+ **/
+static bool visit_all(const elem_t key, elem_t *value, void *walk)
+{
+  struct predicate_walk *w = walk;
+  w->result = w->P(key, *value, w->x);
+  return w->result;
+}
+
+/**
+ * @brief Check whether a visited entry satisfies the predicate of a walk, stopping at the first that does.
+ * @param key Key of the visited entry.
+ * @param value Value of the visited entry.
+ * @param walk Predicate walk to update.
+ * @return True if the walk should continue, false otherwise.
+ **/
+static bool visit_any(const elem_t key, elem_t *value, void *walk)
+{
+  struct predicate_walk *w = walk;
+  w->result = w->P(key, *value, w->x);
+  return !w->result;
+}
+
 /**
  * @brief Check if all keys in a hash table satisfy some property.
  * @param ht Hash table operated upon.
  * @param P Function to pass keys and values to.
  * @param x Optional additional data.
+ * 
+ * This operation is performed in a single walk over the entries in place, without any allocation, which
+ * stops at the first entry that does not satisfy the property.
  **/
 bool hash_table_all(hash_table_t *ht, predicate_ht P, const void *x)
 {
-  const size_t size = hash_table_size(ht);
-  list_t *keys = hash_table_keys(ht);
-  list_t *values = hash_table_values(ht);
-  bool result = true;
-  for (size_t i = 0; i < size && result; ++i)
-    {
-      result = result && P(linked_list_get(keys, i), linked_list_get(values, i), x);
-    }
-
-  linked_list_destroy(keys);
-  linked_list_destroy(values);
-  
-  return result;
+  struct predicate_walk walk = { .P = P, .x = x, .result = true };
+  ht->ops->for_each(ht, visit_all, &walk);
+  return walk.result;
 }
 
 /** 
@@ -664,72 +2197,443 @@ bool hash_table_all(hash_table_t *ht, predicate_ht P, const void *x)
  * @param ht Hash table operated upon.
  * @param P Function to pass keys and values to.
  * @param x Optional additional data.
+ * 
+ * This operation is performed in a single walk over the entries in place, without any allocation, which
+ * stops at the first entry that satisfies the property.
  **/
 bool hash_table_any(hash_table_t *ht, predicate_ht P, const void *x)
 {
-  const size_t size = hash_table_size(ht);
-  list_t *keys = hash_table_keys(ht);
-  list_t *values = hash_table_values(ht);
-  bool result = false;
-  for (size_t i = 0; i < size && !result; ++i)
-    {
-      result = !result && P(linked_list_get(keys, i), linked_list_get(values, i), x);
-    }
-  linked_list_destroy(keys);
-  linked_list_destroy(values);
+  struct predicate_walk walk = { .P = P, .x = x, .result = false };
+  ht->ops->for_each(ht, visit_any, &walk);
+  return walk.result;
+}
+
+/// @brief Function applied during a walk by hash_table_apply_to_all.
+struct apply_walk
+{
+  apply_function_ht f;  // Function to pass keys and values to.
+  const void *x;        // Optional additional data.
+};
 
-  return result;
+/**
+ * @brief Apply the function of a walk to a visited entry.
+ * @param key Key of the visited entry.
+ * @param value Value of the visited entry, which may be updated in place.
+ * @param walk Apply walk to use.
+ * @return True
+ **/
+static bool visit_apply(const elem_t key, elem_t *value, void *walk)
+{
+  struct apply_walk *w = walk;
+  w->f(key, value, w->x);
+  return true;
 }
 
 /** 
  * @brief Apply some property to all entries in a hash table.
  * @param ht Hash table operated on.
- * @param P Function to pass keys and values to.
+ * @param f Function to pass keys and values to.
  * @param x Optional additional data.
  * 
- * NOTE: This implementation does not utilize hash_table_values as the instructions are a bit unclear.
+ * This operation is performed in a single walk over the entries in place, without any allocation, passing
+ * each value by pointer so that it may be updated.
  **/
 void hash_table_apply_to_all(hash_table_t *ht, apply_function_ht f, const void *x)
 {
-  const size_t size = hash_table_size(ht);
-  list_t *keys = hash_table_keys(ht);
-  elem_t **values = hash_table_values_arr(ht);
+  struct apply_walk walk = { .f = f, .x = x };
+  ht->ops->for_each(ht, visit_apply, &walk);
+}
+
+/**
+ * @brief Link an entry into a chained hash table, replacing the entry of an equal key.
+ * @param ht Hash table operated upon.
+ * @param entry Entry allocated from the pool of the hash table, not linked into any chain.
+ * @param hash Hash of its key under the hash function of the hash table.
+ * 
+ * The hash table grows as for an insertion. Any entry of an equal key is destroyed rather than updated, so
+ * the adopted entry keeps its expiry time and any timer scheduled for it. In cache mode its cost is
+ * computed anew, since it may come from a hash table with a different cost function.
+ **/
+static void chained_adopt(hash_table_t *ht, entry_t *entry, const unsigned long hash)
+{
+  ht = hash_table_resize(ht);
+  entry_t **link = find_link_in_table(ht, entry->key, hash);
+  if (*link != NULL && (*link)->hash == hash)
+  {
+    chained_unlink(ht, link);
+  }
+  entry->hash = hash;
+  entry->next = *link;
+  *link = entry;
+  ht->size += 1;
+  if (ht->filter.blocks != NULL)
+  {
+    filter_add(&ht->filter, hash);
+  }
+  if (ht->cache)
+  {
+    entry_meta(entry)->cost = entry_cost(ht, entry->key, entry->value);
+    ht->cache_bytes += entry_meta(entry)->cost;
+  }
+}
+
+/**
+ * @brief Copy an entry of one chained hash table into another one.
+ * @param dst Hash table to copy the entry into.
+ * @param entry Entry to copy, which is left in place.
+ * @param hash Hash of its key under the hash function of dst.
+ * @return True if the entry was copied, false if memory allocation failed.
+ * 
+ * The copy is allocated from the pool of dst and keeps the expiry time of the entry, for which a timer is
+ * scheduled in dst, and whether it was used since the last eviction sweep if both hash tables are caches.
+ **/
+static bool chained_copy_entry(hash_table_t *dst, const hash_table_t *src, const entry_t *entry, const unsigned long hash)
+{
+  elem_t key = entry->key;
+  if (dst->owned_keys && !key_arena_copy(&dst->keys, &key))
+  {
+    hash_table_log(dst, HASH_TABLE_EVENT_NO_MEMORY, "Failed to allocate memory for key!");
+    return false;
+  }
+  entry_t *copy = entry_create(&dst->pool, key, entry->value, hash, NULL);
+  if (copy == NULL)
+  {
+    hash_table_log(dst, HASH_TABLE_EVENT_NO_MEMORY, "Failed to allocate memory for entry!");
+    if (dst->owned_keys)
+      key_arena_free(&dst->keys, key);
+    return false;
+  }
+  const bool expires = entry_pool_has_meta(&src->pool) && entry_pool_has_meta(&dst->pool) && entry_meta(entry)->expires != 0;
+  if (expires)
+  {
+    entry_meta(copy)->expires = entry_meta(entry)->expires;
+  }
+  if (dst->cache && src->cache)
+  {
+    entry_meta(copy)->referenced = entry_meta(entry)->referenced;
+  }
+  chained_adopt(dst, copy, hash);
+  if (expires)
+  {
+    expiry_schedule(dst, copy);
+  }
+  return true;
+}
+
+/**
+ * @brief Check whether entries may be moved from one hash table to another.
+ * @param dst Hash table to move entries into.
+ * @param src Hash table to move entries out of.
+ * @return True if the hash tables are distinct, neither is concurrent nor mapped, and dst owns its keys if
+ * src does, since keys owned by src are freed along with its entries.
+ **/
+static bool move_allowed(const hash_table_t *dst, const hash_table_t *src)
+{
+  if (dst == src || is_concurrent(dst) || is_concurrent(src) || dst->backend == HASH_TABLE_MAPPED || src->backend == HASH_TABLE_MAPPED)
+  {
+    hash_table_log(src, HASH_TABLE_EVENT_INVALID_ARGUMENT, "Entries can only be moved between distinct hash tables that are neither concurrent nor mapped!");
+    return false;
+  }
+  if (src->owned_keys && !dst->owned_keys)
+  {
+    hash_table_log(src, HASH_TABLE_EVENT_INVALID_ARGUMENT, "Owned keys can only be moved into a hash table that owns its keys!");
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Check whether two hash tables are sharded alike, so that every key belongs to shards of equal index.
+ * @param dst Hash table to move entries into.
+ * @param src Hash table to move entries out of.
+ * @return True if both hash tables are sharded with the same number of shards and hash function.
+ **/
+static bool sharded_alike(const hash_table_t *dst, const hash_table_t *src)
+{
+  return dst->shards != NULL && src->shards != NULL && dst->no_shards == src->no_shards
+    && dst->hash_function == src->hash_function;
+}
 
-  for (size_t i = 0; i < size; ++i)
+/**
+ * @brief Move entries from one hash table to another by inserting and removing them one at a time.
+ * @param dst Hash table to move entries into.
+ * @param src Hash table to move entries out of.
+ * @param P Function selecting the entries to move, NULL to move all of them.
+ * @param x Optional additional data passed to P.
+ * @param failed Pointer where whether an insertion failed, which stops the move, will be stored.
+ * @return The number of entries moved.
+ * 
+ * This works for any pair of backends, at the price of an insertion and a removal per entry. A sharded src is
+ * walked one shard at a time, so that the expiry times of the entries of chained shards can be read. Selected
+ * entries that have already expired are removed from src without being moved, and those that expire later
+ * are inserted into dst with their remaining time to live, unless dst does not support expiry.
+ **/
+static size_t move_by_insertion(hash_table_t *dst, hash_table_t *src, predicate_ht P, const void *x, bool *failed)
+{
+  size_t no_moved = 0;
+  *failed = false;
+  if (src->shards != NULL)
+  {
+    for (size_t s = 0; s < src->no_shards && !*failed; s++)
     {
-      elem_t key = linked_list_get(keys, i);
-      elem_t *value = values[i];
-      f(key, value, x);
+      no_moved += move_by_insertion(dst, src->shards[s], P, x, failed);
     }
+    return no_moved;
+  }
 
-  linked_list_destroy(keys);
-  free(values);
+  const hash_table_t *dst_kind = dst->shards != NULL ? dst->shards[0] : dst;
+  const bool expires = src->backend == HASH_TABLE_CHAINED && entry_pool_has_meta(&src->pool);
+  const bool keeps_expiry = dst_kind->backend == HASH_TABLE_CHAINED;
+  const uint64_t now = expires ? expiry_now(src) : 0;
+  hash_table_iter_t iter;
+  elem_t key;
+  elem_t *value;
+  hash_table_iter_begin(src, &iter);
+  while (hash_table_iter_next(&iter, &key, &value))
+  {
+    if (P != NULL && !P(key, *value, x))
+      continue;
+    const uint64_t expiry = expires ? entry_meta(entry_of_value(value))->expires : 0;
+    if (expiry != 0 && expiry <= now)
+    {
+      hash_table_iter_remove_current(&iter);
+      continue;
+    }
+    const hash_table_status_t status = expiry != 0 && keeps_expiry ? hash_table_insert_ttl(dst, key, *value, expiry - now) : hash_table_insert(dst, key, *value);
+    if (status != HASH_TABLE_INSERTED && status != HASH_TABLE_UPDATED)
+    {
+      *failed = true;
+      break;
+    }
+    hash_table_iter_remove_current(&iter);
+    no_moved += 1;
+  }
+  return no_moved;
 }
 
-/** 
- * @brief Return the values for all entries in a hash table (in no particular order, but same as hash_table_keys).
- * @param ht Hash table operated upon.
- * @return An array of values for hash table ht.
+/**
+ * @brief Move entries from one chained hash table to another by copying them.
+ * @param dst Hash table to move entries into.
+ * @param src Hash table to move entries out of.
+ * @param P Function selecting the entries to move, NULL to move all of them.
+ * @param x Optional additional data passed to P.
+ * @param failed Pointer where whether memory ran out, which stops the move, will be stored.
+ * @return The number of entries moved.
  * 
- * NOTE: This internal function exists because the instructions are a bit unclear for how things are supposed 
- * to work with hash_table_apply_to_all.
+ * The chains of src are walked in place and every selected entry is unlinked from them without looking it
+ * up. Since slabs are only ever released as a whole, the entry itself can not change hands; a copy is taken
+ * from the pool of dst instead, and linked into dst under its stored hash unless the hash functions differ.
+ * If src has entries that expire, the entries of dst are first given room for expiry times. Every entry moved
+ * is recorded as an insertion into dst and a removal from src, as by move_by_insertion. Should the load of
+ * src drop below its minimum load factor, it shrinks once at the end.
  **/
-static elem_t **hash_table_values_arr(hash_table_t *ht)
+static size_t move_by_copying(hash_table_t *dst, hash_table_t *src, predicate_ht P, const void *x, bool *failed)
 {
-  const size_t size = hash_table_size(ht);
-  elem_t **values = calloc(1, size * sizeof(elem_t));
-  for (int i = 0; i < ht->no_buckets; ++i)
+  const bool same_hash = dst->hash_function == src->hash_function;
+  entry_t **arrays[] = { src->old_buckets, src->buckets };
+  const size_t no_buckets[] = { src->no_old_buckets, src->no_buckets };
+  size_t no_moved = 0;
+  *failed = src->wheel != NULL && !chained_widen_entries(dst);
+  for (size_t a = 0; a < sizeof(arrays) / sizeof(arrays[0]) && !*failed; a++)
+  {
+    for (size_t bucket = 0; bucket < no_buckets[a] && !*failed; bucket++)
     {
-      entry_t *first_entry = &ht->buckets[i];
-      entry_t *cursor = first_entry->next;
-      size_t j = 0;
-      while (cursor != NULL)
+      entry_t **link = &arrays[a][bucket];
+      while (*link != NULL)
+      {
+        entry_t *entry = *link;
+        if (P != NULL && !P(entry->key, entry->value, x))
         {
-          values[i + j] = &cursor->value;
-          cursor = cursor->next;
-          j += 1;
+          link = &entry->next;
+          continue;
+        }
+        if (!chained_copy_entry(dst, src, entry, same_hash ? entry->hash : dst->hash_function(entry->key)))
+        {
+          *failed = true;
+          break;
         }
+        change_log_append(dst, HASH_TABLE_CHANGE_INSERT, entry->key, entry->value);
+        change_log_append(src, HASH_TABLE_CHANGE_REMOVE, entry->key, entry->value);
+        chained_unlink(src, link);
+        no_moved += 1;
+      }
     }
- 
-  return values;
+  }
+
+  if (dst->cache)
+  {
+    chained_evict(dst, NULL);
+  }
+  if (below_min_load(src, src->size, src->no_buckets))
+  {
+    chained_reserve(src, 2 * src->size, true);
+  }
+  return no_moved;
+}
+
+/**
+ * @brief Move every entry of a hash table into another one.
+ * @param dst Hash table to move entries into.
+ * @param src Hash table to move entries out of, which is left empty.
+ * @return True if every entry was moved, false if the hash tables can not exchange entries or memory ran out.
+ * 
+ * Between chained hash tables with the same allocator, entry size and setting of owned_keys, no entry is
+ * copied: the slabs, owned keys and timers of src are handed over to dst as a whole, after which every
+ * entry is relinked into the chains of dst. Stored hashes are reused unless the hash functions differ, and
+ * dst is grown at most once, up front. Other chained hash tables have their entries copied as by
+ * hash_table_split. Hash tables sharded alike are merged shard by shard, each pair of shards in one of these
+ * ways, and all other pairs of backends fall back to move_by_insertion. Whichever way entries are moved, the
+ * change logs record the same insertions and removals.
+ **/
+bool hash_table_merge(hash_table_t *dst, hash_table_t *src)
+{
+  if (!move_allowed(dst, src))
+  {
+    return false;
+  }
+  if (sharded_alike(dst, src))
+  {
+    bool merged = true;
+    for (size_t s = 0; s < src->no_shards && merged; s++)
+    {
+      merged = hash_table_merge(dst->shards[s], src->shards[s]);
+    }
+    return merged;
+  }
+  bool failed;
+  if (dst->backend != HASH_TABLE_CHAINED || src->backend != HASH_TABLE_CHAINED)
+  {
+    move_by_insertion(dst, src, NULL, NULL, &failed);
+    return !failed;
+  }
+  const hash_table_allocator_t *dst_allocator = &dst->pool.allocator;
+  const hash_table_allocator_t *src_allocator = &src->pool.allocator;
+  if (dst->owned_keys != src->owned_keys || dst->pool.entry_size != src->pool.entry_size
+      || dst_allocator->alloc != src_allocator->alloc || dst_allocator->free != src_allocator->free
+      || dst_allocator->arena != src_allocator->arena)
+  {
+    move_by_copying(dst, src, NULL, NULL, &failed);
+    return !failed;
+  }
+  if (!chained_reserve(dst, dst->size + src->size, false))
+  {
+    return false;
+  }
+
+  entry_pool_merge(&dst->pool, &src->pool);
+  key_arena_merge(&dst->keys, &src->keys);
+  expiry_merge(dst, src);
+  const bool same_hash = dst->hash_function == src->hash_function;
+  entry_t **arrays[] = { src->old_buckets, src->buckets };
+  const size_t no_buckets[] = { src->no_old_buckets, src->no_buckets };
+  for (size_t a = 0; a < sizeof(arrays) / sizeof(arrays[0]); a++)
+  {
+    for (size_t bucket = 0; bucket < no_buckets[a]; bucket++)
+    {
+      entry_t *entry = arrays[a][bucket];
+      arrays[a][bucket] = NULL;
+      while (entry != NULL)
+      {
+        entry_t *next = entry->next;
+        change_log_append(src, HASH_TABLE_CHANGE_REMOVE, entry->key, entry->value);
+        chained_adopt(dst, entry, same_hash ? entry->hash : dst->hash_function(entry->key));
+        change_log_append(dst, HASH_TABLE_CHANGE_INSERT, entry->key, entry->value);
+        entry = next;
+      }
+    }
+  }
+
+  free(src->old_buckets);
+  src->old_buckets = NULL;
+  src->no_old_buckets = 0;
+  src->rehash_index = 0;
+  src->size = 0;
+  src->cache_bytes = 0;
+  src->clock_hand = 0;
+  if (src->filter.blocks != NULL)
+  {
+    filter_reset(src);
+  }
+  if (dst->cache)
+  {
+    chained_evict(dst, NULL);
+  }
+  return true;
+}
+
+/**
+ * @brief Move the selected entries of one hash table into another in the cheapest way the pair allows.
+ * @param dst Hash table to move entries into.
+ * @param src Hash table to move entries out of.
+ * @param P Function selecting the entries to move.
+ * @param x Optional additional data passed to P.
+ * @param failed Pointer where whether memory ran out or an insertion failed, which stops the move, will be
+ * stored.
+ * @return The number of entries moved.
+ * 
+ * Hash tables sharded alike are split shard by shard, so that every pair of chained shards moves its entries
+ * by move_by_copying.
+ **/
+static size_t move_entries(hash_table_t *dst, hash_table_t *src, predicate_ht P, const void *x, bool *failed)
+{
+  if (sharded_alike(dst, src))
+  {
+    size_t no_moved = 0;
+    *failed = false;
+    for (size_t s = 0; s < src->no_shards && !*failed; s++)
+    {
+      no_moved += move_entries(dst->shards[s], src->shards[s], P, x, failed);
+    }
+    return no_moved;
+  }
+  if (dst->backend != HASH_TABLE_CHAINED || src->backend != HASH_TABLE_CHAINED)
+  {
+    return move_by_insertion(dst, src, P, x, failed);
+  }
+  return move_by_copying(dst, src, P, x, failed);
+}
+
+/**
+ * @brief Move the entries of a hash table that satisfy some property into another one.
+ * @param src Hash table to move entries out of.
+ * @param P Function to pass keys and values to, selecting the entries to move.
+ * @param x Optional additional data.
+ * @param dst Hash table to move entries into.
+ * @return The number of entries moved, which stops short if the hash tables can not exchange entries or
+ * memory ran out.
+ * 
+ * Entries are moved between chained hash tables by move_by_copying, and between hash tables sharded alike
+ * shard by shard. Other backends fall back to move_by_insertion.
+ **/
+size_t hash_table_split(hash_table_t *src, predicate_ht P, const void *x, hash_table_t *dst)
+{
+  if (!move_allowed(dst, src))
+  {
+    return 0;
+  }
+  bool failed;
+  return move_entries(dst, src, P, x, &failed);
+}
+
+/**
+ * @brief Exchange the contents of two hash tables.
+ * @param a First hash table.
+ * @param b Second hash table.
+ * @return True if the contents were exchanged, false if either hash table is concurrent.
+ * 
+ * Everything a hash table consists of, from its backend and functions to its entries and counters, is
+ * exchanged by swapping the two structures, which takes constant time whatever their sizes. Iterators of
+ * either hash table are invalidated.
+ **/
+bool hash_table_swap(hash_table_t *a, hash_table_t *b)
+{
+  if (is_concurrent(a) || is_concurrent(b))
+  {
+    hash_table_log(a, HASH_TABLE_EVENT_INVALID_ARGUMENT, "Concurrent hash tables can not be swapped!");
+    return false;
+  }
+  hash_table_t swapped = *a;
+  *a = *b;
+  *b = swapped;
+  return true;
 }
@@ -0,0 +1,137 @@
+#include <stdlib.h>
+#include <string.h>
+#include "hash_table_internal.h"
+
+/// Most changes a change log keeps, so that the records of a ring always fit in a size_t.
+#define MAX_CHANGE_LOG_SIZE ((size_t) 1 << 40)
+
+/**
+ * @file hash_table_change_log.c
+ * @author Marcus Enderskog
+ * @date 2021-04-15
+ * @brief Change capture of hash tables, for replicating them incrementally.
+ *
+ * A change log is a ring of records, one per insertion, removal or clearing, numbered by sequence numbers
+ * that increase by one with every change. The record of a change goes into the slot given by its sequence
+ * number modulo the capacity, so appending is a single store of a record and never allocates, and the ring
+ * always holds the most recent changes. Readers ask for the changes from a sequence number on, which are
+ * contiguous in the ring up to a single wrap around its end.
+ **/
+
+
+/**
+ * @brief Allocate the change log of a newly created hash table.
+ * @param ht Hash table operated upon, which must not have a change log yet.
+ * @param no_records Number of changes to keep, rounded up to a power of two.
+ * @return True if the change log was allocated, false otherwise.
+ **/
+bool change_log_init(hash_table_t *ht, const size_t no_records)
+{
+  if (no_records > MAX_CHANGE_LOG_SIZE)
+  {
+    hash_table_log(NULL, HASH_TABLE_EVENT_INVALID_ARGUMENT, "A change log keeps at most %zu changes! Got %zu", MAX_CHANGE_LOG_SIZE, no_records);
+    return false;
+  }
+  size_t capacity = 1;
+  while (capacity < no_records)
+  {
+    capacity *= 2;
+  }
+  change_log_t *log = malloc(sizeof(change_log_t));
+  hash_table_change_t *records = log == NULL ? NULL : calloc(capacity, sizeof(hash_table_change_t));
+  if (records == NULL)
+  {
+    hash_table_log(NULL, HASH_TABLE_EVENT_NO_MEMORY, "Failed to allocate memory for a change log of %zu changes!", capacity);
+    free(log);
+    return false;
+  }
+  log->records = records;
+  log->mask = capacity - 1;
+  log->next_seq = 0;
+  ht->log = log;
+  return true;
+}
+
+/**
+ * @brief Release a change log along with its records.
+ * @param log Change log to release, or NULL.
+ **/
+void change_log_destroy(change_log_t *log)
+{
+  if (log != NULL)
+  {
+    free(log->records);
+    free(log);
+  }
+}
+
+/**
+ * @brief Get the sequence number the next change to a hash table will be recorded with.
+ * @param ht Hash table operated upon.
+ * @return The sequence number of the next change, or 0 if the hash table has no change log.
+ **/
+uint64_t hash_table_change_seq(hash_table_t *ht)
+{
+  return ht->log == NULL ? 0 : ht->log->next_seq;
+}
+
+/**
+ * @brief Read the changes to a hash table from a sequence number on.
+ * @param ht Hash table operated upon.
+ * @param since Sequence number of the first change to read.
+ * @param changes Array where the changes will be stored, in the order they were made.
+ * @param max_changes Most changes to read.
+ * @return The number of changes read, 0 if there were none since or the hash table has no change log.
+ *
+ * The changes kept are those from the capacity of the ring before the next sequence number on. They are
+ * copied in at most two runs, the second one starting over at the beginning of the ring.
+ **/
+size_t hash_table_changes(hash_table_t *ht, const uint64_t since, hash_table_change_t *changes, const size_t max_changes)
+{
+  const change_log_t *log = ht->log;
+  if (log == NULL || since >= log->next_seq)
+  {
+    return 0;
+  }
+  const uint64_t oldest = log->next_seq > log->mask ? log->next_seq - log->mask - 1 : 0;
+  const uint64_t first = since < oldest ? oldest : since;
+  const size_t no_changes = log->next_seq - first < max_changes ? (size_t) (log->next_seq - first) : max_changes;
+  const size_t start = (size_t) (first & log->mask);
+  const size_t run = no_changes < log->mask + 1 - start ? no_changes : (size_t) (log->mask + 1 - start);
+  memcpy(changes, &log->records[start], run * sizeof(hash_table_change_t));
+  memcpy(changes + run, log->records, (no_changes - run) * sizeof(hash_table_change_t));
+  return no_changes;
+}
+
+/**
+ * @brief Apply changes read from the change log of another hash table.
+ * @param ht Hash table to apply the changes to.
+ * @param changes Changes to apply, in the order they were made.
+ * @param no_changes Number of changes.
+ * @return The number of changes applied, which stops short if an insertion failed.
+ **/
+size_t hash_table_apply_changes(hash_table_t *ht, const hash_table_change_t *changes, const size_t no_changes)
+{
+  for (size_t i = 0; i < no_changes; i++)
+  {
+    const hash_table_change_t *change = &changes[i];
+    if (change->kind == HASH_TABLE_CHANGE_CLEAR)
+    {
+      hash_table_clear(ht);
+    }
+    else if (change->kind == HASH_TABLE_CHANGE_REMOVE)
+    {
+      elem_t removed;
+      hash_table_remove(ht, change->key, &removed);
+    }
+    else
+    {
+      const hash_table_status_t status = hash_table_insert(ht, change->key, change->value);
+      if (status != HASH_TABLE_INSERTED && status != HASH_TABLE_UPDATED)
+      {
+        return i;
+      }
+    }
+  }
+  return no_changes;
+}
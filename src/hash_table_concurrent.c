@@ -0,0 +1,1436 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "hash_table_internal.h"
+
+/// Size of a cache line; locks are padded to it so that no two of them share one.
+#define CACHE_LINE_SIZE 64
+
+/// Number of thread slots; threads beyond this number share slots with others.
+#define NO_THREAD_SLOTS 64
+
+/// Largest number of lock stripes guarding a bucket array, a power of two.
+#define MAX_STRIPES 256
+
+/// Old buckets migrated per operation during a rehash if the hash table was created without a rehash step.
+#define DEFAULT_REHASH_STEP 2
+
+/// Entries of a chain located per walk when migrating a bucket, tail first.
+#define MIGRATE_WINDOW 16
+
+/// Removed entries a thread slot holds on to before waiting for lock-free readers and reclaiming them.
+#define RETIRE_BATCH 32
+
+/**
+ * @file hash_table_concurrent.c
+ * @author Marcus Enderskog
+ * @date 2021-04-15
+ * @brief Chained hash table that may be shared between threads, using lock striping and incremental rehashing.
+ * 
+ * Bucket i of a bucket array is guarded by stripe i % no_stripes of that array, so operations on different
+ * stripes never contend. Every operation is carried out while holding the lock of a thread slot picked per
+ * thread; since these are only ever all taken at once to swap bucket arrays, a thread practically always
+ * finds its slot lock uncontended and in its own cache. Growing the table allocates a new bucket array and
+ * publishes it next to the old one, after which operations migrate old buckets a few at a time, just like
+ * the incremental rehash of the chained backend. Each operation nests at most one stripe of the new array
+ * inside one stripe of the old array, always in that order, which rules out deadlocks.
+ * 
+ * With lock-free reads, lookups take neither slot nor stripe locks. All links, bucket heads and bucket
+ * arrays are therefore published with atomic stores, and a lookup merely announces itself in a read-side
+ * counter of its slot. Memory that a lookup might still be reading is only reused once every lookup that
+ * may have seen it has left (a grace period), found by flipping an epoch and waiting for the counters of the
+ * previous epoch to drain, as in sleepable RCU. Removed entries are retired in batches per slot, and old
+ * bucket arrays are destroyed after a grace period. Buckets are migrated tail first, so that a lookup
+ * walking an old chain never skips entries that are relinked into a new bucket underneath it.
+ **/
+
+
+/// @brief Lock guarding every bucket whose index is congruent to the stripe index modulo the number of stripes.
+typedef struct stripe stripe_t;
+
+/// @brief Buckets along with the stripes of locks guarding them.
+typedef struct bucket_array bucket_array_t;
+
+/// @brief Lock and entry pool of the threads that are assigned to the same slot.
+typedef struct thread_slot thread_slot_t;
+
+/// @brief Lock guarding every bucket whose index is congruent to the stripe index modulo the number of stripes.
+struct stripe
+{
+  _Alignas(CACHE_LINE_SIZE) pthread_mutex_t lock;  // Lock held while walking or modifying a guarded bucket.
+};
+
+/// @brief Buckets along with the stripes of locks guarding them.
+struct bucket_array
+{
+  entry_t **buckets;  // Heads of the chains in which entries are stored, NULL if empty.
+  size_t no_buckets;  // Number of buckets.
+  bucket_reciprocal_t reciprocal; // Reciprocal of no_buckets, see bucket_index.
+  stripe_t *stripes;  // Locks guarding the buckets.
+  size_t no_stripes;  // Number of locks.
+};
+
+/// @brief Lock and entry pool of the threads that are assigned to the same slot.
+struct thread_slot
+{
+  _Alignas(CACHE_LINE_SIZE) pthread_mutex_t lock;  // Held for the duration of every operation of the threads, except lock-free lookups.
+  entry_pool_t pool;                               // Pool entries are allocated from and returned to.
+  entry_t *retired[RETIRE_BATCH];                  // Removed entries that lock-free readers may still be reading.
+  size_t no_retired;                               // Number of retired entries.
+  _Alignas(CACHE_LINE_SIZE) size_t readers[2];     // Lock-free lookups in progress, per parity of the epoch they started in (atomic).
+};
+
+/// @brief Locks and bucket arrays of a hash table shared between threads.
+struct hash_table_sync
+{
+  thread_slot_t slots[NO_THREAD_SLOTS];                // Slots of the threads operating on the hash table.
+  _Alignas(CACHE_LINE_SIZE) bucket_array_t *current;   // Buckets that new entries are inserted into (atomic).
+  bucket_array_t *old;                                 // Buckets still being migrated during a rehash, otherwise NULL (atomic).
+  size_t epoch;                                        // Flipped to start a grace period; its parity selects the read-side counters (atomic).
+  bool lock_free_reads;                                // Whether lookups take no locks.
+  _Alignas(CACHE_LINE_SIZE) size_t rehash_claimed;     // Number of old buckets claimed for migration (atomic).
+  size_t rehash_done;                                  // Number of old buckets migrated (atomic).
+  bool migration_ready;                                // Whether old buckets may be migrated yet (atomic).
+  pthread_mutex_t resize_lock;                         // Held while starting or finishing a rehash.
+  pthread_mutex_t grace_lock;                          // Held while waiting for a grace period.
+};
+
+/// Slot used by the current thread, or SIZE_MAX if it has not been assigned one yet.
+static _Thread_local size_t thread_slot_index = SIZE_MAX;
+
+/// Slot to assign to the next thread that needs one (atomic).
+static size_t next_thread_slot_index = 0;
+
+/// @brief Operations of the concurrent chained backend.
+static const hash_table_ops_t concurrent_ops;
+
+/// @brief Operations of the concurrent chained backend with lock-free lookups.
+static const hash_table_ops_t concurrent_lock_free_ops;
+
+/**
+ * @brief Create a bucket array of empty buckets along with its stripes of locks.
+ * @param no_buckets Number of buckets.
+ * @return A pointer to the bucket array, or NULL if memory allocation failed.
+ **/
+static bucket_array_t *bucket_array_create(const size_t no_buckets);
+
+/**
+ * @brief Destroy a bucket array and its locks, but not the entries in it.
+ * @param array Bucket array to destroy.
+ **/
+static void bucket_array_destroy(bucket_array_t *array);
+
+/**
+ * @brief Lock the stripe guarding a bucket.
+ * @param array Bucket array the bucket belongs to.
+ * @param bucket Index of the bucket.
+ * @return The stripe that was locked.
+ **/
+static stripe_t *stripe_lock(bucket_array_t *array, const size_t bucket);
+
+/**
+ * @brief Get the index of the thread slot of the calling thread.
+ * @return Index of the slot.
+ **/
+static size_t thread_slot_get(void);
+
+/**
+ * @brief Lock the slot of the calling thread, which must be held during any access to the buckets.
+ * @param sync Synchronization state of the hash table.
+ * @return The slot that was locked.
+ **/
+static thread_slot_t *thread_slot_enter(hash_table_sync_t *sync);
+
+/**
+ * @brief Lock every thread slot, waiting for all ongoing operations to finish and blocking new ones.
+ * @param sync Synchronization state of the hash table.
+ **/
+static void thread_slots_lock_all(hash_table_sync_t *sync);
+
+/**
+ * @brief Unlock every thread slot.
+ * @param sync Synchronization state of the hash table.
+ **/
+static void thread_slots_unlock_all(hash_table_sync_t *sync);
+
+/**
+ * @brief Enter a read-side section, during which memory reachable from the buckets is not reclaimed.
+ * @param sync Synchronization state of the hash table.
+ * @return The counter to pass to read_side_leave.
+ **/
+static size_t *read_side_enter(hash_table_sync_t *sync);
+
+/**
+ * @brief Leave a read-side section.
+ * @param readers Counter returned by read_side_enter.
+ **/
+static void read_side_leave(size_t *readers);
+
+/**
+ * @brief Wait for a grace period, after which no read-side section can still see memory unlinked before it.
+ * @param sync Synchronization state of the hash table.
+ **/
+static void wait_for_readers(hash_table_sync_t *sync);
+
+/**
+ * @brief Retire a removed entry, returning it to the pool of a slot once no lock-free reader can see it.
+ * @param sync Synchronization state of the hash table.
+ * @param slot Slot held by the calling thread.
+ * @param entry Entry to retire, already unlinked from its bucket.
+ **/
+static void entry_retire(hash_table_sync_t *sync, thread_slot_t *slot, entry_t *entry);
+
+/**
+ * @brief Move the entries of an old bucket into the current buckets.
+ * @param old Bucket array being migrated from.
+ * @param current Bucket array being migrated to.
+ * @param bucket Index of the old bucket, whose stripe the calling thread holds.
+ **/
+static void migrate_bucket(bucket_array_t *old, bucket_array_t *current, const size_t bucket);
+
+/**
+ * @brief Find the link to a certain key and lock the stripe guarding it.
+ * @param ht Hash table operated upon.
+ * @param key Key to find.
+ * @param hash Hash of the key.
+ * @param stripe Pointer where the locked stripe will be stored.
+ * @return A pointer to the link to the key, in the current buckets if the key is not stored in the old ones.
+ **/
+static entry_t **find_locked_link(hash_table_t *ht, const elem_t key, const unsigned long hash, stripe_t **stripe);
+
+/**
+ * @brief Migrate buckets of an ongoing rehash.
+ * @param ht Hash table operated upon, whose slot the calling thread holds.
+ * @param no_buckets Maximum number of old buckets to migrate.
+ * @return True if this call migrated the last old bucket, false otherwise.
+ **/
+static bool concurrent_migrate(hash_table_t *ht, size_t no_buckets);
+
+/**
+ * @brief Release the old buckets of a hash table once all of them have been migrated.
+ * @param ht Hash table operated upon, whose slot the calling thread must not hold.
+ **/
+static void concurrent_finish_rehash(hash_table_t *ht);
+
+/**
+ * @brief Start a rehash into a larger bucket array if the maximum load has been reached.
+ * @param ht Hash table operated upon, whose slot the calling thread must not hold.
+ **/
+static void concurrent_grow(hash_table_t *ht);
+
+/**
+ * @brief Create a bucket array of empty buckets along with its stripes of locks.
+ * @param no_buckets Number of buckets.
+ * @return A pointer to the bucket array, or NULL if memory allocation failed.
+ * 
+ * The number of stripes is the largest power of two that neither exceeds the number of buckets nor
+ * MAX_STRIPES, so that the stripe of a bucket is found by masking its index.
+ **/
+static bucket_array_t *bucket_array_create(const size_t no_buckets)
+{
+  bucket_array_t *array = calloc(1, sizeof(bucket_array_t));
+  if (array == NULL)
+  {
+    return NULL;
+  }
+
+  array->no_buckets = no_buckets;
+  array->reciprocal = bucket_reciprocal(no_buckets);
+  array->no_stripes = MAX_STRIPES;
+  while (array->no_stripes > no_buckets)
+    {
+      array->no_stripes /= 2;
+    }
+  array->buckets = calloc(no_buckets, sizeof(entry_t *));
+  array->stripes = aligned_alloc(CACHE_LINE_SIZE, array->no_stripes * sizeof(stripe_t));
+  if (array->buckets == NULL || array->stripes == NULL)
+  {
+    free(array->buckets);
+    free(array->stripes);
+    free(array);
+    return NULL;
+  }
+
+  for (size_t i = 0; i < array->no_stripes; ++i)
+    {
+      pthread_mutex_init(&array->stripes[i].lock, NULL);
+    }
+
+  return array;
+}
+
+/**
+ * @brief Destroy a bucket array and its locks, but not the entries in it.
+ * @param array Bucket array to destroy.
+ **/
+static void bucket_array_destroy(bucket_array_t *array)
+{
+  for (size_t i = 0; i < array->no_stripes; ++i)
+    {
+      pthread_mutex_destroy(&array->stripes[i].lock);
+    }
+  free(array->stripes);
+  free(array->buckets);
+  free(array);
+}
+
+/**
+ * @brief Lock the stripe guarding a bucket.
+ * @param array Bucket array the bucket belongs to.
+ * @param bucket Index of the bucket.
+ * @return The stripe that was locked.
+ **/
+static stripe_t *stripe_lock(bucket_array_t *array, const size_t bucket)
+{
+  stripe_t *stripe = &array->stripes[bucket & (array->no_stripes - 1)];
+  pthread_mutex_lock(&stripe->lock);
+  return stripe;
+}
+
+/**
+ * @brief Get the index of the thread slot of the calling thread.
+ * @return Index of the slot.
+ * 
+ * Threads are assigned slots round-robin the first time they operate on any concurrent hash table, and keep
+ * using the same slot index for all of them.
+ **/
+static size_t thread_slot_get(void)
+{
+  if (thread_slot_index == SIZE_MAX)
+    {
+      thread_slot_index = __atomic_fetch_add(&next_thread_slot_index, 1, __ATOMIC_RELAXED) % NO_THREAD_SLOTS;
+    }
+  return thread_slot_index;
+}
+
+/**
+ * @brief Lock the slot of the calling thread, which must be held during any access to the buckets.
+ * @param sync Synchronization state of the hash table.
+ * @return The slot that was locked.
+ **/
+static thread_slot_t *thread_slot_enter(hash_table_sync_t *sync)
+{
+  thread_slot_t *slot = &sync->slots[thread_slot_get()];
+  pthread_mutex_lock(&slot->lock);
+  return slot;
+}
+
+/**
+ * @brief Lock every thread slot, waiting for all ongoing operations to finish and blocking new ones.
+ * @param sync Synchronization state of the hash table.
+ * 
+ * Slots are always locked in the same order, so several threads may attempt this at once.
+ **/
+static void thread_slots_lock_all(hash_table_sync_t *sync)
+{
+  for (size_t i = 0; i < NO_THREAD_SLOTS; ++i)
+    {
+      pthread_mutex_lock(&sync->slots[i].lock);
+    }
+}
+
+/**
+ * @brief Unlock every thread slot.
+ * @param sync Synchronization state of the hash table.
+ **/
+static void thread_slots_unlock_all(hash_table_sync_t *sync)
+{
+  for (size_t i = 0; i < NO_THREAD_SLOTS; ++i)
+    {
+      pthread_mutex_unlock(&sync->slots[i].lock);
+    }
+}
+
+/**
+ * @brief Enter a read-side section, during which memory reachable from the buckets is not reclaimed.
+ * @param sync Synchronization state of the hash table.
+ * @return The counter to pass to read_side_leave.
+ * 
+ * The counter of the slot of the calling thread that matches the parity of the current epoch is incremented.
+ * The full fence orders this announcement before any of the loads made while in the section.
+ **/
+static size_t *read_side_enter(hash_table_sync_t *sync)
+{
+  thread_slot_t *slot = &sync->slots[thread_slot_get()];
+  size_t *readers = &slot->readers[__atomic_load_n(&sync->epoch, __ATOMIC_RELAXED) & 1];
+  __atomic_fetch_add(readers, 1, __ATOMIC_SEQ_CST);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  return readers;
+}
+
+/**
+ * @brief Leave a read-side section.
+ * @param readers Counter returned by read_side_enter.
+ **/
+static void read_side_leave(size_t *readers)
+{
+  __atomic_fetch_sub(readers, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Wait for a grace period, after which no read-side section can still see memory unlinked before it.
+ * @param sync Synchronization state of the hash table.
+ * 
+ * The epoch is flipped and the counters of its previous parity are waited upon to drain, twice. A single
+ * flip is not enough, since a reader may have sampled the parity just before a flip but only incremented
+ * its counter after the counters were found drained; the second flip catches any such reader.
+ **/
+static void wait_for_readers(hash_table_sync_t *sync)
+{
+  pthread_mutex_lock(&sync->grace_lock);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  for (size_t flip = 0; flip < 2; ++flip)
+    {
+      const size_t parity = __atomic_fetch_add(&sync->epoch, 1, __ATOMIC_SEQ_CST) & 1;
+      for (size_t i = 0; i < NO_THREAD_SLOTS; ++i)
+        {
+          while (__atomic_load_n(&sync->slots[i].readers[parity], __ATOMIC_SEQ_CST) != 0)
+            {
+              sched_yield();
+            }
+        }
+    }
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&sync->grace_lock);
+}
+
+/**
+ * @brief Retire a removed entry, returning it to the pool of a slot once no lock-free reader can see it.
+ * @param sync Synchronization state of the hash table.
+ * @param slot Slot held by the calling thread.
+ * @param entry Entry to retire, already unlinked from its bucket.
+ * 
+ * The entry keeps its link to the rest of the chain so that readers currently on it can carry on. Once a
+ * slot has retired RETIRE_BATCH entries, a grace period is waited for and all of them are destroyed.
+ **/
+static void entry_retire(hash_table_sync_t *sync, thread_slot_t *slot, entry_t *entry)
+{
+  slot->retired[slot->no_retired] = entry;
+  slot->no_retired += 1;
+  if (slot->no_retired == RETIRE_BATCH)
+    {
+      wait_for_readers(sync);
+      for (size_t i = 0; i < slot->no_retired; ++i)
+        {
+          entry_destroy(&slot->pool, slot->retired[i]);
+        }
+      slot->no_retired = 0;
+    }
+}
+
+/**
+ * @brief Move the entries of an old bucket into the current buckets.
+ * @param old Bucket array being migrated from.
+ * @param current Bucket array being migrated to.
+ * @param bucket Index of the old bucket, whose stripe the calling thread holds.
+ * 
+ * Entries are moved starting with the last one of the chain: it gets linked into its current bucket before
+ * being unlinked from the old one, so it is always reachable, and a reader positioned on it that continues
+ * into the current chain has already passed every entry left in the old chain. Since a chain can not be
+ * walked backwards, the links to up to MIGRATE_WINDOW entries at its end are located per walk.
+ **/
+static void migrate_bucket(bucket_array_t *old, bucket_array_t *current, const size_t bucket)
+{
+  size_t remaining = 0;
+  for (entry_t *cursor = old->buckets[bucket]; cursor != NULL; cursor = cursor->next)
+    {
+      remaining += 1;
+    }
+
+  while (remaining > 0)
+    {
+      entry_t **window[MIGRATE_WINDOW];
+      const size_t no_entries = remaining < MIGRATE_WINDOW ? remaining : MIGRATE_WINDOW;
+      entry_t **link = &old->buckets[bucket];
+      for (size_t i = no_entries; i < remaining; ++i)
+        {
+          link = &(*link)->next;
+        }
+      for (size_t i = 0; i < no_entries; ++i)
+        {
+          window[i] = link;
+          link = &(*link)->next;
+        }
+
+      for (size_t i = no_entries; i > 0; --i)
+        {
+          entry_t *entry = *window[i - 1];
+          const size_t new_bucket = bucket_index(entry->hash, current->no_buckets, current->reciprocal);
+
+          stripe_t *stripe = stripe_lock(current, new_bucket);
+          entry_t **target = find_link_for_key(&current->buckets[new_bucket], entry->hash);
+          __atomic_store_n(&entry->next, *target, __ATOMIC_RELEASE);
+          __atomic_store_n(target, entry, __ATOMIC_RELEASE);
+          pthread_mutex_unlock(&stripe->lock);
+          __atomic_store_n(window[i - 1], NULL, __ATOMIC_RELEASE);
+        }
+      remaining -= no_entries;
+    }
+}
+
+/**
+ * @brief Find the link to a certain key and lock the stripe guarding it.
+ * @param ht Hash table operated upon.
+ * @param key Key to find.
+ * @param hash Hash of the key.
+ * @param stripe Pointer where the locked stripe will be stored.
+ * @return A pointer to the link to the key, in the current buckets if the key is not stored in the old ones.
+ * 
+ * During a rehash the old bucket of the key is examined first. Entries only ever move from old buckets to
+ * current ones, so if the key is not found there its stripe may be unlocked before locking the current
+ * bucket: the key is either already in the current bucket or not stored at all.
+ **/
+static entry_t **find_locked_link(hash_table_t *ht, const elem_t key, const unsigned long hash, stripe_t **stripe)
+{
+  hash_table_sync_t *sync = ht->sync;
+  bucket_array_t *old = sync->old;
+  if (old != NULL)
+    {
+      const size_t old_bucket = bucket_index(hash, old->no_buckets, old->reciprocal);
+      *stripe = stripe_lock(old, old_bucket);
+      entry_t **link = find_link_matching(ht, &old->buckets[old_bucket], key, hash);
+      if (*link != NULL && (*link)->hash == hash)
+        {
+          return link;
+        }
+      pthread_mutex_unlock(&(*stripe)->lock);
+    }
+
+  bucket_array_t *current = sync->current;
+  const size_t bucket = bucket_index(hash, current->no_buckets, current->reciprocal);
+  *stripe = stripe_lock(current, bucket);
+  return find_link_matching(ht, &current->buckets[bucket], key, hash);
+}
+
+/**
+ * @brief Migrate buckets of an ongoing rehash.
+ * @param ht Hash table operated upon, whose slot the calling thread holds.
+ * @param no_buckets Maximum number of old buckets to migrate.
+ * @return True if this call migrated the last old bucket, false otherwise.
+ * 
+ * Old buckets are claimed one at a time through an atomic counter, so any number of threads may help with
+ * the migration. The stripe of a claimed bucket is held while its entries are relinked into the current
+ * buckets, locking the stripe of each target bucket in turn. Nothing is migrated until the hash table is
+ * ready for it, which with lock-free reads is only once lookups that predate the rehash have left.
+ **/
+static bool concurrent_migrate(hash_table_t *ht, size_t no_buckets)
+{
+  hash_table_sync_t *sync = ht->sync;
+  bucket_array_t *old = sync->old;
+  bucket_array_t *current = sync->current;
+  bool finished = false;
+
+  if (old == NULL || !__atomic_load_n(&sync->migration_ready, __ATOMIC_ACQUIRE))
+    {
+      return false;
+    }
+  const uint64_t start = stats_clock();
+  while (no_buckets > 0)
+    {
+      const size_t i = __atomic_fetch_add(&sync->rehash_claimed, 1, __ATOMIC_RELAXED);
+      if (i >= old->no_buckets)
+        {
+          break;
+        }
+
+      stripe_t *old_stripe = stripe_lock(old, i);
+      migrate_bucket(old, current, i);
+      pthread_mutex_unlock(&old_stripe->lock);
+
+      no_buckets -= 1;
+      if (__atomic_add_fetch(&sync->rehash_done, 1, __ATOMIC_ACQ_REL) == old->no_buckets)
+        {
+          finished = true;
+        }
+    }
+
+  STATS_ADD(ht, rehash_nanoseconds, stats_clock() - start);
+  return finished;
+}
+
+/**
+ * @brief Release the old buckets of a hash table once all of them have been migrated.
+ * @param ht Hash table operated upon, whose slot the calling thread must not hold.
+ * 
+ * The old bucket array is unpublished while holding every thread slot, which guarantees that no locking
+ * thread is still walking it by the time it gets destroyed; lock-free readers are waited for separately.
+ **/
+static void concurrent_finish_rehash(hash_table_t *ht)
+{
+  hash_table_sync_t *sync = ht->sync;
+  pthread_mutex_lock(&sync->resize_lock);
+  bucket_array_t *old = sync->old;
+  if (old != NULL && __atomic_load_n(&sync->rehash_done, __ATOMIC_ACQUIRE) == old->no_buckets)
+    {
+      thread_slots_lock_all(sync);
+      __atomic_store_n(&sync->old, NULL, __ATOMIC_RELEASE);
+      thread_slots_unlock_all(sync);
+      if (sync->lock_free_reads)
+        {
+          wait_for_readers(sync);
+        }
+      bucket_array_destroy(old);
+    }
+  pthread_mutex_unlock(&sync->resize_lock);
+}
+
+/**
+ * @brief Help an ongoing rehash by migrating every old bucket that is not yet claimed.
+ * @param ht Hash table operated upon, whose slot the calling thread must not hold.
+ **/
+static void concurrent_help_rehash(hash_table_t *ht)
+{
+  thread_slot_t *slot = thread_slot_enter(ht->sync);
+  const bool finished = concurrent_migrate(ht, SIZE_MAX);
+  pthread_mutex_unlock(&slot->lock);
+  if (finished)
+    {
+      concurrent_finish_rehash(ht);
+    }
+}
+
+/**
+ * @brief Start a rehash into a new bucket array.
+ * @param ht Hash table operated upon, whose resize lock the calling thread holds while no rehash is ongoing.
+ * @param no_buckets_new Number of buckets of the new bucket array, which may be fewer than the current ones.
+ * @return True if the new bucket array could be allocated, false otherwise.
+ * 
+ * The new bucket array is allocated before taking any thread slot; publishing it then only swaps two pointers
+ * while holding every slot. The buckets themselves are migrated by subsequent operations. With lock-free
+ * reads, lookups that started before the swap may still only know of the old bucket array as the current
+ * one, so migration is held off until they have left.
+ **/
+static bool concurrent_rehash(hash_table_t *ht, const size_t no_buckets_new)
+{
+  hash_table_sync_t *sync = ht->sync;
+  hash_table_log(ht, HASH_TABLE_EVENT_RESIZE, "Rehashing %zu entries into %zu buckets", hash_table_size(ht), no_buckets_new);
+  bucket_array_t *array = bucket_array_create(no_buckets_new);
+  if (array == NULL)
+    {
+      hash_table_log(ht, HASH_TABLE_EVENT_NO_MEMORY, "Failed to allocate %zu buckets!", no_buckets_new);
+      return false;
+    }
+
+  thread_slots_lock_all(sync);
+  sync->rehash_claimed = 0;
+  sync->rehash_done = 0;
+  __atomic_store_n(&sync->migration_ready, !sync->lock_free_reads, __ATOMIC_RELEASE);
+  __atomic_store_n(&sync->old, sync->current, __ATOMIC_RELEASE);
+  __atomic_store_n(&sync->current, array, __ATOMIC_RELEASE);
+  __atomic_store_n(&ht->no_buckets, no_buckets_new, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&ht->no_resizes, 1, __ATOMIC_RELAXED);
+  thread_slots_unlock_all(sync);
+  if (sync->lock_free_reads)
+    {
+      wait_for_readers(sync);
+      __atomic_store_n(&sync->migration_ready, true, __ATOMIC_RELEASE);
+    }
+  return true;
+}
+
+/**
+ * @brief Start a rehash into a larger bucket array if the maximum load has been reached.
+ * @param ht Hash table operated upon, whose slot the calling thread must not hold.
+ * 
+ * A rehash that is still ongoing is helped to completion first, so that there are never more than two bucket
+ * arrays. The size of the new bucket array is the smallest prime number that is at least twice the current one.
+ **/
+static void concurrent_grow(hash_table_t *ht)
+{
+  hash_table_sync_t *sync = ht->sync;
+  concurrent_help_rehash(ht);
+
+  pthread_mutex_lock(&sync->resize_lock);
+  bucket_array_t *current = sync->current;
+  const float current_load = (float) hash_table_size(ht) / (float) current->no_buckets;
+  if (sync->old == NULL && current_load >= ht->load_factor)
+    {
+      const size_t no_buckets_new = current->no_buckets <= (SIZE_MAX - 1) / 2 ? get_next_prime_number(2 * current->no_buckets + 1) : 0;
+      if (no_buckets_new == 0)
+        {
+          hash_table_log(ht, HASH_TABLE_EVENT_OVERFLOW, "Resizing not possible, the number of buckets would overflow!");
+        }
+      else
+        {
+          concurrent_rehash(ht, no_buckets_new);
+        }
+    }
+  pthread_mutex_unlock(&sync->resize_lock);
+}
+
+/**
+ * @brief Start a rehash into a smaller bucket array if the load has dropped below the minimum load factor.
+ * @param ht Hash table operated upon, whose slot the calling thread must not hold.
+ * 
+ * Just like when growing, a rehash that is still ongoing is helped to completion first. The new bucket array
+ * holds twice the current number of entries before reaching the maximum load.
+ **/
+static void concurrent_shrink(hash_table_t *ht)
+{
+  hash_table_sync_t *sync = ht->sync;
+  concurrent_help_rehash(ht);
+
+  pthread_mutex_lock(&sync->resize_lock);
+  const size_t size = hash_table_size(ht);
+  const size_t no_buckets_new = buckets_for_entries(ht, 2 * size);
+  if (sync->old == NULL && below_min_load(ht, size, sync->current->no_buckets) && no_buckets_new != 0
+      && no_buckets_new < sync->current->no_buckets)
+    {
+      concurrent_rehash(ht, no_buckets_new);
+    }
+  pthread_mutex_unlock(&sync->resize_lock);
+}
+
+/**
+ * @brief Resize a concurrent hash table to the number of buckets that holds a number of entries.
+ * @param ht Hash table operated upon.
+ * @param no_entries Number of entries the hash table should hold without growing.
+ * @param shrink Whether the hash table may end up with fewer buckets than it has now.
+ * @return True if the hash table has the required number of buckets afterwards, false otherwise.
+ * 
+ * Unlike growing, which gives up if another thread started a rehash in the meantime, ongoing rehashes are
+ * helped until none is left while holding the resize lock. The new bucket array is then published, and its
+ * buckets are migrated by subsequent operations.
+ **/
+static bool concurrent_reserve(hash_table_t *ht, const size_t no_entries, const bool shrink)
+{
+  hash_table_sync_t *sync = ht->sync;
+  const size_t no_buckets_new = buckets_for_entries(ht, no_entries);
+  if (no_buckets_new == 0)
+    {
+      hash_table_log(ht, HASH_TABLE_EVENT_OVERFLOW, "Resizing not possible, the number of buckets would overflow!");
+      return false;
+    }
+
+  pthread_mutex_lock(&sync->resize_lock);
+  while (sync->old != NULL)
+    {
+      pthread_mutex_unlock(&sync->resize_lock);
+      concurrent_help_rehash(ht);
+      pthread_mutex_lock(&sync->resize_lock);
+    }
+  const size_t no_buckets = sync->current->no_buckets;
+  bool reserved = true;
+  if (no_buckets_new > no_buckets || (no_buckets_new < no_buckets && shrink))
+    {
+      reserved = concurrent_rehash(ht, no_buckets_new);
+    }
+  pthread_mutex_unlock(&sync->resize_lock);
+  return reserved;
+}
+
+/**
+ * @brief Create a new hash table that may be shared between threads.
+ * @param options Options to create the hash table with, as for hash_table_create_with_options.
+ * @return A new empty thread-safe hash table, or NULL if creation failed.
+ * 
+ * The hash table is created as a chained hash table, whose buckets are then replaced by the first bucket
+ * array along with its stripes of locks. Only the chained backend is supported; NULL is returned if any
+ * other backend, owned keys or cache mode are requested.
+ **/
+hash_table_t *hash_table_concurrent_create(const hash_table_options_t *options)
+{
+  if (options->backend != HASH_TABLE_CHAINED)
+  {
+    hash_table_log(NULL, HASH_TABLE_EVENT_INVALID_ARGUMENT, "Concurrent hash tables only support the chained backend!");
+    return NULL;
+  }
+  if (options->owned_keys)
+  {
+    hash_table_log(NULL, HASH_TABLE_EVENT_INVALID_ARGUMENT, "Concurrent hash tables do not support owned keys!");
+    return NULL;
+  }
+  if (options->max_entries != 0 || options->max_bytes != 0)
+  {
+    hash_table_log(NULL, HASH_TABLE_EVENT_INVALID_ARGUMENT, "Concurrent hash tables do not support cache mode!");
+    return NULL;
+  }
+  if (options->change_log_size != 0)
+  {
+    hash_table_log(NULL, HASH_TABLE_EVENT_INVALID_ARGUMENT, "Concurrent hash tables do not support change logs!");
+    return NULL;
+  }
+  if (options->prefilter)
+  {
+    hash_table_log(NULL, HASH_TABLE_EVENT_INVALID_ARGUMENT, "Concurrent hash tables do not support prefilters!");
+    return NULL;
+  }
+  if (options->no_shards > 1)
+  {
+    return sharded_create(options, true);
+  }
+
+  hash_table_t *ht = hash_table_create_with_options(options);
+  if (ht == NULL)
+  {
+    return NULL;
+  }
+
+  hash_table_sync_t *sync = aligned_alloc(CACHE_LINE_SIZE, sizeof(hash_table_sync_t));
+  bucket_array_t *array = sync == NULL ? NULL : bucket_array_create(ht->no_buckets);
+  if (array == NULL)
+  {
+    hash_table_log(NULL, HASH_TABLE_EVENT_NO_MEMORY, "Failed to allocate memory for concurrent hash table!");
+    free(sync);
+    hash_table_destroy(ht);
+    return NULL;
+  }
+
+  for (size_t i = 0; i < NO_THREAD_SLOTS; ++i)
+    {
+      pthread_mutex_init(&sync->slots[i].lock, NULL);
+      entry_pool_t pool = { .slabs = NULL, .free_list = NULL, .unused = 0, .entry_size = ht->pool.entry_size, .allocator = ht->pool.allocator };
+      sync->slots[i].pool = pool;
+      sync->slots[i].no_retired = 0;
+      sync->slots[i].readers[0] = 0;
+      sync->slots[i].readers[1] = 0;
+    }
+  sync->current = array;
+  sync->old = NULL;
+  sync->epoch = 0;
+  sync->lock_free_reads = options->lock_free_reads;
+  sync->rehash_claimed = 0;
+  sync->rehash_done = 0;
+  sync->migration_ready = false;
+  pthread_mutex_init(&sync->resize_lock, NULL);
+  pthread_mutex_init(&sync->grace_lock, NULL);
+
+  if (ht->rehash_step == 0)
+  {
+    ht->rehash_step = DEFAULT_REHASH_STEP;
+  }
+  free(ht->buckets);
+  ht->buckets = NULL;
+  ht->sync = sync;
+  ht->ops = sync->lock_free_reads ? &concurrent_lock_free_ops : &concurrent_ops;
+  return ht;
+}
+
+/**
+ * @brief Insert a key-value pair entry in a concurrent hash table, or find the existing entry for the key.
+ * @param ht Hash table to insert into.
+ * @param key Key to insert.
+ * @param value Value to insert.
+ * @param hash_key Hash of the key.
+ * @param overwrite Whether the value of an existing entry for the key gets replaced.
+ * @param inserted Pointer where whether the key was inserted will be stored.
+ * @return A pointer to the value stored for the key, or NULL if the key could not be inserted.
+ * 
+ * The key is hashed by the caller before taking any lock. Once a new entry has been linked and all locks
+ * are released, the hash table grows if the maximum load has been reached.
+ **/
+static elem_t *concurrent_insert_entry(hash_table_t *ht, const elem_t key, const elem_t value, const unsigned long hash_key, const bool overwrite, bool *inserted)
+{
+  hash_table_sync_t *sync = ht->sync;
+  thread_slot_t *slot = thread_slot_enter(sync);
+  const bool finished = concurrent_migrate(ht, ht->rehash_step);
+
+  stripe_t *stripe;
+  entry_t **link = find_locked_link(ht, key, hash_key, &stripe);
+  entry_t *next = *link;
+  elem_t *stored = NULL;
+  *inserted = false;
+
+  if (next != NULL && next->hash == hash_key)
+    {
+      if (overwrite)
+        {
+          __atomic_store(&next->value, &value, __ATOMIC_RELAXED);
+        }
+      stored = &next->value;
+    }
+  else
+    {
+      entry_t *new_entry = entry_create(&slot->pool, key, value, hash_key, next);
+      if (new_entry == NULL)
+      {
+        hash_table_log(ht, HASH_TABLE_EVENT_NO_MEMORY, "Failed to allocate memory for entry!");
+      }
+      else
+      {
+        __atomic_store_n(link, new_entry, __ATOMIC_RELEASE);
+        stored = &new_entry->value;
+        *inserted = true;
+      }
+    }
+  pthread_mutex_unlock(&stripe->lock);
+  const size_t no_buckets = sync->current->no_buckets;
+  pthread_mutex_unlock(&slot->lock);
+
+  if (finished)
+    {
+      concurrent_finish_rehash(ht);
+    }
+  if (*inserted)
+    {
+      const size_t size = __atomic_add_fetch(&ht->size, 1, __ATOMIC_RELAXED);
+      if ((float) size / (float) no_buckets >= ht->load_factor)
+        {
+          concurrent_grow(ht);
+        }
+    }
+  return stored;
+}
+
+/**
+ * @brief Insert a key-value pair entry in a concurrent hash table.
+ * @param ht Hash table to insert into.
+ * @param key Key to insert.
+ * @param value Value to insert.
+ * @param hash_key Hash of the key.
+ * @return Status of the insertion.
+ **/
+static hash_table_status_t concurrent_insert(hash_table_t *ht, const elem_t key, const elem_t value, const unsigned long hash_key)
+{
+  bool inserted;
+  if (concurrent_insert_entry(ht, key, value, hash_key, true, &inserted) == NULL)
+    {
+      return HASH_TABLE_NO_MEMORY;
+    }
+  return inserted ? HASH_TABLE_INSERTED : HASH_TABLE_UPDATED;
+}
+
+/**
+ * @brief Get the value slot for a key in a concurrent hash table, inserting the key if missing.
+ * @param ht Hash table operated upon.
+ * @param key Key to lookup or insert.
+ * @param value Value to insert the key with if it is missing.
+ * @param hash_key Hash of the key.
+ * @param inserted Pointer where whether the key was inserted will be stored.
+ * @return A pointer to the value stored for the key, or NULL if the key could not be inserted.
+ * 
+ * The pointer is not protected by any lock once returned, so it is only safe to use while no other thread
+ * modifies the hash table.
+ **/
+static elem_t *concurrent_upsert(hash_table_t *ht, const elem_t key, const elem_t value, const unsigned long hash_key, bool *inserted)
+{
+  return concurrent_insert_entry(ht, key, value, hash_key, false, inserted);
+}
+
+/**
+ * @brief Apply a function to the value for a key in a concurrent hash table.
+ * @param ht Hash table operated upon.
+ * @param key Key whose value to update.
+ * @param hash_key Hash of the key.
+ * @param f Function to pass the key and a pointer to its value to.
+ * @param x Optional additional data.
+ * @param updated Pointer where the value stored by the update will be stored.
+ * @return True if the key was found and its value updated, false otherwise.
+ * 
+ * The function is applied while the stripe of the bucket is held, so updates of the same key never overlap.
+ * It works on a copy of the value that is stored back atomically, since lock-free lookups may be reading it.
+ **/
+static bool concurrent_update(hash_table_t *ht, const elem_t key, const unsigned long hash_key, apply_function_ht f, const void *x, elem_t *updated)
+{
+  hash_table_sync_t *sync = ht->sync;
+  thread_slot_t *slot = thread_slot_enter(sync);
+  const bool finished = concurrent_migrate(ht, ht->rehash_step);
+
+  stripe_t *stripe;
+  entry_t *next = *find_locked_link(ht, key, hash_key, &stripe);
+  const bool found = next != NULL && next->hash == hash_key;
+  if (found)
+    {
+      elem_t value = next->value;
+      f(next->key, &value, x);
+      __atomic_store(&next->value, &value, __ATOMIC_RELAXED);
+      *updated = value;
+    }
+  pthread_mutex_unlock(&stripe->lock);
+  pthread_mutex_unlock(&slot->lock);
+
+  if (finished)
+    {
+      concurrent_finish_rehash(ht);
+    }
+  return found;
+}
+
+/**
+ * @brief Lookup value for key in a concurrent hash table.
+ * @param ht Hash table operated upon.
+ * @param key Key to lookup.
+ * @param hash_key Hash of the key.
+ * @param result Pointer where a found element will be stored.
+ * @return True if a key was found, false otherwise.
+ **/
+static bool concurrent_lookup(hash_table_t *ht, const elem_t key, const unsigned long hash_key, elem_t *result)
+{
+  hash_table_sync_t *sync = ht->sync;
+  thread_slot_t *slot = thread_slot_enter(sync);
+  const bool finished = concurrent_migrate(ht, ht->rehash_step);
+
+  stripe_t *stripe;
+  entry_t *next = *find_locked_link(ht, key, hash_key, &stripe);
+  const bool found = next != NULL && next->hash == hash_key;
+  if (found)
+    {
+      *result = next->value;
+    }
+  pthread_mutex_unlock(&stripe->lock);
+  pthread_mutex_unlock(&slot->lock);
+
+  if (finished)
+    {
+      concurrent_finish_rehash(ht);
+    }
+  return found;
+}
+
+/**
+ * @brief Insert a batch of key-value pairs in a concurrent hash table.
+ * @param ht Hash table to insert into.
+ * @param keys Keys to insert.
+ * @param values Values to insert, one per key.
+ * @param no_keys Number of keys.
+ * 
+ * Pairs are inserted one at a time without prefetching: outside of the locks a bucket array may be replaced
+ * and destroyed at any moment, so its buckets cannot be located ahead of time.
+ **/
+static void concurrent_insert_batch(hash_table_t *ht, const elem_t *keys, const elem_t *values, const size_t no_keys)
+{
+  for (size_t i = 0; i < no_keys; i++)
+    {
+      concurrent_insert(ht, keys[i], values[i], ht->hash_function(keys[i]));
+    }
+}
+
+/**
+ * @brief Lookup values for a batch of keys in a concurrent hash table.
+ * @param ht Hash table operated upon.
+ * @param keys Keys to lookup.
+ * @param no_keys Number of keys.
+ * @param results Array where found values will be stored.
+ * @param found Array of flags telling which keys were found, or NULL.
+ * @return The number of keys found.
+ * 
+ * Keys are looked up one at a time without prefetching, for the same reason as in concurrent_insert_batch.
+ **/
+static size_t concurrent_lookup_batch(hash_table_t *ht, const elem_t *keys, const size_t no_keys, elem_t *results, bool *found)
+{
+  size_t no_found = 0;
+  for (size_t i = 0; i < no_keys; i++)
+    {
+      const bool hit = concurrent_lookup(ht, keys[i], ht->hash_function(keys[i]), &results[i]);
+      if (found != NULL)
+        {
+          found[i] = hit;
+        }
+      no_found += hit;
+    }
+  return no_found;
+}
+
+/**
+ * @brief Find the value for a certain key in a bucket without taking any lock.
+ * @param ht Hash table operated upon.
+ * @param head Head of the bucket.
+ * @param key Key to find.
+ * @param hash Hash of the key.
+ * @param result Pointer where a found element will be stored.
+ * @return True if a key was found, false otherwise.
+ * 
+ * The value is loaded atomically before it is passed to the key comparison function, as an update may be
+ * storing it at the same time.
+ **/
+static bool find_value_lock_free(hash_table_t *ht, entry_t **head, const elem_t key, const unsigned long hash, elem_t *result)
+{
+  entry_t *cursor = __atomic_load_n(head, __ATOMIC_ACQUIRE);
+  STATS_ADD(ht, no_finds, 1);
+  while (cursor != NULL && cursor->hash <= hash)
+    {
+      STATS_ADD(ht, no_probes, 1);
+      if (cursor->hash == hash)
+        {
+          elem_t value;
+          __atomic_load(&cursor->value, &value, __ATOMIC_RELAXED);
+          if (ht->key_equiv(cursor->key, value, &key))
+            {
+              *result = value;
+              return true;
+            }
+        }
+      cursor = __atomic_load_n(&cursor->next, __ATOMIC_ACQUIRE);
+    }
+  return false;
+}
+
+/**
+ * @brief Lookup value for key in a concurrent hash table without taking any lock.
+ * @param ht Hash table operated upon.
+ * @param key Key to lookup.
+ * @param hash_key Hash of the key.
+ * @param result Pointer where a found element will be stored.
+ * @return True if a key was found, false otherwise.
+ * 
+ * The current bucket array is loaded before the old one. Since a rehash publishes its old bucket array
+ * first, a lookup that sees the new current buckets also sees the old ones, whose bucket it examines first
+ * just like locking operations do. Lookups never migrate buckets.
+ **/
+static bool concurrent_lookup_lock_free(hash_table_t *ht, const elem_t key, const unsigned long hash_key, elem_t *result)
+{
+  hash_table_sync_t *sync = ht->sync;
+  size_t *readers = read_side_enter(sync);
+
+  bucket_array_t *current = __atomic_load_n(&sync->current, __ATOMIC_ACQUIRE);
+  bucket_array_t *old = __atomic_load_n(&sync->old, __ATOMIC_ACQUIRE);
+  bool found = false;
+  if (old != NULL && old != current)
+    {
+      found = find_value_lock_free(ht, &old->buckets[bucket_index(hash_key, old->no_buckets, old->reciprocal)], key, hash_key, result);
+    }
+  if (!found)
+    {
+      found = find_value_lock_free(ht, &current->buckets[bucket_index(hash_key, current->no_buckets, current->reciprocal)], key, hash_key, result);
+    }
+
+  read_side_leave(readers);
+  return found;
+}
+
+/**
+ * @brief Lookup values for a batch of keys in a concurrent hash table without taking any lock.
+ * @param ht Hash table operated upon.
+ * @param keys Keys to lookup.
+ * @param no_keys Number of keys.
+ * @param results Array where found values will be stored.
+ * @param found Array of flags telling which keys were found, or NULL.
+ * @return The number of keys found.
+ * 
+ * Each window of keys is resolved within a single read-side critical section, during which the bucket arrays
+ * it loaded cannot be destroyed. That allows hashing the whole window and prefetching the current bucket of
+ * every key, followed by the first entry of each of them, before resolving the keys like
+ * concurrent_lookup_lock_free does. Leaving the critical section between windows keeps a large batch from
+ * holding up reclamation for long.
+ **/
+static size_t concurrent_lookup_batch_lock_free(hash_table_t *ht, const elem_t *keys, const size_t no_keys, elem_t *results, bool *found)
+{
+  hash_table_sync_t *sync = ht->sync;
+  unsigned long hashes[BATCH_WINDOW];
+  size_t no_found = 0;
+  for (size_t start = 0; start < no_keys; start += BATCH_WINDOW)
+    {
+      const size_t window = no_keys - start < BATCH_WINDOW ? no_keys - start : BATCH_WINDOW;
+      for (size_t i = 0; i < window; i++)
+        {
+          hashes[i] = ht->hash_function(keys[start + i]);
+        }
+
+      size_t *readers = read_side_enter(sync);
+      bucket_array_t *current = __atomic_load_n(&sync->current, __ATOMIC_ACQUIRE);
+      bucket_array_t *old = __atomic_load_n(&sync->old, __ATOMIC_ACQUIRE);
+      entry_t **heads[BATCH_WINDOW];
+      for (size_t i = 0; i < window; i++)
+        {
+          heads[i] = &current->buckets[bucket_index(hashes[i], current->no_buckets, current->reciprocal)];
+          __builtin_prefetch(heads[i]);
+        }
+      for (size_t i = 0; i < window; i++)
+        {
+          __builtin_prefetch(__atomic_load_n(heads[i], __ATOMIC_RELAXED));
+        }
+      for (size_t i = 0; i < window; i++)
+        {
+          const unsigned long hash_key = hashes[i];
+          bool hit = false;
+          if (old != NULL && old != current)
+            {
+              hit = find_value_lock_free(ht, &old->buckets[bucket_index(hash_key, old->no_buckets, old->reciprocal)], keys[start + i], hash_key, &results[start + i]);
+            }
+          if (!hit)
+            {
+              hit = find_value_lock_free(ht, heads[i], keys[start + i], hash_key, &results[start + i]);
+            }
+          if (found != NULL)
+            {
+              found[start + i] = hit;
+            }
+          no_found += hit;
+        }
+      read_side_leave(readers);
+    }
+  return no_found;
+}
+
+/**
+ * @brief Remove any mapping from key to a value in a concurrent hash table.
+ * @param ht Hash table to remove entry from.
+ * @param key Key to remove.
+ * @param hash_key Hash of the key.
+ * @param result Pointer where a removed element will be stored.
+ * @return True if a key was removed, false otherwise.
+ * 
+ * The removed entry is returned to the pool of the slot of the calling thread, with lock-free reads only
+ * after a grace period. Once all locks are released, the hash table shrinks if the load has dropped below the
+ * minimum load factor.
+ **/
+static bool concurrent_remove(hash_table_t *ht, const elem_t key, const unsigned long hash_key, elem_t *result)
+{
+  hash_table_sync_t *sync = ht->sync;
+  thread_slot_t *slot = thread_slot_enter(sync);
+  const bool finished = concurrent_migrate(ht, ht->rehash_step);
+
+  stripe_t *stripe;
+  entry_t **link = find_locked_link(ht, key, hash_key, &stripe);
+  entry_t *entry_to_remove = *link;
+  const bool found = entry_to_remove != NULL && entry_to_remove->hash == hash_key;
+  if (found)
+    {
+      *result = entry_to_remove->value;
+      __atomic_store_n(link, entry_to_remove->next, __ATOMIC_RELEASE);
+      __atomic_sub_fetch(&ht->size, 1, __ATOMIC_RELAXED);
+    }
+  pthread_mutex_unlock(&stripe->lock);
+  if (found && sync->lock_free_reads)
+    {
+      entry_retire(sync, slot, entry_to_remove);
+    }
+  else if (found)
+    {
+      entry_destroy(&slot->pool, entry_to_remove);
+    }
+  const size_t no_buckets = sync->current->no_buckets;
+  pthread_mutex_unlock(&slot->lock);
+
+  if (finished)
+    {
+      concurrent_finish_rehash(ht);
+    }
+  if (found && below_min_load(ht, hash_table_size(ht), no_buckets))
+    {
+      concurrent_shrink(ht);
+    }
+  return found;
+}
+
+/**
+ * @brief Clear all entries in a concurrent hash table.
+ * @param ht Hash table operated upon.
+ * 
+ * Every thread slot is held while detaching the chains and releasing the entry pools, so other operations
+ * wait for the clear to finish. Any ongoing rehash is abandoned since there is nothing left to migrate.
+ * With lock-free reads, a grace period is waited for between detaching the chains and releasing them.
+ **/
+static void concurrent_clear(hash_table_t *ht)
+{
+  hash_table_sync_t *sync = ht->sync;
+  pthread_mutex_lock(&sync->resize_lock);
+  thread_slots_lock_all(sync);
+
+  for (size_t i = 0; i < sync->current->no_buckets; ++i)
+    {
+      __atomic_store_n(&sync->current->buckets[i], NULL, __ATOMIC_RELEASE);
+    }
+  bucket_array_t *old = sync->old;
+  __atomic_store_n(&sync->old, NULL, __ATOMIC_RELEASE);
+  if (sync->lock_free_reads)
+    {
+      wait_for_readers(sync);
+    }
+  if (old != NULL)
+    {
+      bucket_array_destroy(old);
+    }
+  for (size_t i = 0; i < NO_THREAD_SLOTS; ++i)
+    {
+      entry_pool_release(&sync->slots[i].pool);
+      sync->slots[i].no_retired = 0;
+    }
+  __atomic_store_n(&ht->size, 0, __ATOMIC_RELAXED);
+
+  thread_slots_unlock_all(sync);
+  pthread_mutex_unlock(&sync->resize_lock);
+}
+
+/**
+ * @brief Release the storage of a concurrent hash table.
+ * @param ht Hash table operated upon.
+ **/
+static void concurrent_destroy(hash_table_t *ht)
+{
+  hash_table_sync_t *sync = ht->sync;
+  for (size_t i = 0; i < NO_THREAD_SLOTS; ++i)
+    {
+      entry_pool_release(&sync->slots[i].pool);
+      pthread_mutex_destroy(&sync->slots[i].lock);
+    }
+  if (sync->old != NULL)
+    {
+      bucket_array_destroy(sync->old);
+    }
+  bucket_array_destroy(sync->current);
+  pthread_mutex_destroy(&sync->resize_lock);
+  pthread_mutex_destroy(&sync->grace_lock);
+  free(sync);
+}
+
+/**
+ * @brief Visit the entries of a concurrent hash table.
+ * @param ht Hash table operated upon.
+ * @param visit Function to pass keys and values to; returning false stops the walk.
+ * @param extra Optional additional data.
+ * 
+ * Every thread slot is held during the walk, so the visited entries are a consistent view of the hash table.
+ **/
+static void concurrent_for_each(hash_table_t *ht, hash_table_visitor visit, void *extra)
+{
+  hash_table_sync_t *sync = ht->sync;
+  bucket_array_t *arrays[] = { NULL, NULL };
+  thread_slots_lock_all(sync);
+  arrays[0] = sync->old;
+  arrays[1] = sync->current;
+
+  for (size_t a = 0; a < 2; ++a)
+    {
+      for (size_t i = 0; arrays[a] != NULL && i < arrays[a]->no_buckets; ++i)
+        {
+          entry_t *cursor = arrays[a]->buckets[i];
+
+          while (cursor != NULL)
+            {
+              if (!visit(cursor->key, &cursor->value, extra))
+                {
+                  thread_slots_unlock_all(sync);
+                  return;
+                }
+              cursor = cursor->next;
+            }
+        }
+    }
+
+  thread_slots_unlock_all(sync);
+}
+
+/**
+ * @brief Measure the chains of a concurrent hash table.
+ * @param ht Hash table operated upon.
+ * @param stats Statistics to store the chain lengths in.
+ * 
+ * Every thread slot is held while measuring, just like during a walk. During a rehash the chains of both
+ * bucket arrays are measured; migrated old buckets are empty and counted as such.
+ **/
+static void concurrent_stats(hash_table_t *ht, hash_table_stats_t *stats)
+{
+  hash_table_sync_t *sync = ht->sync;
+  thread_slots_lock_all(sync);
+  stats->size = hash_table_size(ht);
+  stats->no_buckets = sync->current->no_buckets;
+  size_t no_chains = chains_measure(sync->current->buckets, sync->current->no_buckets, stats);
+  if (sync->old != NULL)
+    {
+      stats->no_buckets += sync->old->no_buckets;
+      no_chains += chains_measure(sync->old->buckets, sync->old->no_buckets, stats);
+    }
+  thread_slots_unlock_all(sync);
+  stats->mean_chain_length = no_chains == 0 ? 0 : (float) stats->size / (float) no_chains;
+}
+
+/**
+ * @brief Advance a walk over a concurrent hash table to the next entry.
+ * @param iter Iterator operated upon.
+ * @param key Pointer where the key of the entry will be stored.
+ * @param value Pointer where a pointer to the value of the entry will be stored.
+ * @return True if there was a next entry, false if the walk is over.
+ * 
+ * No locks are taken, as no other thread may modify the hash table during a walk. Otherwise the walk is the
+ * same as for a chained hash table, over the old bucket array first.
+ **/
+static bool concurrent_iter_next(hash_table_iter_t *iter, elem_t *key, elem_t **value)
+{
+  hash_table_sync_t *sync = iter->ht->sync;
+  if (iter->has_current)
+    {
+      iter->link = &(*iter->link)->next;
+      iter->has_current = false;
+    }
+
+  for (; iter->array < 2; iter->array++, iter->bucket = 0)
+    {
+      bucket_array_t *array = iter->array == 0 ? sync->old : sync->current;
+      for (; array != NULL && iter->bucket < array->no_buckets; iter->bucket++, iter->link = NULL)
+        {
+          if (iter->link == NULL)
+            {
+              iter->link = &array->buckets[iter->bucket];
+            }
+          entry_t *entry = *iter->link;
+          if (entry != NULL)
+            {
+              iter->has_current = true;
+              *key = entry->key;
+              *value = &entry->value;
+              return true;
+            }
+        }
+    }
+
+  return false;
+}
+
+/**
+ * @brief Remove the current entry of a walk over a concurrent hash table.
+ * @param iter Iterator operated upon, which has a current entry.
+ * @return True, as the entry is always removed.
+ * 
+ * The entry is unlinked and reclaimed just like concurrent_remove does, so that lock-free lookups remain safe.
+ **/
+static bool concurrent_iter_remove(hash_table_iter_t *iter)
+{
+  hash_table_t *ht = iter->ht;
+  hash_table_sync_t *sync = ht->sync;
+  entry_t *entry_to_remove = *iter->link;
+  iter->has_current = false;
+
+  thread_slot_t *slot = thread_slot_enter(sync);
+  __atomic_store_n(iter->link, entry_to_remove->next, __ATOMIC_RELEASE);
+  __atomic_sub_fetch(&ht->size, 1, __ATOMIC_RELAXED);
+  if (sync->lock_free_reads)
+    {
+      entry_retire(sync, slot, entry_to_remove);
+    }
+  else
+    {
+      entry_destroy(&slot->pool, entry_to_remove);
+    }
+  pthread_mutex_unlock(&slot->lock);
+  return true;
+}
+
+/// @brief Operations of the concurrent chained backend.
+static const hash_table_ops_t concurrent_ops = {
+  .insert = concurrent_insert,
+  .lookup = concurrent_lookup,
+  .insert_batch = concurrent_insert_batch,
+  .lookup_batch = concurrent_lookup_batch,
+  .remove = concurrent_remove,
+  .upsert = concurrent_upsert,
+  .update = concurrent_update,
+  .reserve = concurrent_reserve,
+  .clear = concurrent_clear,
+  .destroy = concurrent_destroy,
+  .for_each = concurrent_for_each,
+  .stored_hash = entry_stored_hash,
+  .stats = concurrent_stats,
+  .iter_next = concurrent_iter_next,
+  .iter_remove = concurrent_iter_remove,
+};
+
+/// @brief Operations of the concurrent chained backend with lock-free lookups.
+static const hash_table_ops_t concurrent_lock_free_ops = {
+  .insert = concurrent_insert,
+  .lookup = concurrent_lookup_lock_free,
+  .insert_batch = concurrent_insert_batch,
+  .lookup_batch = concurrent_lookup_batch_lock_free,
+  .remove = concurrent_remove,
+  .upsert = concurrent_upsert,
+  .update = concurrent_update,
+  .reserve = concurrent_reserve,
+  .clear = concurrent_clear,
+  .destroy = concurrent_destroy,
+  .for_each = concurrent_for_each,
+  .stored_hash = entry_stored_hash,
+  .stats = concurrent_stats,
+  .iter_next = concurrent_iter_next,
+  .iter_remove = concurrent_iter_remove,
+};
@@ -0,0 +1,526 @@
+#include <stdlib.h>
+#include <time.h>
+#include "hash_table_internal.h"
+
+/// Bits of the expiry time indexing the slots of one level of the timer wheel.
+#define WHEEL_BITS 6
+
+/// Number of slots of every level of the timer wheel.
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+
+/// Number of levels of the timer wheel, which together cover 2^36 ticks ahead.
+#define WHEEL_LEVELS 6
+
+/// Number of timers allocated at once.
+#define TIMER_CHUNK_TIMERS 256
+
+/// Timers processed by every insertion with a time to live.
+#define EXPIRY_STEP 16
+
+/**
+ * @file hash_table_expiry.c
+ * @author Marcus Enderskog
+ * @date 2021-04-15
+ * @brief Expiry of entries of chained hash tables by a hierarchical timer wheel.
+ *
+ * Every insertion with a time to live schedules a timer in a wheel of WHEEL_LEVELS levels. Level l has
+ * WHEEL_SLOTS slots that are each 64^l ticks wide, and a timer goes into the lowest level whose range still
+ * covers its expiry time. When the wheel reaches the start of a slot of a higher level, the timers of that
+ * slot are cascaded into lower levels, until they reach level 0 and fire on the tick they expire. A bitmap
+ * of the occupied slots of every level lets the wheel skip straight to the next tick something happens at,
+ * so advancing it costs time proportional to the timers it processes rather than the ticks elapsed, and
+ * every timer is cascaded at most once per level.
+ *
+ * Timers are not cancelled when their entry is removed or given a new time to live. Instead a timer records
+ * its entry and the expiry time it was scheduled for, and only expires the entry if it still carries that
+ * time; unlinking an entry resets its expiry time, so timers of destroyed entries are recognized as stale.
+ * Entries are never freed before the hash table is cleared, which also discards the wheel, so the entry of
+ * a timer is always safe to read.
+ **/
+
+
+/// @brief Timer of an entry with a time to live.
+typedef struct expiry_timer expiry_timer_t;
+
+/// @brief Chunk of timers allocated at once.
+typedef struct timer_chunk timer_chunk_t;
+
+/// @brief Timer of an entry with a time to live.
+struct expiry_timer
+{
+  expiry_timer_t *next;         // Next timer of the same slot, or of the free list.
+  entry_t *entry;               // Entry to expire.
+  uint64_t expires;             // Expiry time of the entry when the timer was scheduled.
+};
+
+/// @brief Chunk of timers allocated at once.
+struct timer_chunk
+{
+  timer_chunk_t *next;                          // Chunk allocated before this one.
+  expiry_timer_t timers[TIMER_CHUNK_TIMERS];    // Timers handed out from the chunk.
+};
+
+/// @brief Hierarchical timer wheel expiring the entries of a hash table.
+struct timer_wheel
+{
+  expiry_timer_t *slots[WHEEL_LEVELS][WHEEL_SLOTS]; // Timers scheduled in every slot of every level.
+  uint64_t occupied[WHEEL_LEVELS];  // Bit per slot of every level telling whether it holds any timers.
+  uint64_t current;                 // Next tick to process; all earlier ticks have been processed.
+  size_t no_timers;                 // Timers scheduled, including stale ones.
+  expiry_timer_t *free_list;        // Timers ready for reuse.
+  timer_chunk_t *chunks;            // Chunks allocated so far, most recently allocated first.
+  size_t unused;                    // Timers at the end of the most recent chunk never handed out.
+};
+
+/**
+ * @brief Get the current time of a hash table's clock.
+ * @param ht Hash table operated upon.
+ * @return The time returned by its clock function or, without one, milliseconds of the monotonic clock.
+ **/
+uint64_t expiry_now(const hash_table_t *ht)
+{
+  if (ht->clock_function != NULL)
+  {
+    return ht->clock_function(ht->clock_extra);
+  }
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000 + (uint64_t) now.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Hand out a timer from a timer wheel.
+ * @param wheel Timer wheel operated upon.
+ * @return A timer, or NULL if memory for a new chunk could not be allocated.
+ **/
+static expiry_timer_t *timer_alloc(timer_wheel_t *wheel)
+{
+  expiry_timer_t *timer = wheel->free_list;
+  if (timer != NULL)
+  {
+    wheel->free_list = timer->next;
+    return timer;
+  }
+  if (wheel->unused == 0)
+  {
+    timer_chunk_t *chunk = malloc(sizeof(timer_chunk_t));
+    if (chunk == NULL)
+    {
+      return NULL;
+    }
+    chunk->next = wheel->chunks;
+    wheel->chunks = chunk;
+    wheel->unused = TIMER_CHUNK_TIMERS;
+  }
+  wheel->unused -= 1;
+  return &wheel->chunks->timers[TIMER_CHUNK_TIMERS - 1 - wheel->unused];
+}
+
+/**
+ * @brief Return a timer to the free list of a timer wheel.
+ * @param wheel Timer wheel operated upon.
+ * @param timer Timer handed out by timer_alloc, not scheduled.
+ **/
+static void timer_free(timer_wheel_t *wheel, expiry_timer_t *timer)
+{
+  timer->next = wheel->free_list;
+  wheel->free_list = timer;
+}
+
+/**
+ * @brief Schedule a timer in the slot of a timer wheel that covers its expiry time.
+ * @param wheel Timer wheel operated upon.
+ * @param timer Timer to schedule.
+ *
+ * The timer goes into the lowest level whose slots still cover its expiry time, relative to the current
+ * tick. A timer that is already due goes into the slot of the current tick, and one beyond the range of the
+ * wheel into the slot covering the last tick in range, where it is rescheduled once it fires early.
+ **/
+static void timer_schedule(timer_wheel_t *wheel, expiry_timer_t *timer)
+{
+  uint64_t expires = timer->expires < wheel->current ? wheel->current : timer->expires;
+  const uint64_t max_delta = (UINT64_C(1) << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+  if (expires - wheel->current > max_delta)
+  {
+    expires = wheel->current + max_delta;
+  }
+  const uint64_t delta = expires - wheel->current;
+
+  size_t level = 0;
+  while (level + 1 < WHEEL_LEVELS && delta >= UINT64_C(1) << (WHEEL_BITS * (level + 1)))
+  {
+    level += 1;
+  }
+  const size_t slot = (expires >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1);
+  timer->next = wheel->slots[level][slot];
+  wheel->slots[level][slot] = timer;
+  wheel->occupied[level] |= UINT64_C(1) << slot;
+}
+
+/**
+ * @brief Find the next tick at or after the current one that a timer wheel has anything to do at.
+ * @param wheel Timer wheel operated upon.
+ * @return The first tick at which either a slot of level 0 fires or an occupied slot of a higher level gets
+ * cascaded, UINT64_MAX if no timers are scheduled.
+ *
+ * Slots of level l start every 64^l ticks, so the next start of an occupied slot of every level is found
+ * with a single scan of its bitmap, wrapping around into the next rotation of the level.
+ **/
+static uint64_t timer_next_tick(const timer_wheel_t *wheel)
+{
+  uint64_t next = UINT64_MAX;
+  for (size_t level = 0; level < WHEEL_LEVELS; level++)
+  {
+    const uint64_t occupied = wheel->occupied[level];
+    if (occupied == 0)
+    {
+      continue;
+    }
+    const unsigned shift = WHEEL_BITS * level;
+    // Index of the first slot of this level starting at or after the current tick
+    const uint64_t start = (wheel->current + (UINT64_C(1) << shift) - 1) >> shift;
+    const size_t slot = start & (WHEEL_SLOTS - 1);
+    const uint64_t ahead = occupied >> slot;
+    const uint64_t distance = ahead != 0 ? (uint64_t) __builtin_ctzll(ahead) : WHEEL_SLOTS - slot + (uint64_t) __builtin_ctzll(occupied);
+    const uint64_t tick = (start + distance) << shift;
+    if (tick < next)
+    {
+      next = tick;
+    }
+  }
+  return next;
+}
+
+/**
+ * @brief Reschedule the timers of a slot of a higher level of a timer wheel into lower levels.
+ * @param wheel Timer wheel operated upon.
+ * @param level Level of the slot, at least 1.
+ * @param slot Slot to empty.
+ **/
+static void timer_cascade(timer_wheel_t *wheel, const size_t level, const size_t slot)
+{
+  expiry_timer_t *timer = wheel->slots[level][slot];
+  wheel->slots[level][slot] = NULL;
+  wheel->occupied[level] &= ~(UINT64_C(1) << slot);
+  while (timer != NULL)
+  {
+    expiry_timer_t *next = timer->next;
+    timer_schedule(wheel, timer);
+    timer = next;
+  }
+}
+
+/**
+ * @brief Handle a timer of a hash table that fired.
+ * @param ht Hash table operated upon.
+ * @param timer Timer that was taken off its slot.
+ * @param now Current time.
+ * @return True if the entry of the timer was expired, false if the timer was stale or rescheduled.
+ **/
+static bool timer_fire(hash_table_t *ht, expiry_timer_t *timer, const uint64_t now)
+{
+  timer_wheel_t *wheel = ht->wheel;
+  const entry_meta_t *meta = entry_meta(timer->entry);
+  entry_t *entry = timer->entry;
+  if (meta->expires == timer->expires && meta->expires > now)
+  {
+    // Scheduled beyond the range of the wheel, so it fired early
+    timer_schedule(wheel, timer);
+    return false;
+  }
+  wheel->no_timers -= 1;
+  timer_free(wheel, timer);
+  if (meta->expires != timer->expires)
+  {
+    return false;
+  }
+  entry_t **link = find_link_in_table(ht, entry->key, entry->hash);
+  if (*link != entry)
+  {
+    return false;
+  }
+  chained_expire(ht, link);
+  return true;
+}
+
+/**
+ * @brief Expire the entries of a hash table that are due, processing a bounded number of timers.
+ * @param ht Hash table operated upon.
+ * @param budget Most timers to process, SIZE_MAX for all that are due.
+ * @return The number of entries expired.
+ *
+ * The wheel advances to the current time tick by tick, skipping every tick at which nothing happens.
+ * Cascading the slots of higher levels that start at a tick goes from the highest level down, so that timers
+ * due at that very tick fall through to level 0 and fire along with the others. Should the budget run out,
+ * the remaining timers of the slot stay in place and the wheel picks up at the same tick next time, by which
+ * the slots it cascaded are empty, barring timers scheduled for their next rotation, which cascade back into
+ * the same slots.
+ *
+ * A sharded hash table expires the entries of its shards in turn, out of the same budget.
+ **/
+size_t hash_table_expire(hash_table_t *ht, size_t budget)
+{
+  if (ht->shards != NULL)
+  {
+    size_t no_expired = 0;
+    for (size_t s = 0; s < ht->no_shards && no_expired < budget; s++)
+    {
+      no_expired += hash_table_expire(ht->shards[s], budget - no_expired);
+    }
+    return no_expired;
+  }
+  timer_wheel_t *wheel = ht->wheel;
+  if (wheel == NULL)
+  {
+    return 0;
+  }
+  const uint64_t now = expiry_now(ht);
+  size_t no_expired = 0;
+  while (budget > 0)
+  {
+    const uint64_t tick = timer_next_tick(wheel);
+    if (tick > now)
+    {
+      // Nothing happens up to now, so the ticks in between need not be processed
+      if (now != UINT64_MAX && now + 1 > wheel->current)
+      {
+        wheel->current = now + 1;
+      }
+      break;
+    }
+    wheel->current = tick;
+    for (size_t level = WHEEL_LEVELS - 1; level > 0; level--)
+    {
+      if ((tick & ((UINT64_C(1) << (WHEEL_BITS * level)) - 1)) == 0)
+      {
+        timer_cascade(wheel, level, (tick >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1));
+      }
+    }
+    const size_t slot = tick & (WHEEL_SLOTS - 1);
+    expiry_timer_t **head = &wheel->slots[0][slot];
+    while (*head != NULL && budget > 0)
+    {
+      expiry_timer_t *timer = *head;
+      *head = timer->next;
+      budget -= 1;
+      if (timer_fire(ht, timer, now))
+      {
+        no_expired += 1;
+      }
+    }
+    if (*head != NULL)
+    {
+      break;
+    }
+    wheel->occupied[0] &= ~(UINT64_C(1) << slot);
+    wheel->current = tick + 1;
+  }
+  return no_expired;
+}
+
+/**
+ * @brief Get the timer wheel of a hash table, allocating it if there is none yet.
+ * @param ht Hash table operated upon.
+ * @param now Current time, which a new timer wheel starts at.
+ * @return The timer wheel, or NULL if memory allocation failed.
+ **/
+static timer_wheel_t *timer_wheel_get(hash_table_t *ht, const uint64_t now)
+{
+  if (ht->wheel == NULL)
+  {
+    ht->wheel = calloc(1, sizeof(timer_wheel_t));
+    if (ht->wheel == NULL)
+    {
+      hash_table_log(ht, HASH_TABLE_EVENT_NO_MEMORY, "Failed to allocate memory for timer wheel!");
+      return NULL;
+    }
+    ht->wheel->current = now;
+  }
+  return ht->wheel;
+}
+
+/**
+ * @brief Insert a key-value pair entry with an already hashed key that expires once a time to live has passed.
+ * @param ht Hash table to insert into.
+ * @param key Key to insert.
+ * @param value Value to insert.
+ * @param hash Hash of the key.
+ * @param ttl Ticks of the clock of the hash table until the entry expires, 0 to expire it at once.
+ * @return Status of the insertion, as returned by hash_table_insert_ttl.
+ **/
+static hash_table_status_t insert_ttl_hashed(hash_table_t *ht, const elem_t key, const elem_t value, const unsigned long hash, const uint64_t ttl)
+{
+  if (ht->shards != NULL)
+  {
+    return insert_ttl_hashed(shard_for_hash(ht, hash), key, value, hash, ttl);
+  }
+  if (ht->backend != HASH_TABLE_CHAINED || ht->sync != NULL)
+  {
+    hash_table_log(ht, HASH_TABLE_EVENT_INVALID_ARGUMENT, "Expiry is only supported by chained hash tables that are not concurrent!");
+    return HASH_TABLE_UNSUPPORTED;
+  }
+  const uint64_t now = expiry_now(ht);
+  timer_wheel_t *wheel = chained_widen_entries(ht) ? timer_wheel_get(ht, now) : NULL;
+  if (wheel == NULL)
+  {
+    return HASH_TABLE_NO_MEMORY;
+  }
+  hash_table_expire(ht, EXPIRY_STEP);
+
+  expiry_timer_t *timer = timer_alloc(wheel);
+  if (timer == NULL)
+  {
+    hash_table_log(ht, HASH_TABLE_EVENT_NO_MEMORY, "Failed to allocate memory for timer!");
+    return HASH_TABLE_NO_MEMORY;
+  }
+  bool inserted;
+  elem_t *slot = ht->ops->upsert(ht, key, value, hash, &inserted);
+  const hash_table_status_t status = insert_status(slot, inserted, value);
+  if (slot == NULL)
+  {
+    timer_free(wheel, timer);
+    return status;
+  }
+
+  // Expiry time 0 means no expiry, so the earliest time an entry can expire at is 1
+  entry_t *entry = entry_of_value(slot);
+  entry_meta_t *meta = entry_meta(entry);
+  meta->expires = ttl > UINT64_MAX - now ? UINT64_MAX : now + ttl;
+  if (meta->expires == 0)
+  {
+    meta->expires = 1;
+  }
+  timer->entry = entry;
+  timer->expires = meta->expires;
+  timer_schedule(wheel, timer);
+  wheel->no_timers += 1;
+  change_log_append(ht, HASH_TABLE_CHANGE_INSERT, key, value);
+  return status;
+}
+
+/**
+ * @brief Insert a key-value pair entry in a hash table that expires once a time to live has passed.
+ * @param ht Hash table to insert into.
+ * @param key Key to insert.
+ * @param value Value to insert.
+ * @param ttl Ticks of the clock of the hash table until the entry expires, 0 to expire it at once.
+ * @return Whether the key was inserted, its value replaced, or nothing changed since memory ran out or
+ * the hash table does not support expiry.
+ *
+ * The timer wheel is only allocated on the first insertion with a time to live, which also gives the entries
+ * of the hash table room for their expiry times, so hash tables that never use expiry pay for neither.
+ * Before inserting, a step of EXPIRY_STEP timers is processed. A sharded hash table passes the insertion on
+ * to the shard of the key, which keeps a timer wheel of its own.
+ **/
+hash_table_status_t hash_table_insert_ttl(hash_table_t *ht, const elem_t key, const elem_t value, const uint64_t ttl)
+{
+  return insert_ttl_hashed(ht, key, value, ht->hash_function(key), ttl);
+}
+
+/**
+ * @brief Schedule a timer for an entry of a hash table that carries an expiry time.
+ * @param ht Hash table operated upon.
+ * @param entry Entry whose expiry time is set.
+ * @return True if the timer was scheduled, false if memory allocation failed, in which case the entry is
+ * only expired once an operation comes across it.
+ **/
+bool expiry_schedule(hash_table_t *ht, entry_t *entry)
+{
+  timer_wheel_t *wheel = timer_wheel_get(ht, expiry_now(ht));
+  expiry_timer_t *timer = wheel == NULL ? NULL : timer_alloc(wheel);
+  if (timer == NULL)
+  {
+    hash_table_log(ht, HASH_TABLE_EVENT_NO_MEMORY, "Failed to allocate memory for timer!");
+    return false;
+  }
+  timer->entry = entry;
+  timer->expires = entry_meta(entry)->expires;
+  timer_schedule(wheel, timer);
+  wheel->no_timers += 1;
+  return true;
+}
+
+/**
+ * @brief Hand every timer of a hash table over to another one, along with the entries they expire.
+ * @param dst Hash table taking over the timers.
+ * @param src Hash table giving up its timers, which is left without a timer wheel.
+ * 
+ * Without a timer wheel of its own, dst takes over the one of src. Otherwise the timers of src are
+ * rescheduled in the timer wheel of dst, which also takes over their chunks, with the unused and free
+ * timers of src joining its free list.
+ **/
+void expiry_merge(hash_table_t *dst, hash_table_t *src)
+{
+  timer_wheel_t *from = src->wheel;
+  src->wheel = NULL;
+  if (from == NULL)
+  {
+    return;
+  }
+  timer_wheel_t *into = dst->wheel;
+  if (into == NULL)
+  {
+    dst->wheel = from;
+    return;
+  }
+  for (size_t level = 0; level < WHEEL_LEVELS; level++)
+  {
+    for (size_t slot = 0; slot < WHEEL_SLOTS; slot++)
+    {
+      for (expiry_timer_t *timer = from->slots[level][slot]; timer != NULL; )
+      {
+        expiry_timer_t *next = timer->next;
+        timer_schedule(into, timer);
+        timer = next;
+      }
+    }
+  }
+  into->no_timers += from->no_timers;
+  while (from->free_list != NULL)
+  {
+    expiry_timer_t *timer = from->free_list;
+    from->free_list = timer->next;
+    timer_free(into, timer);
+  }
+  for (; from->unused > 0; from->unused -= 1)
+  {
+    timer_free(into, &from->chunks->timers[TIMER_CHUNK_TIMERS - from->unused]);
+  }
+  // Only the most recent chunk hands out unused timers, so the chunks of src go behind that of dst
+  if (from->chunks != NULL)
+  {
+    timer_chunk_t *last = from->chunks;
+    while (last->next != NULL)
+      last = last->next;
+    if (into->chunks == NULL)
+    {
+      into->chunks = from->chunks;
+    }
+    else
+    {
+      last->next = into->chunks->next;
+      into->chunks->next = from->chunks;
+    }
+  }
+  free(from);
+}
+
+/**
+ * @brief Release a timer wheel along with all of its timers.
+ * @param wheel Timer wheel to release, or NULL.
+ **/
+void timer_wheel_destroy(timer_wheel_t *wheel)
+{
+  if (wheel == NULL)
+  {
+    return;
+  }
+  timer_chunk_t *chunk = wheel->chunks;
+  while (chunk != NULL)
+  {
+    timer_chunk_t *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+  free(wheel);
+}
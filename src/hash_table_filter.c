@@ -0,0 +1,171 @@
+#include <stdlib.h>
+#include <string.h>
+#include "hash_table_internal.h"
+
+/// Bits of filter per entry a chained hash table holds at its maximum load, for a false positive rate near 1%.
+#define FILTER_BITS_PER_KEY 10
+
+/// Most blocks of a filter, so that the block of a hash can be picked with a 32-bit multiplication.
+#define MAX_FILTER_BLOCKS ((size_t) UINT32_MAX)
+
+/**
+ * @file hash_table_filter.c
+ * @author Marcus Enderskog
+ * @date 2021-04-15
+ * @brief Blocked Bloom filters that reject lookups of missing keys in chained hash tables.
+ *
+ * A filter is an array of cache-line sized blocks of FILTER_BLOCK_WORDS 64-bit words. Every hash sets one
+ * bit in each word of a single block (a split block Bloom filter), so testing a hash reads one cache line.
+ * Bits can not be cleared when an entry is removed, since other entries may have set them as well. Removed
+ * entries instead leave stale bits behind, which go away when the filter is built anew: by every rehash,
+ * which fills a filter sized for the new number of buckets as entries are migrated, and once as many entries
+ * have been removed as the filter was sized for, by a rebuild from the entries left.
+ **/
+
+
+/**
+ * @brief Get the number of entries a filter for a chained hash table is sized for.
+ * @param filter Filter to examine.
+ * @return The number of entries; holding more of them raises the false positive rate.
+ **/
+static inline size_t filter_capacity(const bloom_filter_t *filter)
+{
+  return filter->no_blocks * FILTER_BLOCK_WORDS * 64 / FILTER_BITS_PER_KEY;
+}
+
+/**
+ * @brief Allocate an empty filter for a chained hash table with a number of buckets.
+ * @param ht Hash table whose load factor to use.
+ * @param filter Filter to initialize.
+ * @param no_buckets Number of buckets of the hash table.
+ * @return True if the filter was allocated, false otherwise.
+ *
+ * The filter is sized for the most entries the buckets hold before the hash table grows.
+ **/
+bool filter_init(const hash_table_t *ht, bloom_filter_t *filter, const size_t no_buckets)
+{
+  const double no_bits = (double) no_buckets * ht->load_factor * FILTER_BITS_PER_KEY;
+  const double no_blocks = no_bits / (FILTER_BLOCK_WORDS * 64) + 1;
+  filter->no_blocks = no_blocks >= (double) MAX_FILTER_BLOCKS ? MAX_FILTER_BLOCKS : (size_t) no_blocks;
+  filter->blocks = aligned_alloc(FILTER_BLOCK_WORDS * sizeof(uint64_t), filter->no_blocks * FILTER_BLOCK_WORDS * sizeof(uint64_t));
+  if (filter->blocks == NULL)
+  {
+    hash_table_log(ht, HASH_TABLE_EVENT_NO_MEMORY, "Failed to allocate a filter of %zu blocks!", filter->no_blocks);
+    return false;
+  }
+  memset(filter->blocks, 0, filter->no_blocks * FILTER_BLOCK_WORDS * sizeof(uint64_t));
+  return true;
+}
+
+/**
+ * @brief Release the blocks of a filter, leaving it without any.
+ * @param filter Filter to release.
+ **/
+void filter_release(bloom_filter_t *filter)
+{
+  free(filter->blocks);
+  filter->blocks = NULL;
+  filter->no_blocks = 0;
+}
+
+/**
+ * @brief Empty the filter of a chained hash table whose entries were all removed at once.
+ * @param ht Hash table operated upon, which has a filter.
+ **/
+void filter_reset(hash_table_t *ht)
+{
+  memset(ht->filter.blocks, 0, ht->filter.no_blocks * FILTER_BLOCK_WORDS * sizeof(uint64_t));
+  filter_release(&ht->old_filter);
+  ht->filter_stale = 0;
+}
+
+/**
+ * @brief Build the filter of a chained hash table anew from its entries, dropping the stale bits of removed ones.
+ * @param ht Hash table operated upon, which has a filter.
+ *
+ * The new filter holds every entry, including those of old buckets still to be migrated, so the filter of
+ * the entries at the start of an ongoing rehash is no longer needed. Should memory run out, the current
+ * filters are kept, as they still never reject a stored key.
+ **/
+void filter_rebuild(hash_table_t *ht)
+{
+  bloom_filter_t filter;
+  if (!filter_init(ht, &filter, ht->no_buckets))
+  {
+    return;
+  }
+  entry_t *const *arrays[] = { ht->old_buckets == NULL ? NULL : &ht->old_buckets[ht->rehash_index], ht->buckets };
+  const size_t no_buckets[] = { ht->no_old_buckets - ht->rehash_index, ht->no_buckets };
+  for (size_t a = 0; a < sizeof(arrays) / sizeof(arrays[0]); a++)
+  {
+    for (size_t bucket = 0; arrays[a] != NULL && bucket < no_buckets[a]; bucket++)
+    {
+      for (const entry_t *entry = arrays[a][bucket]; entry != NULL; entry = entry->next)
+      {
+        filter_add(&filter, entry->hash);
+      }
+    }
+  }
+  filter_release(&ht->filter);
+  filter_release(&ht->old_filter);
+  ht->filter = filter;
+  ht->filter_stale = 0;
+}
+
+/**
+ * @brief Count an entry removed from a chained hash table against its filter, rebuilding the filter if due.
+ * @param ht Hash table operated upon, which has a filter.
+ *
+ * Rebuilding takes time proportional to the number of entries, at most as many as were removed since the
+ * last rebuild plus the capacity of the filter, so it costs constant amortized time per removal.
+ **/
+void filter_forget(hash_table_t *ht)
+{
+  ht->filter_stale += 1;
+  if (ht->filter_stale > filter_capacity(&ht->filter))
+  {
+    filter_rebuild(ht);
+  }
+}
+
+/**
+ * @brief Estimate the chance that a filter fails to reject a hash it was never given.
+ * @param filter Filter to examine.
+ * @return The false positive rate, 0 for a filter without blocks.
+ *
+ * A hash picks a block uniformly and passes it if the one bit it tests in every word is set, so the rate
+ * is the mean, over all blocks, of the product of the fractions of bits set in every word of the block.
+ **/
+static double filter_false_positive_rate(const bloom_filter_t *filter)
+{
+  double sum = 0;
+  for (size_t b = 0; b < filter->no_blocks; b++)
+  {
+    double rate = 1;
+    for (size_t w = 0; w < FILTER_BLOCK_WORDS; w++)
+    {
+      rate *= __builtin_popcountll(filter->blocks[b * FILTER_BLOCK_WORDS + w]) / 64.0;
+    }
+    sum += rate;
+  }
+  return filter->no_blocks == 0 ? 0 : sum / filter->no_blocks;
+}
+
+/**
+ * @brief Add the shape of the filters of a chained hash table to its statistics.
+ * @param ht Hash table operated upon.
+ * @param stats Statistics to fill in the size and false positive rate of the filters in.
+ *
+ * During a rehash a missing key is only rejected if both filters reject it.
+ **/
+void filter_stats(const hash_table_t *ht, hash_table_stats_t *stats)
+{
+  stats->filter_bytes = (ht->filter.no_blocks + ht->old_filter.no_blocks) * FILTER_BLOCK_WORDS * sizeof(uint64_t);
+  if (ht->filter.blocks == NULL)
+  {
+    return;
+  }
+  const double rejected = 1 - filter_false_positive_rate(&ht->filter);
+  const double rejected_old = ht->old_filter.blocks == NULL ? 1 : 1 - filter_false_positive_rate(&ht->old_filter);
+  stats->filter_false_positive_rate = (float) (1 - rejected * rejected_old);
+}
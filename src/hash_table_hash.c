@@ -0,0 +1,214 @@
+#include <stdint.h>
+#include <string.h>
+#include "hash_table.h"
+
+/**
+ * @file hash_table_hash.c
+ * @author Marcus Enderskog
+ * @date 2021-04-15
+ * @brief Built-in hash functions and key comparison functions for integer, pointer and string keys.
+ * 
+ * Integers and pointers are hashed with the 64-bit finalizer of MurmurHash3, which is a bijection, so that
+ * distinct keys never get equal hashes. Byte strings are hashed in the style of wyhash: 16 bytes at a time
+ * are folded into the state with a single 64x64 to 128-bit multiplication. Every hash depends on a process
+ * wide seed, which may be set to a secret random value to resist hash flooding.
+ **/
+
+
+/// @brief Unsigned 128-bit integer holding the full product of two 64-bit integers.
+__extension__ typedef unsigned __int128 product_t;
+
+/// Constants mixed into the state of the byte string hash; odd, with half of their bits set.
+static const uint64_t secret[4] = {
+  UINT64_C(0xa0761d6478bd642f), UINT64_C(0xe7037ed1a0b428db), UINT64_C(0x8ebc6af09c88c6e3), UINT64_C(0x589965cc75374cc3)
+};
+
+/// Seed of the built-in hash functions.
+static uint64_t hash_seed = 0;
+
+/**
+ * @brief Mix the bits of a 64-bit integer so that every bit of the result depends on every bit of the input.
+ * @param x Integer to mix.
+ * @return Mixed integer; distinct inputs always give distinct results.
+ **/
+static inline uint64_t mix64(uint64_t x)
+{
+  x ^= x >> 33;
+  x *= UINT64_C(0xff51afd7ed558ccd);
+  x ^= x >> 33;
+  x *= UINT64_C(0xc4ceb9fe1a85ec53);
+  x ^= x >> 33;
+  return x;
+}
+
+/**
+ * @brief Multiply two 64-bit integers and fold the 128-bit product back into 64 bits.
+ * @param a First factor.
+ * @param b Second factor.
+ * @return Exclusive or of the low and high halves of the product.
+ **/
+static inline uint64_t fold_multiply(const uint64_t a, const uint64_t b)
+{
+  const product_t product = (product_t) a * b;
+  return (uint64_t) product ^ (uint64_t) (product >> 64);
+}
+
+/**
+ * @brief Read 8 bytes as an integer, regardless of their alignment.
+ * @param p Bytes to read.
+ * @return The integer.
+ **/
+static inline uint64_t read64(const uint8_t *p)
+{
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+/**
+ * @brief Read 4 bytes as an integer, regardless of their alignment.
+ * @param p Bytes to read.
+ * @return The integer.
+ **/
+static inline uint64_t read32(const uint8_t *p)
+{
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+/**
+ * @brief Set the seed of the built-in hash functions.
+ * @param seed New seed.
+ **/
+void hash_table_set_hash_seed(const unsigned long seed)
+{
+  hash_seed = seed;
+}
+
+/**
+ * @brief Get the seed of the built-in hash functions.
+ * @return The seed.
+ **/
+unsigned long hash_table_get_hash_seed(void)
+{
+  return (unsigned long) hash_seed;
+}
+
+/**
+ * @brief Hash a sequence of bytes.
+ * @param data Bytes to hash.
+ * @param length Number of bytes.
+ * @param seed Seed to hash with.
+ * @return Hash value in the form of an unsigned long integer.
+ * 
+ * Up to 16 bytes are read as two, possibly overlapping, integers. Longer inputs are consumed 48 bytes at a
+ * time across three independent lanes and then 16 bytes at a time, before the last 16 bytes are read as for
+ * short inputs. Every step mixes two integers with one folded multiplication.
+ **/
+unsigned long hash_table_hash_bytes(const void *data, const size_t length, const unsigned long seed)
+{
+  const uint8_t *p = data;
+  uint64_t state = (uint64_t) seed ^ fold_multiply((uint64_t) seed ^ secret[0], secret[1]);
+  uint64_t a = 0;
+  uint64_t b = 0;
+
+  if (length <= 16)
+    {
+      if (length >= 4)
+        {
+          const size_t middle = (length >> 3) << 2;
+          a = (read32(p) << 32) | read32(p + middle);
+          b = (read32(p + length - 4) << 32) | read32(p + length - 4 - middle);
+        }
+      else if (length > 0)
+        {
+          a = ((uint64_t) p[0] << 16) | ((uint64_t) p[length >> 1] << 8) | p[length - 1];
+        }
+    }
+  else
+    {
+      size_t remaining = length;
+      if (remaining > 48)
+        {
+          uint64_t lane1 = state;
+          uint64_t lane2 = state;
+          do
+            {
+              state = fold_multiply(read64(p) ^ secret[1], read64(p + 8) ^ state);
+              lane1 = fold_multiply(read64(p + 16) ^ secret[2], read64(p + 24) ^ lane1);
+              lane2 = fold_multiply(read64(p + 32) ^ secret[3], read64(p + 40) ^ lane2);
+              p += 48;
+              remaining -= 48;
+            }
+          while (remaining > 48);
+          state ^= lane1 ^ lane2;
+        }
+      while (remaining > 16)
+        {
+          state = fold_multiply(read64(p) ^ secret[1], read64(p + 8) ^ state);
+          p += 16;
+          remaining -= 16;
+        }
+      a = read64(p + remaining - 16);
+      b = read64(p + remaining - 8);
+    }
+
+  const product_t product = (product_t) (a ^ secret[1]) * (b ^ state);
+  return (unsigned long) fold_multiply((uint64_t) product ^ secret[0] ^ length, (uint64_t) (product >> 64) ^ secret[1]);
+}
+
+/**
+ * @brief Hash an integer key.
+ * @param key Key to hash, of which the i or u field is used.
+ * @return Hash value in the form of an unsigned long integer.
+ **/
+unsigned long hash_table_hash_int(const elem_t key)
+{
+  return (unsigned long) mix64((uint64_t) key.u ^ hash_seed);
+}
+
+/**
+ * @brief Hash a pointer key by its address.
+ * @param key Key to hash, of which the p field is used.
+ * @return Hash value in the form of an unsigned long integer.
+ **/
+unsigned long hash_table_hash_pointer(const elem_t key)
+{
+  return (unsigned long) mix64((uint64_t) (uintptr_t) key.p ^ hash_seed);
+}
+
+/**
+ * @brief Hash a string key by its contents.
+ * @param key Key to hash, of which the p field points to a NUL-terminated string.
+ * @return Hash value in the form of an unsigned long integer.
+ **/
+unsigned long hash_table_hash_string(const elem_t key)
+{
+  const char *str = key.p;
+  return hash_table_hash_bytes(str, strlen(str), hash_seed);
+}
+
+/**
+ * @brief Compare a stored string key with a sought one.
+ * @param key Stored key.
+ * @param value_ignored Stored value (ignored).
+ * @param x Pointer to the sought key.
+ * @return True if both strings have the same contents, false otherwise.
+ **/
+bool hash_table_equiv_string(const elem_t key, const elem_t value_ignored, const void *x)
+{
+  return strcmp(key.p, ((const elem_t *) x)->p) == 0;
+}
+
+/**
+ * @brief Compare a stored pointer key with a sought one.
+ * @param key Stored key.
+ * @param value_ignored Stored value (ignored).
+ * @param x Pointer to the sought key.
+ * @return True if both pointers are equal, false otherwise.
+ **/
+bool hash_table_equiv_pointer(const elem_t key, const elem_t value_ignored, const void *x)
+{
+  return key.p == ((const elem_t *) x)->p;
+}
@@ -0,0 +1,753 @@
+#pragma once
+
+#include <stdint.h>
+#ifdef HASH_TABLE_STATS
+#include <time.h>
+#endif
+#include "hash_table.h"
+
+/**
+ * @file hash_table_internal.h
+ * @author Marcus Enderskog
+ * @date 2021-04-15
+ * @brief Internal representation of hash tables shared between storage backends.
+ **/
+
+/// Number of keys of a batch that are hashed and prefetched ahead of being resolved.
+#define BATCH_WINDOW 16
+
+/// Granularity in bytes of the size classes that owned keys are allocated in.
+#define KEY_CLASS_SIZE 16
+
+/// Number of size classes of owned keys; longer keys get a chunk of their own.
+#define KEY_SIZE_CLASSES 16
+
+/// Number of 64-bit words of a block of a filter, which fill one cache line.
+#define FILTER_BLOCK_WORDS 8
+
+/// @brief Precomputed reciprocal of a number of buckets, turning the reduction of hashes to buckets into multiplications.
+__extension__ typedef unsigned __int128 bucket_reciprocal_t;
+
+/// @brief Inline key-value slot used by the open addressing backend.
+typedef struct open_slot open_slot_t;
+
+/// @brief Operations a storage backend provides to the public hash table API.
+typedef struct hash_table_ops hash_table_ops_t;
+
+/// @brief Chunk of entries allocated at once by an entry pool.
+typedef struct entry_slab entry_slab_t;
+
+/// @brief Bookkeeping stored behind the entries of hash tables that need it, such as caches and expiring ones.
+typedef struct entry_meta entry_meta_t;
+
+/// @brief Slab allocator handing out entries of a chained hash table.
+typedef struct entry_pool entry_pool_t;
+
+/// @brief Locks and bucket arrays of a hash table shared between threads.
+typedef struct hash_table_sync hash_table_sync_t;
+
+/// @brief Counters of a hash table that are only maintained when built with HASH_TABLE_STATS.
+typedef struct hash_table_counters hash_table_counters_t;
+
+/// @brief Entry of a snapshot as laid out in the file, used by the mapped backend.
+typedef struct snapshot_entry snapshot_entry_t;
+
+/// @brief Copy of a string key owned by a hash table, stored along with its length.
+typedef struct owned_key owned_key_t;
+
+/// @brief Chunk of memory that owned keys are carved from, or that holds a single long key.
+typedef struct key_chunk key_chunk_t;
+
+/// @brief Storage of the string keys owned by a hash table.
+typedef struct key_arena key_arena_t;
+
+/// @brief Hierarchical timer wheel expiring the entries of a hash table.
+typedef struct timer_wheel timer_wheel_t;
+
+/// @brief Ring buffer of the most recent changes to a hash table.
+typedef struct change_log change_log_t;
+
+/// @brief Blocked Bloom filter of the hashes of the entries of a chained hash table.
+typedef struct bloom_filter bloom_filter_t;
+
+/**
+ * @brief Visit a single entry of a hash table.
+ * @param key Key of the visited entry.
+ * @param value Pointer to the value of the visited entry, which may be updated in place.
+ * @param extra Optional additional data.
+ * @return True if the walk should continue, false to stop it.
+ **/
+typedef bool(*hash_table_visitor)(const elem_t key, elem_t *value, void *extra);
+
+/// @brief Represents a storage key-value pair entry which contains a generic element type.
+struct entry
+{
+  elem_t key;          // Key to map value to.
+  elem_t value;        // The actual value to be stored.
+  unsigned long hash;  // Cached hash of the key, so that chain walks and rehashing never call the hash function.
+  entry_t *next;       // Next entry, possibly NULL.
+};
+
+/// @brief Bookkeeping stored right behind an entry, only by hash tables whose pool hands out room for it.
+struct entry_meta
+{
+  uint64_t expires;    // Time of the clock of the hash table at which the entry expires, 0 if it never does.
+  uint32_t cost;       // Cost of the entry counted against the byte budget (cache mode).
+  bool referenced;     // Whether the entry was used since the eviction sweep last passed it (cache mode).
+};
+
+/// @brief Slab allocator handing out entries of a chained hash table.
+struct entry_pool
+{
+  entry_slab_t *slabs;               // Slabs allocated so far, most recently allocated first.
+  entry_t *free_list;                // Destroyed entries ready for reuse, linked through their next field.
+  size_t unused;                     // Entries at the end of the most recent slab that were never handed out.
+  size_t entry_size;                 // Bytes per entry, including any entry_meta_t behind it.
+  hash_table_allocator_t allocator;  // Arena that slabs are allocated from.
+};
+
+/// @brief Storage of the string keys owned by a hash table.
+struct key_arena
+{
+  key_chunk_t *chunks;                            // Chunks short keys are carved from, most recently allocated first.
+  size_t unused;                                  // Bytes at the end of the most recent chunk never handed out.
+  owned_key_t *free_lists[KEY_SIZE_CLASSES];      // Freed short keys ready for reuse, per size class.
+  key_chunk_t *long_keys;                         // Chunks holding a single long key each, doubly linked.
+};
+
+/// @brief Ring buffer of the most recent changes to a hash table.
+struct change_log
+{
+  hash_table_change_t *records;  // Records of the changes, indexed by sequence number modulo the capacity.
+  uint64_t mask;                 // Capacity minus 1, the capacity being a power of two.
+  uint64_t next_seq;             // Sequence number of the next change.
+};
+
+/// @brief Blocked Bloom filter of the hashes of the entries of a chained hash table.
+struct bloom_filter
+{
+  uint64_t *blocks;   // Blocks of FILTER_BLOCK_WORDS words, aligned to cache lines; NULL for no filter.
+  size_t no_blocks;   // Number of blocks.
+};
+
+/// @brief Counters of a hash table that are only maintained when built with HASH_TABLE_STATS.
+struct hash_table_counters
+{
+  size_t no_finds;              // Searches for a key by any operation.
+  size_t no_filter_rejections;  // Searches answered by the filter alone, as the key was missing.
+  size_t no_probes;             // Entries (chained) or groups (open addressing) examined by searches for a key.
+  uint64_t rehash_nanoseconds;  // Time spent moving entries into new buckets or slots.
+};
+
+/// @brief Operations a storage backend provides to the public hash table API.
+struct hash_table_ops
+{
+  hash_table_status_t (*insert)(hash_table_t *ht, const elem_t key, const elem_t value, const unsigned long hash); // Insert or update a key-value pair.
+  bool (*lookup)(hash_table_t *ht, const elem_t key, const unsigned long hash, elem_t *result); // Lookup value for key.
+  void (*insert_batch)(hash_table_t *ht, const elem_t *keys, const elem_t *values, const size_t no_keys); // Insert pairs in order.
+  size_t (*lookup_batch)(hash_table_t *ht, const elem_t *keys, const size_t no_keys, elem_t *results, bool *found); // Lookup keys.
+  bool (*remove)(hash_table_t *ht, const elem_t key, const unsigned long hash, elem_t *result); // Remove mapping for key.
+  elem_t *(*upsert)(hash_table_t *ht, const elem_t key, const elem_t value, const unsigned long hash, bool *inserted); // Get or insert value slot.
+  bool (*update)(hash_table_t *ht, const elem_t key, const unsigned long hash, apply_function_ht f, const void *x, elem_t *updated); // Apply f to value for key.
+  bool (*reserve)(hash_table_t *ht, const size_t no_entries, const bool shrink); // Resize to hold no_entries, shrinking if told to.
+  void (*clear)(hash_table_t *ht);                                         // Remove all entries.
+  void (*destroy)(hash_table_t *ht);                                       // Release backend storage.
+  void (*for_each)(hash_table_t *ht, hash_table_visitor visit, void *extra); // Visit entries until told to stop.
+  void (*for_each_range)(hash_table_t *ht, const size_t begin, const size_t end, hash_table_visitor visit, void *extra); // Visit bucket positions [begin, end), NULL if walks cannot be split.
+  unsigned long (*stored_hash)(hash_table_t *ht, elem_t *value);          // Hash stored along with a value slot handed to a visitor.
+  void (*stats)(hash_table_t *ht, hash_table_stats_t *stats);                // Measure chains or probe sequences.
+  bool (*iter_next)(hash_table_iter_t *iter, elem_t *key, elem_t **value);   // Advance a walk to the next entry.
+  bool (*iter_remove)(hash_table_iter_t *iter);                             // Remove the current entry of a walk, false if refused.
+};
+
+/// @brief Actual hash table that maps generic keys to values.
+struct hash_table
+{
+  const hash_table_ops_t *ops;  // Backend operations the public functions dispatch to.
+  hash_table_backend_t backend; // Storage backend the hash table was created with.
+  size_t no_buckets;            // Number of buckets (chained) or slots (open addressing) to store entries in.
+  float load_factor;            // Maximum load factor before hash table gets resized.
+  float min_load_factor;        // Load factor below which removals shrink the hash table, 0 to never shrink.
+  hash_function hash_function;  // Hash function to hash keys with.
+  predicate_ht key_equiv;       // Function that determines how keys will get compared.
+  predicate_ht value_equiv;     // Function that detetmines how values will get compared.
+  size_t size;                  // Load/number of entries in the hash table.
+  entry_t **buckets;            // Heads of the chains in which entries are stored, NULL if empty (chained).
+  bucket_reciprocal_t bucket_reciprocal;     // Reciprocal of no_buckets, see bucket_index (chained).
+  bucket_reciprocal_t old_bucket_reciprocal; // Reciprocal of no_old_buckets (chained).
+  entry_pool_t pool;            // Slabs that entries are allocated from (chained).
+  entry_t **old_buckets;        // Buckets still being migrated from during an incremental rehash, otherwise NULL (chained).
+  size_t no_old_buckets;        // Number of buckets in old_buckets (chained).
+  size_t rehash_index;          // Next bucket in old_buckets to migrate; all buckets before it are empty (chained).
+  size_t rehash_step;           // Buckets migrated per operation during an incremental rehash, 0 for synchronous rehashing (chained).
+  int8_t *ctrl;                 // Control byte per slot: empty, deleted or 7 bits of the hash (open addressing).
+  open_slot_t *slots;           // Inline key-value slots, parallel to ctrl (open addressing).
+  size_t growth_left;           // Empty slots that may be filled before a resize is needed (open addressing).
+  hash_table_sync_t *sync;      // Locks and bucket arrays shared between threads, NULL unless concurrent.
+  void *mapping;                // Memory mapping of a snapshot file (mapped).
+  size_t mapping_size;          // Length of mapping in bytes (mapped).
+  const uint64_t *offsets;      // Index of the first entry of every bucket, plus the number of entries at the end (mapped).
+  snapshot_entry_t *entries;    // Entries packed bucket by bucket (mapped).
+  size_t no_resizes;            // Rehashes started since creation.
+  bool owned_keys;              // Whether string keys are copied into keys on insertion.
+  key_arena_t keys;             // Copies of the keys, if owned_keys is set.
+  bool cache;                   // Whether entries are evicted on insertion to stay within a budget (chained).
+  size_t max_entries;           // Entries held at most in cache mode, 0 for no limit.
+  size_t max_bytes;             // Total cost of the entries held at most in cache mode, 0 for no limit.
+  size_t cache_bytes;           // Total cost of the entries.
+  size_t clock_hand;            // Bucket position the next eviction sweep starts at, see chained_for_each_range.
+  hash_table_cost_function cost_function;   // Cost of a newly inserted entry in cache mode, NULL for its own size.
+  hash_table_evict_function evict_function; // Called with every evicted entry, NULL for none.
+  void *evict_extra;            // Data passed to evict_function.
+  hash_table_clock_function clock_function; // Clock that expiry times are measured with, NULL for milliseconds of the monotonic clock.
+  void *clock_extra;            // Data passed to clock_function.
+  timer_wheel_t *wheel;         // Timers of the entries with a time to live, NULL until the first is inserted (chained).
+  hash_table_t **shards;        // Independent hash tables keys are spread over (sharded), otherwise NULL.
+  size_t no_shards;             // Number of shards, a power of two (sharded).
+  unsigned shard_shift;         // Bits the mixed hash of a key is shifted right by to get its shard (sharded).
+  int *shard_nodes;             // NUMA node the entries of every shard are allocated on, -1 for none (sharded).
+  change_log_t *log;            // Most recent changes, NULL unless created with change_log_size; shared by the shards of a sharded table.
+  bloom_filter_t filter;        // Filter of the hashes of all entries, or during a rehash of those migrated or inserted since it started (chained).
+  bloom_filter_t old_filter;    // Filter of the entries when an ongoing rehash started, without blocks otherwise (chained).
+  size_t filter_stale;          // Entries removed since the filter was built, whose bits are still set (chained).
+  hash_table_counters_t counters; // Statistics counters, only updated when built with HASH_TABLE_STATS.
+};
+
+#ifdef HASH_TABLE_STATS
+/// Add to a statistics counter of a hash table; atomically, since concurrent hash tables update them from any thread.
+#define STATS_ADD(ht, counter, n) __atomic_fetch_add(&(ht)->counters.counter, (n), __ATOMIC_RELAXED)
+#else
+/// Statistics counters are not maintained, so nothing is added.
+#define STATS_ADD(ht, counter, n) ((void) (n))
+#endif
+
+/**
+ * @brief Read a monotonic clock to time rehashes with.
+ * @return Nanoseconds since an arbitrary starting point, always 0 unless built with HASH_TABLE_STATS.
+ **/
+static inline uint64_t stats_clock(void)
+{
+#ifdef HASH_TABLE_STATS
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec;
+#else
+  return 0;
+#endif
+}
+
+/**
+ * @brief Precompute the reciprocal of a number of buckets.
+ * @param no_buckets Number of buckets, at least 1.
+ * @return The reciprocal to pass to bucket_index along with the number of buckets.
+ * 
+ * The reciprocal is the 128-bit fixed-point value ceil(2^128 / no_buckets), which wraps around to 0 for a
+ * single bucket.
+ **/
+static inline bucket_reciprocal_t bucket_reciprocal(const size_t no_buckets)
+{
+  return ~(bucket_reciprocal_t) 0 / no_buckets + 1;
+}
+
+/**
+ * @brief Get the bucket a hash belongs in, which is the hash modulo the number of buckets.
+ * @param hash Hash of a key.
+ * @param no_buckets Number of buckets.
+ * @param reciprocal Reciprocal of the number of buckets, as returned by bucket_reciprocal.
+ * @return Index of the bucket.
+ * 
+ * Bucket counts are primes only known at runtime, so computing the remainder directly would take a hardware
+ * division on every operation. Instead the remainder is computed with multiplications (Lemire's fastmod):
+ * the low 128 bits of reciprocal * hash are the fractional part of hash / no_buckets, and multiplying that
+ * fraction by no_buckets leaves the remainder in the bits above the 128th. With a 128-bit reciprocal this is
+ * exact for every 64-bit hash and bucket count.
+ **/
+static inline size_t bucket_index(const unsigned long hash, const size_t no_buckets, const bucket_reciprocal_t reciprocal)
+{
+  const bucket_reciprocal_t fraction = reciprocal * (uint64_t) hash;
+  const bucket_reciprocal_t carry = (fraction & UINT64_MAX) * no_buckets >> 64;
+  return (size_t) (((fraction >> 64) * no_buckets + carry) >> 64);
+}
+
+/**
+ * @brief Check whether removals have brought the load of a hash table below its minimum load factor.
+ * @param ht Hash table operated upon.
+ * @param size Number of entries.
+ * @param no_buckets Number of buckets or slots.
+ * @return True if the hash table should shrink, never if it was created without a minimum load factor.
+ **/
+static inline bool below_min_load(const hash_table_t *ht, const size_t size, const size_t no_buckets)
+{
+  return (float) size / (float) no_buckets < ht->min_load_factor;
+}
+
+/**
+ * @brief Turn the outcome of an upsert into that of an insertion, replacing the value of an existing entry.
+ * @param slot Value slot returned by the upsert, NULL if the key could not be inserted.
+ * @param inserted Whether the upsert inserted the key.
+ * @param value Value to store for an existing key.
+ * @return Status of the insertion.
+ **/
+static inline hash_table_status_t insert_status(elem_t *slot, const bool inserted, const elem_t value)
+{
+  if (slot == NULL)
+    return HASH_TABLE_NO_MEMORY;
+  if (inserted)
+    return HASH_TABLE_INSERTED;
+  *slot = value;
+  return HASH_TABLE_UPDATED;
+}
+
+/**
+ * @brief Get the entry of a chained hash table that a value slot belongs to.
+ * @param value Value slot of an entry, as returned by an upsert.
+ * @return The entry holding the slot.
+ **/
+static inline entry_t *entry_of_value(elem_t *value)
+{
+  return (entry_t *) ((char *) value - offsetof(entry_t, value));
+}
+
+/**
+ * @brief Get the hash stored in the entry of a chained hash table that a value slot belongs to.
+ * @param ht Hash table operated upon.
+ * @param value Value slot of an entry, as handed to a visitor.
+ * @return The hash of the key of the entry.
+ **/
+static inline unsigned long entry_stored_hash(hash_table_t *ht, elem_t *value)
+{
+  return entry_of_value(value)->hash;
+}
+
+/**
+ * @brief Get the bookkeeping stored behind an entry.
+ * @param entry Entry allocated from a pool with room for an entry_meta_t behind every entry.
+ * @return The bookkeeping of the entry.
+ **/
+static inline entry_meta_t *entry_meta(const entry_t *entry)
+{
+  return (entry_meta_t *) (entry + 1);
+}
+
+/**
+ * @brief Check whether an entry pool hands out room for an entry_meta_t behind every entry.
+ * @param pool Entry pool to examine.
+ * @return True if the entries of the pool carry bookkeeping.
+ **/
+static inline bool entry_pool_has_meta(const entry_pool_t *pool)
+{
+  return pool->entry_size > sizeof(entry_t);
+}
+
+/**
+ * @brief Report an event to the registered log function, if any.
+ * @param ht Hash table the event is about, or NULL if it happened while creating one.
+ * @param event Kind of event.
+ * @param format Format of the message, as for printf, which is only formatted if a log function is registered.
+ **/
+void hash_table_log(const hash_table_t *ht, const hash_table_event_t event, const char *format, ...) __attribute__((format(printf, 3, 4)));
+
+/**
+ * @brief Get the smallest prime number greater than or equal to a given number.
+ * @param num Lower bound for the prime number.
+ * @return The next prime number, or 0 if no such number fits in a size_t.
+ **/
+size_t get_next_prime_number(const size_t num);
+
+/**
+ * @brief Get the number of buckets a chained hash table needs to hold a number of entries without growing.
+ * @param ht Hash table whose load factor to use.
+ * @param no_entries Number of entries.
+ * @return The smallest prime number of buckets that keeps the load below the load factor until no_entries
+ * entries are stored, or 0 if no such number fits in a size_t.
+ **/
+size_t buckets_for_entries(const hash_table_t *ht, const size_t no_entries);
+
+/**
+ * @brief Add the chains of a bucket array to the chain length statistics of a hash table.
+ * @param buckets Heads of the chains.
+ * @param no_buckets Number of buckets.
+ * @param stats Statistics to add the chains to, whose maximum chain length and histogram are updated.
+ * @return The number of non-empty chains.
+ **/
+size_t chains_measure(entry_t *const *buckets, const size_t no_buckets, hash_table_stats_t *stats);
+
+/**
+ * @brief Set the hash and comparison functions of a newly allocated hash table.
+ * @param ht Hash table operated upon.
+ * @param options Options holding the functions, where NULL selects the defaults for integer keys and values, or
+ * the comparison function matching a built-in hash function.
+ **/
+void functions_init(hash_table_t *ht, const hash_table_options_t *options);
+
+/**
+ * @brief Find the link to a certain hash, without comparing keys.
+ * @param head Head of the bucket.
+ * @param key Hashed key.
+ * @return A pointer to the link, either the head or the next field of an entry, to the first entry whose hash
+ * is not less than key.
+ **/
+entry_t **find_link_for_key(entry_t **head, const unsigned long key);
+
+/**
+ * @brief Find the link to a certain key, confirming equal hashes with the key comparison function.
+ * @param ht Hash table whose key comparison function to use.
+ * @param head Head of the bucket.
+ * @param key Key to find.
+ * @param hash Hash of the key.
+ * @return A pointer to the link to the entry for the key or, if the key is not stored, the link where it
+ * would be inserted. Either way the key is stored if and only if the linked entry has the same hash.
+ **/
+entry_t **find_link_matching(hash_table_t *ht, entry_t **head, const elem_t key, const unsigned long hash);
+
+/**
+ * @brief Create a new entry.
+ * @param pool Entry pool to allocate the entry from.
+ * @param key Key to associate with entry.
+ * @param value Value to associate with entry.
+ * @param hash Hash of the key.
+ * @param next An entry pointer to the next entry.
+ * @return A pointer to the newly created entry.
+ **/
+entry_t *entry_create(entry_pool_t *pool, const elem_t key, const elem_t value, const unsigned long hash, entry_t *next);
+
+/**
+ * @brief Destroy an entry by returning it to its pool.
+ * @param pool Entry pool the entry was allocated from.
+ * @param entry Entry to destroy.
+ **/
+void entry_destroy(entry_pool_t *pool, entry_t *entry);
+
+/**
+ * @brief Allocate a slab of entries for the caller to fill in, which the pool owns from then on.
+ * @param pool Entry pool operated upon.
+ * @param no_entries Number of entries of the slab.
+ * @return A pointer to the first entry of the slab, or NULL if memory allocation failed.
+ **/
+entry_t *entry_pool_alloc_slab(entry_pool_t *pool, const size_t no_entries);
+
+/**
+ * @brief Release every slab of an entry pool, destroying all entries allocated from it at once.
+ * @param pool Entry pool operated upon.
+ **/
+void entry_pool_release(entry_pool_t *pool);
+
+/**
+ * @brief Hand every slab of an entry pool over to another pool with the same allocator and entry size.
+ * @param dst Entry pool taking over the slabs.
+ * @param src Entry pool giving up its slabs, which is left empty.
+ **/
+void entry_pool_merge(entry_pool_t *dst, entry_pool_t *src);
+
+/**
+ * @brief Give every entry of a chained hash table room for bookkeeping, moving them into a new pool if needed.
+ * @param ht Hash table operated upon.
+ * @return True if the entries carry bookkeeping, false if memory allocation failed.
+ **/
+bool chained_widen_entries(hash_table_t *ht);
+
+/**
+ * @brief Find the link to a certain key in whichever bucket array of a chained hash table holds it.
+ * @param ht Hash table operated upon.
+ * @param key Key to find.
+ * @param hash Hash of the key.
+ * @return A pointer to the link to the key, in the current buckets if the key is not stored in the old ones.
+ **/
+entry_t **find_link_in_table(hash_table_t *ht, const elem_t key, const unsigned long hash);
+
+/**
+ * @brief Expire an entry of a chained hash table, passing it to the evict function before destroying it.
+ * @param ht Hash table operated upon.
+ * @param link Link to the entry, either a bucket head or the next field of another entry.
+ **/
+void chained_expire(hash_table_t *ht, entry_t **link);
+
+/**
+ * @brief Get the current time of the clock of a hash table.
+ * @param ht Hash table operated upon.
+ * @return The time returned by its clock function or, without one, milliseconds of the monotonic clock.
+ **/
+uint64_t expiry_now(const hash_table_t *ht);
+
+/**
+ * @brief Check whether an entry of a chained hash table has expired.
+ * @param ht Hash table operated upon.
+ * @param entry Entry to examine.
+ * @return True if the entry has a time to live that has passed; the clock is only read if it has one, and
+ * entries without bookkeeping never have one.
+ **/
+static inline bool entry_expired(const hash_table_t *ht, const entry_t *entry)
+{
+  return entry_pool_has_meta(&ht->pool) && entry_meta(entry)->expires != 0 && entry_meta(entry)->expires <= expiry_now(ht);
+}
+
+/**
+ * @brief Schedule a timer for an entry of a hash table that carries an expiry time.
+ * @param ht Hash table operated upon.
+ * @param entry Entry whose expiry time is set.
+ * @return True if the timer was scheduled, false if memory allocation failed.
+ **/
+bool expiry_schedule(hash_table_t *ht, entry_t *entry);
+
+/**
+ * @brief Hand every timer of a hash table over to another one, along with the entries they expire.
+ * @param dst Hash table taking over the timers.
+ * @param src Hash table giving up its timers, which is left without a timer wheel.
+ **/
+void expiry_merge(hash_table_t *dst, hash_table_t *src);
+
+/**
+ * @brief Record a change to a hash table in its change log, if it has one.
+ * @param ht Hash table operated upon.
+ * @param kind What changed.
+ * @param key Key that changed.
+ * @param value Value of the key after an insertion, before a removal.
+ **/
+static inline void change_log_append(const hash_table_t *ht, const hash_table_change_kind_t kind, const elem_t key, const elem_t value)
+{
+  change_log_t *log = ht->log;
+  if (log == NULL)
+    return;
+  hash_table_change_t *record = &log->records[log->next_seq & log->mask];
+  record->seq = log->next_seq;
+  record->kind = kind;
+  record->key = key;
+  record->value = value;
+  log->next_seq += 1;
+}
+
+/**
+ * @brief Get the block of a filter that a hash sets and tests bits in, and the bits within every word.
+ * @param filter Filter operated upon, which has blocks.
+ * @param hash Hash of a key.
+ * @param bits Array of FILTER_BLOCK_WORDS masks where the bit of every word will be stored.
+ * @return The first word of the block.
+ * 
+ * The hash is mixed first, since the bucket index of a key already depends on all of its bits. The high half
+ * of the mixed hash picks the block and the low half is multiplied by a different odd salt per word, whose
+ * top bits pick the bit within the word.
+ **/
+static inline uint64_t *filter_block(const bloom_filter_t *filter, const unsigned long hash, uint64_t *bits)
+{
+  static const uint32_t salts[FILTER_BLOCK_WORDS] = {
+    0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU, 0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+  };
+  const uint64_t mixed = ((uint64_t) hash ^ ((uint64_t) hash >> 31)) * UINT64_C(0xC2B2AE3D27D4EB4F);
+  for (size_t w = 0; w < FILTER_BLOCK_WORDS; w++)
+    {
+      bits[w] = UINT64_C(1) << (((uint32_t) mixed * salts[w]) >> 26);
+    }
+  return &filter->blocks[((mixed >> 32) * filter->no_blocks >> 32) * FILTER_BLOCK_WORDS];
+}
+
+/**
+ * @brief Add a hash to a filter.
+ * @param filter Filter operated upon, which has blocks.
+ * @param hash Hash of the key of an entry.
+ **/
+static inline void filter_add(bloom_filter_t *filter, const unsigned long hash)
+{
+  uint64_t bits[FILTER_BLOCK_WORDS];
+  uint64_t *block = filter_block(filter, hash, bits);
+  for (size_t w = 0; w < FILTER_BLOCK_WORDS; w++)
+    {
+      block[w] |= bits[w];
+    }
+}
+
+/**
+ * @brief Test whether a hash may have been added to a filter.
+ * @param filter Filter operated upon, which has blocks.
+ * @param hash Hash of a key.
+ * @return False if the hash was never added, true if it may have been.
+ **/
+static inline bool filter_may_contain(const bloom_filter_t *filter, const unsigned long hash)
+{
+  uint64_t bits[FILTER_BLOCK_WORDS];
+  const uint64_t *block = filter_block(filter, hash, bits);
+  uint64_t missing = 0;
+  for (size_t w = 0; w < FILTER_BLOCK_WORDS; w++)
+    {
+      missing |= bits[w] & ~block[w];
+    }
+  return missing == 0;
+}
+
+/**
+ * @brief Check whether the filters of a chained hash table rule out that a key is stored.
+ * @param ht Hash table operated upon.
+ * @param hash Hash of the key.
+ * @return True if the key is certainly missing, never if the hash table has no filter.
+ * 
+ * During a rehash an entry may be in either filter, so a key is only ruled out if both of them reject it.
+ **/
+static inline bool filter_rejects(hash_table_t *ht, const unsigned long hash)
+{
+  if (ht->filter.blocks == NULL || filter_may_contain(&ht->filter, hash)
+      || (ht->old_filter.blocks != NULL && filter_may_contain(&ht->old_filter, hash)))
+    return false;
+  STATS_ADD(ht, no_filter_rejections, 1);
+  return true;
+}
+
+/**
+ * @brief Allocate an empty filter for a chained hash table with a number of buckets.
+ * @param ht Hash table whose load factor to use.
+ * @param filter Filter to initialize.
+ * @param no_buckets Number of buckets of the hash table.
+ * @return True if the filter was allocated, false otherwise.
+ **/
+bool filter_init(const hash_table_t *ht, bloom_filter_t *filter, const size_t no_buckets);
+
+/**
+ * @brief Release the blocks of a filter, leaving it without any.
+ * @param filter Filter to release.
+ **/
+void filter_release(bloom_filter_t *filter);
+
+/**
+ * @brief Empty the filter of a chained hash table whose entries were all removed at once.
+ * @param ht Hash table operated upon, which has a filter.
+ **/
+void filter_reset(hash_table_t *ht);
+
+/**
+ * @brief Build the filter of a chained hash table anew from its entries, dropping the stale bits of removed ones.
+ * @param ht Hash table operated upon, which has a filter.
+ **/
+void filter_rebuild(hash_table_t *ht);
+
+/**
+ * @brief Count an entry removed from a chained hash table against its filter, rebuilding the filter if due.
+ * @param ht Hash table operated upon, which has a filter.
+ **/
+void filter_forget(hash_table_t *ht);
+
+/**
+ * @brief Add the shape of the filters of a chained hash table to its statistics.
+ * @param ht Hash table operated upon.
+ * @param stats Statistics to fill in the size and false positive rate of the filters in.
+ **/
+void filter_stats(const hash_table_t *ht, hash_table_stats_t *stats);
+
+/**
+ * @brief Allocate the change log of a newly created hash table.
+ * @param ht Hash table operated upon, which must not have a change log yet.
+ * @param no_records Number of changes to keep, rounded up to a power of two.
+ * @return True if the change log was allocated, false otherwise.
+ **/
+bool change_log_init(hash_table_t *ht, const size_t no_records);
+
+/**
+ * @brief Release a change log along with its records.
+ * @param log Change log to release, or NULL.
+ **/
+void change_log_destroy(change_log_t *log);
+
+/**
+ * @brief Release a timer wheel along with all of its timers.
+ * @param wheel Timer wheel to release, or NULL.
+ **/
+void timer_wheel_destroy(timer_wheel_t *wheel);
+
+/**
+ * @brief Migrate every remaining old bucket of an ongoing incremental rehash of a chained hash table.
+ * @param ht Hash table operated upon.
+ **/
+void chained_rehash_finish(hash_table_t *ht);
+
+/**
+ * @brief Copy a string key into the storage of a hash table.
+ * @param arena Key arena to allocate the copy from.
+ * @param key Key to copy, whose pointer is replaced by one to the copy.
+ * @return True if the key was copied, false if memory allocation failed.
+ **/
+bool key_arena_copy(key_arena_t *arena, elem_t *key);
+
+/**
+ * @brief Free the copy of a key, for reuse by later copies.
+ * @param arena Key arena the copy was allocated from.
+ * @param key Key as returned by key_arena_copy.
+ **/
+void key_arena_free(key_arena_t *arena, const elem_t key);
+
+/**
+ * @brief Release all memory of a key arena, freeing every copy allocated from it at once.
+ * @param arena Key arena operated upon.
+ **/
+void key_arena_release(key_arena_t *arena);
+
+/**
+ * @brief Hand every copy of a key arena over to another key arena.
+ * @param dst Key arena taking over the copies.
+ * @param src Key arena giving up its copies, which is left empty.
+ **/
+void key_arena_merge(key_arena_t *dst, key_arena_t *src);
+
+/**
+ * @brief Set up open addressing storage for a newly allocated hash table.
+ * @param ht Hash table whose common fields have already been set.
+ * @param capacity Requested number of slots, rounded up to a power of two of at least one probe group.
+ * @return True if storage could be allocated, false otherwise.
+ **/
+bool open_addressing_init(hash_table_t *ht, const size_t capacity);
+
+/// @brief Operations of the open addressing backend.
+extern const hash_table_ops_t open_addressing_ops;
+
+/**
+ * @brief Get the shard of a sharded hash table that a key with a given hash belongs to.
+ * @param ht Sharded hash table operated upon.
+ * @param hash Hash of the key.
+ * @return Index of the shard.
+ * 
+ * The hash is mixed by a Fibonacci multiplication before its high bits are taken, so that the shard does not
+ * depend on the same low bits that pick buckets within the shard.
+ **/
+static inline size_t shard_index(const hash_table_t *ht, const unsigned long hash)
+{
+  return (size_t) (((uint64_t) hash * UINT64_C(0x9E3779B97F4A7C15)) >> ht->shard_shift);
+}
+
+/**
+ * @brief Get the shard of a sharded hash table that a key with a given hash belongs to.
+ * @param ht Sharded hash table operated upon.
+ * @param hash Hash of the key.
+ * @return The shard holding the key if it is stored.
+ **/
+static inline hash_table_t *shard_for_hash(const hash_table_t *ht, const unsigned long hash)
+{
+  return ht->shards[shard_index(ht, hash)];
+}
+
+/**
+ * @brief Create a hash table split into independent shards.
+ * @param options Options to create the hash table with, whose no_shards is more than 1.
+ * @param concurrent Whether the shards are created with hash_table_concurrent_create.
+ * @return A new empty hash table of backend HASH_TABLE_SHARDED, or NULL if creation failed.
+ **/
+hash_table_t *sharded_create(const hash_table_options_t *options, const bool concurrent);
+
+/**
+ * @brief Get the total size of the shards of a sharded hash table.
+ * @param ht Sharded hash table operated upon.
+ * @return The number of entries of all shards.
+ **/
+size_t sharded_size(hash_table_t *ht);
+
+/**
+ * @brief Get the total capacity of the shards of a sharded hash table.
+ * @param ht Sharded hash table operated upon.
+ * @return The number of buckets or slots of all shards.
+ **/
+size_t sharded_capacity(hash_table_t *ht);
+
+/**
+ * @brief Check whether a hash table may be shared between threads.
+ * @param ht Hash table to examine.
+ * @return True if it was created with hash_table_concurrent_create, sharded or not.
+ **/
+static inline bool is_concurrent(const hash_table_t *ht)
+{
+  return ht->sync != NULL || (ht->shards != NULL && ht->shards[0]->sync != NULL);
+}
@@ -0,0 +1,829 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#include "hash_table_internal.h"
+
+/// Number of control bytes probed at once.
+#define GROUP_WIDTH 16
+
+/// Control byte of a slot that has never been used.
+#define CTRL_EMPTY ((int8_t) -128)
+
+/// Control byte of a slot whose entry has been removed (tombstone).
+#define CTRL_DELETED ((int8_t) -2)
+
+/// Highest load factor an open addressing table is allowed to reach.
+#define MAX_LOAD_FACTOR 0.875f
+
+/// Returned by probe_find when no slot holds the sought key.
+#define SLOT_NOT_FOUND SIZE_MAX
+
+/// Number of bits each slot occupies in a group mask, as a power of two.
+#if defined(__SSE2__) || !defined(__ARM_NEON)
+#define GROUP_LANE_SHIFT 0
+#else
+#define GROUP_LANE_SHIFT 2
+#endif
+
+/**
+ * @file hash_table_open.c
+ * @author Marcus Enderskog
+ * @date 2021-04-15
+ * @brief Open addressing backend storing entries inline, probed one group of control bytes at a time.
+ * 
+ * Every slot has a one byte control tag in a parallel array: either empty, deleted, or the low 7 bits of
+ * the (mixed) hash of its key. A lookup compares the tag of the key against a whole group of 16 control
+ * bytes with a single SIMD instruction (SSE2 or NEON, with a portable fallback), and only touches the
+ * slots whose tags match. Groups are probed in triangular order until one containing an empty slot is seen.
+ **/
+
+
+/// @brief Inline key-value slot used by the open addressing backend.
+struct open_slot
+{
+  elem_t key;          // Key to map value to.
+  elem_t value;        // The actual value to be stored.
+  unsigned long hash;  // Hash of the key as returned by the hash function.
+};
+
+/// @brief Bit mask with one lane per slot in a group, set for slots matching some condition.
+typedef uint64_t group_mask_t;
+
+/**
+ * @brief Mix the bits of a hash so that both the group index and the tag depend on all of them.
+ * @param hash Hash as returned by the hash function.
+ * @return Mixed hash.
+ **/
+static uint64_t mix_hash(const unsigned long hash);
+
+/**
+ * @brief Find the slot holding a key.
+ * @param ht Hash table operated upon.
+ * @param key Key to find.
+ * @param hash Hash of the key.
+ * @return Index of the slot, or SLOT_NOT_FOUND if the key is not present.
+ **/
+static size_t probe_find(hash_table_t *ht, const elem_t key, const unsigned long hash);
+
+/**
+ * @brief Find the first empty or deleted slot along the probe sequence of a hash.
+ * @param ctrl Control bytes to probe.
+ * @param capacity Number of slots.
+ * @param mixed Mixed hash of the key.
+ * @return Index of the slot.
+ **/
+static size_t probe_free(const int8_t *ctrl, const size_t capacity, const uint64_t mixed);
+
+/**
+ * @brief Grow or rehash a table in place when no more empty slots may be used.
+ * @param ht Hash table operated upon.
+ * @return True if there is room for another entry afterwards, false otherwise.
+ **/
+static bool open_resize(hash_table_t *ht);
+
+/**
+ * @brief Resize an open addressing hash table to the number of slots that holds a number of entries.
+ * @param ht Hash table operated upon.
+ * @param no_entries Number of entries the hash table should hold without growing.
+ * @param shrink Whether the hash table may end up with fewer slots than it has now.
+ * @return True if the hash table has room for no_entries entries afterwards, false otherwise.
+ **/
+static bool open_reserve(hash_table_t *ht, const size_t no_entries, const bool shrink);
+
+/**
+ * @brief Remove the entry in a slot.
+ * @param ht Hash table operated upon.
+ * @param index Index of a full slot.
+ **/
+static void slot_erase(hash_table_t *ht, const size_t index);
+
+/**
+ * @brief Mix the bits of a hash so that both the group index and the tag depend on all of them.
+ * @param hash Hash as returned by the hash function.
+ * @return Mixed hash.
+ * 
+ * This is the finalizer of MurmurHash3, which makes sequential integer keys hashed with the identity
+ * spread out over groups instead of all starting their probe sequence in the same one.
+ **/
+static uint64_t mix_hash(const unsigned long hash)
+{
+  uint64_t h = (uint64_t) hash;
+  h ^= h >> 33;
+  h *= UINT64_C(0xff51afd7ed558ccd);
+  h ^= h >> 33;
+  h *= UINT64_C(0xc4ceb9fe1a85ec53);
+  h ^= h >> 33;
+  return h;
+}
+
+/**
+ * @brief Get the tag stored in the control byte of a full slot.
+ * @param mixed Mixed hash of the key.
+ * @return The low 7 bits of the mixed hash.
+ **/
+static inline int8_t hash_tag(const uint64_t mixed)
+{
+  return (int8_t) (mixed & 0x7f);
+}
+
+/**
+ * @brief Get the group at which the probe sequence of a hash starts.
+ * @param mixed Mixed hash of the key.
+ * @param group_mask Number of groups minus one.
+ * @return Index of the first group to probe.
+ **/
+static inline size_t hash_group(const uint64_t mixed, const size_t group_mask)
+{
+  return (size_t) (mixed >> 7) & group_mask;
+}
+
+/**
+ * @brief Match every control byte in a group against a given byte.
+ * @param group First control byte of the group.
+ * @param byte Byte to compare against.
+ * @return Mask with the lanes of all matching slots set.
+ **/
+static inline group_mask_t group_match(const int8_t *group, const int8_t byte)
+{
+#if defined(__SSE2__)
+  const __m128i ctrl = _mm_load_si128((const __m128i *) group);
+  return (group_mask_t) _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(byte)));
+#elif defined(__ARM_NEON)
+  const uint8x16_t eq = vceqq_s8(vld1q_s8(group), vdupq_n_s8(byte));
+  return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+#else
+  group_mask_t mask = 0;
+  for (int i = 0; i < GROUP_WIDTH; i++)
+  {
+    if (group[i] == byte)
+      mask |= (group_mask_t) 1 << i;
+  }
+  return mask;
+#endif
+}
+
+/**
+ * @brief Match every control byte in a group that is either empty or deleted.
+ * @param group First control byte of the group.
+ * @return Mask with the lanes of all free slots set.
+ * 
+ * Both kinds of free slots have their sign bit set, which full slots never have.
+ **/
+static inline group_mask_t group_match_free(const int8_t *group)
+{
+#if defined(__SSE2__)
+  return (group_mask_t) _mm_movemask_epi8(_mm_load_si128((const __m128i *) group));
+#elif defined(__ARM_NEON)
+  const uint8x16_t free_lanes = vcltzq_s8(vld1q_s8(group));
+  return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(free_lanes), 4)), 0);
+#else
+  group_mask_t mask = 0;
+  for (int i = 0; i < GROUP_WIDTH; i++)
+  {
+    if (group[i] < 0)
+      mask |= (group_mask_t) 1 << i;
+  }
+  return mask;
+#endif
+}
+
+/**
+ * @brief Get the slot within its group of the lowest set lane in a mask.
+ * @param mask A mask with at least one lane set.
+ * @return Offset of the slot within the group.
+ **/
+static inline size_t mask_lowest(const group_mask_t mask)
+{
+  return (size_t) __builtin_ctzll(mask) >> GROUP_LANE_SHIFT;
+}
+
+/**
+ * @brief Clear the lowest set lane in a mask.
+ * @param mask A mask with at least one lane set.
+ * @return The mask without its lowest lane.
+ **/
+static inline group_mask_t mask_clear_lowest(const group_mask_t mask)
+{
+  const group_mask_t lane = ((group_mask_t) 1 << (1 << GROUP_LANE_SHIFT)) - 1;
+  return mask & ~(lane << (mask_lowest(mask) << GROUP_LANE_SHIFT));
+}
+
+/**
+ * @brief Get the maximum number of entries a table with a given number of slots may hold.
+ * @param ht Hash table operated upon.
+ * @param capacity Number of slots.
+ * @return Maximum number of entries, always leaving at least one slot empty.
+ **/
+static size_t max_load(hash_table_t *ht, const size_t capacity)
+{
+  const float load_factor = ht->load_factor < MAX_LOAD_FACTOR ? ht->load_factor : MAX_LOAD_FACTOR;
+  size_t load = (size_t) ((float) capacity * load_factor);
+  if (load >= capacity)
+    load = capacity - 1;
+  return load == 0 ? 1 : load;
+}
+
+/**
+ * @brief Allocate a control byte array with every slot marked empty.
+ * @param capacity Number of slots.
+ * @return The control bytes, or NULL if memory allocation failed.
+ **/
+static int8_t *ctrl_create(const size_t capacity)
+{
+  int8_t *ctrl = aligned_alloc(GROUP_WIDTH, capacity);
+  if (ctrl != NULL)
+  {
+    memset(ctrl, CTRL_EMPTY, capacity);
+  }
+  return ctrl;
+}
+
+/**
+ * @brief Set up open addressing storage for a newly allocated hash table.
+ * @param ht Hash table whose common fields have already been set.
+ * @param capacity Requested number of slots, rounded up to a power of two of at least one probe group.
+ * @return True if storage could be allocated, false otherwise.
+ **/
+bool open_addressing_init(hash_table_t *ht, const size_t capacity)
+{
+  size_t slots = GROUP_WIDTH;
+  while (slots < capacity)
+  {
+    if (slots > SIZE_MAX / 2 / sizeof(open_slot_t))
+    {
+      hash_table_log(NULL, HASH_TABLE_EVENT_INVALID_ARGUMENT, "Bucket size %zu is too large!", capacity);
+      return false;
+    }
+    slots *= 2;
+  }
+
+  ht->ctrl = ctrl_create(slots);
+  ht->slots = malloc(slots * sizeof(open_slot_t));
+  if (ht->ctrl == NULL || ht->slots == NULL)
+  {
+    hash_table_log(NULL, HASH_TABLE_EVENT_NO_MEMORY, "Failed to allocate memory for hash table entries!");
+    free(ht->ctrl);
+    free(ht->slots);
+    return false;
+  }
+
+  ht->no_buckets = slots;
+  ht->growth_left = max_load(ht, slots);
+  return true;
+}
+
+/**
+ * @brief Find the slot holding a key.
+ * @param ht Hash table operated upon.
+ * @param key Key to find.
+ * @param hash Hash of the key.
+ * @return Index of the slot, or SLOT_NOT_FOUND if the key is not present.
+ * 
+ * Groups are visited in triangular order (offsets 0, 1, 3, 6, ...) which, with a power of two number of
+ * groups, reaches every group exactly once. The first group that has an empty slot ends the probe, since
+ * an insertion of the key would have used that slot. Within a group only slots with a matching tag are
+ * examined, and the key comparison function is only called for those whose full hash matches as well.
+ **/
+static size_t probe_find(hash_table_t *ht, const elem_t key, const unsigned long hash)
+{
+  const uint64_t mixed = mix_hash(hash);
+  const int8_t tag = hash_tag(mixed);
+  const size_t group_mask = ht->no_buckets / GROUP_WIDTH - 1;
+  size_t group = hash_group(mixed, group_mask);
+
+  STATS_ADD(ht, no_finds, 1);
+  for (size_t stride = 1; stride <= group_mask + 1; stride++)
+  {
+    STATS_ADD(ht, no_probes, 1);
+    const int8_t *ctrl = &ht->ctrl[group * GROUP_WIDTH];
+    for (group_mask_t match = group_match(ctrl, tag); match != 0; match = mask_clear_lowest(match))
+    {
+      const size_t index = group * GROUP_WIDTH + mask_lowest(match);
+      if (ht->slots[index].hash == hash && ht->key_equiv(ht->slots[index].key, ht->slots[index].value, &key))
+        return index;
+    }
+    if (group_match(ctrl, CTRL_EMPTY) != 0)
+      break;
+    group = (group + stride) & group_mask;
+  }
+
+  return SLOT_NOT_FOUND;
+}
+
+/**
+ * @brief Find the first empty or deleted slot along the probe sequence of a hash.
+ * @param ctrl Control bytes to probe.
+ * @param capacity Number of slots.
+ * @param mixed Mixed hash of the key.
+ * @return Index of the slot.
+ * 
+ * The table always keeps at least one slot free, so the probe is guaranteed to find one.
+ **/
+static size_t probe_free(const int8_t *ctrl, const size_t capacity, const uint64_t mixed)
+{
+  const size_t group_mask = capacity / GROUP_WIDTH - 1;
+  size_t group = hash_group(mixed, group_mask);
+
+  for (size_t stride = 1; ; stride++)
+  {
+    const group_mask_t free_lanes = group_match_free(&ctrl[group * GROUP_WIDTH]);
+    if (free_lanes != 0)
+      return group * GROUP_WIDTH + mask_lowest(free_lanes);
+    group = (group + stride) & group_mask;
+  }
+}
+
+/**
+ * @brief Move every entry of a table into newly allocated slots.
+ * @param ht Hash table operated upon.
+ * @param capacity_new Number of slots to allocate, a power of two whose maximum load is at least the size.
+ * @return True if memory could be allocated, false otherwise.
+ * 
+ * Entries are moved using their stored hash, so the hash function is never called. Tombstones are dropped.
+ **/
+static bool open_rehash(hash_table_t *ht, const size_t capacity_new)
+{
+  hash_table_log(ht, HASH_TABLE_EVENT_RESIZE, "Rehashing %zu entries into %zu slots", ht->size, capacity_new);
+  const uint64_t start = stats_clock();
+  int8_t *ctrl_new = ctrl_create(capacity_new);
+  open_slot_t *slots_new = malloc(capacity_new * sizeof(open_slot_t));
+  if (ctrl_new == NULL || slots_new == NULL)
+  {
+    hash_table_log(ht, HASH_TABLE_EVENT_NO_MEMORY, "Failed to allocate %zu slots!", capacity_new);
+    free(ctrl_new);
+    free(slots_new);
+    return false;
+  }
+
+  for (size_t i = 0; i < ht->no_buckets; i++)
+  {
+    if (ht->ctrl[i] >= 0)
+    {
+      const uint64_t mixed = mix_hash(ht->slots[i].hash);
+      const size_t index = probe_free(ctrl_new, capacity_new, mixed);
+      ctrl_new[index] = hash_tag(mixed);
+      slots_new[index] = ht->slots[i];
+    }
+  }
+
+  free(ht->ctrl);
+  free(ht->slots);
+  ht->ctrl = ctrl_new;
+  ht->slots = slots_new;
+  ht->no_buckets = capacity_new;
+  ht->growth_left = max_load(ht, capacity_new) - ht->size;
+  ht->no_resizes += 1;
+  STATS_ADD(ht, rehash_nanoseconds, stats_clock() - start);
+  return true;
+}
+
+/**
+ * @brief Grow or rehash a table in place when no more empty slots may be used.
+ * @param ht Hash table operated upon.
+ * @return True if there is room for another entry afterwards, false otherwise.
+ * 
+ * If more than half of the maximum load is made up of live entries the number of slots is doubled;
+ * otherwise the space is mostly wasted on tombstones and the table is rebuilt at its current size.
+ **/
+static bool open_resize(hash_table_t *ht)
+{
+  size_t capacity_new = ht->no_buckets;
+  if (ht->size >= max_load(ht, ht->no_buckets) / 2)
+  {
+    if (ht->no_buckets > SIZE_MAX / 2 / sizeof(open_slot_t))
+    {
+      hash_table_log(ht, HASH_TABLE_EVENT_OVERFLOW, "Resizing not possible, the number of slots would overflow!");
+      return false;
+    }
+    capacity_new = 2 * ht->no_buckets;
+  }
+
+  return open_rehash(ht, capacity_new);
+}
+
+/**
+ * @brief Resize an open addressing hash table to the number of slots that holds a number of entries.
+ * @param ht Hash table operated upon.
+ * @param no_entries Number of entries the hash table should hold without growing.
+ * @param shrink Whether the hash table may end up with fewer slots than it has now.
+ * @return True if the hash table has room for no_entries entries afterwards, false otherwise.
+ * 
+ * The number of slots is the smallest power of two whose maximum load is at least no_entries. A table that
+ * keeps its number of slots is only rebuilt if tombstones leave too few empty slots for no_entries entries.
+ **/
+static bool open_reserve(hash_table_t *ht, const size_t no_entries, const bool shrink)
+{
+  size_t capacity_new = GROUP_WIDTH;
+  while (max_load(ht, capacity_new) < no_entries)
+  {
+    if (capacity_new > SIZE_MAX / 2 / sizeof(open_slot_t))
+    {
+      hash_table_log(ht, HASH_TABLE_EVENT_OVERFLOW, "Resizing not possible, the number of slots would overflow!");
+      return false;
+    }
+    capacity_new *= 2;
+  }
+
+  if (capacity_new < ht->no_buckets && !shrink)
+    capacity_new = ht->no_buckets;
+  if (capacity_new == ht->no_buckets && (no_entries <= ht->size || ht->growth_left >= no_entries - ht->size))
+    return true;
+  return open_rehash(ht, capacity_new);
+}
+
+/**
+ * @brief Get the value slot for an already hashed key in an open addressing hash table, inserting the key if
+ * missing.
+ * @param ht Hash table operated upon.
+ * @param key Key to lookup or insert.
+ * @param value Value to insert the key with if it is missing.
+ * @param hash Hash of the key.
+ * @param inserted Pointer where whether the key was inserted will be stored.
+ * @return A pointer to the value stored for the key, or NULL if the key could not be inserted.
+ * 
+ * A missing key is placed in the first free slot along its probe sequence, reusing tombstones where possible;
+ * if no more empty slots may be used, the hash table gets resized and rehashed first.
+ **/
+static elem_t *open_upsert_hashed(hash_table_t *ht, const elem_t key, const elem_t value, const unsigned long hash, bool *inserted)
+{
+  *inserted = false;
+  const size_t existing = probe_find(ht, key, hash);
+  if (existing != SLOT_NOT_FOUND)
+    return &ht->slots[existing].value;
+
+  const uint64_t mixed = mix_hash(hash);
+  size_t index = probe_free(ht->ctrl, ht->no_buckets, mixed);
+  if (ht->ctrl[index] == CTRL_EMPTY && ht->growth_left == 0)
+  {
+    if (!open_resize(ht))
+    {
+      return NULL;
+    }
+    index = probe_free(ht->ctrl, ht->no_buckets, mixed);
+  }
+
+  elem_t stored_key = key;
+  if (ht->owned_keys && !key_arena_copy(&ht->keys, &stored_key))
+  {
+    hash_table_log(ht, HASH_TABLE_EVENT_NO_MEMORY, "Failed to allocate memory for key!");
+    return NULL;
+  }
+  if (ht->ctrl[index] == CTRL_EMPTY)
+    ht->growth_left -= 1;
+  ht->ctrl[index] = hash_tag(mixed);
+  ht->slots[index].key = stored_key;
+  ht->slots[index].value = value;
+  ht->slots[index].hash = hash;
+  ht->size += 1;
+  *inserted = true;
+  return &ht->slots[index].value;
+}
+
+/**
+ * @brief Insert a key-value pair entry with an already hashed key in an open addressing hash table.
+ * @param ht Hash table to insert into.
+ * @param key Key to insert.
+ * @param value Value to insert.
+ * @param hash Hash of the key.
+ * @return Status of the insertion.
+ * 
+ * An existing entry for the key has its value replaced.
+ **/
+static hash_table_status_t open_insert_hashed(hash_table_t *ht, const elem_t key, const elem_t value, const unsigned long hash)
+{
+  bool inserted;
+  elem_t *slot = open_upsert_hashed(ht, key, value, hash, &inserted);
+  return insert_status(slot, inserted, value);
+}
+
+/**
+ * @brief Lookup value for key in an open addressing hash table.
+ * @param ht Hash table operated upon.
+ * @param key Key to lookup.
+ * @param hash Hash of the key.
+ * @param result Pointer where a found element will be stored.
+ * @return True if a key was found, false otherwise.
+ **/
+static bool open_lookup(hash_table_t *ht, const elem_t key, const unsigned long hash, elem_t *result)
+{
+  const size_t index = probe_find(ht, key, hash);
+  if (index == SLOT_NOT_FOUND)
+    return false;
+
+  *result = ht->slots[index].value;
+  return true;
+}
+
+/**
+ * @brief Hash a window of keys of a batch and prefetch the first group each of them will be probed in.
+ * @param ht Hash table operated upon.
+ * @param keys Keys of the window.
+ * @param no_keys Number of keys in the window, at most BATCH_WINDOW.
+ * @param hashes Array where the hashes of the keys will be stored.
+ * 
+ * Both the control bytes of the group and the first of its slots are prefetched, as a probe whose tag
+ * matches touches them right after one another.
+ **/
+static void open_prefetch_window(hash_table_t *ht, const elem_t *keys, const size_t no_keys, unsigned long *hashes)
+{
+  const size_t group_mask = ht->no_buckets / GROUP_WIDTH - 1;
+  for (size_t i = 0; i < no_keys; i++)
+  {
+    hashes[i] = ht->hash_function(keys[i]);
+    const size_t group = hash_group(mix_hash(hashes[i]), group_mask);
+    __builtin_prefetch(&ht->ctrl[group * GROUP_WIDTH]);
+    __builtin_prefetch(&ht->slots[group * GROUP_WIDTH]);
+  }
+}
+
+/**
+ * @brief Insert a batch of key-value pairs in an open addressing hash table.
+ * @param ht Hash table to insert into.
+ * @param keys Keys to insert.
+ * @param values Values to insert, one per key.
+ * @param no_keys Number of keys.
+ * 
+ * Pairs are inserted one window at a time, each window being hashed and prefetched as a whole beforehand.
+ **/
+static void open_insert_batch(hash_table_t *ht, const elem_t *keys, const elem_t *values, const size_t no_keys)
+{
+  unsigned long hashes[BATCH_WINDOW];
+  for (size_t start = 0; start < no_keys; start += BATCH_WINDOW)
+  {
+    const size_t window = no_keys - start < BATCH_WINDOW ? no_keys - start : BATCH_WINDOW;
+    open_prefetch_window(ht, &keys[start], window, hashes);
+    for (size_t i = 0; i < window; i++)
+      open_insert_hashed(ht, keys[start + i], values[start + i], hashes[i]);
+  }
+}
+
+/**
+ * @brief Lookup values for a batch of keys in an open addressing hash table.
+ * @param ht Hash table operated upon.
+ * @param keys Keys to lookup.
+ * @param no_keys Number of keys.
+ * @param results Array where found values will be stored.
+ * @param found Array of flags telling which keys were found, or NULL.
+ * @return The number of keys found.
+ * 
+ * Keys are resolved one window at a time, each window being hashed and prefetched as a whole beforehand.
+ **/
+static size_t open_lookup_batch(hash_table_t *ht, const elem_t *keys, const size_t no_keys, elem_t *results, bool *found)
+{
+  unsigned long hashes[BATCH_WINDOW];
+  size_t no_found = 0;
+  for (size_t start = 0; start < no_keys; start += BATCH_WINDOW)
+  {
+    const size_t window = no_keys - start < BATCH_WINDOW ? no_keys - start : BATCH_WINDOW;
+    open_prefetch_window(ht, &keys[start], window, hashes);
+    for (size_t i = 0; i < window; i++)
+    {
+      const size_t index = probe_find(ht, keys[start + i], hashes[i]);
+      if (index != SLOT_NOT_FOUND)
+      {
+        results[start + i] = ht->slots[index].value;
+        no_found += 1;
+      }
+      if (found != NULL)
+        found[start + i] = index != SLOT_NOT_FOUND;
+    }
+  }
+  return no_found;
+}
+
+/**
+ * @brief Apply a function to the value for a key in an open addressing hash table.
+ * @param ht Hash table operated upon.
+ * @param key Key whose value to update.
+ * @param hash Hash of the key.
+ * @param f Function to pass the key and a pointer to its value to.
+ * @param x Optional additional data.
+ * @param updated Pointer where the value stored by the update will be stored.
+ * @return True if the key was found and its value updated, false otherwise.
+ **/
+static bool open_update(hash_table_t *ht, const elem_t key, const unsigned long hash, apply_function_ht f, const void *x, elem_t *updated)
+{
+  const size_t index = probe_find(ht, key, hash);
+  if (index == SLOT_NOT_FOUND)
+    return false;
+
+  f(ht->slots[index].key, &ht->slots[index].value, x);
+  *updated = ht->slots[index].value;
+  return true;
+}
+
+/**
+ * @brief Remove any mapping from key to a value in an open addressing hash table.
+ * @param ht Hash table to remove entry from.
+ * @param key Key to remove.
+ * @param hash Hash of the key.
+ * @param result Pointer where a removed element will be stored.
+ * @return True if a key was removed, false otherwise.
+ * 
+ * A slot in a group that still has an empty slot can be marked empty again, since no probe sequence
+ * continues past such a group. Otherwise the slot becomes a tombstone so that probes keep going. Should the
+ * load drop below the minimum load factor, the table shrinks to half of its maximum load.
+ **/
+static bool open_remove(hash_table_t *ht, const elem_t key, const unsigned long hash, elem_t *result)
+{
+  const size_t index = probe_find(ht, key, hash);
+  if (index == SLOT_NOT_FOUND)
+    return false;
+
+  *result = ht->slots[index].value;
+  slot_erase(ht, index);
+  if (below_min_load(ht, ht->size, ht->no_buckets))
+    open_reserve(ht, 2 * ht->size, true);
+  return true;
+}
+
+/**
+ * @brief Remove the entry in a slot.
+ * @param ht Hash table operated upon.
+ * @param index Index of a full slot.
+ * 
+ * A probe only continues past a group that has no empty slot, so if the group of the slot still contains an
+ * empty one no probe sequence relies on this slot being occupied, and it can be marked empty again. Otherwise
+ * it becomes a tombstone until the next rehash.
+ **/
+static void slot_erase(hash_table_t *ht, const size_t index)
+{
+  if (ht->owned_keys)
+    key_arena_free(&ht->keys, ht->slots[index].key);
+  const int8_t *group = &ht->ctrl[index - index % GROUP_WIDTH];
+  if (group_match(group, CTRL_EMPTY) != 0)
+  {
+    ht->ctrl[index] = CTRL_EMPTY;
+    ht->growth_left += 1;
+  }
+  else
+  {
+    ht->ctrl[index] = CTRL_DELETED;
+  }
+  ht->size -= 1;
+}
+
+/**
+ * @brief Clear all entries in an open addressing hash table.
+ * @param ht Hash table operated upon.
+ * 
+ * Since entries are stored inline, this only marks every slot as empty and releases any owned keys at once.
+ **/
+static void open_clear(hash_table_t *ht)
+{
+  memset(ht->ctrl, CTRL_EMPTY, ht->no_buckets);
+  key_arena_release(&ht->keys);
+  ht->size = 0;
+  ht->growth_left = max_load(ht, ht->no_buckets);
+}
+
+/**
+ * @brief Release the storage of an open addressing hash table.
+ * @param ht Hash table operated upon.
+ **/
+static void open_destroy(hash_table_t *ht)
+{
+  key_arena_release(&ht->keys);
+  free(ht->ctrl);
+  free(ht->slots);
+}
+
+/**
+ * @brief Visit the entries of a range of slots of an open addressing hash table.
+ * @param ht Hash table operated upon.
+ * @param begin First slot to visit.
+ * @param end Slot one past the last one to visit.
+ * @param visit Function to pass keys and values to; returning false stops the walk.
+ * @param extra Optional additional data.
+ **/
+static void open_for_each_range(hash_table_t *ht, const size_t begin, const size_t end, hash_table_visitor visit, void *extra)
+{
+  for (size_t i = begin; i < end; i++)
+  {
+    if (ht->ctrl[i] >= 0 && !visit(ht->slots[i].key, &ht->slots[i].value, extra))
+      return;
+  }
+}
+
+/**
+ * @brief Visit the entries of an open addressing hash table.
+ * @param ht Hash table operated upon.
+ * @param visit Function to pass keys and values to; returning false stops the walk.
+ * @param extra Optional additional data.
+ **/
+static void open_for_each(hash_table_t *ht, hash_table_visitor visit, void *extra)
+{
+  open_for_each_range(ht, 0, ht->no_buckets, visit, extra);
+}
+
+/**
+ * @brief Get the hash stored in the slot of an open addressing hash table that a value belongs to.
+ * @param ht Hash table operated upon.
+ * @param value Value of a slot, as handed to a visitor.
+ * @return The hash of the key of the slot.
+ **/
+static unsigned long open_stored_hash(hash_table_t *ht, elem_t *value)
+{
+  return ((open_slot_t *) ((char *) value - offsetof(open_slot_t, value)))->hash;
+}
+
+/**
+ * @brief Measure the probe sequences of an open addressing hash table.
+ * @param ht Hash table operated upon.
+ * @param stats Statistics to store the probe sequence lengths in.
+ * 
+ * The length of the probe sequence of an entry is the number of groups a lookup of its key visits, found by
+ * following the probe sequence of its hash until reaching the group of its slot.
+ **/
+static void open_stats(hash_table_t *ht, hash_table_stats_t *stats)
+{
+  const size_t group_mask = ht->no_buckets / GROUP_WIDTH - 1;
+  size_t total_length = 0;
+  stats->size = ht->size;
+  stats->no_buckets = ht->no_buckets;
+  for (size_t i = 0; i < ht->no_buckets; i++)
+  {
+    if (ht->ctrl[i] < 0)
+      continue;
+
+    size_t group = hash_group(mix_hash(ht->slots[i].hash), group_mask);
+    size_t length = 1;
+    while (group != i / GROUP_WIDTH)
+    {
+      group = (group + length) & group_mask;
+      length++;
+    }
+
+    total_length += length;
+    if (length > stats->max_chain_length)
+      stats->max_chain_length = length;
+    stats->chain_length_histogram[length < HASH_TABLE_STATS_HISTOGRAM_SIZE ? length : HASH_TABLE_STATS_HISTOGRAM_SIZE - 1] += 1;
+  }
+  stats->mean_chain_length = ht->size == 0 ? 0 : (float) total_length / (float) ht->size;
+}
+
+/**
+ * @brief Advance a walk over an open addressing hash table to the next entry.
+ * @param iter Iterator operated upon.
+ * @param key Pointer where the key of the entry will be stored.
+ * @param value Pointer where a pointer to the value of the entry will be stored.
+ * @return True if there was a next entry, false if the walk is over.
+ * 
+ * Slots are scanned in order from the one following the current entry; the bucket field of the iterator is
+ * therefore always one past the slot of the current entry.
+ **/
+static bool open_iter_next(hash_table_iter_t *iter, elem_t *key, elem_t **value)
+{
+  hash_table_t *ht = iter->ht;
+  for (size_t i = iter->bucket; i < ht->no_buckets; i++)
+  {
+    if (ht->ctrl[i] >= 0)
+    {
+      iter->bucket = i + 1;
+      iter->has_current = true;
+      *key = ht->slots[i].key;
+      *value = &ht->slots[i].value;
+      return true;
+    }
+  }
+  iter->bucket = ht->no_buckets;
+  iter->has_current = false;
+  return false;
+}
+
+/**
+ * @brief Remove the current entry of a walk over an open addressing hash table.
+ * @param iter Iterator operated upon, which has a current entry.
+ * @return True, as the entry is always removed.
+ **/
+static bool open_iter_remove(hash_table_iter_t *iter)
+{
+  slot_erase(iter->ht, iter->bucket - 1);
+  iter->has_current = false;
+  return true;
+}
+
+/// @brief Operations of the open addressing backend.
+const hash_table_ops_t open_addressing_ops = {
+  .insert = open_insert_hashed,
+  .lookup = open_lookup,
+  .insert_batch = open_insert_batch,
+  .lookup_batch = open_lookup_batch,
+  .remove = open_remove,
+  .upsert = open_upsert_hashed,
+  .update = open_update,
+  .reserve = open_reserve,
+  .clear = open_clear,
+  .destroy = open_destroy,
+  .for_each = open_for_each,
+  .for_each_range = open_for_each_range,
+  .stored_hash = open_stored_hash,
+  .stats = open_stats,
+  .iter_next = open_iter_next,
+  .iter_remove = open_iter_remove,
+};
@@ -0,0 +1,437 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "hash_table_internal.h"
+
+/// Most threads a parallel operation runs on, whatever the number asked for.
+#define PARALLEL_MAX_THREADS 64
+
+/// Fewest pairs or bucket positions a thread is given, so that small hash tables are not split at a loss.
+#define PARALLEL_MIN_ITEMS 4096
+
+/**
+ * @file hash_table_parallel.c
+ * @author Marcus Enderskog
+ * @date 2021-04-15
+ * @brief Bulk loading of chained hash tables and walks over hash tables split across several threads.
+ *
+ * A parallel build splits the bucket array of a presized chained hash table into one contiguous range per
+ * thread. The pairs are hashed and counted per range in parallel, scattered into an array grouped by range
+ * with a counting sort that keeps their order, and finally linked into their chains by the thread owning
+ * the range. No two threads ever touch the same chain, so no locks are needed, and pairs with equal keys
+ * are resolved in their original order by a single thread. The entries come from a single slab allocated
+ * up front, since entry pools and their allocators are not thread-safe.
+ *
+ * A parallel walk splits the bucket positions of a backend (see for_each_range) the same way. Phases run
+ * by creating threads and joining them; a worker whose thread could not be created is run by the calling
+ * thread instead, so the operations never fail for lack of threads.
+ **/
+
+
+/// @brief State of a parallel build shared by its workers.
+typedef struct build_job
+{
+  hash_table_t *ht;             // Hash table being loaded.
+  const elem_t *keys;           // Keys to insert.
+  const elem_t *values;         // Values to insert, one per key.
+  size_t no_keys;               // Number of keys.
+  size_t no_threads;            // Number of workers, slices of pairs and ranges of buckets.
+  size_t buckets_per_range;     // Number of buckets of every range but possibly the last.
+  unsigned long *hashes;        // Hash of every key.
+  size_t *offsets;              // Pairs of slice s in range r, counted at [s * no_threads + r], then their first index in order.
+  size_t *range_starts;         // First index in order of every range, plus no_keys at the end.
+  size_t *order;                // Indices of the pairs, grouped by range and in their original order within a range.
+  entry_t *entries;             // Entries to link, no_keys of them, where range r uses those from range_starts[r] on.
+} build_job_t;
+
+/// @brief Worker of a parallel build, which handles one slice of the pairs and one range of the buckets.
+typedef struct build_worker
+{
+  build_job_t *job;             // Build the worker takes part in.
+  size_t index;                 // Index of the slice and the range of the worker.
+  size_t no_inserted;           // Pairs of the range that were new keys, once linked.
+} build_worker_t;
+
+/// @brief State of a parallel walk shared by its workers.
+typedef struct walk_job
+{
+  hash_table_t *ht;             // Hash table being walked.
+  size_t no_positions;          // Number of bucket positions to split.
+  size_t no_threads;            // Number of workers and ranges.
+  hash_table_visitor visit;     // Function every worker visits its entries with.
+  apply_function_ht f;          // Function to apply, for hash_table_apply_to_all_parallel.
+  predicate_ht P;               // Predicate to check, for hash_table_all_parallel and hash_table_any_parallel.
+  bool stop_on;                 // Outcome of P that settles the result of the walk.
+  const void *x;                // Optional additional data passed to f or P.
+  bool stop;                    // Set once an entry settled the result, read by every worker.
+} walk_job_t;
+
+/// @brief Worker of a parallel walk, which visits one range of the bucket positions.
+typedef struct walk_worker
+{
+  walk_job_t *job;              // Walk the worker takes part in.
+  size_t index;                 // Index of the range of the worker.
+} walk_worker_t;
+
+/**
+ * @brief Decide how many threads to split some work across.
+ * @param no_threads Number of threads asked for, 0 for one per online processor.
+ * @param no_items Number of pairs or bucket positions to split.
+ * @return Number of threads, at least 1, at most PARALLEL_MAX_THREADS and such that every thread gets at
+ * least PARALLEL_MIN_ITEMS items.
+ **/
+static size_t parallel_threads(const size_t no_threads, const size_t no_items)
+{
+  size_t threads = no_threads;
+  if (threads == 0)
+  {
+    const long online = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = online > 0 ? (size_t) online : 1;
+  }
+  if (threads > PARALLEL_MAX_THREADS)
+    threads = PARALLEL_MAX_THREADS;
+  if (threads > no_items / PARALLEL_MIN_ITEMS)
+    threads = no_items / PARALLEL_MIN_ITEMS;
+  return threads == 0 ? 1 : threads;
+}
+
+/**
+ * @brief Get the first item of a part of some items split evenly.
+ * @param no_items Number of items split.
+ * @param no_parts Number of parts.
+ * @param part Index of the part, up to and including no_parts for the end of the last part.
+ * @return Index of the first item of the part.
+ **/
+static size_t part_begin(const size_t no_items, const size_t no_parts, const size_t part)
+{
+  const size_t remainder = no_items % no_parts;
+  return no_items / no_parts * part + (part < remainder ? part : remainder);
+}
+
+/**
+ * @brief Run one phase of a parallel operation, with one thread per worker, and wait for all of them.
+ * @param workers Array of workers.
+ * @param worker_size Size in bytes of every worker.
+ * @param no_workers Number of workers, at most PARALLEL_MAX_THREADS.
+ * @param task Function to run with every worker.
+ *
+ * The first worker is run by the calling thread, as is any worker whose thread could not be created.
+ **/
+static void run_workers(void *workers, const size_t worker_size, const size_t no_workers, void *(*task)(void *))
+{
+  pthread_t threads[PARALLEL_MAX_THREADS];
+  bool started[PARALLEL_MAX_THREADS] = { false };
+  for (size_t i = 1; i < no_workers; i++)
+  {
+    void *worker = (char *) workers + i * worker_size;
+    started[i] = pthread_create(&threads[i], NULL, task, worker) == 0;
+    if (!started[i])
+      task(worker);
+  }
+  task(workers);
+  for (size_t i = 1; i < no_workers; i++)
+  {
+    if (started[i])
+      pthread_join(threads[i], NULL);
+  }
+}
+
+/**
+ * @brief Get the bucket range a hash belongs to.
+ * @param job Build operated upon.
+ * @param hash Hash of a key.
+ * @return Index of the range.
+ **/
+static inline size_t build_range(const build_job_t *job, const unsigned long hash)
+{
+  return bucket_index(hash, job->ht->no_buckets, job->ht->bucket_reciprocal) / job->buckets_per_range;
+}
+
+/**
+ * @brief Hash the keys of the slice of a worker and count them per bucket range.
+ * @param arg Build worker.
+ * @return NULL
+ **/
+static void *build_hash_task(void *arg)
+{
+  build_worker_t *worker = arg;
+  build_job_t *job = worker->job;
+  size_t *counts = &job->offsets[worker->index * job->no_threads];
+  const size_t end = part_begin(job->no_keys, job->no_threads, worker->index + 1);
+  for (size_t i = part_begin(job->no_keys, job->no_threads, worker->index); i < end; i++)
+  {
+    const unsigned long hash = job->ht->hash_function(job->keys[i]);
+    job->hashes[i] = hash;
+    counts[build_range(job, hash)] += 1;
+  }
+  return NULL;
+}
+
+/**
+ * @brief Scatter the pairs of the slice of a worker into the order of their bucket ranges.
+ * @param arg Build worker.
+ * @return NULL
+ **/
+static void *build_scatter_task(void *arg)
+{
+  build_worker_t *worker = arg;
+  build_job_t *job = worker->job;
+  size_t *next = &job->offsets[worker->index * job->no_threads];
+  const size_t end = part_begin(job->no_keys, job->no_threads, worker->index + 1);
+  for (size_t i = part_begin(job->no_keys, job->no_threads, worker->index); i < end; i++)
+  {
+    job->order[next[build_range(job, job->hashes[i])]++] = i;
+  }
+  return NULL;
+}
+
+/**
+ * @brief Link the pairs of the bucket range of a worker into their chains.
+ * @param arg Build worker.
+ * @return NULL
+ *
+ * Pairs whose key is already linked replace its value, just like hash_table_insert.
+ **/
+static void *build_link_task(void *arg)
+{
+  build_worker_t *worker = arg;
+  build_job_t *job = worker->job;
+  hash_table_t *ht = job->ht;
+  const size_t begin = job->range_starts[worker->index];
+  const size_t end = job->range_starts[worker->index + 1];
+  for (size_t k = begin; k < end; k++)
+  {
+    const size_t i = job->order[k];
+    const unsigned long hash = job->hashes[i];
+    entry_t **head = &ht->buckets[bucket_index(hash, ht->no_buckets, ht->bucket_reciprocal)];
+    entry_t **link = find_link_matching(ht, head, job->keys[i], hash);
+    if (*link != NULL && (*link)->hash == hash)
+    {
+      (*link)->value = job->values[i];
+      continue;
+    }
+    entry_t *entry = &job->entries[begin + worker->no_inserted];
+    entry->key = job->keys[i];
+    entry->value = job->values[i];
+    entry->hash = hash;
+    entry->next = *link;
+    *link = entry;
+    worker->no_inserted += 1;
+  }
+  return NULL;
+}
+
+/**
+ * @brief Turn the counts of pairs per slice and range into the first index in order of every slice and range.
+ * @param job Build operated upon, whose pairs have been counted.
+ *
+ * Ranges follow one another in order, and within a range the pairs of earlier slices come first, so that
+ * scattering keeps pairs with equal keys in their original order.
+ **/
+static void build_offsets(build_job_t *job)
+{
+  const size_t threads = job->no_threads;
+  size_t offset = 0;
+  for (size_t r = 0; r < threads; r++)
+  {
+    job->range_starts[r] = offset;
+    for (size_t s = 0; s < threads; s++)
+    {
+      const size_t count = job->offsets[s * threads + r];
+      job->offsets[s * threads + r] = offset;
+      offset += count;
+    }
+  }
+  job->range_starts[threads] = offset;
+}
+
+/**
+ * @brief Load a batch of key-value pairs into an empty hash table using several threads.
+ * @param ht Hash table to load, which should be empty.
+ * @param keys Keys to insert.
+ * @param values Values to insert, one per key.
+ * @param no_keys Number of keys.
+ * @param no_threads Number of threads to use, 0 for one per online processor.
+ *
+ * Entries of the slab that were not needed, because some keys were equal, are returned to the entry pool
+ * once every range has been linked. Should the scratch arrays or the slab not fit in memory, the failure is
+ * reported to the log function and the pairs are inserted by hash_table_insert_batch instead.
+ **/
+void hash_table_build_parallel(hash_table_t *ht, const elem_t *keys, const elem_t *values, const size_t no_keys, const size_t no_threads)
+{
+  const size_t threads = parallel_threads(no_threads, no_keys);
+  if (threads == 1 || ht->backend != HASH_TABLE_CHAINED || ht->sync != NULL || ht->owned_keys || ht->cache
+      || entry_pool_has_meta(&ht->pool) || ht->log != NULL
+      || ht->size != 0 || !ht->ops->reserve(ht, no_keys, false))
+  {
+    hash_table_insert_batch(ht, keys, values, no_keys);
+    return;
+  }
+  chained_rehash_finish(ht);
+
+  build_job_t job = {
+    .ht = ht,
+    .keys = keys,
+    .values = values,
+    .no_keys = no_keys,
+    .no_threads = threads,
+    .buckets_per_range = (ht->no_buckets + threads - 1) / threads,
+    .hashes = malloc(no_keys * sizeof(unsigned long)),
+    .offsets = calloc(threads * threads, sizeof(size_t)),
+    .range_starts = malloc((threads + 1) * sizeof(size_t)),
+    .order = malloc(no_keys * sizeof(size_t)),
+  };
+  if (job.hashes == NULL || job.offsets == NULL || job.range_starts == NULL || job.order == NULL
+      || (job.entries = entry_pool_alloc_slab(&ht->pool, no_keys)) == NULL)
+  {
+    hash_table_log(ht, HASH_TABLE_EVENT_NO_MEMORY, "Failed to allocate memory for a parallel build of %zu pairs!", no_keys);
+    hash_table_insert_batch(ht, keys, values, no_keys);
+  }
+  else
+  {
+    build_worker_t workers[PARALLEL_MAX_THREADS];
+    for (size_t i = 0; i < threads; i++)
+    {
+      workers[i] = (build_worker_t) { .job = &job, .index = i, .no_inserted = 0 };
+    }
+    run_workers(workers, sizeof(build_worker_t), threads, build_hash_task);
+    build_offsets(&job);
+    run_workers(workers, sizeof(build_worker_t), threads, build_scatter_task);
+    run_workers(workers, sizeof(build_worker_t), threads, build_link_task);
+
+    for (size_t r = 0; r < threads; r++)
+    {
+      for (size_t k = job.range_starts[r] + workers[r].no_inserted; k < job.range_starts[r + 1]; k++)
+      {
+        entry_destroy(&ht->pool, &job.entries[k]);
+      }
+      ht->size += workers[r].no_inserted;
+    }
+    if (ht->filter.blocks != NULL)
+    {
+      filter_rebuild(ht);
+    }
+  }
+  free(job.hashes);
+  free(job.offsets);
+  free(job.range_starts);
+  free(job.order);
+}
+
+/**
+ * @brief Walk the range of bucket positions of a worker.
+ * @param arg Walk worker.
+ * @return NULL
+ **/
+static void *walk_task(void *arg)
+{
+  walk_worker_t *worker = arg;
+  walk_job_t *job = worker->job;
+  const size_t begin = part_begin(job->no_positions, job->no_threads, worker->index);
+  const size_t end = part_begin(job->no_positions, job->no_threads, worker->index + 1);
+  job->ht->ops->for_each_range(job->ht, begin, end, job->visit, job);
+  return NULL;
+}
+
+/**
+ * @brief Apply the function of a parallel walk to a visited entry.
+ * @param key Key of the visited entry.
+ * @param value Value of the visited entry, which may be updated in place.
+ * @param arg Walk job to use.
+ * @return True
+ **/
+static bool visit_apply_parallel(const elem_t key, elem_t *value, void *arg)
+{
+  walk_job_t *job = arg;
+  job->f(key, value, job->x);
+  return true;
+}
+
+/**
+ * @brief Check a visited entry against the predicate of a parallel walk, stopping every worker once it settles the result.
+ * @param key Key of the visited entry.
+ * @param value Value of the visited entry.
+ * @param arg Walk job to update.
+ * @return True if the walk should continue, false otherwise.
+ **/
+static bool visit_predicate_parallel(const elem_t key, elem_t *value, void *arg)
+{
+  walk_job_t *job = arg;
+  if (__atomic_load_n(&job->stop, __ATOMIC_RELAXED))
+    return false;
+  if (job->P(key, *value, job->x) == job->stop_on)
+  {
+    __atomic_store_n(&job->stop, true, __ATOMIC_RELAXED);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Walk a hash table with several threads, each visiting one range of its bucket positions.
+ * @param job Walk to run, whose hash table, visitor and function or predicate are set.
+ * @param no_threads Number of threads asked for, 0 for one per online processor.
+ * @return False if the backend cannot split walks, so that the caller should walk sequentially.
+ **/
+static bool walk_parallel(walk_job_t *job, const size_t no_threads)
+{
+  if (job->ht->ops->for_each_range == NULL)
+    return false;
+
+  job->no_positions = job->ht->no_old_buckets + job->ht->no_buckets;
+  job->no_threads = parallel_threads(no_threads, job->no_positions);
+  walk_worker_t workers[PARALLEL_MAX_THREADS];
+  for (size_t i = 0; i < job->no_threads; i++)
+  {
+    workers[i] = (walk_worker_t) { .job = job, .index = i };
+  }
+  run_workers(workers, sizeof(walk_worker_t), job->no_threads, walk_task);
+  return true;
+}
+
+/**
+ * @brief Apply some property to all entries in a hash table using several threads.
+ * @param ht Hash table operated on.
+ * @param f Function to pass keys and values to, called from several threads at once.
+ * @param x Optional additional data.
+ * @param no_threads Number of threads to use, 0 for one per online processor.
+ **/
+void hash_table_apply_to_all_parallel(hash_table_t *ht, apply_function_ht f, const void *x, const size_t no_threads)
+{
+  walk_job_t job = { .ht = ht, .visit = visit_apply_parallel, .f = f, .x = x };
+  if (!walk_parallel(&job, no_threads))
+    hash_table_apply_to_all(ht, f, x);
+}
+
+/**
+ * @brief Check if all keys in a hash table satisfy some property using several threads.
+ * @param ht Hash table operated upon.
+ * @param P Function to pass keys and values to, called from several threads at once.
+ * @param x Optional additional data.
+ * @param no_threads Number of threads to use, 0 for one per online processor.
+ * @return True if no entry fails the property.
+ **/
+bool hash_table_all_parallel(hash_table_t *ht, predicate_ht P, const void *x, const size_t no_threads)
+{
+  walk_job_t job = { .ht = ht, .visit = visit_predicate_parallel, .P = P, .stop_on = false, .x = x };
+  if (!walk_parallel(&job, no_threads))
+    return hash_table_all(ht, P, x);
+  return !job.stop;
+}
+
+/**
+ * @brief Check if at least one key in a hash table satisfy some property using several threads.
+ * @param ht Hash table operated upon.
+ * @param P Function to pass keys and values to, called from several threads at once.
+ * @param x Optional additional data.
+ * @param no_threads Number of threads to use, 0 for one per online processor.
+ * @return True if some entry satisfies the property.
+ **/
+bool hash_table_any_parallel(hash_table_t *ht, predicate_ht P, const void *x, const size_t no_threads)
+{
+  walk_job_t job = { .ht = ht, .visit = visit_predicate_parallel, .P = P, .stop_on = true, .x = x };
+  if (!walk_parallel(&job, no_threads))
+    return hash_table_any(ht, P, x);
+  return job.stop;
+}
@@ -0,0 +1,572 @@
+#include <stdint.h>
+#include <stdlib.h>
+#ifdef HASH_TABLE_NUMA
+#include <numa.h>
+#endif
+#include "hash_table_internal.h"
+
+/// Most shards a hash table is split into.
+#define MAX_SHARDS 4096
+
+/**
+ * @file hash_table_sharded.c
+ * @author Marcus Enderskog
+ * @date 2021-04-15
+ * @brief Hash tables split into independent shards selected by hash.
+ *
+ * A sharded hash table is a front-end over a power of two of independent hash tables of the chosen
+ * backend, concurrent ones if created with hash_table_concurrent_create. Every operation on a key is passed
+ * on to the shard given by the high bits of its mixed hash, so shards grow and rehash independently and a
+ * resize only stalls the keys of one shard. Operations on the whole table visit the shards in turn. The
+ * front-end keeps no state of its own that operations on keys would write to, so threads working on
+ * different shards share no cache lines.
+ *
+ * When built with HASH_TABLE_NUMA, the entry slabs of every shard may be allocated on a NUMA node of its own
+ * with libnuma.
+ **/
+
+
+#ifdef HASH_TABLE_NUMA
+/**
+ * @brief Allocate an entry slab on the NUMA node a shard was placed on.
+ * @param size Number of bytes to allocate.
+ * @param arena NUMA node, cast to a pointer.
+ * @return A pointer to the allocated memory, or NULL on failure.
+ **/
+static void *numa_slab_alloc(size_t size, void *arena)
+{
+  return numa_alloc_onnode(size, (int) (intptr_t) arena);
+}
+
+/**
+ * @brief Release an entry slab allocated by numa_slab_alloc.
+ * @param ptr Slab to release.
+ * @param size Size of the slab in bytes.
+ * @param arena NUMA node the slab was allocated on (ignored).
+ **/
+static void numa_slab_free(void *ptr, size_t size, void *arena)
+{
+  numa_free(ptr, size);
+}
+#endif
+
+/**
+ * @brief Insert a key-value pair into the shard of its key.
+ * @param ht Sharded hash table to insert into.
+ * @param key Key to insert.
+ * @param value Value to insert.
+ * @param hash Hash of the key.
+ * @return Status of the insertion into the shard.
+ * 
+ * The shards hash keys with the hash function of the front-end, so the hash that selected the shard is
+ * passed on to it rather than computed again.
+ **/
+static hash_table_status_t sharded_insert(hash_table_t *ht, const elem_t key, const elem_t value, const unsigned long hash)
+{
+  hash_table_t *shard = shard_for_hash(ht, hash);
+  return shard->ops->insert(shard, key, value, hash);
+}
+
+/**
+ * @brief Lookup value for key in its shard.
+ * @param ht Sharded hash table operated upon.
+ * @param key Key to lookup.
+ * @param hash Hash of the key.
+ * @param result Pointer where a found element will be stored.
+ * @return True if a key was found, false otherwise.
+ **/
+static bool sharded_lookup(hash_table_t *ht, const elem_t key, const unsigned long hash, elem_t *result)
+{
+  hash_table_t *shard = shard_for_hash(ht, hash);
+  return shard->ops->lookup(shard, key, hash, result);
+}
+
+/**
+ * @brief Insert a batch of key-value pairs into the shards of their keys.
+ * @param ht Sharded hash table to insert into.
+ * @param keys Keys to insert.
+ * @param values Values to insert, one per key.
+ * @param no_keys Number of keys.
+ **/
+static void sharded_insert_batch(hash_table_t *ht, const elem_t *keys, const elem_t *values, const size_t no_keys)
+{
+  for (size_t i = 0; i < no_keys; i++)
+  {
+    sharded_insert(ht, keys[i], values[i], ht->hash_function(keys[i]));
+  }
+}
+
+/**
+ * @brief Lookup values for a batch of keys in their shards.
+ * @param ht Sharded hash table operated upon.
+ * @param keys Keys to lookup.
+ * @param no_keys Number of keys.
+ * @param results Array of no_keys elements where found values will be stored.
+ * @param found Array of no_keys flags telling which keys were found, or NULL.
+ * @return The number of keys found.
+ **/
+static size_t sharded_lookup_batch(hash_table_t *ht, const elem_t *keys, const size_t no_keys, elem_t *results, bool *found)
+{
+  size_t no_found = 0;
+  for (size_t i = 0; i < no_keys; i++)
+  {
+    const bool key_found = sharded_lookup(ht, keys[i], ht->hash_function(keys[i]), &results[i]);
+    if (found != NULL)
+      found[i] = key_found;
+    no_found += key_found;
+  }
+  return no_found;
+}
+
+/**
+ * @brief Remove any mapping from key to a value in its shard.
+ * @param ht Sharded hash table to remove entry from.
+ * @param key Key to remove.
+ * @param hash Hash of the key.
+ * @param result Pointer where a removed element will be stored.
+ * @return True if a key was removed, false otherwise.
+ **/
+static bool sharded_remove(hash_table_t *ht, const elem_t key, const unsigned long hash, elem_t *result)
+{
+  hash_table_t *shard = shard_for_hash(ht, hash);
+  return shard->ops->remove(shard, key, hash, result);
+}
+
+/**
+ * @brief Get the value slot for a key in its shard, inserting the key if missing.
+ * @param ht Sharded hash table operated upon.
+ * @param key Key to lookup or insert.
+ * @param value Value to insert the key with if it is missing.
+ * @param hash Hash of the key.
+ * @param inserted Pointer where whether the key was inserted will be stored.
+ * @return A pointer to the value stored for the key, or NULL if the key could not be inserted.
+ **/
+static elem_t *sharded_upsert(hash_table_t *ht, const elem_t key, const elem_t value, const unsigned long hash, bool *inserted)
+{
+  hash_table_t *shard = shard_for_hash(ht, hash);
+  return shard->ops->upsert(shard, key, value, hash, inserted);
+}
+
+/**
+ * @brief Apply a function to the value for a key in its shard.
+ * @param ht Sharded hash table operated upon.
+ * @param key Key whose value to update.
+ * @param hash Hash of the key.
+ * @param f Function to pass the key and a pointer to its value to.
+ * @param x Optional additional data.
+ * @param updated Pointer where the value stored by the update will be stored.
+ * @return True if the key was found and its value updated, false otherwise.
+ **/
+static bool sharded_update(hash_table_t *ht, const elem_t key, const unsigned long hash, apply_function_ht f, const void *x, elem_t *updated)
+{
+  hash_table_t *shard = shard_for_hash(ht, hash);
+  return shard->ops->update(shard, key, hash, f, x, updated);
+}
+
+/**
+ * @brief Make room for a number of entries in every shard.
+ * @param ht Sharded hash table operated upon.
+ * @param no_entries Number of entries the hash table should hold without growing.
+ * @param shrink Whether shards may end up smaller than they are now.
+ * @return True if every shard has room for its share of the entries afterwards, false otherwise.
+ *
+ * Every shard makes room for an even share of the entries, which keys spread over shards by hash come
+ * close to.
+ **/
+static bool sharded_reserve(hash_table_t *ht, const size_t no_entries, const bool shrink)
+{
+  const size_t share = no_entries / ht->no_shards + (no_entries % ht->no_shards != 0);
+  bool reserved = true;
+  for (size_t s = 0; s < ht->no_shards; s++)
+  {
+    hash_table_t *shard = ht->shards[s];
+    reserved &= shard->ops->reserve(shard, shrink ? hash_table_size(shard) : share, shrink);
+  }
+  return reserved;
+}
+
+/**
+ * @brief Clear every shard of a sharded hash table.
+ * @param ht Sharded hash table operated upon.
+ **/
+static void sharded_clear(hash_table_t *ht)
+{
+  for (size_t s = 0; s < ht->no_shards; s++)
+  {
+    ht->shards[s]->ops->clear(ht->shards[s]);
+  }
+}
+
+/**
+ * @brief Destroy every shard of a sharded hash table.
+ * @param ht Sharded hash table operated upon.
+ **/
+static void sharded_destroy(hash_table_t *ht)
+{
+  for (size_t s = 0; s < ht->no_shards; s++)
+  {
+    if (ht->shards[s] != NULL)
+    {
+      ht->shards[s]->log = NULL;
+      hash_table_destroy(ht->shards[s]);
+    }
+  }
+  free(ht->shards);
+  free(ht->shard_nodes);
+}
+
+/// @brief Visitor of a walk over a sharded hash table, which tells when it asked to stop.
+struct sharded_walk
+{
+  hash_table_visitor visit;   // Visitor of the whole walk.
+  void *extra;                // Data passed to visit.
+  bool stopped;               // Whether visit returned false.
+};
+
+/**
+ * @brief Pass a visited entry of a shard on to the visitor of the whole walk.
+ * @param key Key of the visited entry.
+ * @param value Value of the visited entry, which may be updated in place.
+ * @param walk Sharded walk to use.
+ * @return Whatever the visitor of the whole walk returned.
+ **/
+static bool visit_shard(const elem_t key, elem_t *value, void *walk)
+{
+  struct sharded_walk *w = walk;
+  w->stopped = !w->visit(key, value, w->extra);
+  return !w->stopped;
+}
+
+/**
+ * @brief Visit the entries of every shard in turn until told to stop.
+ * @param ht Sharded hash table operated upon.
+ * @param visit Visitor to call with every entry.
+ * @param extra Data passed to the visitor.
+ **/
+static void sharded_for_each(hash_table_t *ht, hash_table_visitor visit, void *extra)
+{
+  struct sharded_walk walk = { .visit = visit, .extra = extra, .stopped = false };
+  for (size_t s = 0; s < ht->no_shards && !walk.stopped; s++)
+  {
+    ht->shards[s]->ops->for_each(ht->shards[s], visit_shard, &walk);
+  }
+}
+
+/**
+ * @brief Get the hash stored along with a value slot of one of the shards of a sharded hash table.
+ * @param ht Sharded hash table operated upon.
+ * @param value Value slot of an entry, as handed to a visitor by sharded_for_each.
+ * @return The hash of the key of the entry.
+ *
+ * Every shard has the same backend, so the first one can tell the hash of an entry of any of them.
+ **/
+static unsigned long sharded_stored_hash(hash_table_t *ht, elem_t *value)
+{
+  return ht->shards[0]->ops->stored_hash(ht->shards[0], value);
+}
+
+/**
+ * @brief Measure every shard and add up their statistics.
+ * @param ht Sharded hash table operated upon.
+ * @param stats Statistics to fill in, including the counters of the shards.
+ * 
+ * The mean chain length of the whole table weighs the mean of every shard by what it was averaged over.
+ * Keys are spread evenly over the shards, so the false positive rate of the prefilters is their mean.
+ **/
+static void sharded_stats(hash_table_t *ht, hash_table_stats_t *stats)
+{
+  double total_length = 0;
+  double no_measured = 0;
+  double false_positive_rate = 0;
+  for (size_t s = 0; s < ht->no_shards; s++)
+  {
+    hash_table_stats_t shard;
+    hash_table_stats(ht->shards[s], &shard);
+    stats->no_buckets += shard.no_buckets;
+    stats->size += shard.size;
+    if (shard.max_chain_length > stats->max_chain_length)
+      stats->max_chain_length = shard.max_chain_length;
+    for (size_t i = 0; i < HASH_TABLE_STATS_HISTOGRAM_SIZE; i++)
+      stats->chain_length_histogram[i] += shard.chain_length_histogram[i];
+    // Chained shards average over their non-empty chains, which add up to size entries; other backends average over their entries.
+    const double measured = ht->shards[s]->backend != HASH_TABLE_CHAINED ? (double) shard.size : shard.mean_chain_length == 0 ? 0 : shard.size / shard.mean_chain_length;
+    total_length += measured * shard.mean_chain_length;
+    no_measured += measured;
+    stats->no_resizes += shard.no_resizes;
+    stats->filter_bytes += shard.filter_bytes;
+    false_positive_rate += shard.filter_false_positive_rate;
+    stats->no_finds += shard.no_finds;
+    stats->no_probes += shard.no_probes;
+    stats->no_filter_rejections += shard.no_filter_rejections;
+    stats->rehash_seconds += shard.rehash_seconds;
+  }
+  stats->mean_chain_length = no_measured == 0 ? 0 : (float) (total_length / no_measured);
+  stats->filter_false_positive_rate = (float) (false_positive_rate / ht->no_shards);
+}
+
+/**
+ * @brief Let the walk over the current shard of an iterator operate on a scratch iterator of that shard.
+ * @param iter Iterator over the sharded hash table.
+ * @param inner Scratch iterator that takes over the position within the shard.
+ **/
+static inline void shard_iter_load(const hash_table_iter_t *iter, hash_table_iter_t *inner)
+{
+  *inner = *iter;
+  inner->ht = iter->ht->shards[iter->shard];
+}
+
+/**
+ * @brief Store the position within the shard of a scratch iterator back into the iterator it came from.
+ * @param iter Iterator over the sharded hash table.
+ * @param inner Scratch iterator of its current shard.
+ **/
+static inline void shard_iter_store(hash_table_iter_t *iter, const hash_table_iter_t *inner)
+{
+  hash_table_t *ht = iter->ht;
+  const size_t shard = iter->shard;
+  *iter = *inner;
+  iter->ht = ht;
+  iter->shard = shard;
+}
+
+/**
+ * @brief Advance a walk over a sharded hash table to the next entry.
+ * @param iter Iterator operated upon.
+ * @param key Pointer where the key of the entry will be stored.
+ * @param value Pointer where a pointer to the value of the entry will be stored.
+ * @return True if there was a next entry, false if the walk is over.
+ *
+ * The shards are walked one after the other. The position within the current shard lives in the fields
+ * of the iterator itself, which are handed to the backend of the shard by way of a scratch iterator.
+ **/
+static bool sharded_iter_next(hash_table_iter_t *iter, elem_t *key, elem_t **value)
+{
+  hash_table_t *ht = iter->ht;
+  for (; iter->shard < ht->no_shards; iter->shard++)
+  {
+    hash_table_iter_t inner;
+    shard_iter_load(iter, &inner);
+    const bool found = inner.ht->ops->iter_next(&inner, key, value);
+    shard_iter_store(iter, &inner);
+    if (found)
+    {
+      return true;
+    }
+    hash_table_iter_begin(ht->shards[iter->shard], &inner);
+    shard_iter_store(iter, &inner);
+  }
+  return false;
+}
+
+/**
+ * @brief Remove the current entry of a walk over a sharded hash table from its shard.
+ * @param iter Iterator operated upon.
+ * @return True if the entry was removed, false if the shard refused.
+ **/
+static bool sharded_iter_remove(hash_table_iter_t *iter)
+{
+  hash_table_iter_t inner;
+  shard_iter_load(iter, &inner);
+  const bool removed = inner.ht->ops->iter_remove(&inner);
+  shard_iter_store(iter, &inner);
+  return removed;
+}
+
+/// @brief Operations of the sharded front-end.
+static const hash_table_ops_t sharded_ops = {
+  .insert = sharded_insert,
+  .lookup = sharded_lookup,
+  .insert_batch = sharded_insert_batch,
+  .lookup_batch = sharded_lookup_batch,
+  .remove = sharded_remove,
+  .upsert = sharded_upsert,
+  .update = sharded_update,
+  .reserve = sharded_reserve,
+  .clear = sharded_clear,
+  .destroy = sharded_destroy,
+  .for_each = sharded_for_each,
+  .for_each_range = NULL,
+  .stored_hash = sharded_stored_hash,
+  .stats = sharded_stats,
+  .iter_next = sharded_iter_next,
+  .iter_remove = sharded_iter_remove,
+};
+
+/**
+ * @brief Split a budget of a hash table in cache mode evenly over its shards.
+ * @param budget Budget of the whole hash table, 0 for no limit.
+ * @param no_shards Number of shards.
+ * @return The budget of every shard, at least 1 unless there is no limit.
+ **/
+static inline size_t shard_budget(const size_t budget, const size_t no_shards)
+{
+  return budget / no_shards + (budget % no_shards != 0);
+}
+
+/**
+ * @brief Create a hash table split into independent shards.
+ * @param options Options to create the hash table with, whose no_shards is more than 1.
+ * @param concurrent Whether the shards are created with hash_table_concurrent_create.
+ * @return A new empty sharded hash table, or NULL if creation failed.
+ *
+ * Every shard is created from the same options, with the capacity hint and the budgets of cache mode split
+ * evenly between them. The change log, if any, belongs to the front-end and is shared with the shards, so
+ * that evictions and expiries within a shard are recorded along with the changes made through the
+ * front-end. The front-end takes over the hash and comparison functions the shards resolved, so that
+ * computing the shard of a key selects the same defaults, and the hash a key is sharded by is the one the
+ * shard looks it up with.
+ **/
+hash_table_t *sharded_create(const hash_table_options_t *options, const bool concurrent)
+{
+  if (options->no_shards > MAX_SHARDS)
+  {
+    hash_table_log(NULL, HASH_TABLE_EVENT_INVALID_ARGUMENT, "At most %d shards are supported! Got %zu", MAX_SHARDS, options->no_shards);
+    return NULL;
+  }
+  size_t no_shards = 2;
+  unsigned shard_bits = 1;
+  while (no_shards < options->no_shards)
+  {
+    no_shards *= 2;
+    shard_bits += 1;
+  }
+
+  hash_table_t *ht = calloc(1, sizeof(hash_table_t));
+  if (ht != NULL)
+  {
+    ht->shards = calloc(no_shards, sizeof(hash_table_t *));
+    ht->shard_nodes = malloc(no_shards * sizeof(int));
+  }
+  if (ht == NULL || ht->shards == NULL || ht->shard_nodes == NULL)
+  {
+    hash_table_log(NULL, HASH_TABLE_EVENT_NO_MEMORY, "Failed to allocate memory for hash table!");
+    if (ht != NULL)
+    {
+      free(ht->shards);
+      free(ht->shard_nodes);
+      free(ht);
+    }
+    return NULL;
+  }
+  ht->ops = &sharded_ops;
+  ht->backend = HASH_TABLE_SHARDED;
+  ht->no_shards = no_shards;
+  ht->shard_shift = 64 - shard_bits;
+
+  hash_table_options_t shard_options = *options;
+  shard_options.no_shards = 0;
+  shard_options.shard_nodes = NULL;
+  shard_options.change_log_size = 0;
+  shard_options.no_buckets = shard_budget(options->no_buckets, no_shards);
+  shard_options.max_entries = shard_budget(options->max_entries, no_shards);
+  shard_options.max_bytes = shard_budget(options->max_bytes, no_shards);
+#ifdef HASH_TABLE_NUMA
+  const bool numa = options->shard_nodes != NULL && numa_available() >= 0;
+#else
+  const bool numa = false;
+#endif
+  for (size_t s = 0; s < no_shards; s++)
+  {
+    ht->shard_nodes[s] = numa ? options->shard_nodes[s] : -1;
+#ifdef HASH_TABLE_NUMA
+    if (ht->shard_nodes[s] >= 0)
+    {
+      hash_table_allocator_t allocator = { .alloc = numa_slab_alloc, .free = numa_slab_free, .arena = (void *) (intptr_t) ht->shard_nodes[s] };
+      shard_options.allocator = allocator;
+    }
+    else
+    {
+      shard_options.allocator = options->allocator;
+    }
+#endif
+    ht->shards[s] = concurrent ? hash_table_concurrent_create(&shard_options) : hash_table_create_with_options(&shard_options);
+    if (ht->shards[s] == NULL)
+    {
+      sharded_destroy(ht);
+      free(ht);
+      return NULL;
+    }
+  }
+
+  if (options->change_log_size != 0 && !change_log_init(ht, options->change_log_size))
+  {
+    sharded_destroy(ht);
+    free(ht);
+    return NULL;
+  }
+  for (size_t s = 0; s < no_shards; s++)
+  {
+    ht->shards[s]->log = ht->log;
+  }
+
+  hash_table_t *first = ht->shards[0];
+  ht->hash_function = first->hash_function;
+  ht->key_equiv = first->key_equiv;
+  ht->value_equiv = first->value_equiv;
+  ht->load_factor = first->load_factor;
+  ht->min_load_factor = first->min_load_factor;
+  ht->owned_keys = first->owned_keys;
+  return ht;
+}
+
+/**
+ * @brief Get the total size of the shards of a sharded hash table.
+ * @param ht Sharded hash table operated upon.
+ * @return The number of entries of all shards.
+ **/
+size_t sharded_size(hash_table_t *ht)
+{
+  size_t size = 0;
+  for (size_t s = 0; s < ht->no_shards; s++)
+  {
+    size += hash_table_size(ht->shards[s]);
+  }
+  return size;
+}
+
+/**
+ * @brief Get the total capacity of the shards of a sharded hash table.
+ * @param ht Sharded hash table operated upon.
+ * @return The number of buckets or slots of all shards.
+ **/
+size_t sharded_capacity(hash_table_t *ht)
+{
+  size_t capacity = 0;
+  for (size_t s = 0; s < ht->no_shards; s++)
+  {
+    capacity += hash_table_capacity(ht->shards[s]);
+  }
+  return capacity;
+}
+
+/**
+ * @brief Get the number of shards of a hash table.
+ * @param ht Hash table operated upon.
+ * @return The number of shards, 1 unless the hash table is sharded.
+ **/
+size_t hash_table_no_shards(hash_table_t *ht)
+{
+  return ht->shards == NULL ? 1 : ht->no_shards;
+}
+
+/**
+ * @brief Get the shard a key belongs to.
+ * @param ht Hash table operated upon.
+ * @param key Key to examine.
+ * @return Index of the shard that holds the key if stored, 0 unless the hash table is sharded.
+ **/
+size_t hash_table_shard_of(hash_table_t *ht, const elem_t key)
+{
+  return ht->shards == NULL ? 0 : shard_index(ht, ht->hash_function(key));
+}
+
+/**
+ * @brief Get the NUMA node the entries of a shard are allocated on.
+ * @param ht Hash table operated upon.
+ * @param shard Index of the shard.
+ * @return The NUMA node of the shard, -1 if it was not placed on one or the index is out of range.
+ **/
+int hash_table_shard_node(hash_table_t *ht, const size_t shard)
+{
+  return ht->shards == NULL || shard >= ht->no_shards ? -1 : ht->shard_nodes[shard];
+}
@@ -0,0 +1,600 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "hash_table_internal.h"
+
+/// Identifies a snapshot file, followed by the version of its layout.
+#define SNAPSHOT_MAGIC "HTSNAP\0"
+
+/// Version of the snapshot layout, bumped whenever it changes.
+#define SNAPSHOT_VERSION 1
+
+/// Written as is into every snapshot, so that snapshots of a machine with another byte order are recognized.
+#define SNAPSHOT_BYTE_ORDER UINT64_C(0x0102030405060708)
+
+/// Smallest number of entries room is made for when collecting the entries of a hash table to save.
+#define MIN_SNAPSHOT_ENTRIES 16
+
+/**
+ * @file hash_table_snapshot.c
+ * @author Marcus Enderskog
+ * @date 2021-04-15
+ * @brief Snapshots of hash tables written to files, and the read-only backend serving them from memory mappings.
+ *
+ * A snapshot is laid out like a chained hash table with its chains packed one after the other: a header,
+ * an array of no_buckets + 1 offsets where bucket i holds the entries from offsets[i] up to offsets[i + 1],
+ * and the entries themselves with the hashes of their keys. Every field has a fixed width and the layout
+ * holds no pointers, so a mapping of the file can be searched in place. Buckets are found with bucket_index
+ * just like in the chained backend.
+ **/
+
+
+/// @brief Header at the start of every snapshot.
+typedef struct snapshot_header
+{
+  char magic[8];         // SNAPSHOT_MAGIC.
+  uint32_t version;      // SNAPSHOT_VERSION.
+  uint32_t elem_size;    // Size of elem_t in bytes.
+  uint64_t byte_order;   // SNAPSHOT_BYTE_ORDER as written.
+  uint64_t hash_seed;    // Seed of the built-in hash functions the hashes were computed with.
+  uint64_t no_buckets;   // Number of buckets, at least 1.
+  uint64_t size;         // Number of entries.
+} snapshot_header_t;
+
+/// @brief Entry of a snapshot as laid out in the file, used by the mapped backend.
+struct snapshot_entry
+{
+  uint64_t hash;  // Hash of the key as returned by the hash function.
+  elem_t key;     // Key to map value to.
+  elem_t value;   // The actual value to be stored.
+};
+
+/// @brief Entries of a hash table being collected for a snapshot.
+typedef struct snapshot_collect
+{
+  hash_table_t *ht;             // Hash table being saved.
+  snapshot_entry_t *entries;    // Entries collected so far.
+  size_t size;                  // Number of entries collected.
+  size_t capacity;              // Number of entries that fit in entries.
+  bool failed;                  // Whether growing entries failed.
+} snapshot_collect_t;
+
+/// @brief Operations of the mapped backend.
+static const hash_table_ops_t mapped_ops;
+
+/**
+ * @brief Collect an entry of a hash table being saved, along with the hash stored for its key.
+ * @param key Key of the entry.
+ * @param value Value of the entry.
+ * @param extra The snapshot_collect_t collecting the entries.
+ * @return True to continue, false if memory allocation failed.
+ **/
+static bool snapshot_collect_entry(const elem_t key, elem_t *value, void *extra)
+{
+  snapshot_collect_t *collect = extra;
+  if (collect->size == collect->capacity)
+  {
+    const size_t capacity = collect->capacity * 2;
+    snapshot_entry_t *entries = realloc(collect->entries, capacity * sizeof(snapshot_entry_t));
+    if (entries == NULL)
+    {
+      collect->failed = true;
+      return false;
+    }
+    collect->entries = entries;
+    collect->capacity = capacity;
+  }
+
+  snapshot_entry_t entry = { .hash = collect->ht->ops->stored_hash(collect->ht, value), .key = key, .value = *value };
+  collect->entries[collect->size++] = entry;
+  return true;
+}
+
+/**
+ * @brief Sort collected entries bucket by bucket in place, and compute the offset of every bucket.
+ * @param entries Entries to sort.
+ * @param size Number of entries.
+ * @param offsets Offsets to compute, no_buckets + 1 of them, all 0 on entry.
+ * @param next Scratch space for the next unsorted position of every bucket, no_buckets of them.
+ * @param no_buckets Number of buckets.
+ *
+ * This is a counting sort that permutes entries in place (an American flag sort of a single digit): once the
+ * buckets are counted, every entry found in the wrong bucket is swapped into the next unsorted position of its
+ * own bucket, until every bucket is full. Each swap puts one entry in its final position, so the sort takes
+ * linear time and needs memory per bucket rather than a second copy of the entries.
+ **/
+static void snapshot_sort(snapshot_entry_t *entries, const size_t size, uint64_t *offsets, uint64_t *next, const size_t no_buckets)
+{
+  const bucket_reciprocal_t reciprocal = bucket_reciprocal(no_buckets);
+  for (size_t i = 0; i < size; i++)
+    offsets[bucket_index(entries[i].hash, no_buckets, reciprocal) + 1] += 1;
+  for (size_t b = 0; b < no_buckets; b++)
+  {
+    offsets[b + 1] += offsets[b];
+    next[b] = offsets[b];
+  }
+
+  for (size_t b = 0; b < no_buckets; b++)
+  {
+    while (next[b] < offsets[b + 1])
+    {
+      const size_t target = bucket_index(entries[next[b]].hash, no_buckets, reciprocal);
+      if (target == b)
+      {
+        next[b] += 1;
+        continue;
+      }
+      const snapshot_entry_t moved = entries[next[b]];
+      entries[next[b]] = entries[next[target]];
+      entries[next[target]++] = moved;
+    }
+  }
+}
+
+/**
+ * @brief Write a buffer to a file descriptor completely, retrying partial and interrupted writes.
+ * @param fd File descriptor to write to.
+ * @param data Bytes to write.
+ * @param length Number of bytes to write.
+ * @return True if every byte was written, false otherwise, with errno set.
+ **/
+static bool write_all(const int fd, const void *data, size_t length)
+{
+  const char *bytes = data;
+  while (length > 0)
+  {
+    const ssize_t written = write(fd, bytes, length);
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written == 0)
+      errno = EIO;
+    if (written <= 0)
+      return false;
+    bytes += written;
+    length -= (size_t) written;
+  }
+  return true;
+}
+
+/**
+ * @brief Write a snapshot of a hash table to a file, to be mapped back into memory by hash_table_open_mapped.
+ * @param ht Hash table to save, which is left unchanged.
+ * @param fd File descriptor to write the snapshot to, from its current position on.
+ * @return True if the whole snapshot was written, false otherwise.
+ *
+ * Entries are collected with a single walk of the backend, which a concurrent hash table performs with all
+ * threads held off, so the snapshot is consistent. Every backend stores the hash of a key next to its value,
+ * so the hashes are read from there rather than recomputed with the hash function. Buckets are sized for the
+ * load factor of the hash table, then the entries are sorted into them in place and written out along with
+ * the offsets.
+ **/
+bool hash_table_save(hash_table_t *ht, const int fd)
+{
+  const size_t size_hint = hash_table_size(ht);
+  snapshot_collect_t collect = { .ht = ht, .capacity = size_hint < MIN_SNAPSHOT_ENTRIES ? MIN_SNAPSHOT_ENTRIES : size_hint };
+  collect.entries = malloc(collect.capacity * sizeof(snapshot_entry_t));
+  if (collect.entries == NULL)
+  {
+    hash_table_log(ht, HASH_TABLE_EVENT_NO_MEMORY, "Failed to allocate memory for a snapshot of %zu entries!", size_hint);
+    return false;
+  }
+  ht->ops->for_each(ht, snapshot_collect_entry, &collect);
+  if (collect.failed)
+  {
+    hash_table_log(ht, HASH_TABLE_EVENT_NO_MEMORY, "Failed to allocate memory for a snapshot of %zu entries!", collect.size);
+    free(collect.entries);
+    return false;
+  }
+
+  const size_t no_buckets = buckets_for_entries(ht, collect.size);
+  uint64_t *offsets = no_buckets == 0 ? NULL : calloc(no_buckets + 1, sizeof(uint64_t));
+  uint64_t *next = no_buckets == 0 ? NULL : malloc(no_buckets * sizeof(uint64_t));
+  if (offsets == NULL || next == NULL)
+  {
+    hash_table_log(ht, HASH_TABLE_EVENT_NO_MEMORY, "Failed to allocate memory for a snapshot of %zu entries!", collect.size);
+    free(next);
+    free(offsets);
+    free(collect.entries);
+    return false;
+  }
+  snapshot_sort(collect.entries, collect.size, offsets, next, no_buckets);
+  free(next);
+
+  snapshot_header_t header = {
+    .magic = SNAPSHOT_MAGIC,
+    .version = SNAPSHOT_VERSION,
+    .elem_size = sizeof(elem_t),
+    .byte_order = SNAPSHOT_BYTE_ORDER,
+    .hash_seed = hash_table_get_hash_seed(),
+    .no_buckets = no_buckets,
+    .size = collect.size,
+  };
+  const bool written = write_all(fd, &header, sizeof(header))
+    && write_all(fd, offsets, (no_buckets + 1) * sizeof(uint64_t))
+    && write_all(fd, collect.entries, collect.size * sizeof(snapshot_entry_t));
+  if (!written)
+    hash_table_log(ht, HASH_TABLE_EVENT_IO_ERROR, "Failed to write snapshot: %s", strerror(errno));
+
+  free(offsets);
+  free(collect.entries);
+  return written;
+}
+
+/**
+ * @brief Check that a mapped file is a snapshot this process can serve.
+ * @param header Header at the start of the mapping.
+ * @param length Length of the mapping in bytes, at least the size of a header.
+ * @return A description of the first problem found, or NULL if the snapshot is valid.
+ *
+ * Only the header and the final offset are checked, so that validation touches one page of the offsets
+ * and none of the entries; lookups guard against offsets that are out of order instead.
+ **/
+static const char *snapshot_validate(const snapshot_header_t *header, const size_t length)
+{
+  if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0)
+    return "not a snapshot";
+  if (header->version != SNAPSHOT_VERSION)
+    return "unsupported version";
+  if (header->elem_size != sizeof(elem_t) || header->byte_order != SNAPSHOT_BYTE_ORDER)
+    return "saved on an incompatible machine";
+  if (header->hash_seed != hash_table_get_hash_seed())
+    return "saved with another hash seed";
+
+  const size_t no_offsets_max = (length - sizeof(snapshot_header_t)) / sizeof(uint64_t);
+  if (header->no_buckets == 0 || header->no_buckets >= no_offsets_max)
+    return "truncated or corrupt";
+  const size_t entries_length = length - sizeof(snapshot_header_t) - (header->no_buckets + 1) * sizeof(uint64_t);
+  if (header->size != entries_length / sizeof(snapshot_entry_t) || entries_length % sizeof(snapshot_entry_t) != 0)
+    return "truncated or corrupt";
+
+  const uint64_t *offsets = (const uint64_t *) (header + 1);
+  if (offsets[header->no_buckets] != header->size)
+    return "truncated or corrupt";
+  return NULL;
+}
+
+/**
+ * @brief Map a snapshot written by hash_table_save into memory as a hash table.
+ * @param path Path of the snapshot.
+ * @param options Hash and comparison functions to use, or NULL for integer keys and values.
+ * @return A hash table of backend HASH_TABLE_MAPPED, or NULL if the file could not be mapped or is not a
+ * valid snapshot for this process.
+ *
+ * The file is mapped privately and writable, so that values can be updated in place (copy-on-write) without
+ * ever changing the file. Failures are reported to the log function.
+ **/
+hash_table_t *hash_table_open_mapped(const char *path, const hash_table_options_t *options)
+{
+  const int fd = open(path, O_RDONLY);
+  if (fd < 0)
+  {
+    hash_table_log(NULL, HASH_TABLE_EVENT_IO_ERROR, "Failed to open snapshot %s: %s", path, strerror(errno));
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(snapshot_header_t))
+  {
+    hash_table_log(NULL, HASH_TABLE_EVENT_IO_ERROR, "Snapshot %s is not valid: truncated or corrupt", path);
+    close(fd);
+    return NULL;
+  }
+  const size_t length = (size_t) st.st_size;
+  void *mapping = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED)
+  {
+    hash_table_log(NULL, HASH_TABLE_EVENT_IO_ERROR, "Failed to map snapshot %s: %s", path, strerror(errno));
+    return NULL;
+  }
+
+  const snapshot_header_t *header = mapping;
+  const char *problem = snapshot_validate(header, length);
+  if (problem != NULL)
+  {
+    hash_table_log(NULL, HASH_TABLE_EVENT_IO_ERROR, "Snapshot %s is not valid: %s", path, problem);
+    munmap(mapping, length);
+    return NULL;
+  }
+
+  hash_table_t *ht = calloc(1, sizeof(hash_table_t));
+  if (ht == NULL)
+  {
+    hash_table_log(NULL, HASH_TABLE_EVENT_NO_MEMORY, "Failed to allocate memory for hash table!");
+    munmap(mapping, length);
+    return NULL;
+  }
+  const hash_table_options_t defaults = { 0 };
+  functions_init(ht, options == NULL ? &defaults : options);
+  ht->ops = &mapped_ops;
+  ht->backend = HASH_TABLE_MAPPED;
+  ht->mapping = mapping;
+  ht->mapping_size = length;
+  ht->no_buckets = header->no_buckets;
+  ht->bucket_reciprocal = bucket_reciprocal(header->no_buckets);
+  ht->size = header->size;
+  ht->load_factor = (float) header->size / (float) header->no_buckets;
+  ht->offsets = (const uint64_t *) (header + 1);
+  ht->entries = (snapshot_entry_t *) (ht->offsets + header->no_buckets + 1);
+  return ht;
+}
+
+/**
+ * @brief Find the entry for a key in a mapped hash table.
+ * @param ht Hash table operated upon.
+ * @param key Key to find.
+ * @param hash Hash of the key.
+ * @return A pointer to the entry, or NULL if the key is not stored.
+ *
+ * Entries of a bucket are not sorted, so the whole bucket is searched, comparing keys only for equal hashes.
+ * A bucket whose offsets are out of order or out of range is treated as empty, so that a corrupt snapshot
+ * never makes a lookup read outside of the mapping.
+ **/
+static snapshot_entry_t *mapped_find(hash_table_t *ht, const elem_t key, const unsigned long hash)
+{
+  const size_t bucket = bucket_index(hash, ht->no_buckets, ht->bucket_reciprocal);
+  const uint64_t first = ht->offsets[bucket];
+  const uint64_t last = ht->offsets[bucket + 1];
+  STATS_ADD(ht, no_finds, 1);
+  for (uint64_t i = first; i < last && last <= ht->size; i++)
+  {
+    STATS_ADD(ht, no_probes, 1);
+    snapshot_entry_t *entry = &ht->entries[i];
+    if (entry->hash == hash && ht->key_equiv(entry->key, entry->value, &key))
+      return entry;
+  }
+  return NULL;
+}
+
+/**
+ * @brief Lookup value for key in a mapped hash table.
+ * @param ht Hash table operated upon.
+ * @param key Key to lookup.
+ * @param hash Hash of the key.
+ * @param result Pointer where the value for the key will be stored.
+ * @return True if the key was found, false otherwise.
+ **/
+static bool mapped_lookup(hash_table_t *ht, const elem_t key, const unsigned long hash, elem_t *result)
+{
+  const snapshot_entry_t *entry = mapped_find(ht, key, hash);
+  if (entry == NULL)
+    return false;
+  *result = entry->value;
+  return true;
+}
+
+/**
+ * @brief Get the value slot for a key in a mapped hash table, which can not take the key if it is missing.
+ * @param ht Hash table operated upon.
+ * @param key Key to lookup.
+ * @param value_ignored Value the key would be inserted with (ignored).
+ * @param hash Hash of the key.
+ * @param inserted Pointer where false will be stored.
+ * @return A pointer to the value for the key, or NULL if the key is not stored.
+ **/
+static elem_t *mapped_upsert(hash_table_t *ht, const elem_t key, const elem_t value_ignored, const unsigned long hash, bool *inserted)
+{
+  snapshot_entry_t *entry = mapped_find(ht, key, hash);
+  *inserted = false;
+  return entry == NULL ? NULL : &entry->value;
+}
+
+/**
+ * @brief Update the value for a key in a mapped hash table.
+ * @param ht Hash table operated upon.
+ * @param key Key to insert.
+ * @param value Value to store for the key.
+ * @param hash Hash of the key.
+ * @return HASH_TABLE_UPDATED if the key was stored, HASH_TABLE_READ_ONLY otherwise.
+ **/
+static hash_table_status_t mapped_insert(hash_table_t *ht, const elem_t key, const elem_t value, const unsigned long hash)
+{
+  snapshot_entry_t *entry = mapped_find(ht, key, hash);
+  if (entry == NULL)
+    return HASH_TABLE_READ_ONLY;
+  entry->value = value;
+  return HASH_TABLE_UPDATED;
+}
+
+/**
+ * @brief Update the values for keys of a mapped hash table in order, skipping keys that are not stored.
+ * @param ht Hash table operated upon.
+ * @param keys Keys to insert.
+ * @param values Values to store for the keys.
+ * @param no_keys Number of keys.
+ **/
+static void mapped_insert_batch(hash_table_t *ht, const elem_t *keys, const elem_t *values, const size_t no_keys)
+{
+  for (size_t i = 0; i < no_keys; i++)
+    mapped_insert(ht, keys[i], values[i], ht->hash_function(keys[i]));
+}
+
+/**
+ * @brief Lookup values for several keys of a mapped hash table.
+ * @param ht Hash table operated upon.
+ * @param keys Keys to lookup.
+ * @param no_keys Number of keys.
+ * @param results Array where the value for each found key will be stored.
+ * @param found Array where whether each key was found will be stored, or NULL.
+ * @return The number of keys found.
+ **/
+static size_t mapped_lookup_batch(hash_table_t *ht, const elem_t *keys, const size_t no_keys, elem_t *results, bool *found)
+{
+  size_t no_found = 0;
+  for (size_t i = 0; i < no_keys; i++)
+  {
+    const bool key_found = mapped_lookup(ht, keys[i], ht->hash_function(keys[i]), &results[i]);
+    no_found += key_found;
+    if (found != NULL)
+      found[i] = key_found;
+  }
+  return no_found;
+}
+
+/**
+ * @brief Refuse to remove a key from a mapped hash table.
+ * @param ht Hash table operated upon.
+ * @param key_ignored Key to remove (ignored).
+ * @param hash_ignored Hash of the key (ignored).
+ * @param result_ignored Pointer where the value would be stored (ignored).
+ * @return False, as the set of keys of a mapped hash table is fixed.
+ **/
+static bool mapped_remove(hash_table_t *ht, const elem_t key_ignored, const unsigned long hash_ignored, elem_t *result_ignored)
+{
+  hash_table_log(ht, HASH_TABLE_EVENT_INVALID_ARGUMENT, "Keys can not be removed from a mapped hash table!");
+  return false;
+}
+
+/**
+ * @brief Apply a function to the value for a key in a mapped hash table.
+ * @param ht Hash table operated upon.
+ * @param key Key whose value to update.
+ * @param hash Hash of the key.
+ * @param f Function to pass the key and a pointer to its value to.
+ * @param x Optional additional data.
+ * @param updated Pointer where the value stored by the update will be stored.
+ * @return True if the key was found and its value updated, false otherwise.
+ **/
+static bool mapped_update(hash_table_t *ht, const elem_t key, const unsigned long hash, apply_function_ht f, const void *x, elem_t *updated)
+{
+  snapshot_entry_t *entry = mapped_find(ht, key, hash);
+  if (entry == NULL)
+    return false;
+  f(entry->key, &entry->value, x);
+  *updated = entry->value;
+  return true;
+}
+
+/**
+ * @brief Check whether a mapped hash table holds a number of entries, as it can not be resized.
+ * @param ht Hash table operated upon.
+ * @param no_entries Number of entries to make room for.
+ * @param shrink_ignored Whether to shrink (ignored).
+ * @return True if no more entries than those already stored are asked for, false otherwise.
+ **/
+static bool mapped_reserve(hash_table_t *ht, const size_t no_entries, const bool shrink_ignored)
+{
+  return no_entries <= ht->size;
+}
+
+/**
+ * @brief Refuse to clear a mapped hash table.
+ * @param ht Hash table operated upon.
+ **/
+static void mapped_clear(hash_table_t *ht)
+{
+  hash_table_log(ht, HASH_TABLE_EVENT_INVALID_ARGUMENT, "A mapped hash table can not be cleared!");
+}
+
+/**
+ * @brief Release the mapping of a mapped hash table.
+ * @param ht Hash table operated upon.
+ **/
+static void mapped_destroy(hash_table_t *ht)
+{
+  munmap(ht->mapping, ht->mapping_size);
+}
+
+/**
+ * @brief Visit the entries of a mapped hash table.
+ * @param ht Hash table operated upon.
+ * @param visit Function to pass keys and values to; returning false stops the walk.
+ * @param extra Optional additional data.
+ **/
+static void mapped_for_each(hash_table_t *ht, hash_table_visitor visit, void *extra)
+{
+  for (size_t i = 0; i < ht->size; i++)
+  {
+    if (!visit(ht->entries[i].key, &ht->entries[i].value, extra))
+      return;
+  }
+}
+
+/**
+ * @brief Get the hash stored in the entry of a mapped hash table that a value belongs to.
+ * @param ht Hash table operated upon.
+ * @param value Value of an entry, as handed to a visitor.
+ * @return The hash of the key of the entry.
+ **/
+static unsigned long mapped_stored_hash(hash_table_t *ht, elem_t *value)
+{
+  return (unsigned long) ((snapshot_entry_t *) ((char *) value - offsetof(snapshot_entry_t, value)))->hash;
+}
+
+/**
+ * @brief Measure the buckets of a mapped hash table.
+ * @param ht Hash table operated upon.
+ * @param stats Statistics to store the chain lengths in.
+ *
+ * Buckets are measured like the chains of a chained hash table, their lengths being differences of offsets.
+ **/
+static void mapped_stats(hash_table_t *ht, hash_table_stats_t *stats)
+{
+  size_t no_chains = 0;
+  stats->size = ht->size;
+  stats->no_buckets = ht->no_buckets;
+  for (size_t i = 0; i < ht->no_buckets; i++)
+  {
+    const size_t length = ht->offsets[i + 1] - ht->offsets[i];
+    no_chains += length > 0;
+    if (length > stats->max_chain_length)
+      stats->max_chain_length = length;
+    stats->chain_length_histogram[length < HASH_TABLE_STATS_HISTOGRAM_SIZE ? length : HASH_TABLE_STATS_HISTOGRAM_SIZE - 1] += 1;
+  }
+  stats->mean_chain_length = no_chains == 0 ? 0 : (float) ht->size / (float) no_chains;
+}
+
+/**
+ * @brief Advance a walk over a mapped hash table to the next entry.
+ * @param iter Iterator operated upon.
+ * @param key Pointer where the key of the entry will be stored.
+ * @param value Pointer where a pointer to the value of the entry will be stored.
+ * @return True if there was a next entry, false if the walk is over.
+ *
+ * Entries are packed, so the bucket field of the iterator is simply the index of the next entry.
+ **/
+static bool mapped_iter_next(hash_table_iter_t *iter, elem_t *key, elem_t **value)
+{
+  hash_table_t *ht = iter->ht;
+  iter->has_current = iter->bucket < ht->size;
+  if (!iter->has_current)
+    return false;
+  *key = ht->entries[iter->bucket].key;
+  *value = &ht->entries[iter->bucket].value;
+  iter->bucket += 1;
+  return true;
+}
+
+/**
+ * @brief Refuse to remove the current entry of a walk over a mapped hash table.
+ * @param iter Iterator operated upon, which has a current entry.
+ * @return False, as the set of keys of a mapped hash table is fixed.
+ **/
+static bool mapped_iter_remove(hash_table_iter_t *iter)
+{
+  hash_table_log(iter->ht, HASH_TABLE_EVENT_INVALID_ARGUMENT, "Keys can not be removed from a mapped hash table!");
+  return false;
+}
+
+/// @brief Operations of the mapped backend.
+static const hash_table_ops_t mapped_ops = {
+  .insert = mapped_insert,
+  .lookup = mapped_lookup,
+  .insert_batch = mapped_insert_batch,
+  .lookup_batch = mapped_lookup_batch,
+  .remove = mapped_remove,
+  .upsert = mapped_upsert,
+  .update = mapped_update,
+  .reserve = mapped_reserve,
+  .clear = mapped_clear,
+  .destroy = mapped_destroy,
+  .for_each = mapped_for_each,
+  .stored_hash = mapped_stored_hash,
+  .stats = mapped_stats,
+  .iter_next = mapped_iter_next,
+  .iter_remove = mapped_iter_remove,
+};
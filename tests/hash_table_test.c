@@ -1,9 +1,15 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
 #include <CUnit/Basic.h>
 #include "linked_list.h"
 #include "hash_table.h"
+#include "hash_table_typed.h"
 
 int init_suite(void)
 {
@@ -32,6 +38,14 @@ unsigned long string_knr_hash(elem_t key)
   return result;
 }
 
+static size_t hash_function_calls = 0;
+
+unsigned long counting_int_hash(elem_t key)
+{
+  hash_function_calls += 1;
+  return (unsigned long) key.i;
+}
+
 static bool str_key_equiv(const elem_t key, const elem_t value_ignored, const void *x)
 {
   return (char*)key.p == (char*)((elem_t*)x)->p; 
@@ -151,6 +165,125 @@ void test_lookupinsert_key_in_use()
   hash_table_destroy(ht);
 }
 
+void test_insert_lookup_batch()
+{
+  const int num_of_entries = 1000;
+  hash_table_options_t chained = { .backend = HASH_TABLE_CHAINED };
+  hash_table_options_t open = { .backend = HASH_TABLE_OPEN_ADDRESSING };
+  hash_table_options_t incremental = { .backend = HASH_TABLE_CHAINED, .rehash_step = 1 };
+  hash_table_options_t lock_free = { .backend = HASH_TABLE_CHAINED, .lock_free_reads = true };
+  hash_table_t *tables[] = {
+    hash_table_create_with_options(&chained),
+    hash_table_create_with_options(&open),
+    hash_table_create_with_options(&incremental),
+    hash_table_concurrent_create(&chained),
+    hash_table_concurrent_create(&lock_free),
+  };
+  elem_t keys[2 * num_of_entries];
+  elem_t values[2 * num_of_entries];
+  elem_t results[2 * num_of_entries];
+  bool found[2 * num_of_entries];
+
+  for (int i = 0; i < 2 * num_of_entries; i++)
+    {
+      keys[i] = int_elem(i < num_of_entries ? i : i % 3);
+      values[i] = int_elem(i < num_of_entries ? -i : i);
+    }
+
+  for (size_t t = 0; t < sizeof(tables) / sizeof(tables[0]); t++)
+    {
+      hash_table_t *ht = tables[t];
+      // Later pairs win, just like inserting them one by one.
+      hash_table_insert_batch(ht, keys, values, 2 * num_of_entries);
+      CU_ASSERT(hash_table_size(ht) == num_of_entries);
+
+      for (int i = 0; i < 2 * num_of_entries; i++)
+        {
+          keys[i] = int_elem(i - num_of_entries / 2);
+          results[i] = int_elem(num_of_entries);
+        }
+      CU_ASSERT(hash_table_lookup_batch(ht, keys, 2 * num_of_entries, results, found) == num_of_entries);
+      for (int i = 0; i < 2 * num_of_entries; i++)
+        {
+          const int key = i - num_of_entries / 2;
+          CU_ASSERT(found[i] == (key >= 0 && key < num_of_entries));
+          if (key >= 3 && key < num_of_entries)
+            {
+              CU_ASSERT(results[i].i == -key);
+            }
+          else if (key >= 0 && key < 3)
+            {
+              CU_ASSERT(results[i].i == 2 * num_of_entries - 1 - (2 * num_of_entries - 1 - key) % 3);
+            }
+          else
+            {
+              CU_ASSERT(results[i].i == num_of_entries);
+            }
+        }
+      CU_ASSERT(hash_table_lookup_batch(ht, keys, 5, results, NULL) == 0);
+      CU_ASSERT(hash_table_lookup_batch(ht, keys, 0, results, NULL) == 0);
+
+      for (int i = 0; i < 2 * num_of_entries; i++)
+        {
+          keys[i] = int_elem(i < num_of_entries ? i : i % 3);
+        }
+      hash_table_destroy(ht);
+    }
+}
+
+static void add_to_value(const elem_t key, elem_t *value, const void *extra)
+{
+  value->i += ((const elem_t *)extra)->i;
+}
+
+void test_upsert_and_update()
+{
+  hash_table_options_t chained = { .backend = HASH_TABLE_CHAINED, .hash_function = counting_int_hash };
+  hash_table_options_t open = { .backend = HASH_TABLE_OPEN_ADDRESSING, .hash_function = counting_int_hash };
+  hash_table_t *tables[] = {
+    hash_table_create_with_options(&chained),
+    hash_table_create_with_options(&open),
+    hash_table_concurrent_create(&chained),
+  };
+  const int num_of_entries = 500;
+  const elem_t one = int_elem(1);
+
+  for (size_t t = 0; t < sizeof(tables) / sizeof(tables[0]); t++)
+    {
+      hash_table_t *ht = tables[t];
+      bool inserted;
+      elem_t result;
+
+      // Count occurrences of i % num_of_entries, one probe per occurrence.
+      hash_function_calls = 0;
+      for (int i = 0; i < 3 * num_of_entries; i++)
+        {
+          elem_t *count = hash_table_upsert(ht, int_elem(i % num_of_entries), int_elem(0), &inserted);
+          CU_ASSERT_PTR_NOT_NULL_FATAL(count);
+          CU_ASSERT(inserted == (i < num_of_entries));
+          count->i += 1;
+        }
+      CU_ASSERT(hash_function_calls == 3 * num_of_entries);
+      CU_ASSERT(hash_table_size(ht) == num_of_entries);
+      CU_ASSERT(hash_table_lookup(ht, int_elem(7), &result) && result.i == 3);
+      CU_ASSERT(hash_table_upsert(ht, int_elem(7), int_elem(0), NULL)->i == 3);
+
+      hash_function_calls = 0;
+      for (int i = 0; i < num_of_entries; i += 2)
+        {
+          CU_ASSERT(hash_table_update(ht, int_elem(i), add_to_value, &one));
+        }
+      CU_ASSERT_FALSE(hash_table_update(ht, int_elem(num_of_entries), add_to_value, &one));
+      CU_ASSERT(hash_function_calls == num_of_entries / 2 + 1);
+      CU_ASSERT_FALSE(hash_table_has_key(ht, int_elem(num_of_entries)));
+      for (int i = 0; i < num_of_entries; i++)
+        {
+          CU_ASSERT(hash_table_lookup(ht, int_elem(i), &result) && result.i == (i % 2 == 0 ? 4 : 3));
+        }
+      hash_table_destroy(ht);
+    }
+}
+
 void test_remove_invalid_key()
 {
   hash_table_t *ht = hash_table_create(NULL, NULL, NULL);
@@ -297,6 +430,31 @@ void test_has_key()
   hash_table_destroy(ht);
 }
 
+void test_has_key_probes_bucket()
+{
+  hash_table_t *ht = hash_table_create(counting_int_hash, NULL, NULL);
+  for (int i = 0; i < 1000; i++)
+    {
+      hash_table_insert(ht, int_elem(i), int_elem(i));
+    }
+
+  hash_function_calls = 0;
+  CU_ASSERT(hash_table_has_key(ht, int_elem(500)));
+  CU_ASSERT_FALSE(hash_table_has_key(ht, int_elem(1000)));
+  CU_ASSERT(hash_function_calls == 2);
+
+  for (int i = 0; i < 1000; i += 2)
+    {
+      elem_t result;
+      hash_table_remove(ht, int_elem(i), &result);
+    }
+  for (int i = 0; i < 1000; i++)
+    {
+      CU_ASSERT(hash_table_has_key(ht, int_elem(i)) == (i % 2 == 1));
+    }
+  hash_table_destroy(ht);
+}
+
 void test_has_value()
 {
   hash_table_t *ht = hash_table_create(NULL, NULL, NULL);
@@ -357,6 +515,252 @@ void test_hash_table_any()
   hash_table_destroy(ht);
 }
 
+static size_t predicate_calls = 0;
+
+static bool counting_int_key_equiv(const elem_t key, const elem_t value_ignored, const void *x)
+{
+  predicate_calls += 1;
+  return key.i == ((elem_t *)x)->i;
+}
+
+/// Hash function mapping every key to one of four hashes, so that most keys collide.
+static unsigned long colliding_int_hash(elem_t key)
+{
+  return (unsigned long) (key.u % 4);
+}
+
+void test_colliding_keys()
+{
+  hash_table_options_t chained = { .backend = HASH_TABLE_CHAINED, .hash_function = colliding_int_hash };
+  hash_table_options_t open = { .backend = HASH_TABLE_OPEN_ADDRESSING, .hash_function = colliding_int_hash };
+  hash_table_options_t incremental = { .backend = HASH_TABLE_CHAINED, .hash_function = colliding_int_hash, .rehash_step = 1 };
+  hash_table_options_t lock_free = { .backend = HASH_TABLE_CHAINED, .hash_function = colliding_int_hash, .lock_free_reads = true };
+  hash_table_t *tables[] = {
+    hash_table_create_with_options(&chained),
+    hash_table_create_with_options(&open),
+    hash_table_create_with_options(&incremental),
+    hash_table_concurrent_create(&chained),
+    hash_table_concurrent_create(&lock_free),
+  };
+  const int num_of_entries = 200;
+  const elem_t one = int_elem(1);
+
+  for (size_t t = 0; t < sizeof(tables) / sizeof(tables[0]); t++)
+    {
+      hash_table_t *ht = tables[t];
+      elem_t result;
+      for (int i = 0; i < num_of_entries; i++)
+        {
+          hash_table_insert(ht, int_elem(i), int_elem(i));
+        }
+      CU_ASSERT(hash_table_size(ht) == num_of_entries);
+
+      for (int i = 0; i < num_of_entries; i++)
+        {
+          CU_ASSERT(hash_table_lookup(ht, int_elem(i), &result) && result.i == i);
+          CU_ASSERT(hash_table_update(ht, int_elem(i), add_to_value, &one));
+        }
+      CU_ASSERT_FALSE(hash_table_has_key(ht, int_elem(num_of_entries)));
+
+      for (int i = 0; i < num_of_entries; i += 2)
+        {
+          CU_ASSERT(hash_table_remove(ht, int_elem(i), &result) && result.i == i + 1);
+        }
+      elem_t keys[num_of_entries];
+      elem_t results[num_of_entries];
+      for (int i = 0; i < num_of_entries; i++)
+        {
+          keys[i] = int_elem(i);
+        }
+      CU_ASSERT(hash_table_lookup_batch(ht, keys, num_of_entries, results, NULL) == num_of_entries / 2);
+      for (int i = 0; i < num_of_entries; i++)
+        {
+          bool inserted;
+          elem_t *value = hash_table_upsert(ht, int_elem(i), int_elem(-i), &inserted);
+          CU_ASSERT_PTR_NOT_NULL_FATAL(value);
+          CU_ASSERT(inserted == (i % 2 == 0));
+          CU_ASSERT(value->i == (i % 2 == 0 ? -i : i + 1));
+        }
+      CU_ASSERT(hash_table_size(ht) == num_of_entries);
+      hash_table_destroy(ht);
+    }
+}
+
+void test_key_equiv_after_hash()
+{
+  hash_table_options_t options = { .hash_function = extract_int_hash_key, .key_equiv = counting_int_key_equiv };
+  hash_table_t *ht = hash_table_create_with_options(&options);
+  for (int i = 0; i < 1000; i++)
+    {
+      hash_table_insert(ht, int_elem(i), int_elem(i));
+    }
+
+  // Keys are only compared once their hashes are known to be equal.
+  elem_t result;
+  predicate_calls = 0;
+  CU_ASSERT(hash_table_lookup(ht, int_elem(500), &result));
+  CU_ASSERT_FALSE(hash_table_lookup(ht, int_elem(1000), &result));
+  CU_ASSERT(predicate_calls == 1);
+  hash_table_destroy(ht);
+
+  // Equal strings in distinct buffers are the same key.
+  char first[] = "key";
+  char second[] = "key";
+  ht = hash_table_create(hash_table_hash_string, NULL, NULL);
+  hash_table_insert(ht, ptr_elem(first), int_elem(1));
+  hash_table_insert(ht, ptr_elem(second), int_elem(2));
+  CU_ASSERT(hash_table_size(ht) == 1);
+  CU_ASSERT(hash_table_lookup(ht, ptr_elem("key"), &result) && result.i == 2);
+  hash_table_destroy(ht);
+}
+
+void test_prefilter()
+{
+  const int num_of_entries = 20000;
+  hash_table_options_t chained = { .backend = HASH_TABLE_CHAINED, .prefilter = true };
+  hash_table_options_t incremental = { .backend = HASH_TABLE_CHAINED, .rehash_step = 1, .prefilter = true };
+  hash_table_options_t sharded = { .backend = HASH_TABLE_CHAINED, .no_shards = 4, .prefilter = true };
+  hash_table_t *tables[] = {
+    hash_table_create_with_options(&chained),
+    hash_table_create_with_options(&incremental),
+    hash_table_create_with_options(&sharded),
+  };
+
+  for (size_t t = 0; t < sizeof(tables) / sizeof(tables[0]); t++)
+    {
+      hash_table_t *ht = tables[t];
+      CU_ASSERT_PTR_NOT_NULL_FATAL(ht);
+      elem_t result;
+      bool all_found = true;
+      for (int i = 0; i < num_of_entries; i++)
+        {
+          hash_table_insert(ht, int_elem(i), int_elem(i));
+          // Keys are never rejected, including while buckets are being migrated
+          all_found &= hash_table_lookup(ht, int_elem(i / 2), &result) && result.i == i / 2;
+        }
+      CU_ASSERT(all_found);
+
+      size_t no_found = 0;
+      for (int i = num_of_entries; i < 2 * num_of_entries; i++)
+        {
+          no_found += hash_table_has_key(ht, int_elem(i));
+        }
+      CU_ASSERT(no_found == 0);
+      CU_ASSERT_FALSE(hash_table_remove(ht, int_elem(-1), &result));
+      CU_ASSERT_FALSE(hash_table_update(ht, int_elem(-1), add_to_value, &result));
+      hash_table_stats_t stats;
+      hash_table_stats(ht, &stats);
+      CU_ASSERT(stats.filter_bytes >= num_of_entries);
+      CU_ASSERT(stats.filter_false_positive_rate > 0 && stats.filter_false_positive_rate < 0.02);
+      if (stats.has_counters)
+        {
+          CU_ASSERT(stats.no_filter_rejections > 0.95 * num_of_entries);
+        }
+
+      // Churn leaves stale bits behind, which rebuilds keep from piling up
+      bool all_removed = true;
+      for (int i = 0; i < 10 * num_of_entries; i++)
+        {
+          hash_table_insert(ht, int_elem(2 * num_of_entries + i), int_elem(i));
+          all_removed &= hash_table_remove(ht, int_elem(2 * num_of_entries + i), &result);
+        }
+      CU_ASSERT(all_removed);
+      CU_ASSERT_FALSE(hash_table_has_key(ht, int_elem(2 * num_of_entries)));
+      hash_table_stats(ht, &stats);
+      CU_ASSERT(stats.filter_false_positive_rate < 0.05);
+      elem_t keys[100];
+      elem_t results[100];
+      bool found[100];
+      for (int i = 0; i < 100; i++)
+        {
+          keys[i] = int_elem(i % 2 == 0 ? i : num_of_entries + i);
+        }
+      hash_table_stats_t before;
+      hash_table_stats(ht, &before);
+      CU_ASSERT(hash_table_lookup_batch(ht, keys, 100, results, found) == 50);
+      CU_ASSERT(found[0] && !found[1] && results[98].i == 98);
+      bool flags_match = true;
+      for (int i = 0; i < 100; i++)
+        {
+          flags_match &= found[i] == (i % 2 == 0);
+        }
+      CU_ASSERT(flags_match);
+      // Batches probe only the keys that get through the filter
+      hash_table_stats(ht, &stats);
+      if (stats.has_counters)
+        {
+          CU_ASSERT(stats.no_finds - before.no_finds < 60);
+          CU_ASSERT(stats.no_filter_rejections - before.no_filter_rejections > 40);
+        }
+
+      hash_table_clear(ht);
+      CU_ASSERT_FALSE(hash_table_has_key(ht, int_elem(0)));
+      hash_table_stats(ht, &stats);
+      CU_ASSERT(stats.filter_false_positive_rate == 0);
+      hash_table_insert(ht, int_elem(0), int_elem(1));
+      CU_ASSERT(hash_table_lookup(ht, int_elem(0), &result) && result.i == 1);
+    }
+
+  // Entries moved into a hash table get through its filter
+  hash_table_t *src = hash_table_create(NULL, NULL, NULL);
+  elem_t keys[1000];
+  for (int i = 0; i < 1000; i++)
+    {
+      keys[i] = int_elem(i);
+      hash_table_insert(src, keys[i], keys[i]);
+    }
+  elem_t bound = int_elem(500);
+  CU_ASSERT(hash_table_split(src, int_key_less, &bound, tables[0]) == 500);
+  CU_ASSERT(hash_table_merge(tables[1], src));
+  CU_ASSERT(hash_table_has_key(tables[0], int_elem(499)) && !hash_table_has_key(tables[0], int_elem(500)));
+  CU_ASSERT(hash_table_has_key(tables[1], int_elem(999)) && !hash_table_has_key(tables[1], int_elem(499)));
+  CU_ASSERT(hash_table_merge(tables[1], tables[0]));
+  CU_ASSERT(hash_table_size(tables[1]) == 1000 && !hash_table_has_key(tables[0], int_elem(1)));
+  hash_table_destroy(tables[0]);
+  tables[0] = hash_table_create_with_options(&chained);
+  hash_table_build_parallel(tables[0], keys, keys, 1000, 4);
+  bool all_found = true;
+  for (int i = 0; i < 1000; i++)
+    {
+      all_found &= hash_table_has_key(tables[0], keys[i]);
+    }
+  CU_ASSERT(all_found);
+  hash_table_destroy(src);
+  for (size_t t = 0; t < sizeof(tables) / sizeof(tables[0]); t++)
+    {
+      hash_table_destroy(tables[t]);
+    }
+
+  hash_table_options_t open = { .backend = HASH_TABLE_OPEN_ADDRESSING, .prefilter = true };
+  CU_ASSERT_PTR_NULL(hash_table_create_with_options(&open));
+  CU_ASSERT_PTR_NULL(hash_table_concurrent_create(&chained));
+}
+
+void test_hash_table_any_all_stop_early()
+{
+  hash_table_t *ht = hash_table_create(NULL, NULL, NULL);
+  int number_of_entries = 100;
+  for (int i = 0; i < number_of_entries; ++i)
+    {
+      hash_table_insert(ht, int_elem(i), int_elem(i));
+    }
+
+  elem_t key_equal_to = int_elem(7);
+  predicate_calls = 0;
+  CU_ASSERT(hash_table_any(ht, counting_int_key_equiv, &key_equal_to));
+  CU_ASSERT(predicate_calls >= 1 && predicate_calls <= number_of_entries);
+  predicate_calls = 0;
+  CU_ASSERT_FALSE(hash_table_all(ht, counting_int_key_equiv, &key_equal_to));
+  CU_ASSERT(predicate_calls <= 2);
+
+  key_equal_to = int_elem(number_of_entries);
+  predicate_calls = 0;
+  CU_ASSERT_FALSE(hash_table_any(ht, counting_int_key_equiv, &key_equal_to));
+  CU_ASSERT(predicate_calls == number_of_entries);
+
+  hash_table_destroy(ht);
+}
+
 static void set_value(const elem_t key, elem_t *value, const void *extra)
 {
   *value = *((elem_t*)extra);
@@ -413,6 +817,9 @@ void test_hash_table_create_dynamic()
 {
   hash_table_t *ht = hash_table_create_dynamic(0, 0.5, NULL, NULL, NULL);
   CU_ASSERT_PTR_NULL(ht);
+
+  ht = hash_table_create_dynamic(17, 0, NULL, NULL, NULL);
+  CU_ASSERT_PTR_NULL(ht);
   
   ht = hash_table_create_dynamic(17, 0.75, NULL, NULL, NULL);
   hash_table_insert(ht, int_elem(1), ptr_elem("test"));
@@ -425,6 +832,22 @@ void test_hash_table_create_dynamic()
   hash_table_destroy(ht);
 }
 
+void test_hash_table_create_dynamic_any_capacity()
+{
+  const size_t capacity_hints[] = {1, 2, 18, 1000, 100000};
+  for (size_t i = 0; i < sizeof(capacity_hints) / sizeof(capacity_hints[0]); i++)
+    {
+      hash_table_t *ht = hash_table_create_dynamic(capacity_hints[i], 0.75, NULL, NULL, NULL);
+      CU_ASSERT_PTR_NOT_NULL(ht);
+      for (int j = 0; j < 100; j++)
+        {
+          hash_table_insert(ht, int_elem(j), int_elem(j));
+        }
+      CU_ASSERT(hash_table_size(ht) == 100);
+      hash_table_destroy(ht);
+    }
+}
+
 void test_hash_table_resize()
 {
   const size_t bucket_size = 17;
@@ -446,22 +869,211 @@ void test_hash_table_resize()
   hash_table_destroy(ht);
 }
 
-void test_hash_table_resize_not_possible()
+void test_hash_table_resize_beyond_prime_library()
 {  
   const size_t bucket_size = 16381;
   hash_table_t *ht = hash_table_create_dynamic(bucket_size, 0.01, NULL, NULL, NULL);
 
-  int num_of_entries = 165;
+  int num_of_entries = 50000;
   for (int i = 0; i < num_of_entries; i++)
   {
     hash_table_insert(ht, int_elem(i), int_elem(i));
   }
   
-  CU_ASSERT(hash_table_size(ht) == 165);
+  CU_ASSERT(hash_table_size(ht) == num_of_entries);
+
+  elem_t *result = calloc(1, sizeof(elem_t));
+  for (int i = 0; i < num_of_entries; i++)
+  {
+    CU_ASSERT(hash_table_lookup(ht, int_elem(i), result));
+    CU_ASSERT(result->i == i);
+  }
+  free(result);
+
+  hash_table_destroy(ht);
+}
+
+void test_hash_table_resize_does_not_rehash_keys()
+{
+  hash_table_t *ht = hash_table_create(counting_int_hash, NULL, NULL);
+  hash_function_calls = 0;
+
+  int num_of_entries = 1000;
+  for (int i = 0; i < num_of_entries; i++)
+  {
+    hash_table_insert(ht, int_elem(i), int_elem(i));
+  }
+  CU_ASSERT(hash_function_calls == num_of_entries);
+
+  elem_t *result = calloc(1, sizeof(elem_t));
+  for (int i = 0; i < num_of_entries; i++)
+  {
+    CU_ASSERT(hash_table_lookup(ht, int_elem(i), result));
+  }
+  CU_ASSERT(hash_function_calls == 2 * num_of_entries);
+  free(result);
 
   hash_table_destroy(ht);
 }
 
+void test_reserve_and_shrink_to_fit()
+{
+  hash_table_options_t chained = { .backend = HASH_TABLE_CHAINED };
+  hash_table_options_t open = { .backend = HASH_TABLE_OPEN_ADDRESSING };
+  hash_table_options_t incremental = { .backend = HASH_TABLE_CHAINED, .rehash_step = 1 };
+  hash_table_options_t lock_free = { .backend = HASH_TABLE_CHAINED, .lock_free_reads = true };
+  hash_table_t *tables[] = {
+    hash_table_create_with_options(&chained),
+    hash_table_create_with_options(&open),
+    hash_table_create_with_options(&incremental),
+    hash_table_concurrent_create(&chained),
+    hash_table_concurrent_create(&lock_free),
+  };
+  const int num_of_entries = 1000;
+  const int num_of_kept = 10;
+
+  for (size_t t = 0; t < sizeof(tables) / sizeof(tables[0]); t++)
+    {
+      hash_table_t *ht = tables[t];
+      elem_t result;
+      CU_ASSERT(hash_table_reserve(ht, num_of_entries));
+      const size_t reserved = hash_table_capacity(ht);
+      CU_ASSERT(reserved >= num_of_entries);
+      CU_ASSERT(hash_table_reserve(ht, num_of_entries / 2));
+      CU_ASSERT(hash_table_capacity(ht) == reserved);
+
+      for (int i = 0; i < num_of_entries; i++)
+        {
+          hash_table_insert(ht, int_elem(i), int_elem(i));
+        }
+      CU_ASSERT(hash_table_capacity(ht) == reserved);
+
+      for (int i = num_of_kept; i < num_of_entries; i++)
+        {
+          CU_ASSERT(hash_table_remove(ht, int_elem(i), &result));
+        }
+      CU_ASSERT(hash_table_capacity(ht) == reserved);
+      CU_ASSERT(hash_table_shrink_to_fit(ht));
+      CU_ASSERT(hash_table_capacity(ht) < reserved);
+      CU_ASSERT(hash_table_size(ht) == num_of_kept);
+      for (int i = 0; i < num_of_entries; i++)
+        {
+          CU_ASSERT(hash_table_lookup(ht, int_elem(i), &result) == (i < num_of_kept));
+        }
+      hash_table_destroy(ht);
+    }
+}
+
+void test_min_load_factor()
+{
+  hash_table_options_t invalid = { .min_load_factor = 0.5 };
+  CU_ASSERT_PTR_NULL(hash_table_create_with_options(&invalid));
+
+  hash_table_options_t chained = { .backend = HASH_TABLE_CHAINED, .min_load_factor = 0.1 };
+  hash_table_options_t open = { .backend = HASH_TABLE_OPEN_ADDRESSING, .min_load_factor = 0.1 };
+  hash_table_options_t incremental = { .backend = HASH_TABLE_CHAINED, .rehash_step = 1, .min_load_factor = 0.1 };
+  hash_table_t *tables[] = {
+    hash_table_create_with_options(&chained),
+    hash_table_create_with_options(&open),
+    hash_table_create_with_options(&incremental),
+    hash_table_concurrent_create(&chained),
+  };
+  const int num_of_entries = 1000;
+
+  for (size_t t = 0; t < sizeof(tables) / sizeof(tables[0]); t++)
+    {
+      hash_table_t *ht = tables[t];
+      elem_t result;
+      for (int i = 0; i < num_of_entries; i++)
+        {
+          hash_table_insert(ht, int_elem(i), int_elem(i));
+        }
+      const size_t grown = hash_table_capacity(ht);
+
+      for (int i = 0; i < num_of_entries; i++)
+        {
+          CU_ASSERT(hash_table_remove(ht, int_elem(i), &result) && result.i == i);
+          for (int j = i + 1; j < num_of_entries; j += 97)
+            {
+              CU_ASSERT(hash_table_lookup(ht, int_elem(j), &result) && result.i == j);
+            }
+        }
+      CU_ASSERT(hash_table_is_empty(ht));
+      CU_ASSERT(hash_table_capacity(ht) < grown / 10);
+      hash_table_destroy(ht);
+    }
+}
+
+void test_stats()
+{
+  hash_table_options_t chained = { .backend = HASH_TABLE_CHAINED };
+  hash_table_options_t open = { .backend = HASH_TABLE_OPEN_ADDRESSING };
+  hash_table_options_t incremental = { .backend = HASH_TABLE_CHAINED, .rehash_step = 1 };
+  hash_table_options_t colliding = { .backend = HASH_TABLE_CHAINED, .hash_function = colliding_int_hash };
+  hash_table_options_t lock_free = { .backend = HASH_TABLE_CHAINED, .lock_free_reads = true };
+  hash_table_t *tables[] = {
+    hash_table_create_with_options(&open),
+    hash_table_create_with_options(&chained),
+    hash_table_create_with_options(&incremental),
+    hash_table_create_with_options(&colliding),
+    hash_table_concurrent_create(&chained),
+    hash_table_concurrent_create(&lock_free),
+  };
+  const int num_of_entries = 1000;
+
+  for (size_t t = 0; t < sizeof(tables) / sizeof(tables[0]); t++)
+    {
+      hash_table_t *ht = tables[t];
+      hash_table_stats_t stats;
+      elem_t result;
+      hash_table_stats(ht, &stats);
+      CU_ASSERT(stats.size == 0);
+      CU_ASSERT(stats.max_chain_length == 0);
+      CU_ASSERT(stats.no_resizes == 0);
+
+      for (int i = 0; i < num_of_entries; i++)
+        {
+          hash_table_insert(ht, int_elem(i), int_elem(i));
+        }
+      for (int i = 0; i < num_of_entries; i++)
+        {
+          CU_ASSERT(hash_table_lookup(ht, int_elem(i), &result));
+        }
+
+      hash_table_stats(ht, &stats);
+      CU_ASSERT(stats.size == num_of_entries);
+      CU_ASSERT(stats.no_buckets >= hash_table_capacity(ht));
+      CU_ASSERT(stats.load_factor > 0 && stats.load_factor <= 1);
+      CU_ASSERT(stats.no_resizes > 0);
+      CU_ASSERT(stats.max_chain_length >= 1);
+      CU_ASSERT(stats.mean_chain_length >= 1 && stats.mean_chain_length <= stats.max_chain_length);
+
+      size_t histogram_total = 0;
+      for (size_t i = 0; i < HASH_TABLE_STATS_HISTOGRAM_SIZE; i++)
+        {
+          histogram_total += stats.chain_length_histogram[i];
+        }
+      // Open addressing counts entries per probe sequence length, chained hash tables count buckets per chain length
+      CU_ASSERT(histogram_total == (t == 0 ? stats.size : stats.no_buckets));
+
+      if (ht == tables[3])
+        {
+          CU_ASSERT(stats.max_chain_length == num_of_entries / 4);
+          CU_ASSERT(stats.chain_length_histogram[HASH_TABLE_STATS_HISTOGRAM_SIZE - 1] == 4);
+        }
+      if (stats.has_counters)
+        {
+          CU_ASSERT(stats.no_finds >= num_of_entries);
+          CU_ASSERT(stats.no_probes > 0);
+        }
+      else
+        {
+          CU_ASSERT(stats.no_finds == 0 && stats.no_probes == 0 && stats.rehash_seconds == 0);
+        }
+      hash_table_destroy(ht);
+    }
+}
+
 void test_keys_and_values()
 {
   const size_t bucket_size = 17;
@@ -477,12 +1089,14 @@ void test_keys_and_values()
   puts("*** clearing hash table ***");
   hash_table_clear(ht);
 
+  bool seen[17] = { false };
   for (int i = 0; i < bucket_size; i++)
     {
       int key = (int)linked_list_get(keys, i).i;
       int value = (int)linked_list_get(values, i).i;
-      CU_ASSERT(key == i);
-      CU_ASSERT(value == i);
+      CU_ASSERT(key == value);
+      CU_ASSERT(key >= 0 && key < bucket_size && !seen[key]);
+      seen[key] = true;
     }  
 
   linked_list_destroy(keys);
@@ -490,6 +1104,97 @@ void test_keys_and_values()
   hash_table_destroy(ht);
 }
 
+/**
+ * @brief Walk a hash table holding keys 0 to num_of_entries - 1 mapped to themselves, doubling odd values in
+ * place and removing even keys, then check what is left.
+ **/
+static void check_iter_walk(hash_table_t *ht, const int num_of_entries)
+{
+  hash_table_iter_t iter;
+  elem_t key;
+  elem_t *value;
+  bool *seen = calloc(num_of_entries, sizeof(bool));
+  int visited = 0;
+
+  hash_table_iter_begin(ht, &iter);
+  CU_ASSERT_FALSE(hash_table_iter_remove_current(&iter));
+  while (hash_table_iter_next(&iter, &key, &value))
+    {
+      CU_ASSERT(key.i >= 0 && key.i < num_of_entries && !seen[key.i]);
+      CU_ASSERT(value->i == key.i);
+      seen[key.i] = true;
+      visited++;
+      if (key.i % 2 == 0)
+        {
+          CU_ASSERT(hash_table_iter_remove_current(&iter));
+          CU_ASSERT_FALSE(hash_table_iter_remove_current(&iter));
+        }
+      else
+        {
+          value->i *= 2;
+        }
+    }
+  CU_ASSERT(visited == num_of_entries);
+  CU_ASSERT_FALSE(hash_table_iter_next(&iter, &key, &value));
+  CU_ASSERT(hash_table_size(ht) == num_of_entries / 2);
+
+  elem_t result;
+  for (int i = 0; i < num_of_entries; i++)
+    {
+      CU_ASSERT(hash_table_lookup(ht, int_elem(i), &result) == (i % 2 == 1));
+      if (i % 2 == 1)
+        {
+          CU_ASSERT(result.i == 2 * i);
+        }
+    }
+  free(seen);
+}
+
+void test_iter()
+{
+  const int num_of_entries = 1000;
+  hash_table_options_t chained = { .backend = HASH_TABLE_CHAINED };
+  hash_table_options_t open = { .backend = HASH_TABLE_OPEN_ADDRESSING };
+  hash_table_t *tables[] = {
+    hash_table_create_with_options(&chained),
+    hash_table_create_with_options(&open),
+    hash_table_concurrent_create(&chained),
+  };
+
+  for (size_t t = 0; t < sizeof(tables) / sizeof(tables[0]); t++)
+    {
+      hash_table_iter_t iter;
+      elem_t key;
+      elem_t *value;
+      hash_table_iter_begin(tables[t], &iter);
+      CU_ASSERT_FALSE(hash_table_iter_next(&iter, &key, &value));
+
+      for (int i = 0; i < num_of_entries; i++)
+        {
+          hash_table_insert(tables[t], int_elem(i), int_elem(i));
+        }
+      check_iter_walk(tables[t], num_of_entries);
+      hash_table_destroy(tables[t]);
+    }
+}
+
+void test_iter_during_incremental_rehash()
+{
+  hash_table_options_t options = { .backend = HASH_TABLE_CHAINED, .rehash_step = 1 };
+
+  // Every size is walked, so that some walks start right after a resize, with most buckets yet to be migrated.
+  for (int num_of_entries = 1; num_of_entries <= 300; num_of_entries++)
+    {
+      hash_table_t *ht = hash_table_create_with_options(&options);
+      for (int i = 0; i < num_of_entries; i++)
+        {
+          hash_table_insert(ht, int_elem(i), int_elem(i));
+        }
+      check_iter_walk(ht, num_of_entries);
+      hash_table_destroy(ht);
+    }
+}
+
 void test_key_and_value_equiv()
 {
   const size_t bucket_size = 17;
@@ -500,6 +1205,2112 @@ void test_key_and_value_equiv()
   hash_table_destroy(ht);
 }
 
+void test_create_with_options()
+{
+  hash_table_options_t options = { .backend = HASH_TABLE_CHAINED };
+  hash_table_t *ht = hash_table_create_with_options(&options);
+  CU_ASSERT_PTR_NOT_NULL(ht);
+  hash_table_destroy(ht);
+
+  options.backend = HASH_TABLE_OPEN_ADDRESSING;
+  ht = hash_table_create_with_options(&options);
+  CU_ASSERT_PTR_NOT_NULL(ht);
+  hash_table_destroy(ht);
+
+  options.backend = 42;
+  CU_ASSERT_PTR_NULL(hash_table_create_with_options(&options));
+
+  options.backend = HASH_TABLE_OPEN_ADDRESSING;
+  options.load_factor = -1;
+  CU_ASSERT_PTR_NULL(hash_table_create_with_options(&options));
+}
+
+static void check_backend_churn(hash_table_backend_t backend, hash_function func)
+{
+  hash_table_options_t options = { .backend = backend, .hash_function = func };
+  hash_table_t *ht = hash_table_create_with_options(&options);
+  const int num_of_entries = 10000;
+  elem_t result;
+
+  for (int round = 0; round < 3; round++)
+    {
+      for (int i = 0; i < num_of_entries; i++)
+        {
+          hash_table_insert(ht, int_elem(i), int_elem(i + round));
+        }
+      CU_ASSERT(hash_table_size(ht) == num_of_entries);
+      for (int i = 0; i < num_of_entries; i += 2)
+        {
+          CU_ASSERT(hash_table_remove(ht, int_elem(i), &result));
+          CU_ASSERT(result.i == i + round);
+        }
+      CU_ASSERT(hash_table_size(ht) == num_of_entries / 2);
+      for (int i = 0; i < num_of_entries; i++)
+        {
+          CU_ASSERT(hash_table_lookup(ht, int_elem(i), &result) == (i % 2 == 1));
+        }
+    }
+
+  hash_table_clear(ht);
+  CU_ASSERT(hash_table_is_empty(ht));
+  CU_ASSERT_FALSE(hash_table_lookup(ht, int_elem(1), &result));
+  hash_table_destroy(ht);
+}
+
+void test_backend_churn()
+{
+  check_backend_churn(HASH_TABLE_CHAINED, NULL);
+  check_backend_churn(HASH_TABLE_OPEN_ADDRESSING, NULL);
+  check_backend_churn(HASH_TABLE_OPEN_ADDRESSING, extract_int_hash_key);
+}
+
+void test_incremental_rehash()
+{
+  hash_table_options_t options = { .backend = HASH_TABLE_CHAINED, .rehash_step = 1 };
+  hash_table_t *ht = hash_table_create_with_options(&options);
+  const int num_of_entries = 5000;
+  elem_t result;
+
+  for (int i = 0; i < num_of_entries; i++)
+    {
+      hash_table_insert(ht, int_elem(i), int_elem(i));
+      CU_ASSERT(hash_table_lookup(ht, int_elem(i / 2), &result));
+      CU_ASSERT(result.i == i / 2);
+      if (i % 97 == 0)
+        {
+          list_t *keys = hash_table_keys(ht);
+          CU_ASSERT(linked_list_size(keys) == i + 1);
+          linked_list_destroy(keys);
+        }
+    }
+  CU_ASSERT(hash_table_size(ht) == num_of_entries);
+
+  for (int i = 0; i < num_of_entries; i += 3)
+    {
+      hash_table_insert(ht, int_elem(i), int_elem(-i));
+      CU_ASSERT(hash_table_remove(ht, int_elem(i + 1), &result) == (i + 1 < num_of_entries));
+    }
+  for (int i = 0; i < num_of_entries; i++)
+    {
+      const bool present = i % 3 != 1;
+      CU_ASSERT(hash_table_lookup(ht, int_elem(i), &result) == present);
+      if (present)
+        {
+          CU_ASSERT(result.i == (i % 3 == 0 ? -i : i));
+        }
+    }
+
+  hash_table_clear(ht);
+  CU_ASSERT(hash_table_is_empty(ht));
+  for (int i = 0; i < num_of_entries; i++)
+    {
+      hash_table_insert(ht, int_elem(i), int_elem(i));
+    }
+  CU_ASSERT(hash_table_size(ht) == num_of_entries);
+  hash_table_destroy(ht);
+}
+
+/// Work of a single thread operating on a shared hash table.
+struct concurrent_worker
+{
+  hash_table_t *ht;
+  int first_key;
+  int no_keys;
+  int errors;
+};
+
+static void *concurrent_worker_run(void *arg)
+{
+  struct concurrent_worker *worker = arg;
+  elem_t result;
+
+  for (int i = worker->first_key; i < worker->first_key + worker->no_keys; i++)
+    {
+      hash_table_insert(worker->ht, int_elem(i), int_elem(i));
+      if (!hash_table_lookup(worker->ht, int_elem(i), &result) || result.i != i)
+        {
+          worker->errors += 1;
+        }
+    }
+  for (int i = worker->first_key; i < worker->first_key + worker->no_keys; i += 2)
+    {
+      if (!hash_table_remove(worker->ht, int_elem(i), &result) || result.i != i)
+        {
+          worker->errors += 1;
+        }
+    }
+  for (int i = worker->first_key; i < worker->first_key + worker->no_keys; i++)
+    {
+      if (hash_table_lookup(worker->ht, int_elem(i), &result) != (i % 2 == 1))
+        {
+          worker->errors += 1;
+        }
+    }
+  return NULL;
+}
+
+static void *concurrent_counter_run(void *arg)
+{
+  const elem_t one = int_elem(1);
+  for (int i = 0; i < 10000; i++)
+    {
+      hash_table_update(arg, int_elem(i % 10), add_to_value, &one);
+    }
+  return NULL;
+}
+
+void test_concurrent_update()
+{
+  hash_table_options_t options = { .backend = HASH_TABLE_CHAINED, .lock_free_reads = true };
+  hash_table_t *ht = hash_table_concurrent_create(&options);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(ht);
+  for (int i = 0; i < 10; i++)
+    {
+      hash_table_insert(ht, int_elem(i), int_elem(0));
+    }
+
+  pthread_t threads[4];
+  for (int t = 0; t < 4; t++)
+    {
+      CU_ASSERT(pthread_create(&threads[t], NULL, concurrent_counter_run, ht) == 0);
+    }
+  for (int t = 0; t < 4; t++)
+    {
+      pthread_join(threads[t], NULL);
+    }
+
+  elem_t result;
+  for (int i = 0; i < 10; i++)
+    {
+      CU_ASSERT(hash_table_lookup(ht, int_elem(i), &result) && result.i == 4000);
+    }
+  hash_table_destroy(ht);
+}
+
+void test_concurrent_insert_lookup_remove()
+{
+  hash_table_options_t options = { .backend = HASH_TABLE_CHAINED };
+  hash_table_t *ht = hash_table_concurrent_create(&options);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(ht);
+
+  const int no_threads = 4;
+  const int no_keys = 20000;
+  pthread_t threads[4];
+  struct concurrent_worker workers[4];
+  for (int t = 0; t < no_threads; t++)
+    {
+      struct concurrent_worker worker = { .ht = ht, .first_key = t * no_keys, .no_keys = no_keys, .errors = 0 };
+      workers[t] = worker;
+      CU_ASSERT(pthread_create(&threads[t], NULL, concurrent_worker_run, &workers[t]) == 0);
+    }
+  for (int t = 0; t < no_threads; t++)
+    {
+      pthread_join(threads[t], NULL);
+      CU_ASSERT(workers[t].errors == 0);
+    }
+
+  CU_ASSERT(hash_table_size(ht) == no_threads * no_keys / 2);
+  list_t *keys = hash_table_keys(ht);
+  CU_ASSERT(linked_list_size(keys) == no_threads * no_keys / 2);
+  linked_list_destroy(keys);
+
+  hash_table_clear(ht);
+  CU_ASSERT(hash_table_is_empty(ht));
+  hash_table_insert(ht, int_elem(1), int_elem(2));
+  elem_t result;
+  CU_ASSERT(hash_table_lookup(ht, int_elem(1), &result) && result.i == 2);
+  hash_table_destroy(ht);
+
+  options.backend = HASH_TABLE_OPEN_ADDRESSING;
+  CU_ASSERT_PTR_NULL(hash_table_concurrent_create(&options));
+}
+
+/// Lookups of keys that stay in a shared hash table while another thread modifies it.
+struct lock_free_reader
+{
+  hash_table_t *ht;
+  int no_keys;
+  bool *done;
+  int errors;
+};
+
+static void *lock_free_reader_run(void *arg)
+{
+  struct lock_free_reader *reader = arg;
+  elem_t result;
+
+  while (!__atomic_load_n(reader->done, __ATOMIC_ACQUIRE))
+    {
+      for (int i = 0; i < reader->no_keys; i++)
+        {
+          if (!hash_table_lookup(reader->ht, int_elem(i), &result) || result.i != i)
+            {
+              reader->errors += 1;
+            }
+        }
+    }
+  return NULL;
+}
+
+void test_concurrent_lock_free_reads()
+{
+  hash_table_options_t options = { .backend = HASH_TABLE_CHAINED, .lock_free_reads = true };
+  hash_table_t *ht = hash_table_concurrent_create(&options);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(ht);
+
+  const int no_keys = 1000;
+  for (int i = 0; i < no_keys; i++)
+    {
+      hash_table_insert(ht, int_elem(i), int_elem(i));
+    }
+
+  bool done = false;
+  pthread_t threads[2];
+  struct lock_free_reader readers[2];
+  for (int t = 0; t < 2; t++)
+    {
+      struct lock_free_reader reader = { .ht = ht, .no_keys = no_keys, .done = &done, .errors = 0 };
+      readers[t] = reader;
+      CU_ASSERT(pthread_create(&threads[t], NULL, lock_free_reader_run, &readers[t]) == 0);
+    }
+
+  elem_t result;
+  for (int round = 0; round < 3; round++)
+    {
+      for (int i = no_keys; i < 20 * no_keys; i++)
+        {
+          hash_table_insert(ht, int_elem(i), int_elem(i));
+        }
+      for (int i = no_keys; i < 20 * no_keys; i++)
+        {
+          CU_ASSERT(hash_table_remove(ht, int_elem(i), &result) && result.i == i);
+        }
+    }
+  __atomic_store_n(&done, true, __ATOMIC_RELEASE);
+  for (int t = 0; t < 2; t++)
+    {
+      pthread_join(threads[t], NULL);
+      CU_ASSERT(readers[t].errors == 0);
+    }
+
+  CU_ASSERT(hash_table_size(ht) == no_keys);
+  hash_table_clear(ht);
+  CU_ASSERT_FALSE(hash_table_lookup(ht, int_elem(1), &result));
+  hash_table_destroy(ht);
+}
+
+/// Arena that counts the allocations made from it.
+struct counting_arena
+{
+  size_t allocs;
+  size_t frees;
+  size_t bytes_in_use;
+};
+
+static void *counting_alloc(size_t size, void *arena)
+{
+  struct counting_arena *a = arena;
+  a->allocs += 1;
+  a->bytes_in_use += size;
+  return malloc(size);
+}
+
+static void counting_free(void *ptr, size_t size, void *arena)
+{
+  struct counting_arena *a = arena;
+  a->frees += 1;
+  a->bytes_in_use -= size;
+  free(ptr);
+}
+
+void test_entry_pool_arena()
+{
+  struct counting_arena arena = { 0 };
+  hash_table_options_t options = {
+    .backend = HASH_TABLE_CHAINED,
+    .allocator = { .alloc = counting_alloc, .free = counting_free, .arena = &arena },
+  };
+  hash_table_t *ht = hash_table_create_with_options(&options);
+
+  const int num_of_entries = 10000;
+  for (int i = 0; i < num_of_entries; i++)
+    {
+      hash_table_insert(ht, int_elem(i), int_elem(i));
+    }
+  CU_ASSERT(arena.allocs > 0);
+  CU_ASSERT(arena.allocs < 30);
+
+  elem_t result;
+  const size_t allocs_before_churn = arena.allocs;
+  for (int i = 0; i < num_of_entries; i++)
+    {
+      CU_ASSERT(hash_table_remove(ht, int_elem(i), &result));
+      hash_table_insert(ht, int_elem(i + num_of_entries), int_elem(i));
+    }
+  CU_ASSERT(arena.allocs == allocs_before_churn);
+  CU_ASSERT(hash_table_lookup(ht, int_elem(num_of_entries), &result));
+
+  hash_table_clear(ht);
+  CU_ASSERT(arena.frees == arena.allocs);
+  CU_ASSERT(arena.bytes_in_use == 0);
+  CU_ASSERT_FALSE(hash_table_lookup(ht, int_elem(num_of_entries), &result));
+
+  hash_table_insert(ht, int_elem(1), int_elem(1));
+  CU_ASSERT(hash_table_lookup(ht, int_elem(1), &result));
+  hash_table_destroy(ht);
+  CU_ASSERT(arena.frees == arena.allocs);
+  CU_ASSERT(arena.bytes_in_use == 0);
+}
+
+void test_build_parallel()
+{
+  const int num_of_keys = 50000;
+  const int num_of_distinct = 40000;
+  elem_t *keys = calloc(num_of_keys, sizeof(elem_t));
+  elem_t *values = calloc(num_of_keys, sizeof(elem_t));
+  CU_ASSERT_PTR_NOT_NULL_FATAL(keys);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(values);
+  for (int i = 0; i < num_of_keys; i++)
+    {
+      keys[i] = int_elem(i % num_of_distinct);
+      values[i] = int_elem(i);
+    }
+
+  struct counting_arena arena = { 0 };
+  hash_table_options_t chained = { .backend = HASH_TABLE_CHAINED };
+  hash_table_options_t incremental = { .backend = HASH_TABLE_CHAINED, .rehash_step = 1 };
+  hash_table_options_t pooled = { .backend = HASH_TABLE_CHAINED, .allocator = { counting_alloc, counting_free, &arena } };
+  hash_table_options_t open = { .backend = HASH_TABLE_OPEN_ADDRESSING };
+  hash_table_t *tables[] = {
+    hash_table_create_with_options(&chained),
+    hash_table_create_with_options(&incremental),
+    hash_table_create_with_options(&pooled),
+    hash_table_create_with_options(&open),
+    hash_table_concurrent_create(&chained),
+  };
+  const size_t threads[] = { 4, 0, 3, 4, 4 };
+
+  for (size_t t = 0; t < sizeof(tables) / sizeof(tables[0]); t++)
+    {
+      hash_table_t *ht = tables[t];
+      CU_ASSERT_PTR_NOT_NULL_FATAL(ht);
+      hash_table_build_parallel(ht, keys, values, num_of_keys, threads[t]);
+      CU_ASSERT(hash_table_size(ht) == (size_t) num_of_distinct);
+
+      // Later pairs replace the values of earlier pairs with equal keys, as with hash_table_insert_batch
+      elem_t result;
+      for (int i = 0; i < num_of_distinct; i++)
+        {
+          const int expected = i < num_of_keys - num_of_distinct ? i + num_of_distinct : i;
+          CU_ASSERT(hash_table_lookup(ht, int_elem(i), &result) && result.i == expected);
+        }
+      CU_ASSERT_FALSE(hash_table_has_key(ht, int_elem(num_of_distinct)));
+
+      // Entries left over from duplicate keys are reused, and the table keeps growing as usual
+      for (int i = 0; i < num_of_distinct; i += 2)
+        {
+          CU_ASSERT(hash_table_remove(ht, int_elem(i), &result));
+        }
+      for (int i = num_of_distinct; i < 3 * num_of_distinct; i++)
+        {
+          CU_ASSERT(hash_table_insert(ht, int_elem(i), int_elem(i)) == HASH_TABLE_INSERTED);
+        }
+      CU_ASSERT(hash_table_size(ht) == (size_t) num_of_distinct / 2 + 2 * num_of_distinct);
+      CU_ASSERT(hash_table_lookup(ht, int_elem(1), &result) && result.i == num_of_distinct + 1);
+
+      // A hash table that already holds entries is loaded one pair at a time
+      hash_table_clear(ht);
+      hash_table_insert(ht, int_elem(-1), int_elem(-1));
+      hash_table_build_parallel(ht, keys, values, num_of_keys, threads[t]);
+      CU_ASSERT(hash_table_size(ht) == (size_t) num_of_distinct + 1);
+      CU_ASSERT(hash_table_lookup(ht, int_elem(0), &result) && result.i == num_of_distinct);
+      hash_table_destroy(ht);
+    }
+  CU_ASSERT(arena.allocs > 0);
+  CU_ASSERT(arena.bytes_in_use == 0);
+  free(keys);
+  free(values);
+}
+
+void test_parallel_walks()
+{
+  const int num_of_entries = 100000;
+  hash_table_options_t chained = { .backend = HASH_TABLE_CHAINED };
+  hash_table_options_t incremental = { .backend = HASH_TABLE_CHAINED, .rehash_step = 1 };
+  hash_table_options_t open = { .backend = HASH_TABLE_OPEN_ADDRESSING };
+  hash_table_options_t sharded = { .backend = HASH_TABLE_CHAINED, .no_shards = 4 };
+  hash_table_t *tables[] = {
+    hash_table_create_with_options(&chained),
+    hash_table_create_with_options(&incremental),
+    hash_table_create_with_options(&open),
+    hash_table_concurrent_create(&chained),
+    hash_table_create_with_options(&sharded),
+  };
+
+  for (size_t t = 0; t < sizeof(tables) / sizeof(tables[0]); t++)
+    {
+      hash_table_t *ht = tables[t];
+      CU_ASSERT_PTR_NOT_NULL_FATAL(ht);
+      for (int i = 0; i < num_of_entries; i++)
+        {
+          hash_table_insert(ht, int_elem(i), int_elem(i));
+        }
+
+      // Every entry is passed to the function exactly once, including those of buckets yet to be migrated
+      elem_t increment = int_elem(3);
+      hash_table_apply_to_all_parallel(ht, add_to_value, &increment, 4);
+      elem_t result;
+      bool all_incremented = true;
+      for (int i = 0; i < num_of_entries; i++)
+        {
+          all_incremented &= hash_table_lookup(ht, int_elem(i), &result) && result.i == i + 3;
+        }
+      CU_ASSERT(all_incremented);
+
+      elem_t bound = int_elem(num_of_entries);
+      CU_ASSERT(hash_table_all_parallel(ht, int_key_less, &bound, 4));
+      CU_ASSERT_FALSE(hash_table_any_parallel(ht, int_key_less, &(elem_t) { .i = 0 }, 0));
+      CU_ASSERT(hash_table_any_parallel(ht, int_key_less, &(elem_t) { .i = 1 }, 4));
+      CU_ASSERT_FALSE(hash_table_all_parallel(ht, int_key_less, &(elem_t) { .i = num_of_entries - 1 }, 4));
+      hash_table_destroy(ht);
+    }
+}
+
+static void *failing_alloc(size_t size, void *arena)
+{
+  return NULL;
+}
+
+void test_insert_status()
+{
+  hash_table_options_t chained = { .backend = HASH_TABLE_CHAINED };
+  hash_table_options_t open = { .backend = HASH_TABLE_OPEN_ADDRESSING };
+  hash_table_t *tables[] = {
+    hash_table_create_with_options(&chained),
+    hash_table_create_with_options(&open),
+    hash_table_concurrent_create(&chained),
+  };
+
+  for (size_t t = 0; t < sizeof(tables) / sizeof(tables[0]); t++)
+    {
+      hash_table_t *ht = tables[t];
+      elem_t result;
+      CU_ASSERT(hash_table_insert(ht, int_elem(1), int_elem(1)) == HASH_TABLE_INSERTED);
+      CU_ASSERT(hash_table_insert(ht, int_elem(1), int_elem(2)) == HASH_TABLE_UPDATED);
+      CU_ASSERT(hash_table_insert(ht, int_elem(2), int_elem(2)) == HASH_TABLE_INSERTED);
+      CU_ASSERT(hash_table_lookup(ht, int_elem(1), &result) && result.i == 2);
+      CU_ASSERT(hash_table_size(ht) == 2);
+      hash_table_destroy(ht);
+    }
+
+  hash_table_options_t failing = {
+    .backend = HASH_TABLE_CHAINED,
+    .allocator = { .alloc = failing_alloc, .free = counting_free },
+  };
+  hash_table_t *failing_tables[] = {
+    hash_table_create_with_options(&failing),
+    hash_table_concurrent_create(&failing),
+  };
+  for (size_t t = 0; t < sizeof(failing_tables) / sizeof(failing_tables[0]); t++)
+    {
+      hash_table_t *ht = failing_tables[t];
+      CU_ASSERT(hash_table_insert(ht, int_elem(1), int_elem(1)) == HASH_TABLE_NO_MEMORY);
+      CU_ASSERT(hash_table_is_empty(ht));
+      CU_ASSERT_FALSE(hash_table_has_key(ht, int_elem(1)));
+      hash_table_destroy(ht);
+    }
+}
+
+void test_owned_keys()
+{
+  hash_table_options_t chained = { .backend = HASH_TABLE_CHAINED, .owned_keys = true };
+  hash_table_options_t open = { .backend = HASH_TABLE_OPEN_ADDRESSING, .owned_keys = true };
+  hash_table_options_t incremental = { .backend = HASH_TABLE_CHAINED, .rehash_step = 1, .owned_keys = true };
+  hash_table_t *tables[] = {
+    hash_table_create_with_options(&chained),
+    hash_table_create_with_options(&open),
+    hash_table_create_with_options(&incremental),
+  };
+  CU_ASSERT_PTR_NULL(hash_table_concurrent_create(&chained));
+  const int num_of_entries = 1000;
+  char key[400];
+
+  for (size_t t = 0; t < sizeof(tables) / sizeof(tables[0]); t++)
+    {
+      hash_table_t *ht = tables[t];
+      elem_t result;
+      // Keys are written to the same buffer every time, so the hash table must keep copies of them; every
+      // tenth key is too long for any size class
+      for (int round = 0; round < 2; round++)
+        {
+          for (int i = 0; i < num_of_entries; i++)
+            {
+              snprintf(key, sizeof(key), "%0*d", i % 10 == 0 ? 300 : i % 40, i);
+              CU_ASSERT(hash_table_insert(ht, ptr_elem(key), int_elem(i)) == HASH_TABLE_INSERTED);
+            }
+          CU_ASSERT(hash_table_size(ht) == num_of_entries);
+
+          for (int i = 0; i < num_of_entries; i++)
+            {
+              snprintf(key, sizeof(key), "%0*d", i % 10 == 0 ? 300 : i % 40, i);
+              CU_ASSERT(hash_table_lookup(ht, ptr_elem(key), &result) && result.i == i);
+              CU_ASSERT(hash_table_insert(ht, ptr_elem(key), int_elem(i + 1)) == HASH_TABLE_UPDATED);
+              if (i % 2 == 0)
+                {
+                  CU_ASSERT(hash_table_remove(ht, ptr_elem(key), &result) && result.i == i + 1);
+                }
+            }
+          CU_ASSERT(hash_table_size(ht) == num_of_entries / 2);
+
+          hash_table_iter_t iter;
+          elem_t stored_key;
+          elem_t *value;
+          hash_table_iter_begin(ht, &iter);
+          while (hash_table_iter_next(&iter, &stored_key, &value))
+            {
+              CU_ASSERT(stored_key.p != key);
+              CU_ASSERT(atoi(stored_key.p) == value->i - 1);
+              CU_ASSERT(hash_table_iter_remove_current(&iter));
+            }
+          CU_ASSERT(hash_table_is_empty(ht));
+        }
+
+      snprintf(key, sizeof(key), "kept");
+      hash_table_insert(ht, ptr_elem(key), int_elem(1));
+      hash_table_clear(ht);
+      CU_ASSERT_FALSE(hash_table_has_key(ht, ptr_elem("kept")));
+      hash_table_insert(ht, ptr_elem(key), int_elem(1));
+      key[0] = 'K';
+      CU_ASSERT(hash_table_has_key(ht, ptr_elem("kept")));
+      CU_ASSERT_FALSE(hash_table_has_key(ht, ptr_elem("Kept")));
+      hash_table_destroy(ht);
+    }
+
+  hash_table_options_t failing = {
+    .backend = HASH_TABLE_CHAINED,
+    .owned_keys = true,
+    .allocator = { .alloc = failing_alloc, .free = counting_free },
+  };
+  hash_table_t *ht = hash_table_create_with_options(&failing);
+  CU_ASSERT(hash_table_insert(ht, ptr_elem("key"), int_elem(1)) == HASH_TABLE_NO_MEMORY);
+  CU_ASSERT(hash_table_is_empty(ht));
+  hash_table_destroy(ht);
+}
+
+/// Entries passed to record_eviction.
+struct eviction_log
+{
+  size_t no_evicted;
+  int last_key;
+  int last_value;
+  bool keys_intact;   // Whether every evicted owned key was still readable during the call.
+};
+
+static void record_eviction(const elem_t key, const elem_t value, void *extra)
+{
+  struct eviction_log *log = extra;
+  log->no_evicted += 1;
+  log->last_key = key.i;
+  log->last_value = value.i;
+}
+
+static void record_owned_eviction(const elem_t key, const elem_t value, void *extra)
+{
+  struct eviction_log *log = extra;
+  log->no_evicted += 1;
+  log->keys_intact &= atoi(key.p) == value.i;
+}
+
+static size_t value_cost(const elem_t key_ignored, const elem_t value)
+{
+  return (size_t) value.i;
+}
+
+void test_cache_mode()
+{
+  const int capacity = 100;
+  struct eviction_log log = { 0 };
+  hash_table_options_t chained = { .backend = HASH_TABLE_CHAINED, .max_entries = capacity, .evict_function = record_eviction, .evict_extra = &log };
+  hash_table_options_t incremental = { .backend = HASH_TABLE_CHAINED, .rehash_step = 1, .max_entries = capacity, .evict_function = record_eviction, .evict_extra = &log };
+  hash_table_t *tables[] = {
+    hash_table_create_with_options(&chained),
+    hash_table_create_with_options(&incremental),
+  };
+
+  for (size_t t = 0; t < sizeof(tables) / sizeof(tables[0]); t++)
+    {
+      hash_table_t *ht = tables[t];
+      CU_ASSERT_PTR_NOT_NULL_FATAL(ht);
+      memset(&log, 0, sizeof(log));
+      elem_t result;
+      for (int i = 0; i < capacity; i++)
+        {
+          CU_ASSERT(hash_table_insert(ht, int_elem(i), int_elem(-i)) == HASH_TABLE_INSERTED);
+        }
+      CU_ASSERT(log.no_evicted == 0);
+
+      // The first eviction sweeps past every entry once, as all of them are new
+      CU_ASSERT(hash_table_insert(ht, int_elem(capacity), int_elem(-capacity)) == HASH_TABLE_INSERTED);
+      CU_ASSERT(log.no_evicted == 1);
+      CU_ASSERT(log.last_value == -log.last_key);
+      CU_ASSERT_FALSE(hash_table_has_key(ht, int_elem(log.last_key)));
+      CU_ASSERT(hash_table_size(ht) == (size_t) capacity);
+
+      // Entries used since are spared while there are unused ones to evict
+      bool used[100] = { false };
+      for (int i = 0; i < capacity / 2; i++)
+        {
+          used[i] = hash_table_lookup(ht, int_elem(i), &result);
+        }
+      bool inserted;
+      for (int i = capacity + 1; i <= capacity + 40; i++)
+        {
+          elem_t *value = hash_table_upsert(ht, int_elem(i), int_elem(0), &inserted);
+          CU_ASSERT_PTR_NOT_NULL_FATAL(value);
+          CU_ASSERT(inserted);
+          value->i = -i;
+          CU_ASSERT(hash_table_size(ht) == (size_t) capacity);
+        }
+      CU_ASSERT(log.no_evicted == 41);
+      for (int i = 0; i < capacity / 2; i++)
+        {
+          CU_ASSERT(!used[i] || hash_table_has_key(ht, int_elem(i)));
+        }
+      for (int i = capacity + 1; i <= capacity + 40; i++)
+        {
+          CU_ASSERT(hash_table_lookup(ht, int_elem(i), &result) && result.i == -i);
+        }
+
+      // Updating and removing stored keys never evicts
+      CU_ASSERT(hash_table_insert(ht, int_elem(capacity + 1), int_elem(1)) == HASH_TABLE_UPDATED);
+      CU_ASSERT(hash_table_remove(ht, int_elem(capacity + 1), &result));
+      CU_ASSERT(hash_table_insert(ht, int_elem(capacity + 1), int_elem(1)) == HASH_TABLE_INSERTED);
+      CU_ASSERT(log.no_evicted == 41);
+
+      // Churning through many more keys keeps the size at the budget
+      for (int i = 0; i < 50 * capacity; i++)
+        {
+          hash_table_insert(ht, int_elem(1000 + i), int_elem(-1000 - i));
+        }
+      CU_ASSERT(hash_table_size(ht) == (size_t) capacity);
+      CU_ASSERT(log.no_evicted == 41 + 50 * (size_t) capacity);
+      hash_table_clear(ht);
+      for (int i = 0; i < capacity; i++)
+        {
+          hash_table_insert(ht, int_elem(i), int_elem(i));
+        }
+      CU_ASSERT(log.no_evicted == 41 + 50 * (size_t) capacity);
+      hash_table_destroy(ht);
+    }
+
+  hash_table_options_t open = { .backend = HASH_TABLE_OPEN_ADDRESSING, .max_entries = capacity };
+  CU_ASSERT_PTR_NULL(hash_table_create_with_options(&open));
+  CU_ASSERT_PTR_NULL(hash_table_concurrent_create(&chained));
+}
+
+void test_cache_byte_budget()
+{
+  struct eviction_log log = { 0 };
+  hash_table_options_t options = {
+    .backend = HASH_TABLE_CHAINED,
+    .max_bytes = 1000,
+    .cost_function = value_cost,
+    .evict_function = record_eviction,
+    .evict_extra = &log,
+  };
+  hash_table_t *ht = hash_table_create_with_options(&options);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(ht);
+  for (int i = 0; i < 20; i++)
+    {
+      hash_table_insert(ht, int_elem(i), int_elem(100));
+    }
+  CU_ASSERT(hash_table_size(ht) == 10);
+  CU_ASSERT(log.no_evicted == 10);
+
+  // An entry over the whole budget is kept, and evicted in turn by the next insertion
+  elem_t result;
+  hash_table_insert(ht, int_elem(-1), int_elem(5000));
+  CU_ASSERT(hash_table_size(ht) == 1);
+  CU_ASSERT(hash_table_has_key(ht, int_elem(-1)));
+  hash_table_insert(ht, int_elem(-2), int_elem(100));
+  CU_ASSERT(hash_table_size(ht) == 1);
+  CU_ASSERT(log.last_key == -1);
+
+  // Removed entries give their cost back
+  CU_ASSERT(hash_table_remove(ht, int_elem(-2), &result));
+  for (int i = 0; i < 10; i++)
+    {
+      hash_table_insert(ht, int_elem(i), int_elem(100));
+    }
+  CU_ASSERT(hash_table_size(ht) == 10);
+  CU_ASSERT(log.no_evicted == 21);
+  hash_table_destroy(ht);
+
+  // Without a cost function, owned keys count along with their entries
+  memset(&log, 0, sizeof(log));
+  log.keys_intact = true;
+  hash_table_options_t owned = {
+    .backend = HASH_TABLE_CHAINED,
+    .owned_keys = true,
+    .max_bytes = 4096,
+    .evict_function = record_owned_eviction,
+    .evict_extra = &log,
+  };
+  ht = hash_table_create_with_options(&owned);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(ht);
+  char key[64];
+  for (int i = 0; i < 1000; i++)
+    {
+      snprintf(key, sizeof(key), "%d", i);
+      CU_ASSERT(hash_table_insert(ht, ptr_elem(key), int_elem(i)) == HASH_TABLE_INSERTED);
+    }
+  CU_ASSERT(hash_table_size(ht) < 4096 / 32);
+  CU_ASSERT(hash_table_size(ht) > 4096 / 128);
+  CU_ASSERT(log.no_evicted == 1000 - hash_table_size(ht));
+  CU_ASSERT(log.keys_intact);
+  snprintf(key, sizeof(key), "%d", 999);
+  CU_ASSERT(hash_table_has_key(ht, ptr_elem(key)));
+  hash_table_destroy(ht);
+}
+
+void test_cache_entry_footprint()
+{
+  // Only hash tables in cache mode pay for the bookkeeping of eviction in their entries
+  struct counting_arena plain_arena = { 0 };
+  struct counting_arena cache_arena = { 0 };
+  hash_table_options_t plain = {
+    .backend = HASH_TABLE_CHAINED,
+    .allocator = { counting_alloc, counting_free, &plain_arena },
+  };
+  hash_table_options_t cache = {
+    .backend = HASH_TABLE_CHAINED,
+    .max_entries = 1000,
+    .allocator = { counting_alloc, counting_free, &cache_arena },
+  };
+  hash_table_t *plain_ht = hash_table_create_with_options(&plain);
+  hash_table_t *cache_ht = hash_table_create_with_options(&cache);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(plain_ht);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(cache_ht);
+  for (int i = 0; i < 100; i++)
+    {
+      hash_table_insert(plain_ht, int_elem(i), int_elem(i));
+      hash_table_insert(cache_ht, int_elem(i), int_elem(i));
+    }
+  CU_ASSERT(plain_arena.allocs == cache_arena.allocs);
+  CU_ASSERT(plain_arena.bytes_in_use < cache_arena.bytes_in_use);
+  hash_table_destroy(plain_ht);
+  hash_table_destroy(cache_ht);
+  CU_ASSERT(plain_arena.bytes_in_use == 0 && cache_arena.bytes_in_use == 0);
+}
+
+static uint64_t fake_clock(void *extra)
+{
+  return *(const uint64_t *) extra;
+}
+
+void test_sharded()
+{
+  const int num_of_entries = 20000;
+  uint64_t now = 1000;
+  hash_table_options_t chained = { .backend = HASH_TABLE_CHAINED, .no_shards = 3, .no_buckets = 100, .clock_function = fake_clock, .clock_extra = &now };
+  hash_table_options_t open = { .backend = HASH_TABLE_OPEN_ADDRESSING, .no_shards = 8 };
+  hash_table_t *tables[] = {
+    hash_table_create_with_options(&chained),
+    hash_table_create_with_options(&open),
+  };
+
+  for (size_t t = 0; t < sizeof(tables) / sizeof(tables[0]); t++)
+    {
+      hash_table_t *ht = tables[t];
+      CU_ASSERT_PTR_NOT_NULL_FATAL(ht);
+      CU_ASSERT(hash_table_no_shards(ht) == 4 + 4 * t);
+      CU_ASSERT(hash_table_shard_node(ht, 0) == -1);
+      CU_ASSERT(hash_table_shard_node(ht, hash_table_no_shards(ht)) == -1);
+      for (int i = 0; i < num_of_entries; i++)
+        {
+          CU_ASSERT(hash_table_insert(ht, int_elem(i), int_elem(i)) == HASH_TABLE_INSERTED);
+        }
+      CU_ASSERT(hash_table_insert(ht, int_elem(5), int_elem(-5)) == HASH_TABLE_UPDATED);
+      CU_ASSERT(hash_table_size(ht) == num_of_entries);
+
+      // Keys spread over every shard, and the same key always maps to the same one
+      size_t per_shard[8] = { 0 };
+      for (int i = 0; i < num_of_entries; i++)
+        {
+          per_shard[hash_table_shard_of(ht, int_elem(i))] += 1;
+        }
+      for (size_t s = 0; s < hash_table_no_shards(ht); s++)
+        {
+          CU_ASSERT(per_shard[s] > num_of_entries / hash_table_no_shards(ht) / 2);
+        }
+      CU_ASSERT(hash_table_shard_of(ht, int_elem(42)) == hash_table_shard_of(ht, int_elem(42)));
+
+      elem_t result;
+      CU_ASSERT(hash_table_lookup(ht, int_elem(5), &result) && result.i == -5);
+      CU_ASSERT(hash_table_remove(ht, int_elem(5), &result) && result.i == -5);
+      CU_ASSERT_FALSE(hash_table_has_key(ht, int_elem(5)));
+      bool inserted;
+      CU_ASSERT(hash_table_upsert(ht, int_elem(5), int_elem(0), &inserted)->i == 0 && inserted);
+      elem_t increment = int_elem(7);
+      CU_ASSERT(hash_table_update(ht, int_elem(5), add_to_value, &increment));
+      CU_ASSERT(hash_table_lookup(ht, int_elem(5), &result) && result.i == 7);
+      hash_table_insert(ht, int_elem(5), int_elem(5));
+
+      list_t *keys = hash_table_keys(ht);
+      CU_ASSERT(linked_list_size(keys) == num_of_entries);
+      linked_list_destroy(keys);
+      CU_ASSERT(hash_table_capacity(ht) >= num_of_entries);
+
+      hash_table_stats_t stats;
+      hash_table_stats(ht, &stats);
+      CU_ASSERT(stats.size == num_of_entries);
+      CU_ASSERT(stats.no_buckets == hash_table_capacity(ht));
+      CU_ASSERT(stats.no_resizes > 0);
+      CU_ASSERT(stats.mean_chain_length >= 1);
+
+      // Walks cross from shard to shard, removing every odd key on the way
+      hash_table_iter_t iter;
+      hash_table_iter_begin(ht, &iter);
+      elem_t key;
+      elem_t *value;
+      size_t no_visited = 0;
+      bool values_match = true;
+      while (hash_table_iter_next(&iter, &key, &value))
+        {
+          no_visited += 1;
+          values_match &= key.i == value->i;
+          if (key.i % 2 == 1)
+            {
+              CU_ASSERT(hash_table_iter_remove_current(&iter));
+            }
+        }
+      CU_ASSERT_FALSE(hash_table_iter_next(&iter, &key, &value));
+      CU_ASSERT(no_visited == num_of_entries);
+      CU_ASSERT(values_match);
+      CU_ASSERT(hash_table_size(ht) == num_of_entries / 2);
+      CU_ASSERT_FALSE(hash_table_has_key(ht, int_elem(1)));
+      CU_ASSERT(hash_table_has_key(ht, int_elem(2)));
+
+      CU_ASSERT(hash_table_shrink_to_fit(ht));
+      CU_ASSERT(hash_table_reserve(ht, 4 * num_of_entries));
+      CU_ASSERT(hash_table_capacity(ht) >= 4 * num_of_entries);
+      hash_table_clear(ht);
+      CU_ASSERT(hash_table_is_empty(ht));
+    }
+
+  // Times to live are kept by the shard of every key
+  hash_table_t *ht = tables[0];
+  for (int i = 0; i < 100; i++)
+    {
+      CU_ASSERT(hash_table_insert_ttl(ht, int_elem(i), int_elem(i), i < 50 ? 10 : 1000) == HASH_TABLE_INSERTED);
+    }
+  now += 100;
+  CU_ASSERT(hash_table_expire(ht, SIZE_MAX) == 50);
+  CU_ASSERT(hash_table_size(ht) == 50);
+  CU_ASSERT_FALSE(hash_table_has_key(ht, int_elem(0)));
+  CU_ASSERT(hash_table_has_key(ht, int_elem(50)));
+  CU_ASSERT(hash_table_insert_ttl(tables[1], int_elem(0), int_elem(0), 10) == HASH_TABLE_UNSUPPORTED);
+
+  // Entries move between sharded and unsharded tables, but concurrent ones can not be swapped
+  hash_table_t *single = hash_table_create_with_options(&(hash_table_options_t) { .backend = HASH_TABLE_CHAINED });
+  CU_ASSERT(hash_table_merge(single, ht));
+  CU_ASSERT(hash_table_size(single) == 50 && hash_table_is_empty(ht));
+  CU_ASSERT(hash_table_swap(single, ht));
+  CU_ASSERT(hash_table_size(ht) == 50 && hash_table_no_shards(ht) == 1 && hash_table_no_shards(single) == 4);
+  hash_table_t *concurrent = hash_table_concurrent_create(&(hash_table_options_t) { .backend = HASH_TABLE_CHAINED, .no_shards = 2 });
+  CU_ASSERT_PTR_NOT_NULL_FATAL(concurrent);
+  CU_ASSERT_FALSE(hash_table_swap(single, concurrent));
+  hash_table_destroy(single);
+  hash_table_destroy(tables[0]);
+  hash_table_destroy(tables[1]);
+
+  // Shards of a concurrent table are concurrent tables of their own
+  const int no_threads = 4;
+  const int no_keys = 20000;
+  pthread_t threads[4];
+  struct concurrent_worker workers[4];
+  for (int t = 0; t < no_threads; t++)
+    {
+      struct concurrent_worker worker = { .ht = concurrent, .first_key = t * no_keys, .no_keys = no_keys, .errors = 0 };
+      workers[t] = worker;
+      CU_ASSERT(pthread_create(&threads[t], NULL, concurrent_worker_run, &workers[t]) == 0);
+    }
+  for (int t = 0; t < no_threads; t++)
+    {
+      pthread_join(threads[t], NULL);
+      CU_ASSERT(workers[t].errors == 0);
+    }
+  CU_ASSERT(hash_table_size(concurrent) == no_threads * no_keys / 2);
+  hash_table_destroy(concurrent);
+
+  hash_table_options_t too_many = { .backend = HASH_TABLE_CHAINED, .no_shards = SIZE_MAX };
+  CU_ASSERT_PTR_NULL(hash_table_create_with_options(&too_many));
+  hash_table_options_t mapped = { .backend = HASH_TABLE_MAPPED, .no_shards = 2 };
+  CU_ASSERT_PTR_NULL(hash_table_create_with_options(&mapped));
+}
+
+void test_sharded_hashing()
+{
+  hash_table_options_t chained = { .backend = HASH_TABLE_CHAINED, .no_shards = 4, .hash_function = counting_int_hash };
+  hash_table_options_t open = { .backend = HASH_TABLE_OPEN_ADDRESSING, .no_shards = 4, .hash_function = counting_int_hash };
+  hash_table_t *tables[] = {
+    hash_table_create_with_options(&chained),
+    hash_table_create_with_options(&open),
+    hash_table_concurrent_create(&chained),
+  };
+
+  // The hash that selects the shard of a key is the one the shard works with
+  for (size_t t = 0; t < sizeof(tables) / sizeof(tables[0]); t++)
+    {
+      hash_table_t *ht = tables[t];
+      CU_ASSERT_PTR_NOT_NULL_FATAL(ht);
+      elem_t result;
+      bool inserted;
+      elem_t increment = int_elem(1);
+      hash_function_calls = 0;
+      CU_ASSERT(hash_table_insert(ht, int_elem(1), int_elem(1)) == HASH_TABLE_INSERTED);
+      CU_ASSERT(hash_function_calls == 1);
+      CU_ASSERT(hash_table_lookup(ht, int_elem(1), &result) && result.i == 1);
+      CU_ASSERT(hash_function_calls == 2);
+      CU_ASSERT(hash_table_update(ht, int_elem(1), add_to_value, &increment));
+      CU_ASSERT(hash_function_calls == 3);
+      CU_ASSERT(hash_table_upsert(ht, int_elem(2), int_elem(2), &inserted) != NULL && inserted);
+      CU_ASSERT(hash_function_calls == 4);
+      CU_ASSERT(hash_table_has_key(ht, int_elem(2)));
+      CU_ASSERT(hash_function_calls == 5);
+      CU_ASSERT(hash_table_remove(ht, int_elem(1), &result) && result.i == 2);
+      CU_ASSERT(hash_function_calls == 6);
+    }
+  hash_function_calls = 0;
+  CU_ASSERT(hash_table_insert_ttl(tables[0], int_elem(3), int_elem(3), 10) == HASH_TABLE_INSERTED);
+  CU_ASSERT(hash_function_calls == 1);
+
+  for (size_t t = 0; t < sizeof(tables) / sizeof(tables[0]); t++)
+    {
+      hash_table_destroy(tables[t]);
+    }
+}
+
+void test_insert_ttl()
+{
+  uint64_t now = 1000;
+  struct eviction_log log = { 0 };
+  hash_table_options_t chained = { .backend = HASH_TABLE_CHAINED, .clock_function = fake_clock, .clock_extra = &now, .evict_function = record_eviction, .evict_extra = &log };
+  hash_table_options_t incremental = { .backend = HASH_TABLE_CHAINED, .rehash_step = 1, .clock_function = fake_clock, .clock_extra = &now, .evict_function = record_eviction, .evict_extra = &log };
+  hash_table_t *tables[] = {
+    hash_table_create_with_options(&chained),
+    hash_table_create_with_options(&incremental),
+  };
+
+  for (size_t t = 0; t < sizeof(tables) / sizeof(tables[0]); t++)
+    {
+      hash_table_t *ht = tables[t];
+      CU_ASSERT_PTR_NOT_NULL_FATAL(ht);
+      memset(&log, 0, sizeof(log));
+      now = 1000;
+      elem_t result;
+      bool inserted;
+      for (int i = 0; i < 100; i++)
+        {
+          CU_ASSERT(hash_table_insert_ttl(ht, int_elem(i), int_elem(-i), 10 + i) == HASH_TABLE_INSERTED);
+          CU_ASSERT(hash_table_insert(ht, int_elem(100 + i), int_elem(-100 - i)) == HASH_TABLE_INSERTED);
+        }
+      CU_ASSERT(hash_table_expire(ht, SIZE_MAX) == 0);
+
+      // Expired entries are reclaimed by whichever operation comes across them
+      now = 1059;
+      CU_ASSERT_FALSE(hash_table_lookup(ht, int_elem(0), &result));
+      CU_ASSERT(hash_table_lookup(ht, int_elem(50), &result) && result.i == -50);
+      CU_ASSERT_FALSE(hash_table_has_key(ht, int_elem(49)));
+      CU_ASSERT_FALSE(hash_table_update(ht, int_elem(48), add_to_value, &(int){ 1 }));
+      CU_ASSERT_FALSE(hash_table_remove(ht, int_elem(47), &result));
+      elem_t *value = hash_table_upsert(ht, int_elem(46), int_elem(46), &inserted);
+      CU_ASSERT(value != NULL && inserted && value->i == 46);
+      CU_ASSERT(hash_table_size(ht) == 196);
+      CU_ASSERT(log.no_evicted == 5);
+
+      // The rest is left to the timer wheel; the timer of the key inserted again is stale
+      CU_ASSERT(hash_table_expire(ht, SIZE_MAX) == 45);
+      CU_ASSERT(hash_table_size(ht) == 151);
+      CU_ASSERT(log.no_evicted == 50);
+      CU_ASSERT(log.last_value == -log.last_key);
+      CU_ASSERT(hash_table_lookup(ht, int_elem(46), &result) && result.i == 46);
+      CU_ASSERT(hash_table_has_key(ht, int_elem(150)));
+
+      // Inserting with a time to live replaces it, while plain insertion keeps it
+      CU_ASSERT(hash_table_insert_ttl(ht, int_elem(60), int_elem(60), 1000) == HASH_TABLE_UPDATED);
+      now = 1110;
+      CU_ASSERT(hash_table_expire(ht, SIZE_MAX) == 49);
+      CU_ASSERT(hash_table_insert(ht, int_elem(60), int_elem(61)) == HASH_TABLE_UPDATED);
+      now = 2058;
+      CU_ASSERT(hash_table_lookup(ht, int_elem(60), &result) && result.i == 61);
+      now = 2059;
+      CU_ASSERT_FALSE(hash_table_has_key(ht, int_elem(60)));
+      CU_ASSERT(hash_table_expire(ht, SIZE_MAX) == 0);
+      CU_ASSERT(hash_table_size(ht) == 101);
+      CU_ASSERT(hash_table_insert_ttl(ht, int_elem(0), int_elem(0), 0) == HASH_TABLE_INSERTED);
+      CU_ASSERT_FALSE(hash_table_has_key(ht, int_elem(0)));
+
+      // The budget bounds the number of timers processed per call
+      now = 3000;
+      for (int i = 0; i < 1000; i++)
+        {
+          CU_ASSERT(hash_table_insert_ttl(ht, int_elem(1000 + i), int_elem(i), 5) == HASH_TABLE_INSERTED);
+        }
+      now = 3005;
+      CU_ASSERT(hash_table_expire(ht, 10) == 10);
+      CU_ASSERT(hash_table_size(ht) == 1091);
+      CU_ASSERT(hash_table_expire(ht, SIZE_MAX) == 990);
+      CU_ASSERT(hash_table_size(ht) == 101);
+
+      // Clearing discards the timers, and expiry starts over afterwards
+      for (int i = 0; i < 10; i++)
+        {
+          hash_table_insert_ttl(ht, int_elem(i), int_elem(i), 1);
+        }
+      hash_table_clear(ht);
+      CU_ASSERT(hash_table_expire(ht, SIZE_MAX) == 0);
+      CU_ASSERT(hash_table_insert_ttl(ht, int_elem(1), int_elem(1), 1) == HASH_TABLE_INSERTED);
+      now += 1;
+      CU_ASSERT(hash_table_expire(ht, SIZE_MAX) == 1);
+      CU_ASSERT(hash_table_insert_ttl(ht, int_elem(2), int_elem(2), 1) == HASH_TABLE_INSERTED);
+      hash_table_destroy(ht);
+    }
+
+  // Other backends refuse expiry and are left unchanged
+  hash_table_options_t open = { .backend = HASH_TABLE_OPEN_ADDRESSING };
+  hash_table_options_t concurrent = { .backend = HASH_TABLE_CHAINED };
+  hash_table_t *unsupported[] = {
+    hash_table_create_with_options(&open),
+    hash_table_concurrent_create(&concurrent),
+  };
+  for (size_t t = 0; t < sizeof(unsupported) / sizeof(unsupported[0]); t++)
+    {
+      CU_ASSERT_PTR_NOT_NULL_FATAL(unsupported[t]);
+      CU_ASSERT(hash_table_insert_ttl(unsupported[t], int_elem(1), int_elem(1), 10) == HASH_TABLE_UNSUPPORTED);
+      CU_ASSERT(hash_table_is_empty(unsupported[t]));
+      CU_ASSERT(hash_table_expire(unsupported[t], SIZE_MAX) == 0);
+      hash_table_destroy(unsupported[t]);
+    }
+}
+
+void test_expiry_wheel()
+{
+  uint64_t now = 12345;
+  hash_table_options_t options = { .backend = HASH_TABLE_CHAINED, .owned_keys = true, .clock_function = fake_clock, .clock_extra = &now };
+  hash_table_t *ht = hash_table_create_with_options(&options);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(ht);
+
+  // Times to live cover every level of the wheel, slot boundaries and times beyond its range
+  const int no_keys = 2000;
+  uint64_t expires[2000];
+  char key[64];
+  for (int i = 0; i < no_keys; i++)
+    {
+      uint64_t ttl;
+      switch (i % 4)
+        {
+        case 0: ttl = (uint64_t) i + 1; break;
+        case 1: ttl = (uint64_t) i * i * 37; break;
+        case 2: ttl = (uint64_t) i << 28; break;
+        default: ttl = (uint64_t) 64 * i; break;
+        }
+      expires[i] = now + ttl;
+      snprintf(key, sizeof(key), "key %d", i);
+      CU_ASSERT(hash_table_insert_ttl(ht, ptr_elem(key), int_elem(i), ttl) == HASH_TABLE_INSERTED);
+    }
+
+  // Advancing the clock by ever larger steps expires exactly the entries that are due
+  size_t no_steps = 0;
+  for (uint64_t step = 1; hash_table_size(ht) > 0; step += step / 2 + 1, no_steps++)
+    {
+      now += step;
+      size_t due = 0;
+      for (int i = 0; i < no_keys; i++)
+        {
+          due += expires[i] > now - step && expires[i] <= now;
+        }
+      const size_t size = hash_table_size(ht);
+      size_t no_expired = 0;
+      if (no_steps % 2 == 0)
+        {
+          no_expired = hash_table_expire(ht, SIZE_MAX);
+        }
+      else
+        {
+          for (int calls = 0; calls < 100000 && size - no_expired > 0; calls++)
+            {
+              const size_t expired = hash_table_expire(ht, 3);
+              CU_ASSERT(expired <= 3);
+              no_expired += expired;
+              if (expired == 0 && hash_table_expire(ht, SIZE_MAX) == 0)
+                break;
+            }
+        }
+      CU_ASSERT(no_expired == due);
+      CU_ASSERT(hash_table_size(ht) == size - due);
+    }
+  for (int i = 0; i < no_keys; i++)
+    {
+      snprintf(key, sizeof(key), "key %d", i);
+      CU_ASSERT_FALSE(hash_table_has_key(ht, ptr_elem(key)));
+    }
+  CU_ASSERT(no_steps < 100);
+  hash_table_destroy(ht);
+}
+
+void test_expiry_entry_footprint()
+{
+  uint64_t now = 1000;
+  struct counting_arena arena = { 0 };
+  hash_table_allocator_t allocator = { .alloc = counting_alloc, .free = counting_free, .arena = &arena };
+  hash_table_options_t chained = { .backend = HASH_TABLE_CHAINED, .clock_function = fake_clock, .clock_extra = &now, .allocator = allocator };
+  hash_table_options_t incremental = { .backend = HASH_TABLE_CHAINED, .rehash_step = 1, .clock_function = fake_clock, .clock_extra = &now, .allocator = allocator };
+  hash_table_options_t *options[] = { &chained, &incremental };
+
+  for (size_t t = 0; t < sizeof(options) / sizeof(options[0]); t++)
+    {
+      hash_table_t *ht = hash_table_create_with_options(options[t]);
+      CU_ASSERT_PTR_NOT_NULL_FATAL(ht);
+      for (int i = 0; i < 1000; i++)
+        {
+          hash_table_insert(ht, int_elem(i), int_elem(-i));
+        }
+
+      // Entries only make room for expiry times once the first one is inserted with a time to live
+      const size_t bytes_before = arena.bytes_in_use;
+      CU_ASSERT(hash_table_insert_ttl(ht, int_elem(1000), int_elem(-1000), 10) == HASH_TABLE_INSERTED);
+      CU_ASSERT(hash_table_insert_ttl(ht, int_elem(0), int_elem(0), 20) == HASH_TABLE_UPDATED);
+      CU_ASSERT(arena.bytes_in_use > bytes_before);
+      bool all_found = true;
+      elem_t result;
+      for (int i = 1; i <= 1000; i++)
+        {
+          all_found &= hash_table_lookup(ht, int_elem(i), &result) && result.i == -i;
+        }
+      CU_ASSERT(all_found);
+
+      // Moving an expiring entry into a hash table with bare entries keeps its expiry time
+      hash_table_options_t other_arena = { .backend = HASH_TABLE_CHAINED, .clock_function = fake_clock, .clock_extra = &now };
+      hash_table_t *dst = hash_table_create_with_options(&other_arena);
+      CU_ASSERT_PTR_NOT_NULL_FATAL(dst);
+      hash_table_insert(dst, int_elem(-1), int_elem(1));
+      CU_ASSERT(hash_table_merge(dst, ht));
+      CU_ASSERT(hash_table_size(dst) == 1002);
+      now += 10;
+      CU_ASSERT(hash_table_expire(dst, SIZE_MAX) == 1);
+      CU_ASSERT_FALSE(hash_table_has_key(dst, int_elem(1000)));
+      now += 10;
+      CU_ASSERT_FALSE(hash_table_has_key(dst, int_elem(0)));
+      CU_ASSERT(hash_table_has_key(dst, int_elem(-1)) && hash_table_has_key(dst, int_elem(999)));
+      hash_table_destroy(dst);
+      hash_table_destroy(ht);
+      CU_ASSERT(arena.bytes_in_use == 0);
+    }
+}
+
+void test_merge()
+{
+  struct counting_arena arena = { 0 };
+  hash_table_allocator_t allocator = { .alloc = counting_alloc, .free = counting_free, .arena = &arena };
+  hash_table_options_t chained = { .backend = HASH_TABLE_CHAINED, .hash_function = counting_int_hash, .allocator = allocator };
+  hash_table_options_t incremental = { .backend = HASH_TABLE_CHAINED, .hash_function = counting_int_hash, .allocator = allocator, .rehash_step = 1 };
+  hash_table_options_t colliding = { .backend = HASH_TABLE_CHAINED, .hash_function = colliding_int_hash, .allocator = allocator };
+  hash_table_options_t other_arena = { .backend = HASH_TABLE_CHAINED, .hash_function = counting_int_hash };
+  hash_table_options_t open = { .backend = HASH_TABLE_OPEN_ADDRESSING, .hash_function = counting_int_hash };
+  const hash_table_options_t *pairs[][2] = {
+    { &chained, &chained },
+    { &incremental, &chained },
+    { &chained, &incremental },
+    { &colliding, &chained },
+    { &chained, &other_arena },
+    { &open, &chained },
+    { &chained, &open },
+  };
+
+  for (size_t p = 0; p < sizeof(pairs) / sizeof(pairs[0]); p++)
+    {
+      hash_table_t *dst = hash_table_create_with_options(pairs[p][0]);
+      hash_table_t *src = hash_table_create_with_options(pairs[p][1]);
+      CU_ASSERT_PTR_NOT_NULL_FATAL(dst);
+      CU_ASSERT_PTR_NOT_NULL_FATAL(src);
+      for (int i = 0; i < 1000; i++)
+        {
+          hash_table_insert(src, int_elem(i), int_elem(i));
+          hash_table_insert(dst, int_elem(500 + i), int_elem(-500 - i));
+        }
+
+      // Chained entries sharing an allocator are relinked without allocating or hashing
+      const size_t allocs = arena.allocs;
+      const size_t hashes = hash_function_calls;
+      CU_ASSERT(hash_table_merge(dst, src));
+      if (p < 3)
+        {
+          CU_ASSERT(arena.allocs == allocs);
+          CU_ASSERT(hash_function_calls == hashes);
+        }
+      CU_ASSERT(hash_table_is_empty(src));
+      CU_ASSERT(hash_table_size(dst) == 1500);
+      elem_t result;
+      for (int i = 0; i < 1500; i++)
+        {
+          CU_ASSERT(hash_table_lookup(dst, int_elem(i), &result) && result.i == (i < 1000 ? i : -i));
+        }
+
+      // The emptied table stays usable, and entries moved into dst outlive it
+      CU_ASSERT(hash_table_insert(src, int_elem(7), int_elem(7)) == HASH_TABLE_INSERTED);
+      CU_ASSERT(hash_table_merge(dst, src));
+      hash_table_destroy(src);
+      CU_ASSERT(hash_table_insert(dst, int_elem(2000), int_elem(2000)) == HASH_TABLE_INSERTED);
+      CU_ASSERT(hash_table_remove(dst, int_elem(3), &result) && result.i == 3);
+      CU_ASSERT(hash_table_size(dst) == 1500);
+      hash_table_destroy(dst);
+    }
+  CU_ASSERT(arena.bytes_in_use == 0);
+
+  // Sharded tables keep times to live however they merge, shard by shard only if sharded alike
+  uint64_t ticks = 0;
+  hash_table_options_t timed = { .backend = HASH_TABLE_CHAINED, .hash_function = counting_int_hash, .clock_function = fake_clock, .clock_extra = &ticks };
+  hash_table_options_t sharded = { .backend = HASH_TABLE_CHAINED, .no_shards = 4, .hash_function = counting_int_hash, .clock_function = fake_clock, .clock_extra = &ticks };
+  hash_table_options_t more_shards = { .backend = HASH_TABLE_CHAINED, .no_shards = 8, .hash_function = counting_int_hash, .clock_function = fake_clock, .clock_extra = &ticks };
+  const hash_table_options_t *sharded_pairs[][2] = {
+    { &sharded, &sharded },
+    { &more_shards, &sharded },
+    { &timed, &sharded },
+    { &sharded, &timed },
+  };
+  for (size_t p = 0; p < sizeof(sharded_pairs) / sizeof(sharded_pairs[0]); p++)
+    {
+      hash_table_t *dst = hash_table_create_with_options(sharded_pairs[p][0]);
+      hash_table_t *src = hash_table_create_with_options(sharded_pairs[p][1]);
+      CU_ASSERT_PTR_NOT_NULL_FATAL(dst);
+      CU_ASSERT_PTR_NOT_NULL_FATAL(src);
+      ticks = 0;
+      for (int i = 0; i < 150; i++)
+        {
+          if (i < 100)
+            hash_table_insert_ttl(src, int_elem(i), int_elem(i), i < 50 ? 5 : 10);
+          else
+            hash_table_insert(src, int_elem(i), int_elem(i));
+        }
+
+      // Entries that expired before the merge never become live again
+      ticks = 5;
+      const size_t hashes = hash_function_calls;
+      CU_ASSERT(hash_table_merge(dst, src));
+      if (p == 0)
+        {
+          CU_ASSERT(hash_function_calls == hashes);
+        }
+      CU_ASSERT(hash_table_is_empty(src));
+      bool expired_missing = true;
+      bool live_found = true;
+      for (int i = 0; i < 150; i++)
+        {
+          if (i < 50)
+            expired_missing &= !hash_table_has_key(dst, int_elem(i));
+          else
+            live_found &= hash_table_has_key(dst, int_elem(i));
+        }
+      CU_ASSERT(expired_missing);
+      CU_ASSERT(live_found);
+      ticks = 10;
+      CU_ASSERT(hash_table_expire(dst, SIZE_MAX) == 50);
+      CU_ASSERT(hash_table_size(dst) == 50);
+      hash_table_destroy(src);
+      hash_table_destroy(dst);
+    }
+
+  // Owned keys and their times to live move along with the entries
+  uint64_t now = 0;
+  char key[256];
+  hash_table_options_t owned = { .backend = HASH_TABLE_CHAINED, .owned_keys = true, .clock_function = fake_clock, .clock_extra = &now };
+  hash_table_t *dst = hash_table_create_with_options(&owned);
+  hash_table_t *src = hash_table_create_with_options(&owned);
+  for (int i = 0; i < 100; i++)
+    {
+      snprintf(key, sizeof(key), "key %d", i);
+      hash_table_insert_ttl(src, ptr_elem(key), int_elem(i), 10 + i % 2);
+      snprintf(key, sizeof(key), "removed key %d", i);
+      hash_table_insert(src, ptr_elem(key), int_elem(i));
+      hash_table_remove(src, ptr_elem(key), &(elem_t) { 0 });
+      snprintf(key, sizeof(key), "other key %d of some length that needs a chunk of its own %0100d", i, i);
+      hash_table_insert(src, ptr_elem(key), int_elem(i));
+      hash_table_remove(src, ptr_elem(key), &(elem_t) { 0 });
+      hash_table_insert(src, ptr_elem(key), int_elem(i));
+    }
+  hash_table_insert_ttl(dst, ptr_elem("key 0"), int_elem(-1), 100);
+  CU_ASSERT(hash_table_merge(dst, src));
+  hash_table_destroy(src);
+  CU_ASSERT(hash_table_size(dst) == 200);
+  now = 10;
+  CU_ASSERT(hash_table_expire(dst, SIZE_MAX) == 50);
+  CU_ASSERT_FALSE(hash_table_has_key(dst, ptr_elem("key 0")));
+  CU_ASSERT(hash_table_has_key(dst, ptr_elem("key 1")));
+  now = 11;
+  CU_ASSERT(hash_table_expire(dst, SIZE_MAX) == 50);
+  CU_ASSERT(hash_table_size(dst) == 100);
+  snprintf(key, sizeof(key), "other key %d of some length that needs a chunk of its own %0100d", 42, 42);
+  CU_ASSERT(hash_table_has_key(dst, ptr_elem(key)));
+
+  // Owned keys can not move into a table that does not own its keys, nor can tables merge with themselves
+  hash_table_t *borrowed = hash_table_create_with_options(&(hash_table_options_t) { .backend = HASH_TABLE_CHAINED, .hash_function = hash_table_hash_string });
+  CU_ASSERT_FALSE(hash_table_merge(borrowed, dst));
+  CU_ASSERT_FALSE(hash_table_merge(dst, dst));
+  hash_table_t *concurrent = hash_table_concurrent_create(&(hash_table_options_t) { .backend = HASH_TABLE_CHAINED });
+  CU_ASSERT_FALSE(hash_table_merge(concurrent, borrowed));
+  CU_ASSERT(hash_table_size(dst) == 100);
+  hash_table_destroy(concurrent);
+  hash_table_destroy(borrowed);
+  hash_table_destroy(dst);
+}
+
+void test_split()
+{
+  uint64_t now = 0;
+  hash_table_options_t chained = { .backend = HASH_TABLE_CHAINED, .hash_function = counting_int_hash, .clock_function = fake_clock, .clock_extra = &now };
+  hash_table_options_t shrinking = { .backend = HASH_TABLE_CHAINED, .min_load_factor = 0.1, .clock_function = fake_clock, .clock_extra = &now };
+  hash_table_options_t open = { .backend = HASH_TABLE_OPEN_ADDRESSING };
+  hash_table_options_t sharded = { .backend = HASH_TABLE_CHAINED, .no_shards = 4, .hash_function = counting_int_hash, .clock_function = fake_clock, .clock_extra = &now };
+  const hash_table_options_t *pairs[][2] = {
+    { &chained, &chained },
+    { &shrinking, &chained },
+    { &open, &chained },
+    { &chained, &open },
+    { &sharded, &sharded },
+    { &chained, &sharded },
+    { &sharded, &chained },
+  };
+
+  for (size_t p = 0; p < sizeof(pairs) / sizeof(pairs[0]); p++)
+    {
+      hash_table_t *dst = hash_table_create_with_options(pairs[p][0]);
+      hash_table_t *src = hash_table_create_with_options(pairs[p][1]);
+      CU_ASSERT_PTR_NOT_NULL_FATAL(dst);
+      CU_ASSERT_PTR_NOT_NULL_FATAL(src);
+      now = 0;
+      for (int i = 0; i < 1000; i++)
+        {
+          if (pairs[p][1] != &open)
+            hash_table_insert_ttl(src, int_elem(i), int_elem(i), i < 100 ? 5 : 1000);
+          else
+            hash_table_insert(src, int_elem(i), int_elem(i));
+        }
+      hash_table_insert(dst, int_elem(0), int_elem(-1));
+      hash_table_insert(dst, int_elem(5000), int_elem(5000));
+
+      const size_t hashes = hash_function_calls;
+      int below = 900;
+      CU_ASSERT(hash_table_split(src, int_key_less, &below, dst) == 900);
+      if (p == 0 || p == 4)
+        {
+          CU_ASSERT(hash_function_calls == hashes);
+        }
+      CU_ASSERT(hash_table_size(src) == 100);
+      CU_ASSERT(hash_table_size(dst) == 901);
+      elem_t result;
+      for (int i = 0; i < 1000; i++)
+        {
+          CU_ASSERT(hash_table_has_key(src, int_elem(i)) == (i >= 900));
+          CU_ASSERT(hash_table_lookup(dst, int_elem(i), &result) == (i < 900));
+        }
+      if (pairs[p][1] != &open && pairs[p][0] != &open)
+        {
+          // Times to live move along, while the timers left behind in src are stale
+          now = 5;
+          CU_ASSERT(hash_table_expire(src, SIZE_MAX) == 0);
+          CU_ASSERT(hash_table_expire(dst, SIZE_MAX) == 100);
+          CU_ASSERT(hash_table_size(dst) == 801);
+        }
+      int none = -1;
+      CU_ASSERT(hash_table_split(src, int_key_less, &none, dst) == 0);
+      hash_table_destroy(src);
+      CU_ASSERT(hash_table_lookup(dst, int_elem(850), &result) && result.i == 850);
+      CU_ASSERT(hash_table_lookup(dst, int_elem(5000), &result) && result.i == 5000);
+      hash_table_destroy(dst);
+    }
+
+  // Removing most entries shrinks a table with a minimum load factor once
+  hash_table_t *src = hash_table_create_with_options(&shrinking);
+  hash_table_t *dst = hash_table_create_with_options(&chained);
+  for (int i = 0; i < 1000; i++)
+    {
+      hash_table_insert(src, int_elem(i), int_elem(i));
+    }
+  const size_t capacity = hash_table_capacity(src);
+  int below = 990;
+  CU_ASSERT(hash_table_split(src, int_key_less, &below, dst) == 990);
+  CU_ASSERT(hash_table_capacity(src) < capacity);
+  CU_ASSERT(hash_table_size(dst) == 990);
+  hash_table_destroy(src);
+  hash_table_destroy(dst);
+}
+
+void test_swap()
+{
+  hash_table_options_t open = { .backend = HASH_TABLE_OPEN_ADDRESSING };
+  hash_table_t *a = hash_table_create(NULL, NULL, NULL);
+  hash_table_t *b = hash_table_create_with_options(&open);
+  for (int i = 0; i < 100; i++)
+    {
+      hash_table_insert(a, int_elem(i), int_elem(i));
+    }
+  hash_table_insert(b, int_elem(-1), int_elem(-1));
+  CU_ASSERT(hash_table_swap(a, b));
+  CU_ASSERT(hash_table_size(a) == 1);
+  CU_ASSERT(hash_table_size(b) == 100);
+  CU_ASSERT(hash_table_has_key(a, int_elem(-1)));
+  CU_ASSERT(hash_table_has_key(b, int_elem(50)));
+  hash_table_destroy(a);
+
+  // The swapped-in contents keep working as a table of their own backend
+  for (int i = 100; i < 1000; i++)
+    {
+      hash_table_insert(b, int_elem(i), int_elem(i));
+    }
+  CU_ASSERT(hash_table_size(b) == 1000);
+  hash_table_t *concurrent = hash_table_concurrent_create(&(hash_table_options_t) { .backend = HASH_TABLE_CHAINED });
+  CU_ASSERT_FALSE(hash_table_swap(b, concurrent));
+  CU_ASSERT(hash_table_size(b) == 1000);
+  hash_table_destroy(concurrent);
+  hash_table_destroy(b);
+}
+
+/// Number of events reported to record_event, per kind of event.
+static size_t logged_events[HASH_TABLE_EVENT_IO_ERROR + 1];
+
+static void record_event(const hash_table_t *ht, const hash_table_event_t event, const char *message, void *extra)
+{
+  logged_events[event] += 1;
+  CU_ASSERT(strlen(message) > 0);
+  *(const hash_table_t **) extra = ht;
+}
+
+void test_log_function()
+{
+  const hash_table_t *logged_ht = NULL;
+  memset(logged_events, 0, sizeof(logged_events));
+  hash_table_set_log_function(record_event, &logged_ht);
+
+  hash_table_options_t invalid = { .load_factor = -1 };
+  CU_ASSERT_PTR_NULL(hash_table_create_with_options(&invalid));
+  CU_ASSERT(logged_events[HASH_TABLE_EVENT_INVALID_ARGUMENT] == 1);
+  CU_ASSERT_PTR_NULL(logged_ht);
+
+  hash_table_t *ht = hash_table_create(NULL, NULL, NULL);
+  for (int i = 0; i < 100; i++)
+    {
+      hash_table_insert(ht, int_elem(i), int_elem(i));
+    }
+  CU_ASSERT(logged_events[HASH_TABLE_EVENT_RESIZE] > 0);
+  CU_ASSERT(logged_ht == ht);
+  hash_table_destroy(ht);
+
+  hash_table_options_t failing = {
+    .backend = HASH_TABLE_CHAINED,
+    .allocator = { .alloc = failing_alloc, .free = counting_free },
+  };
+  ht = hash_table_create_with_options(&failing);
+  CU_ASSERT(hash_table_insert(ht, int_elem(1), int_elem(1)) == HASH_TABLE_NO_MEMORY);
+  CU_ASSERT(logged_events[HASH_TABLE_EVENT_NO_MEMORY] == 1);
+  CU_ASSERT(logged_ht == ht);
+  hash_table_destroy(ht);
+
+  hash_table_set_log_function(NULL, NULL);
+  const size_t resizes = logged_events[HASH_TABLE_EVENT_RESIZE];
+  ht = hash_table_create(NULL, NULL, NULL);
+  for (int i = 0; i < 100; i++)
+    {
+      hash_table_insert(ht, int_elem(i), int_elem(i));
+    }
+  CU_ASSERT(logged_events[HASH_TABLE_EVENT_RESIZE] == resizes);
+  hash_table_destroy(ht);
+}
+
+void test_hash_int_and_pointer()
+{
+  // Sequential keys must not keep their order, or they would fill consecutive buckets.
+  bool increasing = true;
+  for (int i = 1; i < 1000; i++)
+    {
+      increasing = increasing && hash_table_hash_int(int_elem(i)) > hash_table_hash_int(int_elem(i - 1));
+      CU_ASSERT(hash_table_hash_int(int_elem(i)) != hash_table_hash_int(int_elem(-i)));
+    }
+  CU_ASSERT_FALSE(increasing);
+  CU_ASSERT(hash_table_hash_int(int_elem(-1)) == hash_table_hash_int(unsigned_int_elem(UINT_MAX)));
+
+  int values[2];
+  CU_ASSERT(hash_table_hash_pointer(ptr_elem(&values[0])) != hash_table_hash_pointer(ptr_elem(&values[1])));
+  CU_ASSERT(hash_table_hash_pointer(ptr_elem(&values[0])) == hash_table_hash_pointer(ptr_elem(&values[0])));
+
+  hash_table_options_t options = { .hash_function = hash_table_hash_pointer };
+  hash_table_t *ht = hash_table_create_with_options(&options);
+  hash_table_insert(ht, ptr_elem(&values[0]), int_elem(0));
+  hash_table_insert(ht, ptr_elem(&values[1]), int_elem(1));
+  elem_t result;
+  CU_ASSERT(hash_table_lookup(ht, ptr_elem(&values[1]), &result) && result.i == 1);
+  hash_table_destroy(ht);
+}
+
+void test_hash_bytes_and_string()
+{
+  char buffer[200];
+  char copy[200];
+  for (size_t i = 0; i < sizeof(buffer); i++)
+    {
+      buffer[i] = (char) ('a' + i % 26);
+    }
+  memcpy(copy, buffer, sizeof(buffer));
+
+  for (size_t length = 0; length <= sizeof(buffer); length++)
+    {
+      const unsigned long hash = hash_table_hash_bytes(buffer, length, 0);
+      CU_ASSERT(hash == hash_table_hash_bytes(copy, length, 0));
+      CU_ASSERT(hash != hash_table_hash_bytes(buffer, length, 1));
+      if (length > 0)
+        {
+          // Every byte, wherever it is, affects the hash.
+          for (size_t i = 0; i < length; i++)
+            {
+              copy[i] ^= 1;
+              CU_ASSERT(hash != hash_table_hash_bytes(copy, length, 0));
+              copy[i] ^= 1;
+            }
+          CU_ASSERT(hash != hash_table_hash_bytes(buffer, length - 1, 0));
+        }
+    }
+
+  CU_ASSERT(hash_table_hash_string(ptr_elem("key")) == hash_table_hash_bytes("key", 3, 0));
+  CU_ASSERT(hash_table_hash_string(ptr_elem("")) == hash_table_hash_bytes("", 0, 0));
+}
+
+void test_hash_string_keys()
+{
+  hash_table_t *ht = hash_table_create(hash_table_hash_string, NULL, NULL);
+  elem_t result;
+  char key[16];
+  for (int i = 0; i < 17; ++i)
+    {
+      sprintf(key, "%d", i);
+      CU_ASSERT_FALSE(hash_table_lookup(ht, ptr_elem(key), &result));
+    }
+
+  // Keys in distinct buffers with the same contents find the same entry
+  const char *keys[] = { "A", "B", "C", "" };
+  for (int i = 0; i < 4; i++)
+    {
+      CU_ASSERT(hash_table_insert(ht, ptr_elem((char *) keys[i]), int_elem(i)) == HASH_TABLE_INSERTED);
+    }
+  for (int i = 0; i < 4; i++)
+    {
+      strcpy(key, keys[i]);
+      CU_ASSERT(hash_table_lookup(ht, ptr_elem(key), &result) && result.i == i);
+    }
+  CU_ASSERT_FALSE(hash_table_lookup(ht, ptr_elem("not present"), &result));
+  CU_ASSERT(hash_table_insert(ht, ptr_elem(key), int_elem(4)) == HASH_TABLE_UPDATED);
+  CU_ASSERT(hash_table_size(ht) == 4);
+  hash_table_destroy(ht);
+}
+
+void test_hash_seed()
+{
+  const unsigned long int_hash = hash_table_hash_int(int_elem(42));
+  const unsigned long string_hash = hash_table_hash_string(ptr_elem("forty-two"));
+
+  hash_table_set_hash_seed(0x9e3779b97f4a7c15UL);
+  CU_ASSERT(hash_table_hash_int(int_elem(42)) != int_hash);
+  CU_ASSERT(hash_table_hash_string(ptr_elem("forty-two")) != string_hash);
+  hash_table_t *ht = hash_table_create(hash_table_hash_string, NULL, NULL);
+  hash_table_insert(ht, ptr_elem("forty-two"), int_elem(42));
+  elem_t result;
+  CU_ASSERT(hash_table_lookup(ht, ptr_elem("forty-two"), &result) && result.i == 42);
+  hash_table_destroy(ht);
+
+  hash_table_set_hash_seed(0);
+  CU_ASSERT(hash_table_hash_int(int_elem(42)) == int_hash);
+  CU_ASSERT(hash_table_hash_string(ptr_elem("forty-two")) == string_hash);
+}
+
+/// Write a snapshot of a hash table to a new temporary file, whose path is stored in path.
+static bool save_snapshot(hash_table_t *ht, char *path)
+{
+  strcpy(path, "/tmp/hash_table_snapshot_XXXXXX");
+  const int fd = mkstemp(path);
+  const bool saved = fd >= 0 && hash_table_save(ht, fd);
+  close(fd);
+  return saved;
+}
+
+void test_snapshot_round_trip()
+{
+  hash_table_options_t chained = { .backend = HASH_TABLE_CHAINED };
+  hash_table_options_t open = { .backend = HASH_TABLE_OPEN_ADDRESSING };
+  hash_table_options_t colliding = { .backend = HASH_TABLE_CHAINED, .hash_function = colliding_int_hash };
+  hash_table_options_t counting = { .backend = HASH_TABLE_CHAINED, .hash_function = counting_int_hash };
+  hash_table_options_t sharded = { .backend = HASH_TABLE_OPEN_ADDRESSING, .no_shards = 4, .hash_function = counting_int_hash };
+  hash_table_t *tables[] = {
+    hash_table_create_with_options(&chained),
+    hash_table_create_with_options(&open),
+    hash_table_create_with_options(&colliding),
+    hash_table_concurrent_create(&chained),
+    hash_table_create_with_options(&sharded),
+  };
+  const hash_table_options_t *options[] = { NULL, NULL, &colliding, NULL, &counting };
+  const int num_of_entries = 1000;
+  const elem_t one = int_elem(1);
+
+  for (size_t t = 0; t < sizeof(tables) / sizeof(tables[0]); t++)
+    {
+      hash_table_t *ht = tables[t];
+      char path[64];
+      elem_t result;
+      for (int i = 0; i < num_of_entries; i++)
+        {
+          hash_table_insert(ht, int_elem(i), int_elem(i * 2));
+        }
+      // The hashes stored by the backend are written out, without calling the hash function
+      const size_t hash_calls = hash_function_calls;
+      CU_ASSERT(save_snapshot(ht, path));
+      CU_ASSERT(hash_function_calls == hash_calls);
+      hash_table_destroy(ht);
+
+      hash_table_t *mapped = hash_table_open_mapped(path, options[t]);
+      CU_ASSERT_PTR_NOT_NULL_FATAL(mapped);
+      CU_ASSERT(hash_table_size(mapped) == num_of_entries);
+      for (int i = 0; i < num_of_entries; i++)
+        {
+          CU_ASSERT(hash_table_lookup(mapped, int_elem(i), &result) && result.i == i * 2);
+        }
+      CU_ASSERT_FALSE(hash_table_lookup(mapped, int_elem(num_of_entries), &result));
+      CU_ASSERT_FALSE(hash_table_lookup(mapped, int_elem(-1), &result));
+
+      // Values may change, but the set of keys is fixed
+      CU_ASSERT(hash_table_insert(mapped, int_elem(0), int_elem(-1)) == HASH_TABLE_UPDATED);
+      CU_ASSERT(hash_table_lookup(mapped, int_elem(0), &result) && result.i == -1);
+      CU_ASSERT(hash_table_update(mapped, int_elem(1), add_to_value, &one));
+      CU_ASSERT(hash_table_lookup(mapped, int_elem(1), &result) && result.i == 3);
+      CU_ASSERT(hash_table_insert(mapped, int_elem(num_of_entries), int_elem(0)) == HASH_TABLE_READ_ONLY);
+      CU_ASSERT_PTR_NULL(hash_table_upsert(mapped, int_elem(num_of_entries), int_elem(0), NULL));
+      CU_ASSERT_FALSE(hash_table_remove(mapped, int_elem(2), &result));
+      hash_table_clear(mapped);
+      CU_ASSERT(hash_table_size(mapped) == num_of_entries);
+
+      hash_table_iter_t iter;
+      elem_t key;
+      elem_t *value;
+      int visited = 0;
+      hash_table_iter_begin(mapped, &iter);
+      while (hash_table_iter_next(&iter, &key, &value))
+        {
+          CU_ASSERT(key.i >= 0 && key.i < num_of_entries);
+          CU_ASSERT_FALSE(hash_table_iter_remove_current(&iter));
+          visited++;
+        }
+      CU_ASSERT(visited == num_of_entries);
+
+      hash_table_stats_t stats;
+      hash_table_stats(mapped, &stats);
+      CU_ASSERT(stats.size == num_of_entries);
+      CU_ASSERT(stats.no_buckets == hash_table_capacity(mapped));
+      CU_ASSERT(stats.load_factor <= 0.875);
+
+      // Updated values are private to the process, whereas saving again writes them out
+      char resaved_path[64];
+      CU_ASSERT(save_snapshot(mapped, resaved_path));
+      hash_table_destroy(mapped);
+      mapped = hash_table_open_mapped(path, options[t]);
+      CU_ASSERT(hash_table_lookup(mapped, int_elem(0), &result) && result.i == 0);
+      hash_table_destroy(mapped);
+      mapped = hash_table_open_mapped(resaved_path, options[t]);
+      CU_ASSERT_PTR_NOT_NULL_FATAL(mapped);
+      CU_ASSERT(hash_table_size(mapped) == num_of_entries);
+      CU_ASSERT(hash_table_lookup(mapped, int_elem(0), &result) && result.i == -1);
+      hash_table_destroy(mapped);
+      unlink(path);
+      unlink(resaved_path);
+    }
+
+  char path[64];
+  hash_table_t *empty = hash_table_create(NULL, NULL, NULL);
+  CU_ASSERT(save_snapshot(empty, path));
+  hash_table_destroy(empty);
+  empty = hash_table_open_mapped(path, NULL);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(empty);
+  CU_ASSERT(hash_table_is_empty(empty));
+  CU_ASSERT_FALSE(hash_table_has_key(empty, int_elem(0)));
+  hash_table_destroy(empty);
+  unlink(path);
+}
+
+void test_snapshot_rejects_invalid()
+{
+  const hash_table_t *logged_ht = NULL;
+  memset(logged_events, 0, sizeof(logged_events));
+  hash_table_set_log_function(record_event, &logged_ht);
+
+  CU_ASSERT_PTR_NULL(hash_table_open_mapped("/nonexistent/snapshot", NULL));
+  CU_ASSERT(logged_events[HASH_TABLE_EVENT_IO_ERROR] == 1);
+
+  char path[64];
+  hash_table_t *ht = hash_table_create(NULL, NULL, NULL);
+  for (int i = 0; i < 100; i++)
+    {
+      hash_table_insert(ht, int_elem(i), int_elem(i));
+    }
+  CU_ASSERT(save_snapshot(ht, path));
+
+  // Hashes of the snapshot are only valid with the seed they were computed with
+  hash_table_set_hash_seed(42);
+  CU_ASSERT_PTR_NULL(hash_table_open_mapped(path, NULL));
+  hash_table_set_hash_seed(0);
+  CU_ASSERT(logged_events[HASH_TABLE_EVENT_IO_ERROR] == 2);
+
+  const int fd = open(path, O_WRONLY);
+  CU_ASSERT(ftruncate(fd, 100) == 0);
+  close(fd);
+  CU_ASSERT_PTR_NULL(hash_table_open_mapped(path, NULL));
+  CU_ASSERT(logged_events[HASH_TABLE_EVENT_IO_ERROR] == 3);
+
+  // A file that is not a snapshot
+  FILE *file = fopen(path, "w");
+  fputs("key,value\n1,1\n2,2\n3,3\n4,4\n5,5\n6,6\n7,7\n8,8\n9,9\n", file);
+  fclose(file);
+  CU_ASSERT_PTR_NULL(hash_table_open_mapped(path, NULL));
+  CU_ASSERT(logged_events[HASH_TABLE_EVENT_IO_ERROR] == 4);
+  CU_ASSERT_PTR_NULL(logged_ht);
+
+  CU_ASSERT_FALSE(hash_table_save(ht, -1));
+  CU_ASSERT(logged_events[HASH_TABLE_EVENT_IO_ERROR] == 5);
+  CU_ASSERT(logged_ht == ht);
+  hash_table_set_log_function(NULL, NULL);
+  hash_table_destroy(ht);
+  unlink(path);
+}
+
+static bool same_entries(hash_table_t *a, hash_table_t *b)
+{
+  hash_table_iter_t iter;
+  hash_table_iter_begin(a, &iter);
+  elem_t key;
+  elem_t *value;
+  elem_t result;
+  bool same = hash_table_size(a) == hash_table_size(b);
+  while (hash_table_iter_next(&iter, &key, &value))
+    {
+      same &= hash_table_lookup(b, key, &result) && result.i == value->i;
+    }
+  return same;
+}
+
+void test_change_log()
+{
+  uint64_t now = 1000;
+  hash_table_options_t chained = { .backend = HASH_TABLE_CHAINED, .change_log_size = 1000, .clock_function = fake_clock, .clock_extra = &now };
+  hash_table_options_t open = { .backend = HASH_TABLE_OPEN_ADDRESSING, .change_log_size = 1000 };
+  hash_table_options_t sharded = { .backend = HASH_TABLE_CHAINED, .no_shards = 4, .change_log_size = 1000, .clock_function = fake_clock, .clock_extra = &now };
+  hash_table_t *tables[] = {
+    hash_table_create_with_options(&chained),
+    hash_table_create_with_options(&open),
+    hash_table_create_with_options(&sharded),
+  };
+  hash_table_change_t changes[200];
+
+  for (size_t t = 0; t < sizeof(tables) / sizeof(tables[0]); t++)
+    {
+      hash_table_t *ht = tables[t];
+      CU_ASSERT_PTR_NOT_NULL_FATAL(ht);
+      hash_table_t *replica = hash_table_create(NULL, NULL, NULL);
+      CU_ASSERT(hash_table_change_seq(ht) == 0);
+      CU_ASSERT(hash_table_changes(ht, 0, changes, 200) == 0);
+
+      for (int i = 0; i < 100; i++)
+        {
+          hash_table_insert(ht, int_elem(i), int_elem(i));
+        }
+      hash_table_insert(ht, int_elem(5), int_elem(50));
+      elem_t result;
+      CU_ASSERT(hash_table_remove(ht, int_elem(7), &result));
+      CU_ASSERT_FALSE(hash_table_remove(ht, int_elem(1000), &result));
+      hash_table_upsert(ht, int_elem(200), int_elem(200), NULL);
+      hash_table_upsert(ht, int_elem(5), int_elem(0), NULL);
+      elem_t ten = int_elem(10);
+      CU_ASSERT(hash_table_update(ht, int_elem(3), add_to_value, &ten));
+      CU_ASSERT_FALSE(hash_table_update(ht, int_elem(1000), add_to_value, &ten));
+      elem_t batch_keys[] = { int_elem(300), int_elem(301), int_elem(302) };
+      hash_table_insert_batch(ht, batch_keys, batch_keys, 3);
+      hash_table_iter_t iter;
+      hash_table_iter_begin(ht, &iter);
+      elem_t key;
+      elem_t *value;
+      while (hash_table_iter_next(&iter, &key, &value) && key.i != 10)
+        {
+        }
+      CU_ASSERT(hash_table_iter_remove_current(&iter));
+
+      // Every change but the failed removal and update and the upsert of an existing key is recorded in order
+      CU_ASSERT(hash_table_change_seq(ht) == 108);
+      CU_ASSERT_FATAL(hash_table_changes(ht, 0, changes, 200) == 108);
+      bool in_order = true;
+      for (size_t i = 0; i < 108; i++)
+        {
+          in_order &= changes[i].seq == i;
+        }
+      CU_ASSERT(in_order);
+      CU_ASSERT(changes[99].kind == HASH_TABLE_CHANGE_INSERT && changes[99].key.i == 99 && changes[99].value.i == 99);
+      CU_ASSERT(changes[100].kind == HASH_TABLE_CHANGE_INSERT && changes[100].key.i == 5 && changes[100].value.i == 50);
+      CU_ASSERT(changes[101].kind == HASH_TABLE_CHANGE_REMOVE && changes[101].key.i == 7 && changes[101].value.i == 7);
+      CU_ASSERT(changes[102].kind == HASH_TABLE_CHANGE_INSERT && changes[102].key.i == 200);
+      CU_ASSERT(changes[103].kind == HASH_TABLE_CHANGE_INSERT && changes[103].key.i == 3 && changes[103].value.i == 13);
+      CU_ASSERT(changes[106].kind == HASH_TABLE_CHANGE_INSERT && changes[106].key.i == 302);
+      CU_ASSERT(changes[107].kind == HASH_TABLE_CHANGE_REMOVE && changes[107].key.i == 10 && changes[107].value.i == 10);
+
+      // A replica catches up batch by batch
+      CU_ASSERT(hash_table_apply_changes(replica, changes, 50) == 50);
+      CU_ASSERT(hash_table_changes(ht, 50, changes, 200) == 58 && changes[0].seq == 50);
+      CU_ASSERT(hash_table_apply_changes(replica, changes, 58) == 58);
+      CU_ASSERT(same_entries(ht, replica));
+      CU_ASSERT(hash_table_changes(ht, 108, changes, 200) == 0);
+
+      // Open addressing tables have no times to live
+      if (t != 1)
+        {
+          CU_ASSERT(hash_table_insert_ttl(ht, int_elem(400), int_elem(400), 10) == HASH_TABLE_INSERTED);
+          now += 100;
+          CU_ASSERT(hash_table_expire(ht, SIZE_MAX) == 1);
+          CU_ASSERT(hash_table_changes(ht, 108, changes, 200) == 2);
+          CU_ASSERT(changes[0].kind == HASH_TABLE_CHANGE_INSERT && changes[0].key.i == 400);
+          CU_ASSERT(changes[1].kind == HASH_TABLE_CHANGE_REMOVE && changes[1].key.i == 400);
+        }
+
+      hash_table_clear(ht);
+      const uint64_t seq = hash_table_change_seq(ht);
+      CU_ASSERT(hash_table_changes(ht, seq - 1, changes, 200) == 1 && changes[0].kind == HASH_TABLE_CHANGE_CLEAR);
+      CU_ASSERT(hash_table_apply_changes(replica, changes, 1) == 1);
+      CU_ASSERT(hash_table_is_empty(replica));
+      hash_table_destroy(replica);
+      hash_table_destroy(ht);
+    }
+
+  // The ring keeps the most recent changes; a reader that fell behind sees a gap
+  hash_table_options_t small = { .backend = HASH_TABLE_CHAINED, .change_log_size = 7 };
+  hash_table_t *ht = hash_table_create_with_options(&small);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(ht);
+  for (int i = 0; i < 20; i++)
+    {
+      hash_table_insert(ht, int_elem(i), int_elem(i));
+    }
+  CU_ASSERT(hash_table_changes(ht, 0, changes, 200) == 8 && changes[0].seq == 12 && changes[7].key.i == 19);
+  CU_ASSERT(hash_table_changes(ht, 15, changes, 200) == 5 && changes[0].key.i == 15 && changes[4].key.i == 19);
+  CU_ASSERT(hash_table_changes(ht, 15, changes, 2) == 2 && changes[1].key.i == 16);
+  hash_table_destroy(ht);
+
+  // Evictions in cache mode are recorded as removals
+  hash_table_options_t cache = { .backend = HASH_TABLE_CHAINED, .max_entries = 10, .change_log_size = 64 };
+  ht = hash_table_create_with_options(&cache);
+  hash_table_t *replica = hash_table_create(NULL, NULL, NULL);
+  for (int i = 0; i < 20; i++)
+    {
+      hash_table_insert(ht, int_elem(i), int_elem(i));
+    }
+  CU_ASSERT(hash_table_changes(ht, 0, changes, 200) == 30);
+  CU_ASSERT(hash_table_apply_changes(replica, changes, 30) == 30);
+  CU_ASSERT(hash_table_size(replica) == 10);
+  CU_ASSERT(same_entries(ht, replica));
+  hash_table_destroy(replica);
+  hash_table_destroy(ht);
+
+  // Moves are recorded alike, whether entries are relinked, copied or inserted and removed one at a time
+  hash_table_options_t logged_cache = { .backend = HASH_TABLE_CHAINED, .max_entries = 1000, .change_log_size = 1000 };
+  const hash_table_options_t *dst_options[] = { &chained, &logged_cache, &open };
+  for (size_t t = 0; t < sizeof(dst_options) / sizeof(dst_options[0]); t++)
+    {
+      hash_table_t *src = hash_table_create_with_options(&chained);
+      hash_table_t *dst = hash_table_create_with_options(dst_options[t]);
+      hash_table_t *src_replica = hash_table_create(NULL, NULL, NULL);
+      hash_table_t *dst_replica = hash_table_create(NULL, NULL, NULL);
+      for (int i = 0; i < 100; i++)
+        {
+          hash_table_insert(src, int_elem(i), int_elem(i));
+          hash_table_insert(dst, int_elem(50 + i), int_elem(-i));
+        }
+      elem_t bound = int_elem(25);
+      CU_ASSERT(hash_table_split(src, int_key_less, &bound, dst) == 25);
+      CU_ASSERT(hash_table_merge(dst, src));
+      size_t no_changes = hash_table_changes(src, 0, changes, 200);
+      CU_ASSERT(no_changes == 200);
+      CU_ASSERT(hash_table_apply_changes(src_replica, changes, no_changes) == no_changes);
+      no_changes = hash_table_changes(dst, 0, changes, 200);
+      CU_ASSERT(no_changes == 200);
+      CU_ASSERT(hash_table_apply_changes(dst_replica, changes, no_changes) == no_changes);
+      CU_ASSERT(hash_table_is_empty(src_replica));
+      CU_ASSERT(hash_table_size(dst_replica) == 150);
+      CU_ASSERT(same_entries(dst, dst_replica));
+      hash_table_destroy(dst_replica);
+      hash_table_destroy(src_replica);
+      hash_table_destroy(dst);
+      hash_table_destroy(src);
+    }
+
+  // An update is recorded with the value it stored, without looking the key up once more
+  const hash_table_options_t *updated_options[] = { &chained, &open, &sharded };
+  for (size_t t = 0; t < sizeof(updated_options) / sizeof(updated_options[0]); t++)
+    {
+      hash_table_t *ht = hash_table_create_with_options(updated_options[t]);
+      CU_ASSERT_PTR_NOT_NULL_FATAL(ht);
+      hash_table_insert(ht, int_elem(1), int_elem(1));
+      hash_table_stats_t before;
+      hash_table_stats(ht, &before);
+      elem_t ten = int_elem(10);
+      CU_ASSERT(hash_table_update(ht, int_elem(1), add_to_value, &ten));
+      hash_table_stats_t after;
+      hash_table_stats(ht, &after);
+      CU_ASSERT(after.no_finds - before.no_finds == (before.has_counters ? 1 : 0));
+      CU_ASSERT(hash_table_changes(ht, 1, changes, 200) == 1);
+      CU_ASSERT(changes[0].kind == HASH_TABLE_CHANGE_INSERT && changes[0].key.i == 1 && changes[0].value.i == 11);
+      hash_table_destroy(ht);
+    }
+
+  hash_table_t *plain = hash_table_create(NULL, NULL, NULL);
+  CU_ASSERT(hash_table_change_seq(plain) == 0);
+  hash_table_insert(plain, int_elem(1), int_elem(1));
+  CU_ASSERT(hash_table_changes(plain, 0, changes, 200) == 0);
+  hash_table_destroy(plain);
+
+  hash_table_options_t owned = { .backend = HASH_TABLE_CHAINED, .owned_keys = true, .change_log_size = 64 };
+  CU_ASSERT_PTR_NULL(hash_table_create_with_options(&owned));
+  hash_table_options_t concurrent = { .backend = HASH_TABLE_CHAINED, .change_log_size = 64 };
+  CU_ASSERT_PTR_NULL(hash_table_concurrent_create(&concurrent));
+  hash_table_options_t huge = { .backend = HASH_TABLE_CHAINED, .change_log_size = SIZE_MAX };
+  CU_ASSERT_PTR_NULL(hash_table_create_with_options(&huge));
+}
+
+static uint64_t colliding_typed_hash(const int key)
+{
+  return (uint64_t) key % 4;
+}
+
+static bool typed_str_equiv(const char *a, const char *b)
+{
+  return strcmp(a, b) == 0;
+}
+
+static uint64_t typed_str_hash(const char *key)
+{
+  return hash_table_hash_string(ptr_elem((void *) key));
+}
+
+HASH_TABLE_DEFINE(int_map, int, int, HASH_TABLE_HASH_SCALAR, HASH_TABLE_EQ_SCALAR)
+HASH_TABLE_DEFINE(colliding_map, int, int, colliding_typed_hash, HASH_TABLE_EQ_SCALAR)
+HASH_TABLE_DEFINE(str_map, const char *, long, typed_str_hash, typed_str_equiv)
+
+void test_typed_int_table()
+{
+  const int num_of_entries = 5000;
+  int_map_t *ht = int_map_create();
+  CU_ASSERT_PTR_NOT_NULL_FATAL(ht);
+  CU_ASSERT(int_map_is_empty(ht));
+  CU_ASSERT(int_map_capacity(ht) == HASH_TABLE_TYPED_MIN_SLOTS);
+
+  int result = 0;
+  for (int i = 0; i < num_of_entries; i++)
+    {
+      CU_ASSERT(int_map_insert(ht, i - num_of_entries / 2, i) == HASH_TABLE_INSERTED);
+    }
+  CU_ASSERT(int_map_size(ht) == (size_t) num_of_entries);
+  CU_ASSERT(int_map_capacity(ht) * 7 / 8 >= (size_t) num_of_entries);
+  CU_ASSERT(int_map_insert(ht, 0, -1) == HASH_TABLE_UPDATED);
+  CU_ASSERT(int_map_lookup(ht, 0, &result) && result == -1);
+  CU_ASSERT(int_map_lookup(ht, -num_of_entries / 2, &result) && result == 0);
+  CU_ASSERT_FALSE(int_map_lookup(ht, num_of_entries, &result));
+  CU_ASSERT_FALSE(int_map_has_key(ht, INT_MIN));
+
+  bool inserted;
+  int *value = int_map_upsert(ht, num_of_entries, 0, &inserted);
+  CU_ASSERT(inserted);
+  *value += 10;
+  value = int_map_upsert(ht, num_of_entries, 0, &inserted);
+  CU_ASSERT_FALSE(inserted);
+  CU_ASSERT(*value == 10);
+
+  for (int i = 0; i < num_of_entries; i += 2)
+    {
+      CU_ASSERT(int_map_remove(ht, i - num_of_entries / 2, &result) && result == (i == num_of_entries / 2 ? -1 : i));
+    }
+  CU_ASSERT_FALSE(int_map_remove(ht, -num_of_entries / 2, &result));
+  CU_ASSERT(int_map_size(ht) == (size_t) num_of_entries / 2 + 1);
+
+  // Walk the remaining entries, removing those with odd values as we go
+  int_map_iter_t iter;
+  int key;
+  size_t walked = 0;
+  int_map_iter_begin(ht, &iter);
+  CU_ASSERT_FALSE(int_map_iter_remove_current(&iter));
+  while (int_map_iter_next(&iter, &key, &value))
+    {
+      walked += 1;
+      CU_ASSERT(int_map_has_key(ht, key));
+      if (*value % 2 == 1)
+        {
+          CU_ASSERT(int_map_iter_remove_current(&iter));
+          CU_ASSERT_FALSE(int_map_iter_remove_current(&iter));
+        }
+    }
+  CU_ASSERT(walked == (size_t) num_of_entries / 2 + 1);
+  CU_ASSERT(int_map_size(ht) == 1);
+  CU_ASSERT(int_map_lookup(ht, num_of_entries, &result) && result == 10);
+
+  int_map_clear(ht);
+  CU_ASSERT(int_map_is_empty(ht));
+  CU_ASSERT(int_map_reserve(ht, 100000));
+  const size_t capacity = int_map_capacity(ht);
+  for (int i = 0; i < 100000; i++)
+    {
+      int_map_insert(ht, i, i);
+    }
+  CU_ASSERT(int_map_capacity(ht) == capacity);
+  int_map_destroy(ht);
+}
+
+void test_typed_colliding_and_string_tables()
+{
+  // Every key lands in one of four groups, so probes cross many groups and removals leave tombstones
+  colliding_map_t *colliding = colliding_map_create();
+  CU_ASSERT_PTR_NOT_NULL_FATAL(colliding);
+  int result;
+  for (int round = 0; round < 20; round++)
+    {
+      for (int i = 0; i < 200; i++)
+        {
+          CU_ASSERT(colliding_map_insert(colliding, round * 200 + i, i) == HASH_TABLE_INSERTED);
+        }
+      for (int i = 0; i < 200; i++)
+        {
+          CU_ASSERT(colliding_map_lookup(colliding, round * 200 + i, &result) && result == i);
+          CU_ASSERT(colliding_map_remove(colliding, round * 200 + i, &result) && result == i);
+        }
+      CU_ASSERT(colliding_map_is_empty(colliding));
+    }
+  // Churn rebuilds the table in place rather than growing it
+  CU_ASSERT(colliding_map_capacity(colliding) <= 512);
+  colliding_map_destroy(colliding);
+
+  str_map_t *strings = str_map_create();
+  CU_ASSERT_PTR_NOT_NULL_FATAL(strings);
+  char keys[100][16];
+  for (int i = 0; i < 100; i++)
+    {
+      snprintf(keys[i], sizeof(keys[i]), "key:%d", i);
+      CU_ASSERT(str_map_insert(strings, keys[i], i) == HASH_TABLE_INSERTED);
+    }
+  char probe[16] = "key:42";
+  long value;
+  CU_ASSERT(str_map_lookup(strings, probe, &value) && value == 42);
+  CU_ASSERT_FALSE(str_map_has_key(strings, "key:100"));
+  CU_ASSERT(str_map_insert(strings, probe, 0) == HASH_TABLE_UPDATED);
+  CU_ASSERT(str_map_size(strings) == 100);
+  str_map_destroy(strings);
+}
+
 int main()
 {
   if (CUE_SUCCESS != CU_initialize_registry())
@@ -513,10 +3324,18 @@ int main()
   CU_pSuite keys_and_values = CU_add_suite("Keys And Values", NULL, NULL);
   CU_pSuite function_application = CU_add_suite("Function Application", NULL, NULL);
   CU_pSuite resize_and_rehash = CU_add_suite("Resize And Rehash", NULL, NULL);
+  CU_pSuite concurrency = CU_add_suite("Concurrency", NULL, NULL);
+  CU_pSuite hashing = CU_add_suite("Hashing", NULL, NULL);
+  CU_pSuite snapshots = CU_add_suite("Snapshots", NULL, NULL);
+  CU_pSuite typed = CU_add_suite("Typed Tables", NULL, NULL);
   
   CU_add_test(creation, "Creation", test_create_destroy);
   CU_add_test(creation, "Creation Dynamic", test_hash_table_create_dynamic);
+  CU_add_test(creation, "Creation Dynamic Any Capacity", test_hash_table_create_dynamic_any_capacity);
   CU_add_test(creation, "Clear", test_clear);
+  CU_add_test(creation, "Creation With Options", test_create_with_options);
+  CU_add_test(creation, "Entry Pool Arena", test_entry_pool_arena);
+  CU_add_test(creation, "Log Function", test_log_function);
 
   CU_add_test(size, "Size", test_size);
   CU_add_test(size, "Is Empty", test_hash_table_is_empty_true);
@@ -524,7 +3343,11 @@ int main()
 
   CU_add_test(retrieval, "Lookup", test_lookup);
   CU_add_test(retrieval, "Has Key", test_has_key);
+  CU_add_test(retrieval, "Has Key Probes Bucket", test_has_key_probes_bucket);
   CU_add_test(retrieval, "Has Value", test_has_value);
+  CU_add_test(retrieval, "Colliding Keys", test_colliding_keys);
+  CU_add_test(retrieval, "Key Equiv After Hash", test_key_equiv_after_hash);
+  CU_add_test(retrieval, "Prefilter", test_prefilter);
 
   CU_add_test(insertion, "Insert Integer", test_lookupinsert_int);
   CU_add_test(insertion, "Insert String", test_lookupinsert_str);
@@ -532,21 +3355,63 @@ int main()
   CU_add_test(insertion, "Insert Negative Key", test_lookupinsert_negative_key);
   CU_add_test(insertion, "Insert Multiple", test_lookupinsert_multiple_str);
   CU_add_test(insertion, "Insert Same Bucket", test_insert_same_bucket);
+  CU_add_test(insertion, "Insert And Lookup Batch", test_insert_lookup_batch);
+  CU_add_test(insertion, "Upsert And Update", test_upsert_and_update);
+  CU_add_test(insertion, "Insert Status", test_insert_status);
+  CU_add_test(insertion, "Owned Keys", test_owned_keys);
+  CU_add_test(insertion, "Cache Mode", test_cache_mode);
+  CU_add_test(insertion, "Cache Byte Budget", test_cache_byte_budget);
+  CU_add_test(insertion, "Cache Entry Footprint", test_cache_entry_footprint);
+  CU_add_test(insertion, "Insert With TTL", test_insert_ttl);
+  CU_add_test(insertion, "Expiry Timer Wheel", test_expiry_wheel);
+  CU_add_test(insertion, "Expiry Entry Footprint", test_expiry_entry_footprint);
 
   CU_add_test(removal, "Remove Invalid Key", test_remove_invalid_key);
   CU_add_test(removal, "Remove", test_remove_lookup);
   CU_add_test(removal, "Remove Middle Key", test_remove_lookup_middle_key);
   CU_add_test(removal, "Remove All", test_remove_all);
+  CU_add_test(removal, "Merge", test_merge);
+  CU_add_test(removal, "Split", test_split);
+  CU_add_test(removal, "Swap", test_swap);
 
   CU_add_test(keys_and_values, "Keys And Values", test_keys_and_values);
+  CU_add_test(keys_and_values, "Iterator", test_iter);
+  CU_add_test(keys_and_values, "Iterator During Incremental Rehash", test_iter_during_incremental_rehash);
 
   CU_add_test(function_application, "Key And Value Equiv", test_key_and_value_equiv);
   CU_add_test(function_application, "All", test_hash_table_all);
   CU_add_test(function_application, "Any", test_hash_table_any);
   CU_add_test(function_application, "Apply To All", test_hash_table_apply_to_all);
+  CU_add_test(function_application, "Any And All Stop Early", test_hash_table_any_all_stop_early);
 
   CU_add_test(resize_and_rehash, "Resize", test_hash_table_resize);
-  CU_add_test(resize_and_rehash, "Resizing Not Possible", test_hash_table_resize_not_possible);
+  CU_add_test(resize_and_rehash, "Resize Beyond Prime Library", test_hash_table_resize_beyond_prime_library);
+  CU_add_test(resize_and_rehash, "Resize Does Not Rehash Keys", test_hash_table_resize_does_not_rehash_keys);
+  CU_add_test(resize_and_rehash, "Reserve And Shrink To Fit", test_reserve_and_shrink_to_fit);
+  CU_add_test(resize_and_rehash, "Minimum Load Factor", test_min_load_factor);
+  CU_add_test(resize_and_rehash, "Statistics", test_stats);
+  CU_add_test(resize_and_rehash, "Backend Churn", test_backend_churn);
+  CU_add_test(resize_and_rehash, "Incremental Rehash", test_incremental_rehash);
+
+  CU_add_test(concurrency, "Concurrent Insert Lookup Remove", test_concurrent_insert_lookup_remove);
+  CU_add_test(concurrency, "Concurrent Lock-Free Reads", test_concurrent_lock_free_reads);
+  CU_add_test(concurrency, "Concurrent Update", test_concurrent_update);
+  CU_add_test(concurrency, "Build Parallel", test_build_parallel);
+  CU_add_test(concurrency, "Parallel Walks", test_parallel_walks);
+  CU_add_test(concurrency, "Sharded", test_sharded);
+  CU_add_test(concurrency, "Sharded Hashing", test_sharded_hashing);
+
+  CU_add_test(hashing, "Hash Int And Pointer", test_hash_int_and_pointer);
+  CU_add_test(hashing, "Hash Bytes And String", test_hash_bytes_and_string);
+  CU_add_test(hashing, "Hash String Keys", test_hash_string_keys);
+  CU_add_test(hashing, "Hash Seed", test_hash_seed);
+
+  CU_add_test(snapshots, "Snapshot Round Trip", test_snapshot_round_trip);
+  CU_add_test(snapshots, "Snapshot Rejects Invalid", test_snapshot_rejects_invalid);
+  CU_add_test(snapshots, "Change Log", test_change_log);
+
+  CU_add_test(typed, "Typed Int Table", test_typed_int_table);
+  CU_add_test(typed, "Typed Colliding And String Tables", test_typed_colliding_and_string_tables);
 
   CU_basic_set_mode(CU_BRM_VERBOSE);
   CU_basic_run_tests();